@@ -18,8 +18,11 @@ criminal penalties as provided by law.
 
 #include "common/servconn.hpp"
 
+#include "cstdmf/memory_stream.hpp"
+
 #include "resmgr/bwresource.hpp"
 #include "resmgr/bundiff.hpp"
+#include "resmgr/chunk_patch.hpp"
 #include "resmgr/xml_section.hpp"
 #include "resmgr/multi_file_system.hpp"
 #include "romp/progress.hpp"
@@ -1105,22 +1108,12 @@ bool unzipFile( IFileSystem * pFS, const std::string & srcName,
 	return ferr != 0 && zres == Z_STREAM_END;
 }
 
-// helper function to undiff a file (and find the appropriate bits)
-bool undiffFile( IFileSystem * pFS, IFileSystem * pRomFS, IFileSystem * pDynFS,
-				 const std::string& diffName, const std::string& srcName, 
-				 const std::string& destName )
+// helper function to open the existing version of a file that a diff or
+// patch applies to. It looks first in pFS then in pDynFS then in pRomFS.
+FILE * openSourceFile( IFileSystem * pFS, IFileSystem * pRomFS,
+	IFileSystem * pDynFS, const std::string& srcName )
 {
-	FILE * pDiff;
-	FILE * pSrc;
-	FILE * pDest;
-
-	pDiff = pFS->posixFileOpen( diffName, "rb" );
-	if (!pDiff)
-	{
-		ERROR_MSG( "undiffFile: unable to find diff file %s\n", diffName.c_str() );
-		return false;
-	}
-	pSrc = pFS->posixFileOpen( srcName, "rb" );
+	FILE * pSrc = pFS->posixFileOpen( srcName, "rb" );
 	if (!pSrc)
 		pSrc = pDynFS->posixFileOpen( srcName, "rb" );
 	if (!pSrc)
@@ -1143,16 +1136,41 @@ bool undiffFile( IFileSystem * pFS, IFileSystem * pRomFS, IFileSystem * pDynFS,
 				if (!ok || !pSrc)
 				{
 					if (pSrc) fclose( pSrc );	// unlikely
-					ERROR_MSG( "undiffFile: unable to copy source file from "
-						"text mode ROM FS to temp FS: %s\n", srcName.c_str() );
-					return false;
+					ERROR_MSG( "openSourceFile: unable to copy source file "
+						"from text mode ROM FS to temp FS: %s\n",
+						srcName.c_str() );
+					return NULL;
 				}
 			}
 		}
 	}
 	if (!pSrc)
 	{
-		ERROR_MSG( "undiffFile: unable to find source file %s\n", srcName.c_str() );
+		ERROR_MSG( "openSourceFile: unable to find source file %s\n",
+			srcName.c_str() );
+	}
+
+	return pSrc;
+}
+
+// helper function to undiff a file (and find the appropriate bits)
+bool undiffFile( IFileSystem * pFS, IFileSystem * pRomFS, IFileSystem * pDynFS,
+				 const std::string& diffName, const std::string& srcName, 
+				 const std::string& destName )
+{
+	FILE * pDiff;
+	FILE * pSrc;
+	FILE * pDest;
+
+	pDiff = pFS->posixFileOpen( diffName, "rb" );
+	if (!pDiff)
+	{
+		ERROR_MSG( "undiffFile: unable to find diff file %s\n", diffName.c_str() );
+		return false;
+	}
+	pSrc = openSourceFile( pFS, pRomFS, pDynFS, srcName );
+	if (!pSrc)
+	{
 		fclose( pDiff );
 		return false;
 	}
@@ -1174,6 +1192,71 @@ bool undiffFile( IFileSystem * pFS, IFileSystem * pRomFS, IFileSystem * pDynFS,
 	return ok;
 }
 
+// helper function to apply a chunk patch to a file. Only the chunks that
+// were not in the old version are sent, so the whole old version is needed.
+bool unchunkFile( IFileSystem * pFS, IFileSystem * pRomFS, IFileSystem * pDynFS,
+				  const std::string& patchName, const std::string& srcName,
+				  const std::string& destName )
+{
+	BinaryPtr pPatchData = pFS->readFile( patchName );
+	if (!pPatchData)
+	{
+		ERROR_MSG( "unchunkFile: unable to find patch file %s\n",
+			patchName.c_str() );
+		return false;
+	}
+
+	ChunkPatch patch;
+	MemoryIStream stream( pPatchData->cdata(), pPatchData->len() );
+	if (!patch.readFromStream( stream ) || stream.remainingLength() != 0)
+	{
+		ERROR_MSG( "unchunkFile: invalid patch file %s\n",
+			patchName.c_str() );
+		stream.finish();
+		return false;
+	}
+
+	FILE * pSrc = openSourceFile( pFS, pRomFS, pDynFS, srcName );
+	if (!pSrc) return false;
+
+	fseek( pSrc, 0, SEEK_END );
+	long srcLength = ftell( pSrc );
+	fseek( pSrc, 0, SEEK_SET );
+
+	std::string src( std::max( srcLength, 0L ), '\0' );
+	bool ok = srcLength >= 0 && (src.empty() ||
+		fread( &src[0], 1, src.size(), pSrc ) == src.size());
+	fclose( pSrc );
+	if (!ok)
+	{
+		ERROR_MSG( "unchunkFile: unable to read source file %s\n",
+			srcName.c_str() );
+		return false;
+	}
+
+	std::string result;
+	if (!patch.apply( src.data(), uint32( src.size() ), result ))
+	{
+		ERROR_MSG( "unchunkFile: patch %s does not apply to %s\n",
+			patchName.c_str(), srcName.c_str() );
+		return false;
+	}
+
+	FILE * pDest = pFS->posixFileOpen( destName, "wb" );
+	if (!pDest)
+	{
+		ERROR_MSG( "unchunkFile: unable to find dest file %s\n",
+			destName.c_str() );
+		return false;
+	}
+
+	ok = result.empty() ||
+		fwrite( result.data(), 1, result.size(), pDest ) == result.size();
+	fclose( pDest );
+
+	return ok;
+}
+
 /// helper struct that we only want for its structors
 struct CopyNameExposer
 {
@@ -1293,6 +1376,17 @@ bool ResUpdateHandler::download( uint32 version, const std::string & point,
 		}
 		pFS->eraseFileOrDirectory( ".bdtemp" );
 		break;
+	case 4:	// chunk patch
+		// Note: as for binary diffs, the existing file is looked for first
+		//  in pFS then in pDynFS_ then in pRomFS_
+		if (!unchunkFile( pFS, pRomFS_, pDynFS_, ".dltemp", copyName, ".litemp" ))
+		{
+			ERROR_MSG( "ResUpdateHandler::download: "
+				"Error applying chunk patch to %s\n", copyName.c_str() );
+			return false;
+		}
+		pFS->eraseFileOrDirectory( ".dltemp" );
+		break;
 	default:
 		ERROR_MSG( "ResUpdateHandler::download: "
 			"Unknown packing method after download of %s\n",
@@ -15,6 +15,8 @@ criminal penalties as provided by law.
 #include "cstdmf/binary_stream.hpp"
 #include "pyscript/pickler.hpp"
 
+#include <algorithm>
+
 DECLARE_DEBUG_COMPONENT( 0 )
 
 /**
@@ -109,6 +111,7 @@ SharedData::SharedData( SharedDataType dataType,
 		PyTypePlus * pType ) :
 	PyObjectPlus( pType ),
 	dataType_( dataType ),
+	version_( 0 ),
 	setFn_( setFn ),
 	delFn_( delFn ),
 	onSetFn_( onSetFn ),
@@ -116,6 +119,7 @@ SharedData::SharedData( SharedDataType dataType,
 	pPickler_( pPickler )
 {
 	pMap_ = PyDict_New();
+	pPending_ = PyDict_New();
 }
 
 
@@ -125,6 +129,7 @@ SharedData::SharedData( SharedDataType dataType,
 SharedData::~SharedData()
 {
 	Py_DECREF( pMap_ );
+	Py_DECREF( pPending_ );
 }
 
 
@@ -152,6 +157,8 @@ PyObject * SharedData::pyGetAttribute( const char * attr )
  */
 PyObject * SharedData::subscript( PyObject * key )
 {
+	this->resolve( key );
+
 	PyObject * pObject = PyDict_GetItem( pMap_, key );
 	if (pObject == NULL)
 	{
@@ -179,11 +186,23 @@ int SharedData::ass_subscript( PyObject* key, PyObject * value )
 	if (value == NULL)
 	{
 		(*delFn_)( this->pickle( key ), dataType_ );
+
+		if (PyDict_GetItem( pPending_, key ))
+		{
+			return PyDict_DelItem( pPending_, key );
+		}
+
 		return PyDict_DelItem( pMap_, key );
 	}
 	else
 	{
 		(*setFn_)( this->pickle( key ), this->pickle( value ), dataType_ );
+
+		if (PyDict_GetItem( pPending_, key ))
+		{
+			PyDict_DelItem( pPending_, key );
+		}
+
 		return PyDict_SetItem( pMap_, key, value );
 	}
 }
@@ -194,7 +213,7 @@ int SharedData::ass_subscript( PyObject* key, PyObject * value )
  */
 int SharedData::length()
 {
-	return PyDict_Size( pMap_ );
+	return PyDict_Size( pMap_ ) + PyDict_Size( pPending_ );
 }
 
 
@@ -203,6 +222,12 @@ int SharedData::length()
  */
 PyObject * SharedData::py_has_key( PyObject* args )
 {
+	if (PyTuple_Check( args ) && (PyTuple_Size( args ) == 1) &&
+			PyDict_GetItem( pPending_, PyTuple_GET_ITEM( args, 0 ) ))
+	{
+		return PyBool_FromLong( 1 );
+	}
+
 	return PyObject_CallMethod( pMap_, "has_key", "O", args );
 }
 
@@ -212,7 +237,18 @@ PyObject * SharedData::py_has_key( PyObject* args )
  */
 PyObject* SharedData::py_keys(PyObject* /*args*/)
 {
-	return PyDict_Keys( pMap_ );
+	PyObject * pKeys = PyDict_Keys( pMap_ );
+
+	PyObject * pKey;
+	PyObject * pValue;
+	int pos = 0;
+
+	while (PyDict_Next( pPending_, &pos, &pKey, &pValue ))
+	{
+		PyList_Append( pKeys, pKey );
+	}
+
+	return pKeys;
 }
 
 
@@ -221,6 +257,8 @@ PyObject* SharedData::py_keys(PyObject* /*args*/)
  */
 PyObject* SharedData::py_values( PyObject* /*args*/ )
 {
+	this->resolveAll();
+
 	return PyDict_Values( pMap_ );
 }
 
@@ -231,6 +269,8 @@ PyObject* SharedData::py_values( PyObject* /*args*/ )
  */
 PyObject* SharedData::py_items( PyObject* /*args*/ )
 {
+	this->resolveAll();
+
 	return PyDict_Items( pMap_ );
 }
 
@@ -241,85 +281,342 @@ PyObject* SharedData::py_items( PyObject* /*args*/ )
 
 /**
  *	This method sets a local SharedData entry from the input value.
+ *
+ *	@param key		The pickled key.
+ *	@param value	The pickled value.
+ *	@param version	The version of this update from the manager, or 0.
  */
-bool SharedData::setValue( const std::string & key, const std::string & value )
+bool SharedData::setValue( const std::string & key, const std::string & value,
+		uint32 version )
 {
+	version_ = std::max( version_, version );
+
 	PyObject * pKey = this->unpickle( key );
-	PyObject * pValue = this->unpickle( value );
-	bool isOkay = true;
 
-	if (pKey && pValue)
+	if (pKey == NULL)
+	{
+		ERROR_MSG( "SharedData::setValue: Unpickle failed. Invalid key\n" );
+		PyErr_Print();
+		return false;
+	}
+
+	bool isOkay = this->set( pKey, value );
+	Py_DECREF( pKey );
+
+	return isOkay;
+}
+
+
+/**
+ *	This method deletes a local SharedData entry from the input value.
+ *
+ *	@param key		The pickled key.
+ *	@param version	The version of this update from the manager, or 0.
+ */
+bool SharedData::delValue( const std::string & key, uint32 version )
+{
+	version_ = std::max( version_, version );
+
+	PyObject * pKey = this->unpickle( key );
+
+	if (pKey == NULL)
+	{
+		ERROR_MSG( "SharedData::delValue: Invalid key to delete\n" );
+		PyErr_Print();
+		return false;
+	}
+
+	bool isOkay = this->del( pKey );
+	Py_DECREF( pKey );
+
+	return isOkay;
+}
+
+
+/**
+ *	This method sets an entry from a pickled value. The value is only
+ *	unpickled here if the OnSetFn needs it.
+ */
+bool SharedData::set( PyObject * pKey, const std::string & value )
+{
+	if (onSetFn_ == NULL)
 	{
-		if (PyDict_SetItem( pMap_, pKey, pValue ) == -1)
+		PyObject * pPickled =
+			PyString_FromStringAndSize( value.data(), value.size() );
+
+		if (PyDict_GetItem( pMap_, pKey ))
 		{
-			ERROR_MSG( "SharedData::setValue: Failed to set value\n" );
-			isOkay = false;
+			PyDict_DelItem( pMap_, pKey );
 		}
-		else if (onSetFn_)
+
+		bool isOkay = (PyDict_SetItem( pPending_, pKey, pPickled ) != -1);
+		Py_DECREF( pPickled );
+
+		if (!isOkay)
 		{
-			(*onSetFn_)( pKey, pValue, dataType_ );
+			ERROR_MSG( "SharedData::set: Failed to set value\n" );
+			PyErr_Print();
 		}
+
+		return isOkay;
 	}
-	else
+
+	PyObject * pValue = this->unpickle( value );
+
+	if (pValue == NULL)
 	{
-		ERROR_MSG( "SharedData::setValue: "
-						"Unpickle failed. Invalid key(%p) or value(%p)\n",
-				   pKey, pValue );
+		ERROR_MSG( "SharedData::set: Unpickle failed. Invalid value\n" );
 		PyErr_Print();
+		return false;
+	}
+
+	bool isOkay = true;
+
+	if (PyDict_GetItem( pPending_, pKey ))
+	{
+		PyDict_DelItem( pPending_, pKey );
+	}
+
+	if (PyDict_SetItem( pMap_, pKey, pValue ) == -1)
+	{
+		ERROR_MSG( "SharedData::set: Failed to set value\n" );
 		isOkay = false;
 	}
+	else
+	{
+		(*onSetFn_)( pKey, pValue, dataType_ );
+	}
 
-	Py_XDECREF( pKey );
-	Py_XDECREF( pValue );
+	Py_DECREF( pValue );
 
 	return isOkay;
 }
 
 
 /**
- *	This method deletes a local SharedData entry from the input value.
+ *	This method deletes an entry.
  */
-bool SharedData::delValue( const std::string & key )
+bool SharedData::del( PyObject * pKey )
 {
-	PyObject * pKey = this->unpickle( key );
+	if (PyDict_GetItem( pPending_, pKey ))
+	{
+		PyDict_DelItem( pPending_, pKey );
+	}
+
+	if (PyDict_GetItem( pMap_, pKey ) &&
+		PyDict_DelItem( pMap_, pKey ) == -1)
+	{
+		// ERROR_MSG( "SharedData::delValue: Failed to delete key.\n" );
+		// Probably because we were the one to delete it.
+		PyErr_Clear();
+
+		return false;
+	}
+
+	if (onDelFn_)
+	{
+		(*onDelFn_)( pKey, dataType_ );
+	}
+
+	return true;
+}
+
+
+/**
+ *	This method unpickles the value of an entry, if it has not been already.
+ */
+void SharedData::resolve( PyObject * pKey )
+{
+	PyObject * pPickled = PyDict_GetItem( pPending_, pKey );
+
+	if (pPickled == NULL)
+	{
+		return;
+	}
+
+	PyObject * pValue = this->unpickle( std::string(
+		PyString_AsString( pPickled ), PyString_Size( pPickled ) ) );
+
+	if (pValue)
+	{
+		PyDict_SetItem( pMap_, pKey, pValue );
+		Py_DECREF( pValue );
+	}
+	else
+	{
+		ERROR_MSG( "SharedData::resolve: Unpickle failed. Invalid value\n" );
+		PyErr_Print();
+	}
+
+	PyDict_DelItem( pPending_, pKey );
+}
+
+
+/**
+ *	This method unpickles the values of all of the entries.
+ */
+void SharedData::resolveAll()
+{
+	if (PyDict_Size( pPending_ ) == 0)
+	{
+		return;
+	}
+
+	PyObject * pKeys = PyDict_Keys( pPending_ );
+
+	for (int i = 0; i < PyList_GET_SIZE( pKeys ); ++i)
+	{
+		this->resolve( PyList_GET_ITEM( pKeys, i ) );
+	}
+
+	Py_DECREF( pKeys );
+}
+
+
+/**
+ *	This method applies a section of a batch of updates from the manager. The
+ *	section is made up of:
+ *		uint32			numUpdates
+ *	followed by numUpdates of:
+ *		SharedDataOp	op
+ *		uint32			version
+ *		std::string		key			(not for SHARED_DATA_OP_CLEAR)
+ *		std::string		value		(only for SHARED_DATA_OP_SET)
+ *
+ *	A SHARED_DATA_OP_CLEAR means that the section holds every entry. The
+ *	entries that are not set again later in the section are deleted.
+ *
+ *	@return	Whether all of the updates could be applied.
+ */
+bool SharedData::readUpdates( BinaryIStream & data )
+{
+	uint32 numUpdates;
+	data >> numUpdates;
+
+	PyObject * pStale = NULL;
 	bool isOkay = true;
 
-	if (pKey)
+	std::string key;
+	std::string value;
+
+	for (uint32 i = 0; (i < numUpdates) && !data.error(); ++i)
 	{
-		if (PyDict_GetItem( pMap_, pKey ) && 
-			PyDict_DelItem( pMap_, pKey ) == -1)
+		SharedDataOp op;
+		uint32 version;
+		data >> op >> version;
+
+		version_ = std::max( version_, version );
+
+		if (op == SHARED_DATA_OP_CLEAR)
 		{
-			// ERROR_MSG( "SharedData::delValue: Failed to delete key.\n" );
-			// Probably because we were the one to delete it.
-			PyErr_Clear();
+			Py_XDECREF( pStale );
+			pStale = PyDict_Copy( pMap_ );
+			PyDict_Update( pStale, pPending_ );
+			continue;
+		}
+
+		data >> key;
 
+		if (op == SHARED_DATA_OP_SET)
+		{
+			data >> value;
+		}
+
+		PyObject * pKey = this->unpickle( key );
+
+		if (pKey == NULL)
+		{
+			ERROR_MSG( "SharedData::readUpdates: Invalid key\n" );
+			PyErr_Print();
 			isOkay = false;
+			continue;
+		}
+
+		if (pStale && PyDict_GetItem( pStale, pKey ))
+		{
+			PyDict_DelItem( pStale, pKey );
+		}
+
+		if (op == SHARED_DATA_OP_SET)
+		{
+			isOkay &= this->set( pKey, value );
 		}
-		else if (onDelFn_)
+		else
 		{
-			(*onDelFn_)( pKey, dataType_ );
+			isOkay &= this->del( pKey );
 		}
 
 		Py_DECREF( pKey );
 	}
-	else
-	{
-		ERROR_MSG( "SharedData::delValue: Invalid key to delete\n" );
-		PyErr_Print();
 
+	if (data.error())
+	{
+		ERROR_MSG( "SharedData::readUpdates: Not enough data\n" );
 		isOkay = false;
 	}
+	else if (pStale)
+	{
+		PyObject * pKeys = PyDict_Keys( pStale );
+
+		for (int i = 0; i < PyList_GET_SIZE( pKeys ); ++i)
+		{
+			this->del( PyList_GET_ITEM( pKeys, i ) );
+		}
+
+		Py_DECREF( pKeys );
+	}
+
+	Py_XDECREF( pStale );
 
 	return isOkay;
 }
 
 
+/**
+ *	This static method applies a batch of updates from the manager. The batch
+ *	is a number of sections, each of which is a SharedDataType followed by the
+ *	updates read by readUpdates.
+ *
+ *	@param data		The batch.
+ *	@param first	One of the two SharedData objects of this process.
+ *	@param second	The other.
+ */
+bool SharedData::readBatch( BinaryIStream & data,
+		SharedData & first, SharedData & second )
+{
+	bool isOkay = true;
+
+	while ((data.remainingLength() > 0) && !data.error())
+	{
+		SharedDataType dataType;
+		data >> dataType;
+
+		SharedData * pSharedData =
+			(dataType == first.dataType_)  ? &first :
+			(dataType == second.dataType_) ? &second : NULL;
+
+		if (pSharedData == NULL)
+		{
+			// The rest of the batch cannot be read without knowing the type.
+			ERROR_MSG( "SharedData::readBatch: Invalid dataType %d\n",
+				dataType );
+			data.finish();
+			return false;
+		}
+
+		isOkay &= pSharedData->readUpdates( data );
+	}
+
+	return isOkay && !data.error();
+}
+
+
 /**
  *	This method adds the dictionary to the input stream.
  */
 bool SharedData::addToStream( BinaryOStream & stream ) const
 {
-	uint32 size = PyDict_Size( pMap_ );
+	uint32 size = PyDict_Size( pMap_ ) + PyDict_Size( pPending_ );
 	stream << size;
 
 	PyObject * pKey;
@@ -331,6 +628,15 @@ bool SharedData::addToStream( BinaryOStream & stream ) const
 		stream << this->pickle( pKey ) << this->pickle( pValue );
 	}
 
+	// These are still pickled.
+	pos = 0;
+
+	while (PyDict_Next( pPending_, &pos, &pKey, &pValue ))
+	{
+		stream << this->pickle( pKey ) << std::string(
+			PyString_AsString( pValue ), PyString_Size( pValue ) );
+	}
+
 	return true;
 }
 
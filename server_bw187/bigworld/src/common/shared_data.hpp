@@ -18,9 +18,20 @@ criminal penalties as provided by law.
 #include <map>
 
 typedef uint8 SharedDataType;
+class BinaryIStream;
 class BinaryOStream;
 class Pickler;
 
+/**
+ *	The operations in a batch of shared data updates.
+ *
+ *	@see SharedData::readUpdates
+ */
+typedef uint8 SharedDataOp;
+const SharedDataOp SHARED_DATA_OP_SET = 0;
+const SharedDataOp SHARED_DATA_OP_DEL = 1;
+const SharedDataOp SHARED_DATA_OP_CLEAR = 2;
+
 /*~ class NoModule.SharedData
  *  @components{ base, cell }
  *  An instance of this class emulates a dictionary of data shared between
@@ -35,6 +46,11 @@ class Pickler;
  */
 /**
  *	This class is used to expose the collection of CellApp data.
+ *
+ *	Values that arrive from other processes are kept pickled until they are
+ *	first looked at, unless there is an OnSetFn that needs them straight away.
+ *	Each update from the manager may carry a version, and version() is the
+ *	latest of these, which can be used to ask for only the newer entries.
  */
 class SharedData : public PyObjectPlus
 {
@@ -74,17 +90,38 @@ public:
 							PyObject * key, PyObject * value );
 	static int			s_length( PyObject * self );
 
-	bool setValue( const std::string & key, const std::string & value );
-	bool delValue( const std::string & key );
+	bool setValue( const std::string & key, const std::string & value,
+			uint32 version = 0 );
+	bool delValue( const std::string & key, uint32 version = 0 );
+
+	bool readUpdates( BinaryIStream & data );
+	static bool readBatch( BinaryIStream & data,
+			SharedData & first, SharedData & second );
 
 	bool addToStream( BinaryOStream & stream ) const;
 
+	/// This method returns the latest version received from the manager.
+	uint32 version() const				{ return version_; }
+
+	SharedDataType dataType() const		{ return dataType_; }
+
 private:
+	bool set( PyObject * pKey, const std::string & value );
+	bool del( PyObject * pKey );
+
+	void resolve( PyObject * pKey );
+	void resolveAll();
+
 	std::string pickle( PyObject * pObj ) const;
 	PyObject * unpickle( const std::string & str ) const;
 
 	PyObject * pMap_;
+
+	// The values that have not been unpickled yet, as strings.
+	PyObject * pPending_;
+
 	SharedDataType dataType_;
+	uint32	version_;
 
 	SetFn	setFn_;
 	DelFn	delFn_;
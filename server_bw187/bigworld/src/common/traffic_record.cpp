@@ -0,0 +1,400 @@
+/******************************************************************************
+BigWorld Technology
+Copyright BigWorld Pty, Ltd.
+All Rights Reserved. Commercial in confidence.
+
+WARNING: This computer program is protected by copyright law and international
+treaties. Unauthorized use, reproduction or distribution of this program, or
+any portion of this program, may result in the imposition of civil and
+criminal penalties as provided by law.
+******************************************************************************/
+
+#include "traffic_record.hpp"
+
+#include "cstdmf/debug.hpp"
+#include "cstdmf/timestamp.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+DECLARE_DEBUG_COMPONENT( 0 )
+
+namespace
+{
+
+/**
+ *	This function returns the size of a record with the given data length.
+ *	Records are padded so that each header is 8-byte aligned.
+ */
+inline uint32 recordSize( uint32 length )
+{
+	return (sizeof( TrafficRecordHeader ) + length + 7) & ~uint32( 7 );
+}
+
+} // anonymous namespace
+
+
+// -----------------------------------------------------------------------------
+// Section: TrafficRecorder
+// -----------------------------------------------------------------------------
+
+/**
+ *	Constructor.
+ */
+TrafficRecorder::TrafficRecorder() :
+	fileSize_( 0 ),
+	maxFiles_( 0 ),
+	fileIndex_( 0 ),
+	fd_( -1 ),
+	pBase_( NULL ),
+	offset_( 0 ),
+	numRecords_( 0 ),
+	numBytes_( 0 ),
+	numDropped_( 0 )
+{
+}
+
+
+/**
+ *	Destructor.
+ */
+TrafficRecorder::~TrafficRecorder()
+{
+	this->fini();
+}
+
+
+/**
+ *	This method starts recording.
+ *
+ *	@param pathPrefix	The files are named pathPrefix.NNNNNN.bwtr.
+ *	@param fileSize		The size of each file, in bytes.
+ *	@param maxFiles		The number of files to keep.
+ *
+ *	@return	True on success.
+ */
+bool TrafficRecorder::init( const std::string & pathPrefix, uint32 fileSize,
+		int maxFiles )
+{
+	this->fini();
+
+	if (fileSize < sizeof( TrafficFileHeader ) + recordSize( 0 ))
+	{
+		ERROR_MSG( "TrafficRecorder::init: File size %u is too small\n",
+			fileSize );
+		return false;
+	}
+
+	pathPrefix_ = pathPrefix;
+	fileSize_ = fileSize;
+	maxFiles_ = std::max( 1, maxFiles );
+	fileIndex_ = 0;
+
+	// Carry on after the files of an earlier recording with the same prefix,
+	// so that the files still sort in the order they were written.
+	std::vector< std::string > filenames;
+
+	if (TrafficRecordReader::findFiles( pathPrefix_, filenames ))
+	{
+		const std::string & last = filenames.back();
+		int lastIndex = 0;
+
+		if (sscanf( last.c_str() + pathPrefix_.size(), ".%d", &lastIndex ) == 1)
+		{
+			fileIndex_ = lastIndex + 1;
+		}
+	}
+
+	return this->openFile();
+}
+
+
+/**
+ *	This method stops recording.
+ */
+void TrafficRecorder::fini()
+{
+	this->closeFile();
+}
+
+
+/**
+ *	This method records a message. It is dropped if it is larger than a file.
+ */
+void TrafficRecorder::record( int32 proxyID, uint8 msgID, uint8 flags,
+		const void * pData, uint32 length )
+{
+	if (pBase_ == NULL)
+	{
+		return;
+	}
+
+	const uint32 size = recordSize( length );
+
+	if (size > fileSize_ - sizeof( TrafficFileHeader ))
+	{
+		++numDropped_;
+		return;
+	}
+
+	if (offset_ + size > fileSize_)
+	{
+		this->closeFile();
+		++fileIndex_;
+
+		if (!this->openFile())
+		{
+			++numDropped_;
+			return;
+		}
+	}
+
+	TrafficRecordHeader * pHeader =
+		reinterpret_cast< TrafficRecordHeader * >( pBase_ + offset_ );
+
+	pHeader->stamp = timestamp();
+	pHeader->size = size;
+	pHeader->proxyID = proxyID;
+	pHeader->length = length;
+	pHeader->msgID = msgID;
+	pHeader->flags = flags;
+	pHeader->padding = 0;
+
+	memcpy( pHeader + 1, pData, length );
+
+	offset_ += size;
+	++numRecords_;
+	numBytes_ += size;
+}
+
+
+/**
+ *	This method creates and maps the file with the current index, and removes
+ *	the file that has dropped out of the ring.
+ */
+bool TrafficRecorder::openFile()
+{
+	if (fileIndex_ >= maxFiles_)
+	{
+		unlink( this->filename( fileIndex_ - maxFiles_ ).c_str() );
+	}
+
+	std::string filename = this->filename( fileIndex_ );
+
+	fd_ = open( filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644 );
+
+	if (fd_ == -1)
+	{
+		ERROR_MSG( "TrafficRecorder::openFile: Could not open %s: %s\n",
+			filename.c_str(), strerror( errno ) );
+		return false;
+	}
+
+	if (ftruncate( fd_, fileSize_ ) == -1)
+	{
+		ERROR_MSG( "TrafficRecorder::openFile: Could not size %s: %s\n",
+			filename.c_str(), strerror( errno ) );
+		this->closeFile();
+		return false;
+	}
+
+	void * pBase = mmap( NULL, fileSize_, PROT_READ | PROT_WRITE, MAP_SHARED,
+		fd_, 0 );
+
+	if (pBase == MAP_FAILED)
+	{
+		ERROR_MSG( "TrafficRecorder::openFile: Could not map %s: %s\n",
+			filename.c_str(), strerror( errno ) );
+		this->closeFile();
+		return false;
+	}
+
+	pBase_ = static_cast< char * >( pBase );
+
+	TrafficFileHeader * pHeader =
+		reinterpret_cast< TrafficFileHeader * >( pBase_ );
+	memcpy( pHeader->magic, TRAFFIC_RECORD_MAGIC, sizeof( pHeader->magic ) );
+	pHeader->version = TRAFFIC_RECORD_VERSION;
+	pHeader->stampsPerSecond = stampsPerSecond();
+
+	offset_ = sizeof( TrafficFileHeader );
+
+	INFO_MSG( "TrafficRecorder::openFile: Recording to %s\n",
+		filename.c_str() );
+
+	return true;
+}
+
+
+/**
+ *	This method unmaps and closes the current file. The rest of the file is
+ *	left as zeroes, which ends the records.
+ */
+void TrafficRecorder::closeFile()
+{
+	if (pBase_ != NULL)
+	{
+		munmap( pBase_, fileSize_ );
+		pBase_ = NULL;
+	}
+
+	if (fd_ != -1)
+	{
+		close( fd_ );
+		fd_ = -1;
+	}
+}
+
+
+/**
+ *	This method returns the name of the file with the given index.
+ */
+std::string TrafficRecorder::filename( int index ) const
+{
+	char suffix[ 32 ];
+	bw_snprintf( suffix, sizeof( suffix ), ".%06d%s",
+		index, TRAFFIC_RECORD_EXTENSION );
+
+	return pathPrefix_ + suffix;
+}
+
+
+// -----------------------------------------------------------------------------
+// Section: TrafficRecordReader
+// -----------------------------------------------------------------------------
+
+/**
+ *	Constructor.
+ */
+TrafficRecordReader::TrafficRecordReader() :
+	offset_( 0 ),
+	stampsPerSecond_( 0.0 ),
+	startStamp_( 0 )
+{
+}
+
+
+/**
+ *	This method reads in a file to read the records of.
+ *
+ *	@return	True on success.
+ */
+bool TrafficRecordReader::open( const std::string & filename )
+{
+	buffer_.clear();
+	offset_ = 0;
+
+	FILE * pFile = fopen( filename.c_str(), "rb" );
+
+	if (pFile == NULL)
+	{
+		ERROR_MSG( "TrafficRecordReader::open: Could not open %s: %s\n",
+			filename.c_str(), strerror( errno ) );
+		return false;
+	}
+
+	char chunk[ 65536 ];
+	size_t numRead;
+
+	while ((numRead = fread( chunk, 1, sizeof( chunk ), pFile )) > 0)
+	{
+		buffer_.append( chunk, numRead );
+	}
+
+	fclose( pFile );
+
+	const TrafficFileHeader * pHeader =
+		reinterpret_cast< const TrafficFileHeader * >( buffer_.data() );
+
+	if (buffer_.size() < sizeof( TrafficFileHeader ) ||
+			memcmp( pHeader->magic, TRAFFIC_RECORD_MAGIC,
+				sizeof( pHeader->magic ) ) != 0 ||
+			pHeader->version != TRAFFIC_RECORD_VERSION)
+	{
+		ERROR_MSG( "TrafficRecordReader::open: %s is not a traffic record\n",
+			filename.c_str() );
+		buffer_.clear();
+		return false;
+	}
+
+	stampsPerSecond_ = double( pHeader->stampsPerSecond );
+	offset_ = sizeof( TrafficFileHeader );
+
+	return true;
+}
+
+
+/**
+ *	This method reads the next record of the current file.
+ *
+ *	@return	False if there are no more records.
+ */
+bool TrafficRecordReader::next( TrafficRecord & record )
+{
+	if (offset_ + sizeof( TrafficRecordHeader ) > buffer_.size())
+	{
+		return false;
+	}
+
+	const TrafficRecordHeader * pHeader =
+		reinterpret_cast< const TrafficRecordHeader * >(
+			buffer_.data() + offset_ );
+
+	if (pHeader->size == 0 ||
+			pHeader->size != recordSize( pHeader->length ) ||
+			offset_ + pHeader->size > buffer_.size())
+	{
+		return false;
+	}
+
+	if (startStamp_ == 0)
+	{
+		startStamp_ = pHeader->stamp;
+	}
+
+	record.time = (pHeader->stamp >= startStamp_) ?
+		double( pHeader->stamp - startStamp_ ) / stampsPerSecond_ : 0.0;
+	record.proxyID = pHeader->proxyID;
+	record.msgID = pHeader->msgID;
+	record.flags = pHeader->flags;
+	record.pData = reinterpret_cast< const char * >( pHeader + 1 );
+	record.length = pHeader->length;
+
+	offset_ += pHeader->size;
+
+	return true;
+}
+
+
+/**
+ *	This static method finds the files of a recording, in the order that they
+ *	were written.
+ *
+ *	@return	True if any were found.
+ */
+bool TrafficRecordReader::findFiles( const std::string & pathPrefix,
+		std::vector< std::string > & filenames )
+{
+	std::string pattern = pathPrefix + ".[0-9]*" + TRAFFIC_RECORD_EXTENSION;
+
+	glob_t globResult;
+
+	if (glob( pattern.c_str(), 0, NULL, &globResult ) == 0)
+	{
+		for (size_t i = 0; i < globResult.gl_pathc; ++i)
+		{
+			filenames.push_back( globResult.gl_pathv[i] );
+		}
+	}
+
+	globfree( &globResult );
+
+	return !filenames.empty();
+}
+
+// traffic_record.cpp
@@ -0,0 +1,142 @@
+/******************************************************************************
+BigWorld Technology
+Copyright BigWorld Pty, Ltd.
+All Rights Reserved. Commercial in confidence.
+
+WARNING: This computer program is protected by copyright law and international
+treaties. Unauthorized use, reproduction or distribution of this program, or
+any portion of this program, may result in the imposition of civil and
+criminal penalties as provided by law.
+******************************************************************************/
+
+#ifndef TRAFFIC_RECORD_HPP
+#define TRAFFIC_RECORD_HPP
+
+#include "cstdmf/stdmf.hpp"
+
+#include <string>
+#include <vector>
+
+/**
+ *	This is the header at the start of each traffic record file.
+ *
+ *	The file is followed by the records. Each record is a
+ *	TrafficRecordHeader followed by the message data, padded to a multiple of
+ *	8 bytes. The records end at a record with a size of 0, or at the end of the
+ *	file.
+ */
+struct TrafficFileHeader
+{
+	char		magic[4];			///< TRAFFIC_RECORD_MAGIC
+	uint32		version;			///< TRAFFIC_RECORD_VERSION
+	uint64		stampsPerSecond;	///< The rate of the record timestamps.
+};
+
+/**
+ *	This is the header of a recorded message.
+ */
+struct TrafficRecordHeader
+{
+	uint64		stamp;		///< The timestamp() when the message arrived.
+	uint32		size;		///< The size of the record, including padding.
+	int32		proxyID;	///< The id of the proxy whose client sent it.
+	uint32		length;		///< The length of the message data.
+	uint8		msgID;		///< The message identifier.
+	uint8		flags;		///< The message header flags.
+	uint16		padding;
+};
+
+const char TRAFFIC_RECORD_MAGIC[4] = { 'B', 'W', 'T', 'R' };
+const uint32 TRAFFIC_RECORD_VERSION = 1;
+const char TRAFFIC_RECORD_EXTENSION[] = ".bwtr";
+
+
+/**
+ *	This class appends messages to a set of memory-mapped files. Each file has
+ *	a fixed size. When one is full, recording moves on to the next one, and
+ *	only the most recent maxFiles are kept.
+ *
+ *	Recording a message only copies it into the mapping. The operating system
+ *	writes the pages out in the background.
+ */
+class TrafficRecorder
+{
+public:
+	TrafficRecorder();
+	~TrafficRecorder();
+
+	bool init( const std::string & pathPrefix, uint32 fileSize,
+		int maxFiles );
+	void fini();
+
+	bool isRecording() const	{ return pBase_ != NULL; }
+
+	void record( int32 proxyID, uint8 msgID, uint8 flags,
+		const void * pData, uint32 length );
+
+	uint32 numRecords() const	{ return numRecords_; }
+	uint64 numBytes() const		{ return numBytes_; }
+	uint32 numDropped() const	{ return numDropped_; }
+	int fileIndex() const		{ return fileIndex_; }
+
+private:
+	bool openFile();
+	void closeFile();
+	std::string filename( int index ) const;
+
+	std::string	pathPrefix_;
+	uint32		fileSize_;
+	int			maxFiles_;
+
+	int			fileIndex_;
+	int			fd_;
+	char *		pBase_;
+	uint32		offset_;
+
+	uint32		numRecords_;
+	uint64		numBytes_;
+	uint32		numDropped_;
+};
+
+
+/**
+ *	This structure is a message read from a traffic record file. The data
+ *	points into the reader's buffer.
+ */
+struct TrafficRecord
+{
+	double			time;		///< In seconds since the first record.
+	int32			proxyID;
+	uint8			msgID;
+	uint8			flags;
+	const char *	pData;
+	uint32			length;
+};
+
+
+/**
+ *	This class reads the messages in traffic record files. The files of one
+ *	recording should be opened in turn with the same reader, so that the
+ *	record times carry on from one file to the next.
+ */
+class TrafficRecordReader
+{
+public:
+	TrafficRecordReader();
+
+	bool open( const std::string & filename );
+	bool next( TrafficRecord & record );
+
+	static bool findFiles( const std::string & pathPrefix,
+		std::vector< std::string > & filenames );
+
+private:
+	std::string		buffer_;
+	uint32			offset_;
+	double			stampsPerSecond_;
+
+	/// The timestamp of the first record read, or 0.
+	uint64			startStamp_;
+};
+
+#endif // TRAFFIC_RECORD_HPP
@@ -167,6 +167,7 @@ public:
 	// Shared Data message handlers
 	void setSharedData( BinaryIStream & data );
 	void delSharedData( BinaryIStream & data );
+	void updateSharedData( BinaryIStream & data );
 
 	// set the proxy to receive future messages
 	void setClient( const BaseAppIntInterface::setClientArgs & args );
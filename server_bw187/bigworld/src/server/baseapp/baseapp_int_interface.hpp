@@ -17,6 +17,7 @@ criminal penalties as provided by law.
 #define PROXY_INT_INTERFACE_HPP
 
 #include "network/basictypes.hpp"
+#include "network/tree_broadcast.hpp"
 #include "server/anonymous_channel_client.hpp"
 
 
@@ -323,6 +324,12 @@ BEGIN_MERCURY_INTERFACE( BaseAppIntInterface )
 		uint8				tag;
 	END_STRUCT_MESSAGE()
 
+	// a message from the BaseAppMgr, relayed by another BaseApp
+	MF_TREE_BROADCAST_MSG( treeBroadcast )
+
+	// a batch of versioned shared data changes, read by SharedData::readBatch
+	MF_VARLEN_BASE_APP_MSG( updateSharedData )
+
 	// 128 to 254 are messages destined either for our mailboxes
 	// or for the client's entities. They all look like this:
 	MERCURY_VARIABLE_MESSAGE( entityMessage, 2, NULL )
@@ -0,0 +1,56 @@
+/******************************************************************************
+BigWorld Technology
+Copyright BigWorld Pty, Ltd.
+All Rights Reserved. Commercial in confidence.
+
+WARNING: This computer program is protected by copyright law and international
+treaties. Unauthorized use, reproduction or distribution of this program, or
+any portion of this program, may result in the imposition of civil and
+criminal penalties as provided by law.
+******************************************************************************/
+
+#include "Python.h"		// See http://docs.python.org/api/includes.html
+
+#include "baseapp.hpp"
+
+#include "common/shared_data.hpp"
+#include "cstdmf/debug.hpp"
+
+DECLARE_DEBUG_COMPONENT( 0 )
+
+
+// -----------------------------------------------------------------------------
+// Section: Shared data batches
+// -----------------------------------------------------------------------------
+
+/**
+ *	This method handles a batch of versioned shared data changes from the
+ *	BaseAppMgr. The batch may hold changes to both BigWorld.baseAppData and
+ *	BigWorld.globalData.
+ *
+ *	If the batch cannot be applied, the data may now differ from the
+ *	BaseAppMgr's, so all of it is asked for again.
+ */
+void BaseApp::updateSharedData( BinaryIStream & data )
+{
+	if (SharedData::readBatch( data, *pBaseAppData_, *pGlobalData_ ))
+	{
+		return;
+	}
+
+	ERROR_MSG( "BaseApp::updateSharedData: "
+			"Could not apply batch. Asking for all shared data again\n" );
+
+	// A version newer than the BaseAppMgr's makes it resend everything,
+	// after a SHARED_DATA_OP_CLEAR.
+	Mercury::Bundle & bundle = baseAppMgr_.bundle();
+	BaseAppMgrInterface::requestSharedDataSinceArgs & args =
+		args.start( bundle );
+
+	args.baseAppDataVersion = uint32( -1 );
+	args.globalDataVersion = uint32( -1 );
+
+	baseAppMgr_.send();
+}
+
+// baseapp_shared_data.cpp
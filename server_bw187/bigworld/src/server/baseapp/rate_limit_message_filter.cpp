@@ -0,0 +1,442 @@
+/******************************************************************************
+BigWorld Technology
+Copyright BigWorld Pty, Ltd.
+All Rights Reserved. Commercial in confidence.
+
+WARNING: This computer program is protected by copyright law and international
+treaties. Unauthorized use, reproduction or distribution of this program, or
+any portion of this program, may result in the imposition of civil and
+criminal penalties as provided by law.
+******************************************************************************/
+
+
+#include "rate_limit_message_filter.hpp"
+
+#ifndef CODE_INLINE
+#include "rate_limit_message_filter.ipp"
+#endif
+
+#include "cstdmf/watcher.hpp"
+
+DECLARE_DEBUG_COMPONENT( 0 )
+
+
+// -----------------------------------------------------------------------------
+// Section: BufferedMessageArena
+// -----------------------------------------------------------------------------
+
+/**
+ *	Constructor.
+ */
+BufferedMessageArena::BufferedMessageArena() :
+	numBlocks_( 0 ),
+	numBlocksInUse_( 0 ),
+	maxBlocksInUse_( 0 ),
+	numOversized_( 0 )
+{
+	for (uint i = 0; i < NUM_SIZE_CLASSES; ++i)
+	{
+		freeLists_[i] = NULL;
+	}
+}
+
+
+/**
+ *	Destructor.
+ */
+BufferedMessageArena::~BufferedMessageArena()
+{
+	for (uint i = 0; i < NUM_SIZE_CLASSES; ++i)
+	{
+		while (freeLists_[i] != NULL)
+		{
+			char * pData = freeLists_[i];
+			freeLists_[i] = *reinterpret_cast< char ** >( pData );
+
+			delete [] reinterpret_cast< char * >(
+				reinterpret_cast< BlockHeader * >( pData ) - 1 );
+		}
+	}
+}
+
+
+/**
+ *	This method returns a block of at least the given size. A new block is
+ *	only allocated if there is no free block of the size class.
+ */
+void * BufferedMessageArena::allocate( uint size )
+{
+	const uint totalSize = sizeof( BlockHeader ) + size;
+
+	uint sizeClass = 0;
+
+	while (sizeClass < NUM_SIZE_CLASSES &&
+			(MIN_BLOCK_SIZE << sizeClass) < totalSize)
+	{
+		++sizeClass;
+	}
+
+	BlockHeader * pHeader;
+
+	if (sizeClass == NUM_SIZE_CLASSES)
+	{
+		// Client messages this large are rare.
+		++numOversized_;
+		pHeader = reinterpret_cast< BlockHeader * >( new char[ totalSize ] );
+	}
+	else
+	{
+		char * pData = freeLists_[ sizeClass ];
+
+		if (pData != NULL)
+		{
+			freeLists_[ sizeClass ] = *reinterpret_cast< char ** >( pData );
+			pHeader = reinterpret_cast< BlockHeader * >( pData ) - 1;
+		}
+		else
+		{
+			++numBlocks_;
+			pHeader = reinterpret_cast< BlockHeader * >(
+				new char[ MIN_BLOCK_SIZE << sizeClass ] );
+		}
+
+		++numBlocksInUse_;
+		maxBlocksInUse_ = std::max( maxBlocksInUse_, numBlocksInUse_ );
+	}
+
+	pHeader->sizeClass = sizeClass;
+
+	return pHeader + 1;
+}
+
+
+/**
+ *	This method returns a block from allocate to the free list of its size
+ *	class.
+ */
+void BufferedMessageArena::free( void * pData )
+{
+	if (pData == NULL)
+	{
+		return;
+	}
+
+	BlockHeader * pHeader = reinterpret_cast< BlockHeader * >( pData ) - 1;
+	const uint32 sizeClass = pHeader->sizeClass;
+
+	if (sizeClass == NUM_SIZE_CLASSES)
+	{
+		delete [] reinterpret_cast< char * >( pHeader );
+		return;
+	}
+
+	MF_ASSERT( sizeClass < NUM_SIZE_CLASSES && numBlocksInUse_ > 0 );
+	--numBlocksInUse_;
+
+	*reinterpret_cast< char ** >( pData ) = freeLists_[ sizeClass ];
+	freeLists_[ sizeClass ] = static_cast< char * >( pData );
+}
+
+
+/**
+ *	This static method returns the arena that all filters share.
+ */
+BufferedMessageArena & BufferedMessageArena::instance()
+{
+	static BufferedMessageArena s_instance;
+	static bool s_isWatched = false;
+
+	if (!s_isWatched)
+	{
+		s_isWatched = true;
+		Watcher::rootWatcher().addChild( "rateLimit/arena",
+			BufferedMessageArena::pWatcher(), &s_instance );
+	}
+
+	return s_instance;
+}
+
+
+/**
+ *	This static method returns a watcher for the arena. The number of blocks
+ *	stops increasing once they can hold all of the messages buffered during a
+ *	flood, after which buffering does not allocate.
+ */
+WatcherPtr BufferedMessageArena::pWatcher()
+{
+	DirectoryWatcherPtr pWatcher = new DirectoryWatcher();
+
+#if ENABLE_WATCHERS
+	BufferedMessageArena * pNull = NULL;
+
+	pWatcher->addChild( "numBlocks", makeWatcher( pNull->numBlocks_ ) );
+	pWatcher->addChild( "numBlocksInUse",
+		makeWatcher( pNull->numBlocksInUse_ ) );
+	pWatcher->addChild( "maxBlocksInUse",
+		makeWatcher( pNull->maxBlocksInUse_ ) );
+	pWatcher->addChild( "numOversized", makeWatcher( pNull->numOversized_ ) );
+#endif
+
+	return pWatcher;
+}
+
+
+// -----------------------------------------------------------------------------
+// Section: RateLimitMessageFilter
+// -----------------------------------------------------------------------------
+
+/**
+ *	Constructor.
+ *
+ *	@param config 	The limits to enforce.
+ *	@param addr 	The address of the client that this filter is for.
+ */
+RateLimitMessageFilter::RateLimitMessageFilter( const RateLimitConfig & config,
+			const Mercury::Address & addr ) :
+		config_( config ),
+		pCallback_( NULL ),
+		addr_( addr ),
+		warnFlags_( 0 ),
+		numReceivedSinceLastTick_( 0 ),
+		receivedBytesSinceLastTick_( 0 ),
+		numDispatchedSinceLastTick_( 0 ),
+		dispatchedBytesSinceLastTick_( 0 ),
+		pFront_( NULL ),
+		pBack_( NULL ),
+		numBuffered_( 0 ),
+		sumBufferedSizes_( 0 )
+{
+}
+
+
+/**
+ *	Destructor. The messages that are still buffered are deleted.
+ */
+RateLimitMessageFilter::~RateLimitMessageFilter()
+{
+	while (BufferedMessage * pMessage = this->front())
+	{
+		this->pop_front();
+
+		if (pCallback_)
+		{
+			pCallback_->onMessageDeleted( pMessage );
+		}
+
+		delete pMessage;
+	}
+}
+
+
+/**
+ *	This method overrides the MessageFilter method. The message is dispatched
+ *	if no messages are buffered and the per-tick limits allow it, and is
+ *	buffered otherwise.
+ */
+void RateLimitMessageFilter::filterMessage( const Mercury::Address & srcAddr,
+		Mercury::UnpackedMessageHeader & header,
+		BinaryIStream & data,
+		Mercury::InputMessageHandler * pHandler )
+{
+	uint dataLen = data.remainingLength();
+
+	++numReceivedSinceLastTick_;
+	receivedBytesSinceLastTick_ += dataLen;
+
+	if (numReceivedSinceLastTick_ > config_.warnMessagesPerTick &&
+			!(warnFlags_ & WARN_MESSAGE_COUNT))
+	{
+		WARNING_MSG( "RateLimitMessageFilter::filterMessage( %s ): "
+				"Client sent more than %u messages this tick\n",
+			addr_.c_str(), config_.warnMessagesPerTick );
+		warnFlags_ |= WARN_MESSAGE_COUNT;
+	}
+
+	if (receivedBytesSinceLastTick_ > config_.warnBytesPerTick &&
+			!(warnFlags_ & WARN_MESSAGE_SIZE))
+	{
+		WARNING_MSG( "RateLimitMessageFilter::filterMessage( %s ): "
+				"Client sent more than %u bytes this tick\n",
+			addr_.c_str(), config_.warnBytesPerTick );
+		warnFlags_ |= WARN_MESSAGE_SIZE;
+	}
+
+	if (this->front() == NULL && this->canSendNow( dataLen ))
+	{
+		this->dispatch( header, data, pHandler );
+		return;
+	}
+
+	BufferedMessage * pMessage = pCallback_ ?
+		pCallback_->createBufferedMessage( header, data, pHandler ) :
+		new BufferedMessage( header, data, pHandler );
+
+	if (!this->buffer( pMessage ))
+	{
+		if (pCallback_)
+		{
+			pCallback_->onFilterLimitsExceeded( srcAddr, pMessage );
+		}
+
+		delete pMessage;
+	}
+}
+
+
+/**
+ *	This method is called once per tick. It starts a new tick period, and
+ *	dispatches as many of the buffered messages as the limits allow.
+ */
+void RateLimitMessageFilter::tick()
+{
+	numReceivedSinceLastTick_ = 0;
+	receivedBytesSinceLastTick_ = 0;
+	numDispatchedSinceLastTick_ = 0;
+	dispatchedBytesSinceLastTick_ = 0;
+
+	warnFlags_ &= ~(WARN_MESSAGE_COUNT | WARN_MESSAGE_SIZE);
+
+	this->replayAny();
+}
+
+
+/**
+ *	This method dispatches buffered messages, in the order that they were
+ *	received, until the per-tick limits are reached.
+ */
+void RateLimitMessageFilter::replayAny()
+{
+	// Keep ourselves alive in case a handler removes us from the channel.
+	RateLimitMessageFilterPtr pThis = this;
+
+	BufferedMessage * pMessage;
+
+	while ((pMessage = this->front()) != NULL &&
+			this->canSendNow( pMessage->size() ))
+	{
+		this->pop_front();
+		this->dispatch( pMessage );
+		delete pMessage;
+	}
+
+	if (this->front() == NULL)
+	{
+		warnFlags_ &= ~(WARN_MESSAGE_BUFFERED | WARN_BYTES_BUFFERED);
+	}
+}
+
+
+/**
+ *	This method returns whether a message of the given size can be dispatched
+ *	without exceeding the per-tick limits. The first message of a tick is
+ *	always within the byte limit, so that a message larger than
+ *	maxBytesPerTick is dispatched on its own rather than blocking the buffer.
+ */
+bool RateLimitMessageFilter::canSendNow( uint dataLen )
+{
+	return (numDispatchedSinceLastTick_ < config_.maxMessagesPerTick) &&
+		(dispatchedBytesSinceLastTick_ == 0 ||
+			dispatchedBytesSinceLastTick_ + dataLen <=
+				config_.maxBytesPerTick);
+}
+
+
+/**
+ *	This method removes the message at the front of the buffer. The caller
+ *	takes ownership of it.
+ */
+void RateLimitMessageFilter::pop_front()
+{
+	BufferedMessage * pMessage = pFront_;
+	MF_ASSERT( pMessage != NULL );
+
+	pFront_ = pMessage->pNext_;
+	pMessage->pNext_ = NULL;
+
+	if (pFront_ == NULL)
+	{
+		pBack_ = NULL;
+	}
+
+	--numBuffered_;
+	sumBufferedSizes_ -= pMessage->size();
+}
+
+
+/**
+ *	This method dispatches a message that is not buffered.
+ */
+void RateLimitMessageFilter::dispatch( Mercury::UnpackedMessageHeader & header,
+		BinaryIStream & data, Mercury::InputMessageHandler * pHandler )
+{
+	++numDispatchedSinceLastTick_;
+	dispatchedBytesSinceLastTick_ += data.remainingLength();
+
+	pHandler->handleMessage( addr_, header, data );
+}
+
+
+/**
+ *	This method dispatches a message that has been removed from the buffer.
+ */
+void RateLimitMessageFilter::dispatch( BufferedMessage * pMessage )
+{
+	++numDispatchedSinceLastTick_;
+	dispatchedBytesSinceLastTick_ += pMessage->size();
+
+	pMessage->dispatch( pCallback_, addr_ );
+}
+
+
+/**
+ *	This method adds a message to the back of the buffer, if the buffer
+ *	limits allow it, and warns when it reaches the warning limits.
+ *
+ *	@return	False if the message would exceed the buffer limits. The caller
+ *			keeps ownership of it.
+ */
+bool RateLimitMessageFilter::buffer( BufferedMessage * pMsg )
+{
+	const uint dataLen = pMsg->size();
+
+	if (numBuffered_ + 1 > config_.maxMessagesBuffered ||
+			sumBufferedSizes_ + dataLen > config_.maxBytesBuffered)
+	{
+		return false;
+	}
+
+	if (numBuffered_ + 1 > config_.warnMessagesBuffered &&
+			!(warnFlags_ & WARN_MESSAGE_BUFFERED))
+	{
+		WARNING_MSG( "RateLimitMessageFilter::buffer( %s ): "
+				"More than %u messages are buffered\n",
+			addr_.c_str(), config_.warnMessagesBuffered );
+		warnFlags_ |= WARN_MESSAGE_BUFFERED;
+	}
+
+	if (sumBufferedSizes_ + dataLen > config_.warnBytesBuffered &&
+			!(warnFlags_ & WARN_BYTES_BUFFERED))
+	{
+		WARNING_MSG( "RateLimitMessageFilter::buffer( %s ): "
+				"More than %u bytes are buffered\n",
+			addr_.c_str(), config_.warnBytesBuffered );
+		warnFlags_ |= WARN_BYTES_BUFFERED;
+	}
+
+	if (pBack_ != NULL)
+	{
+		pBack_->pNext_ = pMsg;
+	}
+	else
+	{
+		pFront_ = pMsg;
+	}
+
+	pBack_ = pMsg;
+	++numBuffered_;
+	sumBufferedSizes_ += dataLen;
+
+	return true;
+}
+
+// rate_limit_message_filter.cpp
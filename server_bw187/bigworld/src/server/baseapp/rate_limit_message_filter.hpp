@@ -18,7 +18,7 @@ criminal penalties as provided by law.
 #include "cstdmf/smartpointer.hpp"
 #include "cstdmf/memory_stream.hpp"
 
-#include <queue>
+#include <string.h>
 
 /**
  *	This struct holds configuration parameters for the rate-limiting message
@@ -37,12 +37,65 @@ struct RateLimitConfig
 };
 
 class BufferedMessage;
+class Watcher;
+typedef SmartPointer< Watcher > WatcherPtr;
+
+
+/**
+ *	This class is a pool of blocks that buffered messages and their data are
+ *	allocated from. It is shared by all of the RateLimitMessageFilters of a
+ *	BaseApp.
+ *
+ *	Blocks come in power-of-two size classes. A freed block is kept on the
+ *	free list of its class, so a flood of client messages stops allocating
+ *	once there are enough blocks for the buffer limits of the flooding
+ *	clients. Only requests larger than the largest class are allocated and
+ *	freed individually.
+ */
+class BufferedMessageArena
+{
+public:
+	BufferedMessageArena();
+	~BufferedMessageArena();
+
+	void * allocate( uint size );
+	void free( void * pData );
+
+	static BufferedMessageArena & instance();
+
+	static WatcherPtr pWatcher();
+
+private:
+	/**
+	 *	This is the header at the start of each block.
+	 */
+	struct BlockHeader
+	{
+		uint32	sizeClass;
+		uint32	padding;
+	};
+
+	static const uint MIN_BLOCK_SIZE = 64;
+	static const uint NUM_SIZE_CLASSES = 9;	///< Up to 16KB blocks.
+
+	// The free blocks of each size class, linked through their data.
+	char *	freeLists_[ NUM_SIZE_CLASSES ];
+
+	uint	numBlocks_;
+	uint	numBlocksInUse_;
+	uint	maxBlocksInUse_;
+	uint	numOversized_;
+};
 
 
 /**
  *	All messages from external clients get passed through an instance of this
  *	class. It is responsible for enforcing rate limits on client messages,
  *	buffering and playing back messages when limits are no longer exceeded.
+ *
+ *	Buffered messages are allocated from the BufferedMessageArena and queued
+ *	through their own next pointers, so buffering and replaying a message
+ *	does not allocate once the arena has enough free blocks.
  */
 class RateLimitMessageFilter : public Mercury::MessageFilter
 {
@@ -194,7 +247,7 @@ private:
 	 *	or NULL if the queue is empty.
 	 */
 	BufferedMessage * front()
-	{ return queue_.empty() ? NULL : queue_.front(); }
+	{ return pFront_; }
 
 
 	void pop_front();
@@ -230,11 +283,6 @@ private:
 	 */
 	static const uint8 WARN_BYTES_BUFFERED 		= 0x08;
 
-	/**
-	 *	Message queue data type.
-	 */
-	typedef std::queue< BufferedMessage * > MsgQueue;
-
 	// The configuration structure.
 	RateLimitConfig		config_;
 
@@ -262,10 +310,14 @@ private:
 	// The total size of the dispatched messages since we were last ticked.
 	uint 				dispatchedBytesSinceLastTick_;
 
-	// The buffer message queue.
-	MsgQueue			queue_;
+	// The buffered message queue, linked through BufferedMessage::pNext_.
+	BufferedMessage *	pFront_;
+	BufferedMessage *	pBack_;
 
-	// This is always the sum of all the messages in queue_.
+	// The number of buffered messages.
+	uint				numBuffered_;
+
+	// This is always the sum of all the buffered messages' sizes.
 	uint				sumBufferedSizes_;
 
 };
@@ -284,6 +336,9 @@ typedef SmartPointer< RateLimitMessageFilter > RateLimitMessageFilterPtr;
  *	state and/or overriding the dispatch method for doing any custom actions.
  *	They can override RateLimitMessageFilter::Callback::createBufferedMessage()
  *	in order to have the filter create instances of different derived classes.
+ *
+ *	Instances and their data are allocated from the BufferedMessageArena,
+ *	including those of derived classes.
  */
 class BufferedMessage
 {
@@ -299,10 +354,14 @@ public:
 				BinaryIStream & data,
 				Mercury::InputMessageHandler * pHandler ):
 			header_( header ),
-			data_( data.remainingLength() ),
-			pHandler_( pHandler )
+			pData_( static_cast< char * >( BufferedMessageArena::instance().
+				allocate( data.remainingLength() ) ) ),
+			data_( pData_, data.remainingLength() ),
+			pHandler_( pHandler ),
+			pNext_( NULL )
 	{
-		data_.transfer( data, data.remainingLength() );
+		memcpy( pData_, data.retrieve( data_.remainingLength() ),
+			data_.remainingLength() );
 	}
 
 
@@ -310,7 +369,24 @@ public:
 	 *	Destructor.
 	 */
 	virtual ~BufferedMessage()
-	{}
+	{
+		// Messages that are deleted without being dispatched are not read.
+		data_.finish();
+		BufferedMessageArena::instance().free( pData_ );
+	}
+
+
+	/**
+	 *	Allocate a message from the BufferedMessageArena.
+	 */
+	static void * operator new( size_t size )
+	{ return BufferedMessageArena::instance().allocate( size ); }
+
+	/**
+	 *	Free a message allocated from the BufferedMessageArena.
+	 */
+	static void operator delete( void * pMessage )
+	{ BufferedMessageArena::instance().free( pMessage ); }
 
 
 	/**
@@ -362,12 +438,20 @@ private:
 	// The message header.
 	Mercury::UnpackedMessageHeader 	header_;
 
-	// The message data.
-	MemoryOStream 					data_;
+	// The message data, allocated from the BufferedMessageArena.
+	char *							pData_;
+
+	// The stream that the message data is read from.
+	MemoryIStream 					data_;
 
 	// The destination handler for this message.
 	Mercury::InputMessageHandler * 	pHandler_;
 
+	// The next message in the filter's queue.
+	BufferedMessage *				pNext_;
+
+	friend class RateLimitMessageFilter;
+
 };
 
 
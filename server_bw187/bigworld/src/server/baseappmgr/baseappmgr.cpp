@@ -22,6 +22,7 @@ criminal penalties as provided by law.
 
 #include "cellapp/cellapp_interface.hpp"
 #include "cellappmgr/cellappmgr_interface.hpp"
+#include "common/shared_data.hpp"
 #include "cstdmf/memory_stream.hpp"
 #include "cstdmf/profile.hpp"
 #include "cstdmf/timestamp.hpp"
@@ -91,11 +92,23 @@ BaseAppMgr * BaseAppMgr::pInstance_ = NULL;
 BaseAppMgr::BaseAppMgr( Mercury::Nub & nub ) :
 	nub_( nub ),
 	cellAppMgr_( nub_ ),
+	treeBroadcaster_( nub_, BaseAppIntInterface::treeBroadcast,
+		BaseAppMgrInterface::treeBroadcastAck ),
+	sharedDataVersion_( 0 ),
+	sentSharedDataVersion_( 0 ),
+	prunedSharedDataVersion_( 0 ),
+	numSharedDataDeletions_( 0 ),
+	maxSharedDataDeletions_( 1024 ),
+	shouldBatchSharedData_( false ),
+	numSharedDataBatches_( 0 ),
 	lastBaseAppID_( 0 ),
 	latestVersion_( uint32(-1) ),
 	impendingVersion_( uint32(-1) ),
 	updaterStep_( -1 ),
 	allowNewBaseApps_( true ),
+	updateStartTime_( 0 ),
+	updaterStepTime_( 0 ),
+	lastUpdateDuration_( 0.0 ),
 	time_( 0 ),
 	pTimeKeeper_( NULL ),
 	updateHertz_( DEFAULT_GAME_UPDATE_HERTZ ),
@@ -165,6 +178,14 @@ BaseAppMgr::BaseAppMgr( Mercury::Nub & nub ) :
 		}
 	}
 
+	BWConfig::update( "baseAppMgr/batchSharedData", shouldBatchSharedData_ );
+	BWConfig::update( "baseAppMgr/sharedDataHistorySize",
+			maxSharedDataDeletions_ );
+
+	treeBroadcaster_.fanOut( BWConfig::get( "baseAppMgr/broadcastFanOut", 0 ) );
+	treeBroadcaster_.resendPeriod(
+		BWConfig::get( "baseAppMgr/broadcastResendPeriod", 1.f ) );
+
 	float baseAppTimeout = 5.f;
 	BWConfig::update( "baseAppMgr/baseAppTimeout", baseAppTimeout );
 	baseAppTimeoutPeriod_ = int64( stampsPerSecondD() * baseAppTimeout );
@@ -567,11 +588,39 @@ BaseAppID BaseAppMgr::getNextID()
  *  payload is taken from the provided MemoryOStream.  If pExclude is non-NULL,
  *  nothing will be sent to that app.  If pReplyHandler is non-NULL, we start a
  *  request instead of starting a regular message.
+ *
+ *	If baseAppMgr/broadcastFanOut is set, and there are more BaseApps than
+ *	that, messages that are not requests are sent along a tree of BaseApps
+ *	instead. Those messages are not sent on the BaseApps' channels, so they
+ *	are only ordered with respect to each other.
  */
 void BaseAppMgr::sendToBaseApps( const Mercury::InterfaceElement & ifElt,
 	MemoryOStream & args, const BaseApp * pExclude,
 	Mercury::ReplyMessageHandler * pHandler )
 {
+	const int fanOut = treeBroadcaster_.fanOut();
+
+	if (!pHandler && (fanOut > 0) && (int( baseApps_.size() ) > fanOut))
+	{
+		std::vector< Mercury::Address > destinations;
+		destinations.reserve( baseApps_.size() );
+
+		for (BaseApps::iterator it = baseApps_.begin();
+				it != baseApps_.end(); ++it)
+		{
+			if (pExclude != it->second.get())
+			{
+				destinations.push_back( it->first );
+			}
+		}
+
+		treeBroadcaster_.broadcast( ifElt, destinations,
+			args.data(), args.size() );
+
+		args.finish();
+		return;
+	}
+
 	for (BaseApps::iterator it = baseApps_.begin(); it != baseApps_.end(); ++it)
 	{
 		BaseApp & baseApp = *it->second;
@@ -669,6 +718,12 @@ void BaseAppMgr::addWatchers()
 
 	MF_WATCH( "config/baseAppOverloadLevel", baseAppOverloadLevel_ );
 
+	MF_WATCH( "updater/step", updaterStep_, Watcher::WT_READ_ONLY,
+		"The step of the resource update in progress, or -1" );
+	MF_WATCH( "updater/lastUpdateDuration", lastUpdateDuration_,
+		Watcher::WT_READ_ONLY,
+		"The seconds from the first to the last step of the last update" );
+
 	Watcher * pBaseAppWatcher = BaseApp::makeWatcher();
 
 	// map of these for locals
@@ -684,6 +739,22 @@ void BaseAppMgr::addWatchers()
 
 	pRoot->addChild( "nub", Mercury::Nub::pWatcher(), &nub_ );
 
+	pRoot->addChild( "treeBroadcast", Mercury::TreeBroadcaster::pWatcher(),
+		&treeBroadcaster_ );
+
+	MF_WATCH( "sharedData/version", sharedDataVersion_,
+		Watcher::WT_READ_ONLY,
+		"The version of the latest change to the shared data" );
+	MF_WATCH( "sharedData/prunedVersion", prunedSharedDataVersion_,
+		Watcher::WT_READ_ONLY,
+		"BaseApps older than this version are sent all of the shared data" );
+	MF_WATCH( "sharedData/numDeletions", numSharedDataDeletions_,
+		Watcher::WT_READ_ONLY,
+		"The number of deleted entries kept for catching up" );
+	MF_WATCH( "sharedData/numBatches", numSharedDataBatches_,
+		Watcher::WT_READ_ONLY,
+		"The number of batches of changes sent to the BaseApps" );
+
 	pRoot->addChild( "cellAppMgr", Mercury::Channel::pWatcher(),
 		&cellAppMgr_.channel() );
 
@@ -710,6 +781,10 @@ int BaseAppMgr::handleTimeout( int /*id*/, void * arg )
 		{
 			++time_;
 
+			pTimeKeeper_->onTick();
+
+			this->sendSharedDataUpdates();
+
 			if (time_ % syncTimePeriod_ == 0)
 			{
 				pTimeKeeper_->synchroniseWithMaster();
@@ -1275,28 +1350,37 @@ void BaseAppMgr::add( const Mercury::Address & srcAddr,
 		}
 	}
 
-	if (!sharedBaseAppData_.empty())
+	if (shouldBatchSharedData_)
+	{
+		bundle.startMessage( BaseAppIntInterface::updateSharedData );
+		this->addSharedDataUpdates( bundle, SHARED_DATA_TYPE_BASE_APP, 0 );
+		this->addSharedDataUpdates( bundle, SHARED_DATA_TYPE_GLOBAL, 0 );
+	}
+	else
 	{
 		SharedData::iterator iter = sharedBaseAppData_.begin();
 
 		while (iter != sharedBaseAppData_.end())
 		{
-			bundle.startMessage( BaseAppIntInterface::setSharedData );
-			bundle << SharedDataType( SHARED_DATA_TYPE_BASE_APP ) <<
-				iter->first << iter->second;
+			if (!iter->second.isDeleted)
+			{
+				bundle.startMessage( BaseAppIntInterface::setSharedData );
+				bundle << SharedDataType( SHARED_DATA_TYPE_BASE_APP ) <<
+					iter->first << iter->second.value;
+			}
 			++iter;
 		}
-	}
 
-	if (!sharedGlobalData_.empty())
-	{
-		SharedData::iterator iter = sharedGlobalData_.begin();
+		iter = sharedGlobalData_.begin();
 
 		while (iter != sharedGlobalData_.end())
 		{
-			bundle.startMessage( BaseAppIntInterface::setSharedData );
-			bundle << SharedDataType( SHARED_DATA_TYPE_GLOBAL ) <<
-				iter->first << iter->second;
+			if (!iter->second.isDeleted)
+			{
+				bundle.startMessage( BaseAppIntInterface::setSharedData );
+				bundle << SharedDataType( SHARED_DATA_TYPE_GLOBAL ) <<
+					iter->first << iter->second.value;
+			}
 			++iter;
 		}
 	}
@@ -1569,7 +1653,7 @@ void BaseAppMgr::recoverBaseApp( const Mercury::Address & srcAddr,
 		for (uint32 i = 0; i < numEntries; ++i)
 		{
 			data >> key >> value;
-			sharedBaseAppData_[ key ] = value;
+			this->setSharedDataValue( sharedBaseAppData_, key, value );
 		}
 	}
 
@@ -1589,7 +1673,7 @@ void BaseAppMgr::recoverBaseApp( const Mercury::Address & srcAddr,
 		for (uint32 i = 0; i < numEntries; ++i)
 		{
 			data >> key >> value;
-			sharedGlobalData_[ key ] = value;
+			this->setSharedDataValue( sharedGlobalData_, key, value );
 		}
 	}
 
@@ -1961,11 +2045,14 @@ bool BaseAppMgr::onBaseAppGone( const Mercury::Address & addr,
 				this->checkGlobalBases( addr );
 			}
 
-			// Tell all the baseapps that the dead one is gone.
+			// Tell all the baseapps that the dead one is gone. It is not
+			// sent to the dead one, since it may be a relay.
+			treeBroadcaster_.onAddressDead( addr );
+
 			MemoryOStream args;
 			args << iter->first << baseApp.backupHash();
 			this->sendToBaseApps( BaseAppIntInterface::handleBaseAppDeath,
-				args );
+				args, &baseApp );
 
 			// Adjust globalBases_ for new mapping
 			{
@@ -2301,13 +2388,11 @@ void BaseAppMgr::setSharedData( BinaryIStream & data )
 	std::string value;
 	data >> dataType >> key >> value;
 
-	if (dataType == SHARED_DATA_TYPE_BASE_APP)
-	{
-		sharedBaseAppData_[ key ] = value;
-	}
-	else if (dataType == SHARED_DATA_TYPE_GLOBAL)
+	SharedData * pSharedData = this->findSharedData( dataType );
+
+	if (pSharedData)
 	{
-		sharedGlobalData_[ key ] = value;
+		this->setSharedDataValue( *pSharedData, key, value );
 	}
 	else if ((dataType == SHARED_DATA_TYPE_GLOBAL_FROM_BASE_APP) ||
 		(dataType == SHARED_DATA_TYPE_CELL_APP))
@@ -2335,7 +2420,16 @@ void BaseAppMgr::setSharedData( BinaryIStream & data )
 		return;
 	}
 
-	if (sendToBaseApps)
+	if (sendToBaseApps && shouldBatchSharedData_)
+	{
+		// This is sent with the other changes made this tick, unless the
+		// game timer is not running yet.
+		if (!hasStarted_)
+		{
+			this->sendSharedDataUpdates();
+		}
+	}
+	else if (sendToBaseApps)
 	{
 		MemoryOStream payload;
 		payload << dataType << key << value;
@@ -2360,13 +2454,11 @@ void BaseAppMgr::delSharedData( BinaryIStream & data )
 	std::string key;
 	data >> dataType >> key;
 
-	if (dataType == SHARED_DATA_TYPE_BASE_APP)
-	{
-		sharedBaseAppData_.erase( key );
-	}
-	else if (dataType == SHARED_DATA_TYPE_GLOBAL)
+	SharedData * pSharedData = this->findSharedData( dataType );
+
+	if (pSharedData)
 	{
-		sharedGlobalData_.erase( key );
+		this->delSharedDataValue( *pSharedData, key );
 	}
 	else if ((dataType == SHARED_DATA_TYPE_GLOBAL_FROM_BASE_APP) ||
 		(dataType == SHARED_DATA_TYPE_CELL_APP))
@@ -2397,7 +2489,16 @@ void BaseAppMgr::delSharedData( BinaryIStream & data )
 	MemoryOStream payload;
 	payload << dataType << key;
 
-	if (sendToBaseApps)
+	if (sendToBaseApps && shouldBatchSharedData_)
+	{
+		// This is sent with the other changes made this tick, unless the
+		// game timer is not running yet.
+		if (!hasStarted_)
+		{
+			this->sendSharedDataUpdates();
+		}
+	}
+	else if (sendToBaseApps)
 	{
 		this->sendToBaseApps( BaseAppIntInterface::delSharedData, payload );
 		this->sendToBackupBaseApps( BaseAppIntInterface::delSharedData,
@@ -2406,6 +2507,256 @@ void BaseAppMgr::delSharedData( BinaryIStream & data )
 }
 
 
+/**
+ *	This method returns the shared data of the given type that this object
+ *	keeps, or NULL if it does not keep that type.
+ */
+BaseAppMgr::SharedData * BaseAppMgr::findSharedData( SharedDataType dataType )
+{
+	if (dataType == SHARED_DATA_TYPE_BASE_APP)
+	{
+		return &sharedBaseAppData_;
+	}
+	else if (dataType == SHARED_DATA_TYPE_GLOBAL)
+	{
+		return &sharedGlobalData_;
+	}
+
+	return NULL;
+}
+
+
+/**
+ *	This method sets a shared data value, at a new version.
+ */
+void BaseAppMgr::setSharedDataValue( SharedData & sharedData,
+		const std::string & key, const std::string & value )
+{
+	SharedDataValue & entry = sharedData[ key ];
+
+	if (entry.isDeleted)
+	{
+		--numSharedDataDeletions_;
+	}
+
+	entry.value = value;
+	entry.version = ++sharedDataVersion_;
+	entry.isDeleted = false;
+}
+
+
+/**
+ *	This method deletes a shared data value. The entry is kept, at a new
+ *	version, so that the deletion can be sent to BaseApps that catch up later.
+ */
+void BaseAppMgr::delSharedDataValue( SharedData & sharedData,
+		const std::string & key )
+{
+	SharedData::iterator iter = sharedData.find( key );
+
+	if ((iter == sharedData.end()) || iter->second.isDeleted)
+	{
+		return;
+	}
+
+	iter->second.value.clear();
+	iter->second.version = ++sharedDataVersion_;
+	iter->second.isDeleted = true;
+
+	if (++numSharedDataDeletions_ > maxSharedDataDeletions_)
+	{
+		this->pruneSharedDataDeletions();
+	}
+}
+
+
+/**
+ *	This method forgets the older half of the deleted entries. A BaseApp that
+ *	has not seen all of the changes up to the latest one forgotten is sent all
+ *	of the shared data when it catches up.
+ */
+void BaseAppMgr::pruneSharedDataDeletions()
+{
+	std::vector< uint32 > versions;
+	versions.reserve( numSharedDataDeletions_ );
+
+	SharedData * sharedDatas[] = { &sharedBaseAppData_, &sharedGlobalData_ };
+
+	for (int i = 0; i < 2; ++i)
+	{
+		SharedData::iterator iter = sharedDatas[i]->begin();
+
+		while (iter != sharedDatas[i]->end())
+		{
+			if (iter->second.isDeleted)
+			{
+				versions.push_back( iter->second.version );
+			}
+
+			++iter;
+		}
+	}
+
+	if (versions.empty())
+	{
+		numSharedDataDeletions_ = 0;
+		return;
+	}
+
+	std::vector< uint32 >::iterator median =
+		versions.begin() + versions.size() / 2;
+	std::nth_element( versions.begin(), median, versions.end() );
+	const uint32 cutOff = *median;
+
+	for (int i = 0; i < 2; ++i)
+	{
+		SharedData::iterator iter = sharedDatas[i]->begin();
+
+		while (iter != sharedDatas[i]->end())
+		{
+			if (iter->second.isDeleted && (iter->second.version <= cutOff))
+			{
+				sharedDatas[i]->erase( iter++ );
+				--numSharedDataDeletions_;
+			}
+			else
+			{
+				++iter;
+			}
+		}
+	}
+
+	prunedSharedDataVersion_ = std::max( prunedSharedDataVersion_, cutOff );
+}
+
+
+/**
+ *	This method streams the changes to a type of shared data since a version,
+ *	as read by SharedData::readUpdates. If some of those changes have been
+ *	forgotten, or the version is from before this BaseAppMgr was restarted,
+ *	all of the entries are streamed, after a SHARED_DATA_OP_CLEAR. Nothing is
+ *	streamed if there are no changes.
+ */
+void BaseAppMgr::addSharedDataUpdates( BinaryOStream & stream,
+		SharedDataType dataType, uint32 sinceVersion )
+{
+	SharedData * pSharedData = this->findSharedData( dataType );
+	MF_ASSERT( pSharedData );
+
+	const bool isFull = (sinceVersion < prunedSharedDataVersion_) ||
+		(sinceVersion > sharedDataVersion_);
+
+	// A BaseApp with nothing does not need to be told about deletions.
+	const bool isLive = isFull || (sinceVersion == 0);
+
+	uint32 numUpdates = isFull ? 1 : 0;
+
+	SharedData::const_iterator iter = pSharedData->begin();
+
+	while (iter != pSharedData->end())
+	{
+		if (isLive ?
+				!iter->second.isDeleted : (iter->second.version > sinceVersion))
+		{
+			++numUpdates;
+		}
+
+		++iter;
+	}
+
+	if (numUpdates == 0)
+	{
+		return;
+	}
+
+	stream << dataType << numUpdates;
+
+	if (isFull)
+	{
+		stream << SHARED_DATA_OP_CLEAR << sharedDataVersion_;
+	}
+
+	for (iter = pSharedData->begin(); iter != pSharedData->end(); ++iter)
+	{
+		const SharedDataValue & entry = iter->second;
+
+		if (isLive ? entry.isDeleted : (entry.version <= sinceVersion))
+		{
+			continue;
+		}
+
+		if (entry.isDeleted)
+		{
+			stream << SHARED_DATA_OP_DEL << entry.version << iter->first;
+		}
+		else
+		{
+			stream << SHARED_DATA_OP_SET << entry.version << iter->first <<
+				entry.value;
+		}
+	}
+}
+
+
+/**
+ *	This method sends the shared data changes that have not been sent yet to
+ *	all of the BaseApps, as one message. This is called each tick, so that
+ *	a value that is changed many times in a tick is only sent once.
+ */
+void BaseAppMgr::sendSharedDataUpdates()
+{
+	if (!shouldBatchSharedData_ ||
+			(sentSharedDataVersion_ == sharedDataVersion_))
+	{
+		return;
+	}
+
+	MemoryOStream payload;
+	this->addSharedDataUpdates( payload, SHARED_DATA_TYPE_BASE_APP,
+			sentSharedDataVersion_ );
+	this->addSharedDataUpdates( payload, SHARED_DATA_TYPE_GLOBAL,
+			sentSharedDataVersion_ );
+
+	sentSharedDataVersion_ = sharedDataVersion_;
+
+	if (payload.size() > 0)
+	{
+		++numSharedDataBatches_;
+		this->sendToBaseApps( BaseAppIntInterface::updateSharedData, payload );
+		this->sendToBackupBaseApps( BaseAppIntInterface::updateSharedData,
+			payload );
+	}
+}
+
+
+/**
+ *	This method handles a request from a BaseApp for the shared data that has
+ *	changed since the versions that it has. This is used when a BaseApp
+ *	reconnects, instead of sending it all of the shared data again.
+ */
+void BaseAppMgr::requestSharedDataSince(
+		const BaseAppMgrInterface::requestSharedDataSinceArgs & args,
+		const Mercury::Address & addr )
+{
+	Mercury::ChannelOwner * pChannelOwner = this->findChannelOwner( addr );
+
+	if (pChannelOwner == NULL)
+	{
+		WARNING_MSG( "BaseAppMgr::requestSharedDataSince: "
+				"No BaseApp %s\n", (char *)addr );
+		return;
+	}
+
+	Mercury::Bundle & bundle = pChannelOwner->bundle();
+	bundle.startMessage( BaseAppIntInterface::updateSharedData );
+	this->addSharedDataUpdates( bundle, SHARED_DATA_TYPE_BASE_APP,
+			args.baseAppDataVersion );
+	this->addSharedDataUpdates( bundle, SHARED_DATA_TYPE_GLOBAL,
+			args.globalDataVersion );
+	pChannelOwner->send();
+}
+
+
 /**
  *	This class is used to handle the changes to the hash once new hash has been
  *	primed.
@@ -2506,6 +2857,18 @@ void BaseAppMgr::useNewBackupHash( const Mercury::Address & addr,
 }
 
 
+/**
+ *	This method handles a message from a BaseApp acknowledging a broadcast
+ *	that was sent along the tree of BaseApps.
+ */
+void BaseAppMgr::treeBroadcastAck(
+		const BaseAppMgrInterface::treeBroadcastAckArgs & args,
+		const Mercury::Address & addr )
+{
+	treeBroadcaster_.onAck( addr, args.broadcastID );
+}
+
+
 /**
  *	This method responds to a message from the DBMgr that tells us to start.
  */
@@ -2581,6 +2944,9 @@ void BaseAppMgr::startTimer()
 				reinterpret_cast< void * >( TIMEOUT_GAME_TICK ) );
 		pTimeKeeper_ = new TimeKeeper( nub_, gtid, time_, updateHertz_,
 			&cellAppMgr_.addr(), &CellAppMgrInterface::gameTimeReading );
+
+		Watcher::rootWatcher().addChild( "timeKeeper",
+			TimeKeeper::pWatcher(), pTimeKeeper_ );
 	}
 }
 
@@ -2952,6 +3318,21 @@ void BaseAppMgr::resourceVersionControl(
 	// record the step that the updater has decreed
 	if (args.activity >= 1 && args.activity < 256)
 	{
+		uint64 now = timestamp();
+
+		if (args.activity == 1)
+		{
+			updateStartTime_ = now;
+		}
+		else if (updaterStep_ > 0)
+		{
+			DEBUG_MSG( "BaseAppMgr::resourceVersionControl: "
+					"Step %d took %.3fs\n",
+				updaterStep_,
+				double( now - updaterStepTime_ ) / stampsPerSecondD() );
+		}
+
+		updaterStepTime_ = now;
 		coordinatingVersion_ = args.version;
 		updaterStep_ = (int)args.activity;
 	}
@@ -3031,8 +3412,11 @@ void BaseAppMgr::resourceVersionControl(
 		allowNewBaseApps_ = true;
 		updaterStep_ = -1;	// the update is over! yay!
 		this->sendUpdaterStepAck( 9 );
-		DEBUG_MSG( "BaseAppMgr::resourceVersionControl: "
-			"Gone to step 9 and update is complete\n" );
+		lastUpdateDuration_ =
+			double( timestamp() - updateStartTime_ ) / stampsPerSecondD();
+		INFO_MSG( "BaseAppMgr::resourceVersionControl: "
+			"Gone to step 9 and update is complete after %.3fs\n",
+			lastUpdateDuration_ );
 		return;	// don't send this to anyone else
 	default:
 		ERROR_MSG( "BaseAppMgr::resourceVersionControl: "
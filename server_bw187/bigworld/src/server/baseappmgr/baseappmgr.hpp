@@ -17,6 +17,7 @@ criminal penalties as provided by law.
 #include "common/doc_watcher.hpp"
 #include "cstdmf/profile.hpp"
 #include "network/channel.hpp"
+#include "network/tree_broadcast.hpp"
 #include "server/common.hpp"
 
 #include <map>
@@ -27,6 +28,8 @@ class BaseApp;
 class BackupBaseApp;
 class TimeKeeper;
 
+typedef uint8 SharedDataType;
+
 typedef Mercury::ChannelOwner CellAppMgr;
 typedef Mercury::ChannelOwner DBMgr;
 
@@ -83,6 +86,14 @@ public:
 			const Mercury::UnpackedMessageHeader & header,
 			BinaryIStream & data );
 
+	void requestSharedDataSince(
+		const BaseAppMgrInterface::requestSharedDataSinceArgs & args,
+		const Mercury::Address & addr );
+
+	void treeBroadcastAck(
+		const BaseAppMgrInterface::treeBroadcastAckArgs & args,
+		const Mercury::Address & addr );
+
 	BaseApp * findBaseApp( const Mercury::Address & addr );
 	Mercury::ChannelOwner * findChannelOwner( const Mercury::Address & addr );
 
@@ -217,10 +228,46 @@ private:
 		BackupBaseApps;
 	BackupBaseApps backupBaseApps_;
 
-	typedef std::map< std::string, std::string > SharedData;
+	// Sends to the BaseApps along a tree, when baseAppMgr/broadcastFanOut is
+	// set.
+	Mercury::TreeBroadcaster treeBroadcaster_;
+
+	/**
+	 *	This structure is a shared data entry, with the version that it was
+	 *	last changed at. Deleted entries are kept for a while, so that a
+	 *	BaseApp can be sent just the changes since the version it has.
+	 */
+	struct SharedDataValue
+	{
+		SharedDataValue() : version( 0 ), isDeleted( false ) {}
+
+		std::string	value;
+		uint32		version;
+		bool		isDeleted;
+	};
+
+	typedef std::map< std::string, SharedDataValue > SharedData;
 	SharedData sharedBaseAppData_; // Authoritative copy
 	SharedData sharedGlobalData_; // Copy from CellAppMgr
 
+	SharedData * findSharedData( SharedDataType dataType );
+	void setSharedDataValue( SharedData & sharedData, const std::string & key,
+		const std::string & value );
+	void delSharedDataValue( SharedData & sharedData, const std::string & key );
+	void pruneSharedDataDeletions();
+
+	void addSharedDataUpdates( BinaryOStream & stream, SharedDataType dataType,
+		uint32 sinceVersion );
+	void sendSharedDataUpdates();
+
+	uint32			sharedDataVersion_;
+	uint32			sentSharedDataVersion_;
+	uint32			prunedSharedDataVersion_;
+	int				numSharedDataDeletions_;
+	int				maxSharedDataDeletions_;
+	bool			shouldBatchSharedData_;
+	uint32			numSharedDataBatches_;
+
 	BaseAppID 	lastBaseAppID_;	//  last id allocated for a BaseApp
 
 	ProfileGroup				pro_;
@@ -246,6 +293,12 @@ private:
 	int					updaterStep_;
 	bool				allowNewBaseApps_;
 
+	// When the current update and its current step started, and how long
+	// the last update took in seconds.
+	uint64				updateStartTime_;
+	uint64				updaterStepTime_;
+	double				lastUpdateDuration_;
+
 	void sendUpdaterStepAck( int step );
 
 	typedef std::map< std::string, EntityMailBoxRef > GlobalBases;
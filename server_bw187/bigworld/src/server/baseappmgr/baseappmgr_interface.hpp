@@ -174,6 +174,18 @@ BEGIN_MERCURY_INTERFACE( BaseAppMgrInterface )
 
 	MF_RAW_BASE_APP_MGR_MSG( useNewBackupHash )
 
+	// A BaseApp wants the shared data that has changed since the versions
+	// that it has.
+	MF_BEGIN_BASE_APP_MGR_MSG_WITH_ADDR( requestSharedDataSince )
+		uint32 baseAppDataVersion;
+		uint32 globalDataVersion;
+	END_STRUCT_MESSAGE()
+
+	// A BaseApp has received a broadcast sent along the BaseApp tree.
+	MF_BEGIN_BASE_APP_MGR_MSG_WITH_ADDR( treeBroadcastAck )
+		uint32 broadcastID;
+	END_STRUCT_MESSAGE()
+
 	MF_REVIVER_PING_MSG()
 
 END_MERCURY_INTERFACE()
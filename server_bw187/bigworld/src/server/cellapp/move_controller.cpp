@@ -16,6 +16,11 @@ criminal penalties as provided by law.
 #include "real_entity.hpp"
 #include "server/bwconfig.hpp"
 
+#include "cstdmf/timestamp.hpp"
+#include "cstdmf/watcher.hpp"
+
+#include <algorithm>
+
 DECLARE_DEBUG_COMPONENT(0)
 
 /*~ callback Entity.onMove
@@ -52,7 +57,8 @@ DECLARE_DEBUG_COMPONENT(0)
 MoveController::MoveController( float velocity, bool faceMovement,
 		bool moveVertically ):
 	faceMovement_( faceMovement ),
-	moveVertically_( moveVertically )
+	moveVertically_( moveVertically ),
+	batchIndex_( -1 )
 {
 	metresPerTick_ = velocity / CellApp::instance().updateHertz();
 }
@@ -109,6 +115,25 @@ bool MoveController::move( const Position3D& destination )
 }
 
 
+/**
+ *	This method is called every tick, when this controller is not moved by
+ *	the MoveControllerBatch.
+ */
+void MoveController::update()
+{
+	// Keep ourselves alive until we have finished cleaning up,
+	// with an extra reference count from a smart pointer.
+	ControllerPtr pController = this;
+
+	Position3D destination;
+
+	if (this->prepareMove( destination ) && this->move( destination ))
+	{
+		this->onArrived();
+	}
+}
+
+
 void MoveController::writeRealToStream( BinaryOStream& stream )
 {
 	this->Controller::writeRealToStream( stream );
@@ -130,7 +155,15 @@ bool MoveController::readRealFromStream( BinaryIStream& stream )
 void MoveController::startReal( bool /*isInitialStart*/ )
 {
 	MF_ASSERT( entity().isReal() );
-	CellApp::instance().registerForUpdate( this );
+
+	if (MoveControllerBatch::isEnabled())
+	{
+		MoveControllerBatch::instance().add( this );
+	}
+	else
+	{
+		CellApp::instance().registerForUpdate( this );
+	}
 }
 
 
@@ -139,7 +172,14 @@ void MoveController::startReal( bool /*isInitialStart*/ )
  */
 void MoveController::stopReal( bool /*isFinalStop*/ )
 {
-	MF_VERIFY( CellApp::instance().deregisterForUpdate( this ) );
+	if (MoveControllerBatch::isEnabled())
+	{
+		MoveControllerBatch::instance().remove( this );
+	}
+	else
+	{
+		MF_VERIFY( CellApp::instance().deregisterForUpdate( this ) );
+	}
 }
 
 
@@ -200,22 +240,29 @@ bool MoveToPointController::readRealFromStream( BinaryIStream& stream )
 
 
 /**
- *	This method is called every tick.
+ *	This method overrides the MoveController method.
  */
-void MoveToPointController::update()
+bool MoveToPointController::prepareMove( Position3D & destination )
 {
-	if (this->move(destination_))
-	{
-		// Keep ourselves alive until we have finished cleaning up,
-		// with an extra reference count from a smart pointer.
-		ControllerPtr pController = this;
+	destination = destination_;
+	return true;
+}
 
-		START_PROFILE( ON_MOVE );
-		this->standardCallback("onMove");
-		STOP_PROFILE( ON_MOVE );
 
-		if (this->isAttached()) this->cancel();
-	}
+/**
+ *	This method overrides the MoveController method.
+ */
+void MoveToPointController::onArrived()
+{
+	// Keep ourselves alive until we have finished cleaning up,
+	// with an extra reference count from a smart pointer.
+	ControllerPtr pController = this;
+
+	START_PROFILE( ON_MOVE );
+	this->standardCallback("onMove");
+	STOP_PROFILE( ON_MOVE );
+
+	if (this->isAttached()) this->cancel();
 }
 
 
@@ -297,9 +344,10 @@ void MoveToEntityController::recalcOffset()
 
 
 /**
- *	This method is called every tick.
+ *	This method overrides the MoveController method. It finishes the move
+ *	itself if the destination entity has gone or is already close enough.
  */
-void MoveToEntityController::update()
+bool MoveToEntityController::prepareMove( Position3D & destination )
 {
 	// Resolve the entity ID to an entity pointer.
 
@@ -319,10 +367,10 @@ void MoveToEntityController::update()
 		ControllerPtr pController = this;
 		this->standardCallback("onMoveFailure");
 		if (this->isAttached()) this->cancel();
-		return;
+		return false;
 	}
 
-	Position3D destination = this->pDestEntity_->position();
+	destination = this->pDestEntity_->position();
 	Vector3 remaining = destination - this->entity().position();
 	remaining.y = 0.f;
 
@@ -340,32 +388,390 @@ void MoveToEntityController::update()
 	}
 	*/
 
+	if (closeEnough)
+	{
+		// Keep ourselves alive until we have finished cleaning up,
+		// with an extra reference count from a smart pointer.
+		ControllerPtr pController = this;
+
+		// In case we were moving towards a point near the entity,
+		// make sure that we are now facing it exactly.
+
+		const Position3D & position = this->entity().position();
+		Vector3 vector = destination - position;
+
+		Direction3D direction = this->entity().direction();
+		direction.yaw = vector.yaw();
+		this->entity().setPositionAndDirection( position, direction );
+
+		this->onArrived();
+		return false;
+	}
+
+	destination += offset_;
+	return true;
+}
+
+
+/**
+ *	This method overrides the MoveController method.
+ */
+void MoveToEntityController::onArrived()
+{
 	// Keep ourselves alive until we have finished cleaning up,
 	// with an extra reference count from a smart pointer.
 	ControllerPtr pController = this;
 
-	if (closeEnough || this->move(destination + offset_))
+	if (this->isAttached())
+	{
+		this->standardCallback("onMove");
+		if (this->isAttached()) this->cancel();
+	}
+}
+
+
+// -----------------------------------------------------------------------------
+// Section: MoveControllerBatch
+// -----------------------------------------------------------------------------
+
+/**
+ *	Constructor.
+ */
+MoveControllerBatch::MoveControllerBatch() :
+	isRegistered_( false ),
+	isInPass_( false ),
+	numMovers_( 0 ),
+	lastPassMovers_( 0 ),
+	lastPassArrivals_( 0 ),
+	lastPassTime_( 0.0 ),
+	moversPerMs_( 0.0 )
+{
+	MF_WATCH( "movement/movers", numMovers_, Watcher::WT_READ_ONLY,
+		"The number of move controllers in the batch" );
+	MF_WATCH( "movement/lastPassMovers", lastPassMovers_,
+		Watcher::WT_READ_ONLY,
+		"The number of entities moved in the last pass" );
+	MF_WATCH( "movement/lastPassArrivals", lastPassArrivals_,
+		Watcher::WT_READ_ONLY,
+		"The number of entities that arrived in the last pass" );
+	MF_WATCH( "movement/lastPassTime", lastPassTime_, Watcher::WT_READ_ONLY,
+		"Milliseconds spent moving entities in the last pass, "
+			"not counting callbacks" );
+	MF_WATCH( "movement/moversPerMs", moversPerMs_, Watcher::WT_READ_ONLY,
+		"Entities moved per millisecond in the last pass" );
+}
+
+
+/**
+ *	This static method returns whether move controllers are moved by the
+ *	batch, rather than each being updated on its own.
+ */
+bool MoveControllerBatch::isEnabled()
+{
+	static bool s_isEnabled =
+		BWConfig::get( "cellApp/batchMovement", true );
+
+	return s_isEnabled;
+}
+
+
+/**
+ *	This static method returns the singleton instance of this class.
+ */
+MoveControllerBatch & MoveControllerBatch::instance()
+{
+	static MoveControllerBatch s_instance;
+	return s_instance;
+}
+
+
+/**
+ *	This method adds a controller to the batch. The batch registers for
+ *	updates with the first controller.
+ */
+void MoveControllerBatch::add( MoveController * pController )
+{
+	MF_ASSERT( pController->batchIndex_ == -1 );
+
+	pController->batchIndex_ = int( controllers_.size() );
+	controllers_.push_back( pController );
+	++numMovers_;
+
+	if (!isRegistered_)
+	{
+		CellApp::instance().registerForUpdate( this );
+		isRegistered_ = true;
+	}
+}
+
+
+/**
+ *	This method removes a controller from the batch. During a pass, its entry
+ *	is only cleared, and the entries are compacted once the pass is over.
+ */
+void MoveControllerBatch::remove( MoveController * pController )
+{
+	int index = pController->batchIndex_;
+
+	if (index == -1)
+	{
+		return;
+	}
+
+	MF_ASSERT( controllers_[ index ].get() == pController );
+
+	pController->batchIndex_ = -1;
+	--numMovers_;
+
+	if (isInPass_)
+	{
+		controllers_[ index ] = NULL;
+	}
+	else
 	{
-		if (closeEnough)
+		MoveControllerPtr pLast = controllers_.back();
+		controllers_.pop_back();
+
+		if (pLast.get() != pController)
 		{
-			// In case we were moving towards a point near the entity,
-			// make sure that we are now facing it exactly.
+			controllers_[ index ] = pLast;
+			pLast->batchIndex_ = index;
+		}
+	}
+}
+
+
+/**
+ *	This method is called every tick. It moves all of the controllers in the
+ *	batch, and then calls back the ones that have arrived. Controllers that
+ *	are added during the pass are first moved on the next tick.
+ */
+void MoveControllerBatch::update()
+{
+	uint64 startTime = timestamp();
+
+	isInPass_ = true;
+
+	const size_t size = controllers_.size();
+
+	this->gather( size );
+	this->advance( size );
+	this->scatter( size );
+
+	isInPass_ = false;
+
+	this->compact();
+
+	lastPassTime_ = double( timestamp() - startTime ) * 1000.0 /
+		stampsPerSecondD();
+	moversPerMs_ = (lastPassTime_ > 0.0) ?
+		lastPassMovers_ / lastPassTime_ : 0.0;
+	lastPassArrivals_ = arrivals_.size();
+
+	START_PROFILE( ON_MOVE );
+
+	for (Controllers::iterator iter = arrivals_.begin();
+			iter != arrivals_.end(); ++iter)
+	{
+		if ((*iter)->isAttached())
+		{
+			(*iter)->onArrived();
+		}
+	}
+
+	STOP_PROFILE( ON_MOVE );
+
+	arrivals_.clear();
+}
+
+
+/**
+ *	This method reads the positions and destinations of the controllers into
+ *	the arrays. Controllers that do not move this tick are left inactive.
+ */
+void MoveControllerBatch::gather( size_t size )
+{
+	if (flags_.size() < size)
+	{
+		posX_.resize( size ); posY_.resize( size ); posZ_.resize( size );
+		destX_.resize( size ); destY_.resize( size ); destZ_.resize( size );
+		newX_.resize( size ); newY_.resize( size ); newZ_.resize( size );
+		metresPerTick_.resize( size );
+		yaw_.resize( size );
+		flags_.resize( size );
+	}
+
+	lastPassMovers_ = 0;
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		flags_[i] = 0;
+		posX_[i] = posY_[i] = posZ_[i] = 0.f;
+		destX_[i] = destY_[i] = destZ_[i] = 0.f;
+		metresPerTick_[i] = 0.f;
 
-			const Position3D & position = this->entity().position();
-			Vector3 vector = destination - position;
+		// Holds the controller in case prepareMove cancels it.
+		MoveControllerPtr pController = controllers_[i];
 
-			Direction3D direction = this->entity().direction();
-			direction.yaw = vector.yaw();
-			this->entity().setPositionAndDirection( position, direction );
+		if (!pController)
+		{
+			continue;
 		}
 
-		if (this->isAttached())
+		Position3D destination;
+
+		if (!pController->prepareMove( destination ) ||
+				!pController->isAttached())
 		{
-			this->standardCallback("onMove");
-			if (this->isAttached()) this->cancel();
+			continue;
 		}
+
+		const Position3D & position = pController->entity().position();
+
+		posX_[i] = position.x;
+		posY_[i] = position.y;
+		posZ_[i] = position.z;
+		destX_[i] = destination.x;
+		destY_[i] = destination.y;
+		destZ_[i] = destination.z;
+		metresPerTick_[i] = pController->metresPerTick_;
+
+		flags_[i] = FLAG_ACTIVE |
+			(pController->faceMovement_ ? FLAG_FACE_MOVEMENT : 0) |
+			(pController->moveVertically_ ? FLAG_MOVE_VERTICALLY : 0);
+
+		++lastPassMovers_;
+	}
+}
+
+
+/**
+ *	This method works out the new positions of all of the movers. It does the
+ *	same as MoveController::move, but only on the arrays.
+ */
+void MoveControllerBatch::advance( size_t size )
+{
+	for (size_t i = 0; i < size; ++i)
+	{
+		const uint8 flags = flags_[i];
+		const bool moveVertically = (flags & FLAG_MOVE_VERTICALLY) != 0;
+
+		const float dx = destX_[i] - posX_[i];
+		const float dy = moveVertically ? destY_[i] - posY_[i] : 0.f;
+		const float dz = destZ_[i] - posZ_[i];
+		const float length = sqrtf( dx*dx + dy*dy + dz*dz );
+
+		if (length < metresPerTick_[i] || length == 0.f)
+		{
+			newX_[i] = destX_[i];
+			newY_[i] = destY_[i];
+			newZ_[i] = destZ_[i];
+		}
+		else
+		{
+			const float scale = metresPerTick_[i] / length;
+			newX_[i] = posX_[i] + dx * scale;
+			newY_[i] = posY_[i] + dy * scale;
+			newZ_[i] = posZ_[i] + dz * scale;
+		}
+
+		uint8 newFlags = flags;
+
+		if ((flags & FLAG_FACE_MOVEMENT) && (dx != 0.f || dz != 0.f))
+		{
+			yaw_[i] = atan2f( dx, dz );
+			newFlags |= FLAG_TURNED;
+		}
+
+		if (newX_[i] == destX_[i] && newZ_[i] == destZ_[i] &&
+				(newY_[i] == destY_[i] || !moveVertically))
+		{
+			newFlags |= FLAG_ARRIVED;
+		}
+
+		flags_[i] = newFlags;
+	}
+}
+
+
+/**
+ *	This method writes the new positions back to the entities, and collects
+ *	the controllers that have arrived.
+ */
+void MoveControllerBatch::scatter( size_t size )
+{
+	for (size_t i = 0; i < size; ++i)
+	{
+		if (!(flags_[i] & FLAG_ACTIVE))
+		{
+			continue;
+		}
+
+		// Holds the controller in case a callback from moving the entity, such
+		// as a trap being triggered, cancels it.
+		MoveControllerPtr pController = controllers_[i];
+
+		if (!pController || !pController->isAttached())
+		{
+			continue;
+		}
+
+		Entity & entity = pController->entity();
+		const Position3D & position = entity.position();
+		bool hasArrived;
+
+		if (position.x != posX_[i] ||
+				position.y != posY_[i] ||
+				position.z != posZ_[i])
+		{
+			// The entity was moved by a callback from moving another entity
+			// in this pass, so the new position is worked out again.
+			hasArrived = pController->move(
+				Position3D( destX_[i], destY_[i], destZ_[i] ) );
+		}
+		else
+		{
+			Direction3D direction = entity.direction();
+
+			if (flags_[i] & FLAG_TURNED)
+			{
+				direction.yaw = yaw_[i];
+			}
+
+			entity.isOnGround( false );
+			entity.setPositionAndDirection(
+				Position3D( newX_[i], newY_[i], newZ_[i] ), direction );
+
+			hasArrived = pController->isAttached() &&
+				(flags_[i] & FLAG_ARRIVED);
+		}
+
+		if (hasArrived)
+		{
+			arrivals_.push_back( pController );
+		}
+	}
+}
+
+
+/**
+ *	This method removes the cleared entries, and renumbers the rest.
+ */
+void MoveControllerBatch::compact()
+{
+	if (controllers_.size() == numMovers_)
+	{
 		return;
 	}
+
+	Controllers::iterator newEnd = std::remove( controllers_.begin(),
+		controllers_.end(), MoveControllerPtr() );
+	controllers_.erase( newEnd, controllers_.end() );
+
+	for (size_t i = 0; i < controllers_.size(); ++i)
+	{
+		controllers_[i]->batchIndex_ = int( i );
+	}
 }
 
 // move_controller.cpp
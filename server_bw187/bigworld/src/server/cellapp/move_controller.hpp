@@ -16,6 +16,8 @@ criminal penalties as provided by law.
 #include "network/basictypes.hpp"
 #include "updatable.hpp"
 
+#include <vector>
+
 typedef SmartPointer<Entity> EntityPtr;
 
 /**
@@ -36,17 +38,38 @@ public:
 
 	void				writeRealToStream( BinaryOStream& stream );
 	bool 				readRealFromStream( BinaryIStream& stream );
+	void				update();
 
 protected:
 	bool faceMovement() const				{ return faceMovement_; }
 	bool moveVertically() const				{ return moveVertically_; }
 
+	/**
+	 *	This method is called each tick, before this controller is moved. It
+	 *	sets the position to move towards, or returns false if the controller
+	 *	should not be moved this tick, for example because it has already
+	 *	finished.
+	 */
+	virtual bool		prepareMove( Position3D & destination ) = 0;
+
+	/**
+	 *	This method is called once the entity has reached the destination.
+	 */
+	virtual void		onArrived() = 0;
+
 private:
+	friend class MoveControllerBatch;
+
 	float				metresPerTick_;
 	bool faceMovement_;
 	bool moveVertically_;
+
+	// The index of this controller in the MoveControllerBatch, or -1.
+	int					batchIndex_;
 };
 
+typedef SmartPointer< MoveController > MoveControllerPtr;
+
 
 
 /**
@@ -67,7 +90,10 @@ public:
 
 	void				writeRealToStream( BinaryOStream& stream );
 	bool 				readRealFromStream( BinaryIStream& stream );
-	void				update();
+
+protected:
+	virtual bool		prepareMove( Position3D & destination );
+	virtual void		onArrived();
 
 private:
 	Position3D			destination_;
@@ -94,7 +120,10 @@ public:
 	virtual void		stopReal( bool isFinalStop );
 	void				writeRealToStream( BinaryOStream& stream );
 	bool 				readRealFromStream( BinaryIStream& stream );
-	void				update();
+
+protected:
+	virtual bool		prepareMove( Position3D & destination );
+	virtual void		onArrived();
 
 private:
 
@@ -106,4 +135,67 @@ private:
 	float				range_;
 };
 
+
+/**
+ *	This class moves all of the MoveControllers on this CellApp in a single
+ *	pass each tick, instead of each of them being updated on its own.
+ *
+ *	The positions, destinations and speeds of the movers are gathered into
+ *	parallel arrays, the new positions are worked out in one tight loop over
+ *	those arrays, and then written back to the entities. Only the movers that
+ *	have arrived are called back afterwards.
+ *
+ *	This is turned off by setting cellApp/batchMovement to false in bw.xml,
+ *	in which case each controller registers for updates itself.
+ */
+class MoveControllerBatch : public Updatable
+{
+public:
+	MoveControllerBatch();
+
+	void add( MoveController * pController );
+	void remove( MoveController * pController );
+
+	virtual void update();
+
+	static bool isEnabled();
+	static MoveControllerBatch & instance();
+
+private:
+	void gather( size_t size );
+	void advance( size_t size );
+	void scatter( size_t size );
+	void compact();
+
+	enum
+	{
+		FLAG_ACTIVE = 0x1,
+		FLAG_FACE_MOVEMENT = 0x2,
+		FLAG_MOVE_VERTICALLY = 0x4,
+		FLAG_TURNED = 0x8,
+		FLAG_ARRIVED = 0x10
+	};
+
+	typedef std::vector< MoveControllerPtr > Controllers;
+	Controllers			controllers_;
+	Controllers			arrivals_;
+
+	typedef std::vector< float > Floats;
+	Floats				posX_, posY_, posZ_;
+	Floats				destX_, destY_, destZ_;
+	Floats				newX_, newY_, newZ_;
+	Floats				metresPerTick_;
+	Floats				yaw_;
+	std::vector< uint8 > flags_;
+
+	bool				isRegistered_;
+	bool				isInPass_;
+
+	uint32				numMovers_;
+	uint32				lastPassMovers_;
+	uint32				lastPassArrivals_;
+	double				lastPassTime_;
+	double				moversPerMs_;
+};
+
 #endif // MOVE_CONTROLLER_HPP
@@ -0,0 +1,352 @@
+#include "distanceDetecter.hpp"
+#include "cellapp/cellapp.hpp"
+#include "cellapp/entity.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+DECLARE_DEBUG_COMPONENT(0)
+
+
+// -----------------------------------------------------------------------------
+// Section: DistanceTrigger
+// -----------------------------------------------------------------------------
+
+/**
+ *	Constructor.
+ */
+DistanceTrigger::DistanceTrigger( DistanceController & controller,
+		float range ) :
+	RangeTrigger( controller.entity().pRangeListNode(), range ),
+	controller_( controller )
+{
+}
+
+
+/**
+ *	This method is called when a node crosses into the trigger.
+ */
+void DistanceTrigger::triggerEnter( RangeListNode * who )
+{
+	if (who->isEntity() && who != pSubject_)
+	{
+		controller_.onTriggerEnter( *EntityRangeListNode::getEntity( who ) );
+	}
+}
+
+
+/**
+ *	This method is called when a node crosses out of the trigger.
+ */
+void DistanceTrigger::triggerLeave( RangeListNode * who )
+{
+	if (who->isEntity() && who != pSubject_)
+	{
+		controller_.onTriggerLeave( *EntityRangeListNode::getEntity( who ) );
+	}
+}
+
+
+// -----------------------------------------------------------------------------
+// Section: DistanceController
+// -----------------------------------------------------------------------------
+
+IMPLEMENT_CONTROLLER_TYPE( DistanceController, DOMAIN_REAL )
+
+/**
+ *	Constructor.
+ *
+ *	@param range	The range in metres.
+ *	@param targets	The ids of the entities to watch.
+ */
+DistanceController::DistanceController( float range,
+		const Targets & targets ) :
+	range_( range ),
+	targets_( targets ),
+	pTrigger_( NULL )
+{
+	std::sort( targets_.begin(), targets_.end() );
+	targets_.erase( std::unique( targets_.begin(), targets_.end() ),
+		targets_.end() );
+}
+
+
+/**
+ *	Destructor.
+ */
+DistanceController::~DistanceController()
+{
+	MF_ASSERT( pTrigger_ == NULL );
+}
+
+
+/**
+ *	This method overrides the Controller method. Inserting the trigger calls
+ *	back the targets that are already in range.
+ *
+ *	When the entity arrives from another cell, the targets that were in range
+ *	there are not called back again, and the ones that are no longer in range
+ *	are called back as having left.
+ */
+void DistanceController::startReal( bool isInitialStart )
+{
+	MF_ASSERT( entity().isReal() );
+	MF_ASSERT( pTrigger_ == NULL );
+
+	// Keep ourselves alive in case a callback cancels us.
+	ControllerPtr pController = this;
+
+	pTrigger_ = new DistanceTrigger( *this, range_ );
+	pTrigger_->insert();
+	this->entity().addTrigger( pTrigger_ );
+
+	if (!isInitialStart && this->isAttached())
+	{
+		this->checkInside();
+	}
+}
+
+
+/**
+ *	This method overrides the Controller method. The targets in range are not
+ *	called back.
+ */
+void DistanceController::stopReal( bool /*isFinalStop*/ )
+{
+	if (pTrigger_ == NULL)
+	{
+		return;
+	}
+
+	this->entity().delTrigger( pTrigger_ );
+	pTrigger_->removeWithoutContracting();
+
+	delete pTrigger_;
+	pTrigger_ = NULL;
+}
+
+
+void DistanceController::writeRealToStream( BinaryOStream& stream )
+{
+	this->Controller::writeRealToStream( stream );
+	stream << range_ << targets_ << inside_;
+}
+
+
+bool DistanceController::readRealFromStream( BinaryIStream& stream )
+{
+	bool result = this->Controller::readRealFromStream( stream );
+	stream >> range_ >> targets_ >> inside_;
+
+	return result;
+}
+
+
+/**
+ *	This method replaces the entities that this controller watches. The new
+ *	targets that are already in range are called back as having entered. The
+ *	old targets are dropped without being called back.
+ */
+void DistanceController::setTargets( const Targets & targets )
+{
+	Targets newTargets( targets );
+	std::sort( newTargets.begin(), newTargets.end() );
+	newTargets.erase( std::unique( newTargets.begin(), newTargets.end() ),
+		newTargets.end() );
+
+	Targets added;
+	std::set_difference( newTargets.begin(), newTargets.end(),
+		targets_.begin(), targets_.end(), std::back_inserter( added ) );
+
+	Targets stillInside;
+	std::set_intersection( inside_.begin(), inside_.end(),
+		newTargets.begin(), newTargets.end(),
+		std::back_inserter( stillInside ) );
+
+	targets_.swap( newTargets );
+	inside_.swap( stillInside );
+
+	if (pTrigger_ == NULL)
+	{
+		return;
+	}
+
+	// Keep ourselves alive in case a callback cancels us.
+	ControllerPtr pController = this;
+
+	for (Targets::iterator iter = added.begin();
+			iter != added.end() && this->isAttached(); ++iter)
+	{
+		if (this->isInRange( *iter ) &&
+				!std::binary_search( inside_.begin(), inside_.end(), *iter ))
+		{
+			inside_.insert( std::lower_bound( inside_.begin(), inside_.end(),
+				*iter ), *iter );
+			this->onEnter( *iter );
+		}
+	}
+}
+
+
+/**
+ *	This method sets the range. It is used by derived controllers that read
+ *	their own stream format, and so can only be called while the controller
+ *	is not started.
+ */
+void DistanceController::setRange( float range )
+{
+	MF_ASSERT( pTrigger_ == NULL );
+	range_ = range;
+}
+
+
+/**
+ *	This method is called by the trigger when an entity comes within range.
+ */
+void DistanceController::onTriggerEnter( Entity & entity )
+{
+	ObjectID id = entity.id();
+
+	if (!std::binary_search( targets_.begin(), targets_.end(), id ))
+	{
+		return;
+	}
+
+	Targets::iterator iter =
+		std::lower_bound( inside_.begin(), inside_.end(), id );
+
+	if (iter != inside_.end() && *iter == id)
+	{
+		// This target was already in range on the previous cell.
+		return;
+	}
+
+	inside_.insert( iter, id );
+	this->onEnter( id );
+}
+
+
+/**
+ *	This method is called by the trigger when an entity goes out of range.
+ */
+void DistanceController::onTriggerLeave( Entity & entity )
+{
+	ObjectID id = entity.id();
+
+	Targets::iterator iter =
+		std::lower_bound( inside_.begin(), inside_.end(), id );
+
+	if (iter == inside_.end() || *iter != id)
+	{
+		return;
+	}
+
+	inside_.erase( iter );
+	this->onLeave( id );
+}
+
+
+/**
+ *	This method calls back the targets that were in range, but are not once
+ *	the trigger has been inserted on this cell.
+ */
+void DistanceController::checkInside()
+{
+	Targets wasInside( inside_ );
+
+	for (Targets::iterator iter = wasInside.begin();
+			iter != wasInside.end() && this->isAttached(); ++iter)
+	{
+		Targets::iterator insideIter =
+			std::lower_bound( inside_.begin(), inside_.end(), *iter );
+
+		if (insideIter != inside_.end() && *insideIter == *iter &&
+				!this->isInRange( *iter ))
+		{
+			inside_.erase( insideIter );
+			this->onLeave( *iter );
+		}
+	}
+}
+
+
+/**
+ *	This method returns whether the given entity is within the trigger. It
+ *	looks the entity up, so it is only used when the targets change or the
+ *	entity arrives from another cell.
+ */
+bool DistanceController::isInRange( ObjectID entityID ) const
+{
+	Entity * pEntity = CellApp::instance().findEntity( entityID );
+
+	return pEntity != NULL && !pEntity->isDestroyed() &&
+		pTrigger_->contains( pEntity->pRangeListNode() );
+}
+
+
+/**
+ *	This method is called when a target comes within range.
+ */
+void DistanceController::onEnter( ObjectID entityID )
+{
+	this->callback( "onEntityEnterRange", entityID );
+}
+
+
+/**
+ *	This method is called when a target goes out of range.
+ */
+void DistanceController::onLeave( ObjectID entityID )
+{
+	this->callback( "onEntityLeaveRange", entityID );
+}
+
+
+/**
+ *	This method calls the given script method of the entity with the id of
+ *	this controller, the id of the target and the user argument.
+ */
+void DistanceController::callback( const char * methodName,
+		ObjectID entityID )
+{
+	// Keep ourselves alive in case the script cancels us.
+	ControllerPtr pController = this;
+
+	Script::call(
+		PyObject_GetAttrString( (PyObject *)&this->entity(),
+			const_cast< char * >( methodName ) ),
+		Py_BuildValue( "(iii)", this->id(), entityID, this->userArg() ),
+		methodName, /*okIfFunctionNull:*/true );
+}
+
+
+/**
+ *	This static method reads a sequence of entity ids from script.
+ *
+ *	@return	False, with the Python error set, if they could not be read.
+ */
+bool DistanceController::readTargets( PyObject * pSequence,
+		Targets & targets )
+{
+	PyObject * pSeq = PySequence_Fast( pSequence,
+		"entity ids must be a sequence" );
+
+	if (pSeq == NULL)
+	{
+		return false;
+	}
+
+	targets.reserve( PySequence_Fast_GET_SIZE( pSeq ) );
+
+	for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE( pSeq ); ++i)
+	{
+		targets.push_back(
+			ObjectID( PyInt_AsLong( PySequence_Fast_GET_ITEM( pSeq, i ) ) ) );
+	}
+
+	Py_DECREF( pSeq );
+
+	return !PyErr_Occurred();
+}
+
+// distanceDetecter.cpp
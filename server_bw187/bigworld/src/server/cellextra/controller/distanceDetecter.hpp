@@ -0,0 +1,85 @@
+#ifndef CSOL_CELL_CONTROLLER_DISTANCE_DETECTER
+#define CSOL_CELL_CONTROLLER_DISTANCE_DETECTER
+
+#include "cellapp/controller.hpp"
+#include "cellapp/range_list_node.hpp"
+
+#include <vector>
+
+class DistanceController;
+
+
+/**
+ *	This class is the range trigger of a DistanceController. It is placed
+ *	around the controller's entity in the cell's range list, like a trap, and
+ *	passes the entities that cross it on to the controller.
+ */
+class DistanceTrigger : public RangeTrigger
+{
+public:
+	DistanceTrigger( DistanceController & controller, float range );
+
+	virtual void triggerEnter( RangeListNode * who );
+	virtual void triggerLeave( RangeListNode * who );
+
+private:
+	DistanceController & controller_;
+};
+
+
+/**
+ *	This controller tells its entity when any of a set of other entities, such
+ *	as its pets, escorts or party members, comes within or goes beyond a given
+ *	range of it. Like a trap, the range is a square around the entity in the
+ *	x/z plane.
+ *
+ *	The controller is driven by the cell's range triggers, so nothing is done
+ *	while the entities stay on the same side of the range. The entities that
+ *	cross the trigger are matched against the sorted target ids, and no
+ *	entity is looked up by id. A target that is not on this cell is simply
+ *	not in range.
+ *
+ *	The script is called back with onEntityEnterRange and onEntityLeaveRange.
+ */
+class DistanceController : public Controller
+{
+	DECLARE_CONTROLLER_TYPE( DistanceController )
+
+public:
+	typedef std::vector< ObjectID > Targets;
+
+	DistanceController( float range = 0.f,
+		const Targets & targets = Targets() );
+	virtual ~DistanceController();
+
+	virtual void	startReal( bool isInitialStart );
+	virtual void	stopReal( bool isFinalStop );
+
+	void	writeRealToStream( BinaryOStream& stream );
+	bool	readRealFromStream( BinaryIStream& stream );
+
+	void	setTargets( const Targets & targets );
+
+	void	onTriggerEnter( Entity & entity );
+	void	onTriggerLeave( Entity & entity );
+
+	static bool readTargets( PyObject * pSequence, Targets & targets );
+
+protected:
+	virtual void	onEnter( ObjectID entityID );
+	virtual void	onLeave( ObjectID entityID );
+
+	void	setRange( float range );
+
+private:
+	void	callback( const char * methodName, ObjectID entityID );
+	void	checkInside();
+	bool	isInRange( ObjectID entityID ) const;
+
+	float				range_;
+	Targets				targets_;	///< Sorted
+	Targets				inside_;	///< Sorted. The targets within the range.
+	DistanceTrigger *	pTrigger_;
+};
+
+#endif // CSOL_CELL_CONTROLLER_DISTANCE_DETECTER
@@ -2,69 +2,157 @@
 #include "cellapp/cellapp.hpp"
 #include "cellapp/entity.hpp"
 
+#include <float.h>
+
 DECLARE_DEBUG_COMPONENT(0)
 
 
 IMPLEMENT_EXCLUSIVE_CONTROLLER_TYPE(
 		PetDistanceController, DOMAIN_REAL, "Movement" )
 
-PetDistanceController::PetDistanceController( int32 petID, int32 distance ):
-	petID_( petID ), range_( distance )
+PetDistanceController::PetDistanceController( int32 petID, int32 distance ) :
+	DistanceController( float( distance ), Targets( 1, petID ) ),
+	petID_( petID ),
+	range_( distance ),
+	isInRange_( false ),
+	isRegistered_( false )
 {}
 
 
-void PetDistanceController::update()
+/**
+ *	This method overrides the Controller method.
+ *
+ *	When the entity arrives from another cell, whether the pet is in range is
+ *	not streamed, so it is taken from where the pet is now, without calling
+ *	the script.
+ */
+void PetDistanceController::startReal( bool isInitialStart )
 {
-	Entity *ptrPet = CellApp::pInstance()->findEntity( petID_ );
-	float dis = ( entity().position() - ptrPet->position() ).length();
-
-	if( oldDistance_ > range_ )
-	{
-		if( dis < range_ )
-		{
-			this->standardCallback("onPetEnterRange");
-		}
-	}
-	else
+	if (!isInitialStart)
 	{
-		if( dis > range_ )
-		{
-			this->standardCallback("onPetLeaveRange");
-		}
+		isInRange_ = (this->petDistance() < range_);
 	}
-	oldDistance_ = dis;
+
+	this->DistanceController::startReal( isInitialStart );
 }
 
+
 /**
  *	This method overrides the Controller method.
  */
-void PetDistanceController::startReal( bool /*isInitialStart*/ )
+void PetDistanceController::stopReal( bool isFinalStop )
 {
-	MF_ASSERT( entity().isReal() );
-	CellApp::instance().registerForUpdate( this );
+	if (isRegistered_)
+	{
+		MF_VERIFY( CellApp::instance().deregisterForUpdate( this ) );
+		isRegistered_ = false;
+	}
+
+	this->DistanceController::stopReal( isFinalStop );
 }
 
 
 /**
- *	This method overrides the Controller method.
+ *	This method writes the controller in the format it has always had, so
+ *	that CellApps from before it used a range trigger can read it.
  */
-void PetDistanceController::stopReal( bool /*isFinalStop*/ )
-{
-	MF_VERIFY( CellApp::instance().deregisterForUpdate( this ) );
-}
-
 void PetDistanceController::writeRealToStream( BinaryOStream& stream )
 {
 	this->Controller::writeRealToStream( stream );
 	stream << petID_ << range_;
 }
 
+
+/**
+ *	This method reads the controller as written by writeRealToStream, or by a
+ *	CellApp from before it used a range trigger.
+ */
 bool PetDistanceController::readRealFromStream( BinaryIStream& stream )
 {
 	bool result = this->Controller::readRealFromStream( stream );
 	stream >> petID_ >> range_;
 
+	this->setRange( float( range_ ) );
+	this->setTargets( Targets( 1, petID_ ) );
+
 	return result;
 }
 
 
+/**
+ *	This method is called each tick while the pet is within the trigger. It
+ *	calls the script when the pet crosses the range.
+ */
+void PetDistanceController::update()
+{
+	// Keep ourselves alive in case the script cancels us.
+	ControllerPtr pController = this;
+
+	float distance = this->petDistance();
+
+	if (!isInRange_ && distance < range_)
+	{
+		isInRange_ = true;
+		this->standardCallback( "onPetEnterRange" );
+	}
+	else if (isInRange_ && distance > range_)
+	{
+		isInRange_ = false;
+		this->standardCallback( "onPetLeaveRange" );
+	}
+}
+
+
+/**
+ *	This method overrides the DistanceController method. The pet is near, so
+ *	its distance is polled until it leaves the trigger.
+ */
+void PetDistanceController::onEnter( ObjectID /*entityID*/ )
+{
+	if (!isRegistered_)
+	{
+		CellApp::instance().registerForUpdate( this );
+		isRegistered_ = true;
+	}
+
+	this->update();
+}
+
+
+/**
+ *	This method overrides the DistanceController method. The pet is beyond
+ *	the square that holds the range, so it cannot be in range.
+ */
+void PetDistanceController::onLeave( ObjectID /*entityID*/ )
+{
+	if (isRegistered_)
+	{
+		MF_VERIFY( CellApp::instance().deregisterForUpdate( this ) );
+		isRegistered_ = false;
+	}
+
+	if (isInRange_)
+	{
+		isInRange_ = false;
+		this->standardCallback( "onPetLeaveRange" );
+	}
+}
+
+
+/**
+ *	This method returns the 3D distance to the pet, or FLT_MAX if it is not
+ *	on this cell.
+ */
+float PetDistanceController::petDistance()
+{
+	Entity * pPet = CellApp::instance().findEntity( petID_ );
+
+	if (pPet == NULL || pPet->isDestroyed())
+	{
+		return FLT_MAX;
+	}
+
+	return (this->entity().position() - pPet->position()).length();
+}
+
+// petRangeDetecter.cpp
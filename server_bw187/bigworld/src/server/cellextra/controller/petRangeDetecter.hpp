@@ -1,21 +1,30 @@
-/*
-** ÿһtickrolepetľ룬뿪ָʱصű
-*/
-
 #ifndef CSOL_CELL_CONTROLLER_PET_DETECTER
 #define CSOL_CELL_CONTROLLER_PET_DETECTER
 
-
-
-#include "cellapp/controller.hpp"
+#include "distanceDetecter.hpp"
 #include "cellapp/updatable.hpp"
 
-typedef SmartPointer<Entity> EntityPtr;
 
-
-class PetDistanceController : public Controller, public Updatable
+/**
+ *	This controller tells its entity when its pet comes within or goes beyond
+ *	a given distance of it, with onPetEnterRange and onPetLeaveRange. The
+ *	distance is measured in 3D.
+ *
+ *	The range trigger of the DistanceController is only used to tell when
+ *	the pet is near. The distance is polled each tick while the pet is within
+ *	the trigger's square, and not at all while it is outside.
+ *
+ *	It is exclusive in the "Movement" category, so adding it cancels the
+ *	entity's movement controller, as it always has. It is streamed as the pet
+ *	id and the range, as it always has been, so that CellApps of either
+ *	version can offload it to each other.
+ *
+ *	@see DistanceController
+ */
+class PetDistanceController : public DistanceController, public Updatable
 {
 	DECLARE_CONTROLLER_TYPE( PetDistanceController )
+
 public:
 	PetDistanceController( int32 petID = 0, int32 distance = 0 );
 
@@ -24,15 +33,21 @@ public:
 
 	void	writeRealToStream( BinaryOStream& stream );
 	bool	readRealFromStream( BinaryIStream& stream );
-	void	update();
+
+	virtual void	update();
+
+protected:
+	virtual void	onEnter( ObjectID entityID );
+	virtual void	onLeave( ObjectID entityID );
 
 private:
-	int32 petID_;
-	int32 range_;		// 趨֪ͨ
-	int32 oldDistance_;	// һtick˫ľ
-	
+	float	petDistance();
+
+	int32	petID_;
+	int32	range_;			///< The distance at which the script is called.
+	bool	isInRange_;		///< Whether the pet was last within range_.
+	bool	isRegistered_;	///< Whether the distance is being polled.
 };
 
 
 #endif
-
@@ -1932,4 +1932,8 @@
 #define ALLY_TITILE_CHANGE_REASON_ADD			 1
 #define ALLY_TITILE_CHANGE_REASON_ADD_MEMBER		 2
 #define ALLY_TITILE_CHANGE_REASON_MEMBER_CHANGE			 3
+#define RANGE_QUERY_EXCLUDE_SELF			 0x01
+#define RANGE_QUERY_SAME_PLANES				 0x02
+#define RANGE_QUERY_REAL_ONLY				 0x04
+#define RANGE_QUERY_NOT_DEAD				 0x08
 #endif
@@ -2697,3 +2697,8 @@ ALLY_TITILE_CHANGE_REASON_MEMBER_CHANGE			= 3		# 
 
 
 
+# GameObject.entitiesInRangeFiltered()Ĺ˱־
+RANGE_QUERY_EXCLUDE_SELF			= 0x01		# exclude the entity itself
+RANGE_QUERY_SAME_PLANES				= 0x02		# only entities in the same planes
+RANGE_QUERY_REAL_ONLY				= 0x04		# only real entities
+RANGE_QUERY_NOT_DEAD				= 0x08		# exclude entities whose state is ENTITY_STATE_DEAD
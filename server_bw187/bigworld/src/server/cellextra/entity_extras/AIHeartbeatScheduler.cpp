@@ -0,0 +1,195 @@
+#include "AIHeartbeatScheduler.hpp"
+#include "AIInterface.hpp"
+
+#include "cellapp/cellapp.hpp"
+#include "cstdmf/timestamp.hpp"
+#include "cstdmf/watcher.hpp"
+#include "server/bwconfig.hpp"
+
+#include <algorithm>
+
+DECLARE_DEBUG_COMPONENT( 0 )
+
+
+AIHeartbeatScheduler::AIHeartbeatScheduler() :
+	entities_(),
+	indices_(),
+	isInPass_( false ),
+	timerID_( 0 ),
+	numEntities_( 0 ),
+	lastPassHeartbeats_( 0 ),
+	lastPassTime_( 0.0 ),
+	heartbeatsPerMs_( 0.0 ),
+	numActions_( 0 )
+{
+	MF_WATCH( "cellextra/aiHeartbeat/entities", numEntities_,
+		Watcher::WT_READ_ONLY,
+		"The number of entities with a fight AI heartbeat" );
+	MF_WATCH( "cellextra/aiHeartbeat/lastPassHeartbeats", lastPassHeartbeats_,
+		Watcher::WT_READ_ONLY,
+		"The number of heartbeats run in the last pass" );
+	MF_WATCH( "cellextra/aiHeartbeat/lastPassTime", lastPassTime_,
+		Watcher::WT_READ_ONLY,
+		"Milliseconds spent in the last pass" );
+	MF_WATCH( "cellextra/aiHeartbeat/heartbeatsPerMs", heartbeatsPerMs_,
+		Watcher::WT_READ_ONLY,
+		"Heartbeats run per millisecond in the last pass" );
+	MF_WATCH( "cellextra/aiHeartbeat/actions", numActions_,
+		Watcher::WT_READ_ONLY,
+		"The number of AI actions passed to script" );
+}
+
+
+AIHeartbeatScheduler::~AIHeartbeatScheduler()
+{
+	// The CellApp and its time queue have gone by the time that this static
+	// instance is destroyed, so the timer is not cancelled.
+}
+
+
+/**
+ *	This static method returns the singleton instance of this class.
+ */
+AIHeartbeatScheduler & AIHeartbeatScheduler::instance()
+{
+	static AIHeartbeatScheduler s_instance;
+	return s_instance;
+}
+
+
+/**
+ *	This method starts the fight AI heartbeat of the given entity. The timer is
+ *	started with the first entity.
+ */
+void AIHeartbeatScheduler::add( Entity & entity )
+{
+	Indices::iterator iter = indices_.find( entity.id() );
+
+	if (iter != indices_.end())
+	{
+		// This may be a destroyed entity that had the same id.
+		entities_[ iter->second ] = &entity;
+		return;
+	}
+
+	indices_[ entity.id() ] = int( entities_.size() );
+	entities_.push_back( &entity );
+	numEntities_ = indices_.size();
+
+	if (timerID_ == 0)
+	{
+		CellApp & app = CellApp::instance();
+
+		float period = BWConfig::get( "cellApp/aiHeartbeatPeriod", 1.f );
+		int periodInTicks = std::max( 1,
+			int( period * app.updateHertz() + 0.5f ) );
+
+		timerID_ = app.timeQueue().add( app.time() + periodInTicks,
+			periodInTicks, this, NULL );
+	}
+}
+
+
+/**
+ *	This method stops the fight AI heartbeat of the given entity. Its entry is
+ *	only cleared here, since this may be called during a pass.
+ */
+void AIHeartbeatScheduler::remove( Entity & entity )
+{
+	Indices::iterator iter = indices_.find( entity.id() );
+
+	if (iter != indices_.end() &&
+			entities_[ iter->second ].get() == &entity)
+	{
+		entities_[ iter->second ] = NULL;
+		indices_.erase( iter );
+		numEntities_ = indices_.size();
+
+		if (!isInPass_)
+		{
+			this->compact();
+		}
+	}
+}
+
+
+/**
+ *	This method stops the fight AI heartbeats of all entities. It is called
+ *	before Python is finalised, so that the entities are not released by the
+ *	static destructor of this instance, after Python has gone. The timer is
+ *	left to run empty passes, since the time queue may already be gone.
+ */
+void AIHeartbeatScheduler::clear()
+{
+	entities_.clear();
+	indices_.clear();
+	numEntities_ = 0;
+}
+
+
+/**
+ *	This method runs the heartbeats of all of the registered entities.
+ *	Entities added during the pass wait for the next one.
+ */
+void AIHeartbeatScheduler::handleTimeout( TimeQueueId id, void * pUser )
+{
+	uint64 startTime = timestamp();
+	uint32 numHeartbeats = 0;
+
+	isInPass_ = true;
+
+	const size_t size = entities_.size();
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		// Holds the entity in case its script destroys it.
+		EntityPtr pEntity = entities_[i];
+
+		if (!pEntity)
+		{
+			continue;
+		}
+
+		if (pEntity->isDestroyed() || !pEntity->isReal())
+		{
+			this->remove( *pEntity );
+			continue;
+		}
+
+		AIInterface::instance( *pEntity ).onFightAIHeartbeat_AIInterface_cpp();
+		++numHeartbeats;
+	}
+
+	isInPass_ = false;
+
+	this->compact();
+
+	lastPassHeartbeats_ = numHeartbeats;
+	lastPassTime_ = double( timestamp() - startTime ) * 1000.0 /
+		stampsPerSecondD();
+	heartbeatsPerMs_ = (lastPassTime_ > 0.0) ?
+		numHeartbeats / lastPassTime_ : 0.0;
+}
+
+
+/**
+ *	This method removes the cleared entries, and renumbers the rest.
+ */
+void AIHeartbeatScheduler::compact()
+{
+	if (entities_.size() == indices_.size())
+	{
+		return;
+	}
+
+	Entities::iterator newEnd =
+		std::remove( entities_.begin(), entities_.end(), EntityPtr() );
+	entities_.erase( newEnd, entities_.end() );
+
+	for (size_t i = 0; i < entities_.size(); ++i)
+	{
+		indices_[ entities_[i]->id() ] = int( i );
+	}
+}
+
+// AIHeartbeatScheduler.cpp
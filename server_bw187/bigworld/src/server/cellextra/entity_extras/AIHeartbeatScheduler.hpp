@@ -0,0 +1,61 @@
+#ifndef SERVER_CELLEXTRA_AIHEARTBEATSCHEDULER_HPP
+#define SERVER_CELLEXTRA_AIHEARTBEATSCHEDULER_HPP
+
+#include "cellapp/entity.hpp"
+#include "cstdmf/time_queue.hpp"
+
+#include <map>
+#include <vector>
+
+/**
+ *	This class runs the fight AI heartbeats of all of the fighting entities
+ *	on this CellApp in a single pass, from one timer, instead of each entity
+ *	having its own script timer that calls onFightAIHeartbeat_AIInterface_cpp.
+ *
+ *	Entities are added by startFightAIHeartbeat_AIInterface_cpp and removed by
+ *	stopFightAIHeartbeat_AIInterface_cpp. They are also dropped once they are
+ *	destroyed or stop being real. Registration is not carried with an entity
+ *	that is offloaded, so its script should start the heartbeat again on the
+ *	new CellApp. Starting it again is cheap, and does nothing if the entity is
+ *	already registered.
+ *
+ *	The period is set by cellApp/aiHeartbeatPeriod in bw.xml, in seconds.
+ */
+class AIHeartbeatScheduler : public TimeQueueHandler
+{
+public:
+	AIHeartbeatScheduler();
+	virtual ~AIHeartbeatScheduler();
+
+	void add( Entity & entity );
+	void remove( Entity & entity );
+	void clear();
+
+	/// This method counts an AI action that has been passed to script.
+	void onAction()			{ ++numActions_; }
+
+	static AIHeartbeatScheduler & instance();
+
+private:
+	virtual void handleTimeout( TimeQueueId id, void * pUser );
+	virtual void onRelease( TimeQueueId id, void * pUser ) {}
+
+	void compact();
+
+	typedef std::vector< EntityPtr > Entities;
+	Entities		entities_;
+
+	typedef std::map< ObjectID, int > Indices;
+	Indices			indices_;
+
+	bool			isInPass_;
+	TimeQueueId		timerID_;
+
+	uint32			numEntities_;
+	uint32			lastPassHeartbeats_;
+	double			lastPassTime_;
+	double			heartbeatsPerMs_;
+	uint32			numActions_;
+};
+
+#endif // SERVER_CELLEXTRA_AIHEARTBEATSCHEDULER_HPP
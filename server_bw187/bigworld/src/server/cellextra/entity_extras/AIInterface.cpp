@@ -1,5 +1,10 @@
 #include "AIInterface.hpp"
+#include "AIHeartbeatScheduler.hpp"
 #include "../utils/py_array_proxy.hpp"
+#include "cellapp/entity_type.hpp"
+#include "pyscript/script.hpp"
+
+#include <map>
 
 DECLARE_DEBUG_COMPONENT( 0 )
 
@@ -8,6 +13,8 @@ PY_TYPEOBJECT( AIInterface )
 PY_BEGIN_METHODS( AIInterface )
 	PY_METHOD( onFightAIHeartbeat_AIInterface_cpp )
 	PY_METHOD( aiCommonCheck_AIInterface_cpp )
+	PY_METHOD( startFightAIHeartbeat_AIInterface_cpp )
+	PY_METHOD( stopFightAIHeartbeat_AIInterface_cpp )
 PY_END_METHODS()
 
 PY_BEGIN_ATTRIBUTES( AIInterface )
@@ -16,7 +23,206 @@ PY_END_ATTRIBUTES()
 const AIInterface::Instance<AIInterface>
 	AIInterface::instance( &AIInterface::s_attributes_.di_ );
 
-AIInterface::AIInterface( Entity &e ): EntityExtra( e )
+// -----------------------------------------------------------------------------
+// Section: Names and slots
+// -----------------------------------------------------------------------------
+
+namespace
+{
+
+/**
+ *	These are the names of the attributes and methods used by the heartbeat.
+ *	The attributes come first, so that they can also index AISlots.
+ */
+enum AIName
+{
+	FIGHT_STATE_AI_COUNT,
+	FIGHT_START_TIME,
+	ATTR_AI_NOW_LEVEL_TEMP,
+	ATTR_AI_NOW_LEVEL,
+	ATTR_ATTACK_STATE_GENERIC_AIS,
+	COMBO_AI_ARRAY,
+	COMBO_AI_STATE,
+	INSERT_AI,
+	ATTR_SCHEME_AIS,
+	SAI_ARRAY,
+	ATTR_SPECIAL_AIS,
+
+	NUM_ATTRIBUTES,
+
+	INTONATING = NUM_ATTRIBUTES,
+	IN_HOMING_SPELL,
+	DO_COMBO_AI,
+	COMBO_AI_CHECK,
+	ON_SPECIAL_AI_NOT_DO,
+	SET_AI_TARGET_ID,
+	IS_EAI,
+	GET_ID,
+	GET_ACTIVE_RATE,
+	CHECK,
+	DO,
+
+	NUM_NAMES
+};
+
+const char * s_nameStrings[ NUM_NAMES ] =
+{
+	"fightStateAICount",
+	"fightStartTime",
+	"attrAINowLevelTemp",
+	"attrAINowLevel",
+	"attrAttackStateGenericAIs",
+	"comboAIArray",
+	"comboAIState",
+	"insert_ai",
+	"attrSchemeAIs",
+	"saiArray",
+	"attrSpecialAIs",
+
+	"intonating",
+	"inHomingSpell",
+	"doComboAI",
+	"comboAICheck",
+	"onSpecialAINotDo",
+	"setAITargetID",
+	"isEAI",
+	"getID",
+	"getActiveRate",
+	"check",
+	"do"
+};
+
+PyObject * s_names[ NUM_NAMES ];
+
+/**
+ *	This function returns the interned Python string of the given name.
+ */
+inline PyObject * aiName( AIName name )
+{
+	if (s_names[ name ] == NULL)
+	{
+		for (int i = 0; i < NUM_NAMES; ++i)
+		{
+			s_names[i] = PyString_InternFromString( s_nameStrings[i] );
+		}
+	}
+
+	return s_names[ name ];
+}
+
+} // anonymous namespace
+
+
+/**
+ *	This structure is the local indices of the heartbeat attributes for one
+ *	entity type. It is -1 for those that are not defined properties, and so
+ *	are read by name from the entity.
+ */
+struct AISlots
+{
+	EntityTypePtr	pType;
+	int				localIndex[ NUM_ATTRIBUTES ];
+};
+
+
+namespace
+{
+
+typedef std::map< const EntityType *, AISlots > AISlotsMap;
+AISlotsMap s_slots;
+
+/**
+ *	This function returns the slots of the given entity type, looking them up
+ *	the first time that it is asked for. The type is held, so that its address
+ *	is not reused by a reloaded type.
+ */
+const AISlots & aiSlots( EntityTypePtr pType )
+{
+	AISlotsMap::iterator iter = s_slots.find( pType.get() );
+
+	if (iter != s_slots.end())
+	{
+		return iter->second;
+	}
+
+	AISlots & slots = s_slots[ pType.get() ];
+	slots.pType = pType;
+
+	for (int i = 0; i < NUM_ATTRIBUTES; ++i)
+	{
+		DataDescription * pDesc = pType->description( s_nameStrings[i] );
+		slots.localIndex[i] = pDesc ? pDesc->localIndex() : -1;
+	}
+
+	return slots;
+}
+
+
+/**
+ *	This function calls a method with up to one argument, and prints any
+ *	Python error.
+ */
+PyObjectPtr callMethod( PyObject * pObj, AIName name, PyObject * pArg = NULL )
+{
+	PyObject * pResult = PyObject_CallMethodObjArgs( pObj, aiName( name ),
+		pArg, NULL );
+
+	if (pResult == NULL)
+	{
+		PyErr_Print();
+	}
+
+	return PyObjectPtr( pResult, PyObjectPtr::STEAL_REFERENCE );
+}
+
+
+/**
+ *	This function returns the integer result of calling the given method of an
+ *	AI object, or 0 if the call fails.
+ */
+long callIntMethod( PyObject * pAIObj, AIName name )
+{
+	PyObjectPtr pResult = callMethod( pAIObj, name );
+	long result = pResult ? PyInt_AsLong( pResult.get() ) : 0;
+
+	PyErr_Clear();
+
+	return result;
+}
+
+
+/**
+ *	This class releases the Python objects held by the heartbeat before
+ *	Python is finalised. They would otherwise be released by static
+ *	destructors, after it has gone.
+ */
+class AIFiniTimeJob : public Script::FiniTimeJob
+{
+protected:
+	void fini()
+	{
+		AIHeartbeatScheduler::instance().clear();
+		s_slots.clear();
+
+		for (int i = 0; i < NUM_NAMES; ++i)
+		{
+			Py_XDECREF( s_names[i] );
+			s_names[i] = NULL;
+		}
+	}
+};
+
+AIFiniTimeJob s_aiFiniTimeJob;
+
+} // anonymous namespace
+
+
+// -----------------------------------------------------------------------------
+// Section: AIInterface
+// -----------------------------------------------------------------------------
+
+AIInterface::AIInterface( Entity &e ): EntityExtra( e ),
+	pSlots_( &aiSlots( e.pType() ) )
 {
 }
 
@@ -37,268 +243,323 @@ int AIInterface::pySetAttribute( const char * attr, PyObject * value )
 	return this->EntityExtra::pySetAttribute( attr, value );
 }
 
+
+/**
+ *	This method adds this entity to the batched fight AI heartbeat.
+ */
+void AIInterface::startFightAIHeartbeat_AIInterface_cpp()
+{
+	AIHeartbeatScheduler::instance().add( entity_ );
+}
+
+
+/**
+ *	This method removes this entity from the batched fight AI heartbeat.
+ */
+void AIInterface::stopFightAIHeartbeat_AIInterface_cpp()
+{
+	AIHeartbeatScheduler::instance().remove( entity_ );
+}
+
+
+/**
+ *	This method returns the value of a heartbeat attribute of the entity,
+ *	through its property slot if it has one.
+ */
+PyObjectPtr AIInterface::attribute( int name ) const
+{
+	int localIndex = pSlots_->localIndex[ name ];
+
+	if (localIndex >= 0)
+	{
+		return entity_.propertyByLocalIndex( localIndex );
+	}
+
+	PyObject * pValue = PyObject_GetAttr( (PyObject *)&entity_,
+		aiName( AIName( name ) ) );
+
+	if (pValue == NULL)
+	{
+		PyErr_Print();
+	}
+
+	return PyObjectPtr( pValue, PyObjectPtr::STEAL_REFERENCE );
+}
+
+
+/**
+ *	This method sets a heartbeat attribute of the entity. It goes through
+ *	setattr, so that changes to properties are sent on as usual.
+ */
+void AIInterface::setAttribute( int name, PyObject * pValue )
+{
+	if (PyObject_SetAttr( (PyObject *)&entity_, aiName( AIName( name ) ),
+			pValue ) == -1)
+	{
+		PyErr_Print();
+	}
+}
+
+
+/**
+ *	This method returns the list of AIs for the current level from one of the
+ *	dictionaries of AIs, or NULL if there are none. The returned reference is
+ *	borrowed from the dictionary, which is held by pDict.
+ */
+PyObject * AIInterface::aisForLevel( int name, PyObject * pLevel,
+	PyObjectPtr & pDict ) const
+{
+	pDict = this->attribute( name );
+
+	if (!pDict || !PyDict_Check( pDict.get() ) || pLevel == NULL)
+	{
+		return NULL;
+	}
+
+	PyObject * pAIs = PyDict_GetItem( pDict.get(), pLevel );
+
+	return (pAIs != NULL && PyList_Check( pAIs )) ? pAIs : NULL;
+}
+
+
+/**
+ *	This method runs the first AI of the given list whose checks pass, or all
+ *	of those that pass if runAll is true.
+ *
+ *	@return	True if any AI was run.
+ */
+bool AIInterface::runAIs( PyObject * pAIs, bool runAll )
+{
+	if (pAIs == NULL)
+	{
+		return false;
+	}
+
+	// Hold the list, in case an action replaces it.
+	PyObjectPtr pHolder( pAIs );
+	bool hasRun = false;
+
+	for (Py_ssize_t i = 0; i < PyList_GET_SIZE( pAIs ); ++i)
+	{
+		if (runAll && entity_.isDestroyed() && !entity_.isReal())
+		{
+			break;
+		}
+
+		PyObject * pAI = PyList_GET_ITEM( pAIs, i );
+
+		if (this->aiCommonCheck_AIInterface_cpp( pAI ))
+		{
+			this->doAI( pAI );
+			hasRun = true;
+
+			if (!runAll)
+			{
+				break;
+			}
+		}
+	}
+
+	return hasRun;
+}
+
+
+/**
+ *	This method runs the action of an AI, which is always in script.
+ */
+void AIInterface::doAI( PyObject * pAI )
+{
+	AIHeartbeatScheduler::instance().onAction();
+	callMethod( pAI, DO, (PyObject *)&entity_ );
+}
+
+
+/**
+ *	This method is the fight AI heartbeat. It is called by the
+ *	AIHeartbeatScheduler for entities that have started it, and may also
+ *	still be called from script.
+ *
+ *	The attributes that it reads are looked up once for each entity type, and
+ *	the common checks of the AIs are done here. Script is only called for the
+ *	state queries, the AI's own checks and the actions that fire.
+ */
 void AIInterface::onFightAIHeartbeat_AIInterface_cpp()
 {
 	PyObject * pySelfEntityPtr = ( PyObject * )&entity_;
-	PyObject *pTempObjRef1, *pTempObjRef2, *pTempObjRef3;
 
-	pTempObjRef1 = PyObject_GetAttrString( pySelfEntityPtr, "fightStateAICount" );
-	if( PyInt_AS_LONG( pTempObjRef1 ) <= 0 ){
-		Py_XDECREF( pTempObjRef1 );
+	PyObjectPtr pCount = this->attribute( FIGHT_STATE_AI_COUNT );
+	if (!pCount || PyInt_AsLong( pCount.get() ) <= 0)
+	{
+		PyErr_Clear();
 		return;
 	}
-	Py_XDECREF( pTempObjRef1 );
 
-	pTempObjRef1 = PyObject_CallMethod( pySelfEntityPtr, "intonating", NULL );
-	if( pTempObjRef1 == Py_True )
+	if (callMethod( pySelfEntityPtr, INTONATING ).get() == Py_True ||
+		callMethod( pySelfEntityPtr, IN_HOMING_SPELL ).get() == Py_True)
 	{
-		Py_XDECREF( pTempObjRef1 );
 		return;
 	}
-	Py_XDECREF( pTempObjRef1 );
 
-	pTempObjRef1 = PyObject_CallMethod( pySelfEntityPtr, "inHomingSpell", NULL );
-	if( pTempObjRef1 == Py_True )
+	PyObjectPtr pStartTime = this->attribute( FIGHT_START_TIME );
+	if (pStartTime && PyFloat_AsDouble( pStartTime.get() ) == 0.0)
 	{
-		Py_XDECREF( pTempObjRef1 );
-		return;
+		PyObjectPtr pNow( PyFloat_FromDouble( time( NULL ) ),
+			PyObjectPtr::STEAL_REFERENCE );
+		this->setAttribute( FIGHT_START_TIME, pNow.get() );
 	}
-	Py_XDECREF( pTempObjRef1 );
 
-	pTempObjRef1 = PyObject_GetAttrString( pySelfEntityPtr, "fightStartTime" );
-	if( PyFloat_AsDouble( pTempObjRef1 ) == 0.0 ){
-		pTempObjRef2 = PyFloat_FromDouble( time( NULL ) );
-		PyObject_SetAttrString( pySelfEntityPtr, "fightStartTime", pTempObjRef2 );
-		Py_XDECREF( pTempObjRef2 );
-	}
-	Py_XDECREF( pTempObjRef1 );
-
-	//ƥAIеȼ
-	pTempObjRef1 = PyObject_GetAttrString( pySelfEntityPtr, "attrAINowLevelTemp" );
-	PyObject *pAINowLevel = PyObject_GetAttrString( pySelfEntityPtr, "attrAINowLevel" );
-
-	/*
-	PyObject *tmp = PyInt_FromLong(10);
-	DEBUG_MSG( "--->>> before, tmp is %d\n", PyInt_AS_LONG( tmp ) );
-	PyObject_SetAttrString( pySelfEntityPtr, "attrAINowLevel", tmp );
-	DEBUG_MSG( "--->>> after, tmp is %d\n", PyInt_AS_LONG( tmp ) );
-	Py_XDECREF( tmp );
-	DEBUG_MSG( "--->>> attrAINowLevel is %d\n", PyInt_AS_LONG( pAINowLevel ) );
-	tmp = PyObject_GetAttrString( pySelfEntityPtr, "attrAINowLevel" );
-	DEBUG_MSG( "--->>> after2, tmp is %d\n", PyInt_AS_LONG( tmp ) );
-	Py_XDECREF( tmp );
-	βԴ֤ʵ
-	ʹPyObject_GetAttrStringĳֵҪ
-	PyObject_GetAttrString»ȡԵֵȵPyObject_GetAttrString
-	õָָĶ󽫲޸ĵֵ
-	*/
-
-	if(PyInt_AS_LONG( pTempObjRef1 ) != PyInt_AS_LONG( pAINowLevel )){
-		PyObject_SetAttrString( pySelfEntityPtr, "attrAINowLevel", pTempObjRef1 );
-		Py_XDECREF( pAINowLevel );
-		pAINowLevel = PyObject_GetAttrString( pySelfEntityPtr, "attrAINowLevel" );
+	// Match the current AI level.
+	PyObjectPtr pAINowLevel = this->attribute( ATTR_AI_NOW_LEVEL );
+	PyObjectPtr pAINowLevelTemp = this->attribute( ATTR_AI_NOW_LEVEL_TEMP );
+
+	if (pAINowLevel && pAINowLevelTemp &&
+		PyInt_AsLong( pAINowLevelTemp.get() ) !=
+			PyInt_AsLong( pAINowLevel.get() ))
+	{
+		this->setAttribute( ATTR_AI_NOW_LEVEL, pAINowLevelTemp.get() );
+		pAINowLevel = this->attribute( ATTR_AI_NOW_LEVEL );
 	}
-	Py_XDECREF( pTempObjRef1 );
-
-	//ִͨAIѭ
-	pTempObjRef1 = PyObject_GetAttrString( pySelfEntityPtr,"attrAttackStateGenericAIs" );
-	pTempObjRef2 = PyDict_GetItem( pTempObjRef1, pAINowLevel );
-	Py_XDECREF( pTempObjRef1 );
-	if( pTempObjRef2 != NULL ){
-		int16 commonAIListSize = PyList_Size( pTempObjRef2 );
-		int16 index = 0;
-		while( commonAIListSize > index ){
-			if( entity().isDestroyed() && !entity().isReal() ){
-				Py_XDECREF( pAINowLevel );
-				return;
-			}
-			pTempObjRef1 = PyList_GetItem( pTempObjRef2, index );
-			if( aiCommonCheck_AIInterface_cpp( pTempObjRef1 ) ){
-				pTempObjRef3 = PyObject_CallMethod( pTempObjRef1, "do", "O", pySelfEntityPtr );
-				Py_XDECREF( pTempObjRef3 );
-			}
-			index++;
-		}
+
+	PyErr_Clear();
+
+	// The generic AIs all run.
+	PyObjectPtr pDict;
+	this->runAIs( this->aisForLevel( ATTR_ATTACK_STATE_GENERIC_AIS,
+		pAINowLevel.get(), pDict ), /* runAll: */ true );
+
+	if (entity_.isDestroyed() && !entity_.isReal())
+	{
+		return;
 	}
 
-	//AIִAI
-	pTempObjRef1 = PyObject_GetAttrString( pySelfEntityPtr, "comboAIArray" );
-	PyArrayProxy comboAIArray = PyArrayProxy(pTempObjRef1);
-	if (comboAIArray.length() > 0)
+	// Run any combo AI that is in progress.
+	PyObjectPtr pComboAIArray = this->attribute( COMBO_AI_ARRAY );
+	if (pComboAIArray &&
+		PyArrayProxy( pComboAIArray.get() ).length() > 0)
 	{
-		pTempObjRef2 = PyObject_CallMethod( pySelfEntityPtr, "doComboAI", NULL );
-		Py_XDECREF( pTempObjRef2 );
+		callMethod( pySelfEntityPtr, DO_COMBO_AI );
 	}
-	Py_XDECREF( pTempObjRef1 );
 
-	//AIִ״̬
-	PyObject * pComboAIState = PyObject_GetAttrString( pySelfEntityPtr, "comboAIState" );
-	if( pComboAIState == Py_False )
+	if (this->attribute( COMBO_AI_STATE ).get() == Py_False)
 	{
-		Py_XDECREF( pComboAIState );
-
-		//ִAIѭ
-		bool tempAICheckResult = false;
-		pTempObjRef1 = PyObject_GetAttrString( pySelfEntityPtr,"insert_ai" );
-		if(pTempObjRef1 != Py_None){
-			if( aiCommonCheck_AIInterface_cpp( pTempObjRef1 ) ){
-				pTempObjRef3 = PyObject_CallMethod( pTempObjRef1, "do", "O", pySelfEntityPtr );
-				Py_XDECREF( pTempObjRef3 );
-				tempAICheckResult = true;
-			}
+		// An inserted AI takes the place of the scheme AIs.
+		bool hasRun = false;
+
+		PyObjectPtr pInsertAI = this->attribute( INSERT_AI );
+		if (pInsertAI && pInsertAI.get() != Py_None &&
+			this->aiCommonCheck_AIInterface_cpp( pInsertAI.get() ))
+		{
+			this->doAI( pInsertAI.get() );
+			hasRun = true;
 		}
-		Py_XDECREF( pTempObjRef1 );
-
-		if( tempAICheckResult == false ){
-			pTempObjRef1 = PyObject_GetAttrString( pySelfEntityPtr,"attrSchemeAIs" );
-			pTempObjRef2 = PyDict_GetItem( pTempObjRef1, pAINowLevel );
-			Py_XDECREF( pTempObjRef1 );
-			if(pTempObjRef2 != NULL ){
-				int16 schemeAIListSize = PyList_Size( pTempObjRef2 );
-				for(int index = 0; index < schemeAIListSize; index++){
-					pTempObjRef1 = PyList_GetItem( pTempObjRef2, index );
-					if( aiCommonCheck_AIInterface_cpp( pTempObjRef1 ) ){
-						pTempObjRef3 = PyObject_CallMethod( pTempObjRef1, "do", "O", pySelfEntityPtr );
-						Py_XDECREF( pTempObjRef3 );
-						break;
-					}
-				}
-			}
+
+		if (!hasRun)
+		{
+			this->runAIs( this->aisForLevel( ATTR_SCHEME_AIS,
+				pAINowLevel.get(), pDict ), /* runAll: */ false );
 		}
 
-		if( entity().isDestroyed() ){
-			Py_XDECREF( pAINowLevel );
+		if (entity_.isDestroyed())
+		{
 			return;
 		}
 
-		//AIִм
-		pTempObjRef1 = PyObject_CallMethod( pySelfEntityPtr, "comboAICheck", NULL );
-		long comboID = PyInt_AS_LONG( pTempObjRef1 );
-		Py_XDECREF( pTempObjRef1 );
+		// Start a combo AI if one is ready.
+		PyObjectPtr pComboID = callMethod( pySelfEntityPtr, COMBO_AI_CHECK );
+		long comboID = pComboID ? PyInt_AsLong( pComboID.get() ) : 0;
 
-		if( comboID > 0 )
+		if (comboID > 0)
 		{
-			pTempObjRef1 = PyObject_CallMethod( pySelfEntityPtr, "doComboAI", "i", comboID );
-			Py_XDECREF( pTempObjRef1 );
+			PyObjectPtr pArg( PyInt_FromLong( comboID ),
+				PyObjectPtr::STEAL_REFERENCE );
+			callMethod( pySelfEntityPtr, DO_COMBO_AI, pArg.get() );
 		}
 
-		//ٴμAIִ״̬
-		PyObject * pInnerComboAIState = PyObject_GetAttrString( pySelfEntityPtr, "comboAIState" );
-		if( pInnerComboAIState == Py_False )
-		{
-			Py_XDECREF( pInnerComboAIState );
-
-			//ִAIѭ
-			tempAICheckResult = false;
-
-			pTempObjRef1 = PyObject_GetAttrString( pySelfEntityPtr, "saiArray" );
-			PyArrayProxy * pSaiArray = new PyArrayProxy( pTempObjRef1 );
+		PyErr_Clear();
 
-			if( pSaiArray->length() > 0 )
-			{
-				pTempObjRef2 = pSaiArray->pop( 0 );
-				if( aiCommonCheck_AIInterface_cpp( pTempObjRef2 ) )
-				{
-					pTempObjRef3 = PyObject_CallMethod( pTempObjRef2, "do", "O", pySelfEntityPtr );
-					Py_XDECREF( pTempObjRef3 );
-					tempAICheckResult = true;
-				}
-				else
-				{
-					pSaiArray->clear();
-				}
-				Py_XDECREF( pTempObjRef2 );
-			}
+		if (this->attribute( COMBO_AI_STATE ).get() == Py_False)
+		{
+			// The queued special AIs come before the special AIs of the
+			// level. A queued AI that fails its checks clears the queue.
+			hasRun = false;
 
-			delete pSaiArray;
-			Py_XDECREF( pTempObjRef1 );
+			PyObjectPtr pSaiArray = this->attribute( SAI_ARRAY );
 
-			if( tempAICheckResult == false )
+			if (pSaiArray)
 			{
-				bool doSuccess = false;
-
-				pTempObjRef1 = PyObject_GetAttrString( pySelfEntityPtr,"attrSpecialAIs" );
-				pTempObjRef2 = PyDict_GetItem( pTempObjRef1, pAINowLevel );
-				Py_XDECREF( pTempObjRef1 );
+				PyArrayProxy saiArray( pSaiArray.get() );
 
-				if(pTempObjRef2 != NULL)
+				if (saiArray.length() > 0)
 				{
-					int16 schemeAIListSize = PyList_Size( pTempObjRef2 );
-					for(int index = 0; index < schemeAIListSize; index++)
+					PyObjectPtr pAI( saiArray.pop( 0 ),
+						PyObjectPtr::STEAL_REFERENCE );
+
+					if (pAI && this->aiCommonCheck_AIInterface_cpp( pAI.get() ))
 					{
-						pTempObjRef1 = PyList_GetItem( pTempObjRef2, index );
-						if( aiCommonCheck_AIInterface_cpp( pTempObjRef1 ) )
-						{
-							pTempObjRef3 = PyObject_CallMethod( pTempObjRef1, "do", "O", pySelfEntityPtr );
-							Py_XDECREF( pTempObjRef3 );
-							doSuccess = true;
-							break;
-						}
+						this->doAI( pAI.get() );
+						hasRun = true;
+					}
+					else
+					{
+						saiArray.clear();
 					}
 				}
+			}
 
-				if( !doSuccess )
-				{
-					pTempObjRef1 = PyObject_CallMethod( pySelfEntityPtr, "onSpecialAINotDo", NULL );
-					Py_XDECREF( pTempObjRef1 );
-				}
+			if (!hasRun &&
+				!this->runAIs( this->aisForLevel( ATTR_SPECIAL_AIS,
+					pAINowLevel.get(), pDict ), /* runAll: */ false ))
+			{
+				callMethod( pySelfEntityPtr, ON_SPECIAL_AI_NOT_DO );
 			}
-			Py_XDECREF( pAINowLevel );
-			if( entity().isDestroyed() ){
+
+			if (entity_.isDestroyed())
+			{
 				return;
 			}
 		}
-		else
-		{
-			Py_XDECREF( pInnerComboAIState );
-		}
-	}
-	else
-	{
-		Py_XDECREF( pComboAIState );
 	}
 
-	pTempObjRef1 = PyObject_CallMethod( pySelfEntityPtr, "setAITargetID", "i", 0 );
-	Py_XDECREF( pTempObjRef1 );
+	PyObjectPtr pZero( PyInt_FromLong( 0 ), PyObjectPtr::STEAL_REFERENCE );
+	callMethod( pySelfEntityPtr, SET_AI_TARGET_ID, pZero.get() );
 
-	PyObject_SetAttrString( pySelfEntityPtr, "comboAIState", Py_False );
+	this->setAttribute( COMBO_AI_STATE, Py_False );
 }
 
 
+/**
+ *	This method does the common checks of an AI. The active rate is rolled
+ *	natively, before script is asked whether
+ *	it is an excluded AI and whether its own conditions are met.
+ */
 bool AIInterface::aiCommonCheck_AIInterface_cpp( PyObject *pAIObj )
 {
 	PyObject *pySelfEntityPtr = (PyObject *)(&entity_);
-	PyObject *pTempObjRef1, *pTempObjRef2;
 
-	// aiǷһeai ǵĻ
-	pTempObjRef1 = PyObject_CallMethod( pAIObj, "getID", NULL );
-	pTempObjRef2 = PyObject_CallMethod( pySelfEntityPtr, "isEAI", "i", PyInt_AsLong( pTempObjRef1 ) );
-	Py_XDECREF( pTempObjRef1 );
-	if( pTempObjRef2 == Py_True )
+	// These are read each time, since script may change them. The id is only
+	// needed once the roll has passed.
+	long activeRate = callIntMethod( pAIObj, GET_ACTIVE_RATE );
+
+	if (activeRate < 100)
 	{
-		Py_XDECREF( pTempObjRef2 );
-		return false;
+		if (activeRate <= 0 || activeRate < (rand()%101))
+			return false;
 	}
-	Py_XDECREF( pTempObjRef2 );
 
-	//ִaiĻ
-	pTempObjRef1 = PyObject_CallMethod( pAIObj, "getActiveRate", NULL );
-	long activeRate = PyInt_AsLong( pTempObjRef1 );
-	Py_XDECREF( pTempObjRef1 );
-	if(activeRate < 100)
+	// Excluded (E) AIs do not run.
+	PyObjectPtr pID( PyInt_FromLong( callIntMethod( pAIObj, GET_ID ) ),
+		PyObjectPtr::STEAL_REFERENCE );
+	if (callMethod( pySelfEntityPtr, IS_EAI, pID.get() ).get() == Py_True)
 	{
-		if(activeRate <= 0 || activeRate < (rand()%101))
-			return false;
+		return false;
 	}
 
-	// ai
-	pTempObjRef1 = PyObject_CallMethod( pAIObj, "check", "O", pySelfEntityPtr );
-	if(pTempObjRef1 == Py_False)
+	if (callMethod( pAIObj, CHECK, pySelfEntityPtr ).get() == Py_False)
 	{
-		Py_XDECREF( pTempObjRef1 );
 		return false;
 	}
-	Py_XDECREF( pTempObjRef1 );
 
 	return true;
 }
+
+// AIInterface.cpp
@@ -6,6 +6,8 @@
 #undef PY_METHOD_ATTRIBUTE
 #define PY_METHOD_ATTRIBUTE PY_METHOD_ATTRIBUTE_ENTITY_EXTRA
 
+struct AISlots;
+
 class AIInterface : public EntityExtra
 {
 	Py_EntityExtraHeader( AIInterface );
@@ -23,7 +25,24 @@ public:
 	PY_AUTO_METHOD_DECLARE( RETDATA, aiCommonCheck_AIInterface_cpp, ARG( PyObject*, END ) );
 	bool aiCommonCheck_AIInterface_cpp( PyObject* );
 
+	PY_AUTO_METHOD_DECLARE( RETVOID, startFightAIHeartbeat_AIInterface_cpp, END );
+	void startFightAIHeartbeat_AIInterface_cpp();
+
+	PY_AUTO_METHOD_DECLARE( RETVOID, stopFightAIHeartbeat_AIInterface_cpp, END );
+	void stopFightAIHeartbeat_AIInterface_cpp();
+
 	static const Instance<AIInterface> instance;
+
+private:
+	PyObjectPtr attribute( int name ) const;
+	void setAttribute( int name, PyObject * pValue );
+
+	PyObject * aisForLevel( int name, PyObject * pLevel,
+		PyObjectPtr & pDict ) const;
+	bool runAIs( PyObject * pAIs, bool runAll );
+	void doAI( PyObject * pAI );
+
+	const AISlots * pSlots_;
 };
 
 #undef PY_METHOD_ATTRIBUTE
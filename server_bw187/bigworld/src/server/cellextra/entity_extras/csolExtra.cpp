@@ -2,6 +2,7 @@
 #include "gameobject.hpp"
 #include "monster.hpp"
 #include "npcobject.hpp"
+#include "../utils/route_graph_ticker.hpp"
 
 DECLARE_DEBUG_COMPONENT( 0 )
 
@@ -13,8 +14,11 @@ PY_BEGIN_METHODS( CsolExtra )
 	PY_METHOD( testPropertyIndex )
 	PY_METHOD( getDownToGroundPos_cpp )
 	PY_METHOD( moveToPointObstacle_cpp )
+	PY_METHOD( addDistanceDetecter_cpp )
+	PY_METHOD( setDistanceTargets_cpp )
 	PY_METHOD( isSamePlanesExt )
 	PY_METHOD( entitiesInRangeExt )
+	PY_METHOD( entitiesInRangeFiltered )
 PY_END_METHODS()
 
 PY_BEGIN_ATTRIBUTES( CsolExtra )
@@ -25,6 +29,7 @@ const CsolExtra::Instance<CsolExtra> CsolExtra::instance( &CsolExtra::s_attribut
 
 CsolExtra::CsolExtra( Entity & e ):EntityExtra( e )
 {
+	RouteGraphTicker::instance().start();
 	initMapInstancePtr();
 }
 
@@ -118,6 +123,19 @@ PyObject *CsolExtra::moveToPointObstacle_cpp( Vector3 destination,
 }
 
 
+PyObject * CsolExtra::addDistanceDetecter_cpp( float range,
+		PyObjectPtr pEntityIDs, int userArg )
+{
+	return mapInstancePtr->addDistanceDetecter_cpp( range, pEntityIDs,
+		userArg );
+}
+
+PyObject * CsolExtra::setDistanceTargets_cpp( int controllerID,
+		PyObjectPtr pEntityIDs )
+{
+	return mapInstancePtr->setDistanceTargets_cpp( controllerID, pEntityIDs );
+}
+
 bool CsolExtra::isSamePlanesExt( Entity *pEntity )
 {
 	return mapInstancePtr->isSamePlanesExt( pEntity );
@@ -127,3 +145,8 @@ PyObject* CsolExtra::entitiesInRangeExt( float fRange, PyObjectPtr pEntityName,
 {
 	return mapInstancePtr->entitiesInRangeExt( fRange, pEntityName, pPos );
 }
+
+PyObject * CsolExtra::entitiesInRangeFiltered( float range, PyObjectPtr pUTypes, int flags, int maxCount, PyObjectPtr pPos )
+{
+	return mapInstancePtr->entitiesInRangeFiltered( range, pUTypes, flags, maxCount, pPos );
+}
@@ -53,12 +53,25 @@ public:
 							bool faceMovement = true,
 							bool moveVertically = false );
 	
+	PY_AUTO_METHOD_DECLARE( RETOWN, addDistanceDetecter_cpp,
+		ARG( float, ARG( PyObjectPtr, OPTARG( int, 0, END ) ) ) );
+	PyObject * addDistanceDetecter_cpp( float range, PyObjectPtr pEntityIDs,
+		int userArg = 0 );
+
+	PY_AUTO_METHOD_DECLARE( RETOWN, setDistanceTargets_cpp,
+		ARG( int, ARG( PyObjectPtr, END ) ) );
+	PyObject * setDistanceTargets_cpp( int controllerID,
+		PyObjectPtr pEntityIDs );
+
 	PY_AUTO_METHOD_DECLARE(RETDATA, isSamePlanesExt, ARG(Entity *, END));
 	bool isSamePlanesExt( Entity * pEntity );
 	
 	PY_AUTO_METHOD_DECLARE( RETOWN, entitiesInRangeExt,ARG( float, OPTARG( PyObjectPtr, NULL, OPTARG( PyObjectPtr, NULL, END ) ) ) );
 	PyObject* entitiesInRangeExt( float fRange, PyObjectPtr pEntityName=NULL, PyObjectPtr pPos = NULL);
 
+	PY_AUTO_METHOD_DECLARE( RETOWN, entitiesInRangeFiltered, ARG( float, OPTARG( PyObjectPtr, NULL, OPTARG( int, 0, OPTARG( int, 0, OPTARG( PyObjectPtr, NULL, END ) ) ) ) ) );
+	PyObject * entitiesInRangeFiltered( float range, PyObjectPtr pUTypes = NULL, int flags = 0, int maxCount = 0, PyObjectPtr pPos = NULL );
+
 	static const Instance<CsolExtra> instance;
 
 	void initMapInstancePtr();
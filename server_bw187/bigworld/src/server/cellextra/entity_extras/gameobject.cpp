@@ -4,6 +4,9 @@
 #include "chunk/chunk_space.hpp"
 #include "chunk/chunk_obstacle.hpp"
 #include "cellapp/move_controller.hpp"
+#include "../controller/distanceDetecter.hpp"
+
+#include <algorithm>
 
 DECLARE_DEBUG_COMPONENT( 0 )
 
@@ -77,6 +80,9 @@ bool GameObject::getDownToGroundPos(Vector3 &position)
  */
 long GameObject::getPlanesID()
 {
+	if( index_GameObject_planesID_ == -1 )
+		return 0;
+
 	PyObject *pPlanesID = entity_.propertyByLocalIndex( index_GameObject_planesID_ ).getObject();
 	return PyInt_AsLong( pPlanesID );
 }
@@ -90,24 +96,385 @@ bool GameObject::isSamePlanesExt(Entity * pEntity )
 		return false;
 }
 	
+namespace
+{
+
+/**
+ *	This class receives the entities in range that are in the given planes.
+ */
+class PlanesEntityReceiver : public Entity::EntityReceiver
+{
+public:
+	PlanesEntityReceiver( long planesID ) : planesID_( planesID ) {}
+
+	void addEntity( Entity * pEntity )
+	{
+		GameObject * pObject = CsolExtra::extraProxy<GameObject *>( pEntity );
+
+		if (pObject != NULL && pObject->getPlanesID() == planesID_)
+		{
+			entities_.push_back( pEntity );
+		}
+	}
+
+	const EntityList & entities() const { return entities_; }
+
+private:
+	long		planesID_;
+	EntityList	entities_;
+};
+
+} // anonymous namespace
+
+
 PyObject* GameObject::entitiesInRangeExt( float fRange, PyObjectPtr pEntityName=NULL, PyObjectPtr pPos = NULL )
 {
-	ExtEntityReceiver entReceiver = ExtEntityReceiver();
-	PyObject *pNewList = PyList_New(0);
+	PlanesEntityReceiver entReceiver( this->getPlanesID() );
 
 	entity_.getEntitiesInRange( entReceiver, fRange, pEntityName, pPos );
-	//needDisperse = entReceiver.entities().size() > 0;
-	GameObject * pEntAround;
-	for( EntityList::iterator it = entReceiver.begin(); it != entReceiver.end(); it++ )
+
+	// The list is made at its final size, rather than grown an entity at a
+	// time.
+	const EntityList & entities = entReceiver.entities();
+	PyObject *pNewList = PyList_New( entities.size() );
+
+	for (size_t i = 0; i < entities.size(); ++i)
+	{
+		Py_INCREF( entities[i] );
+		PyList_SET_ITEM( pNewList, i, entities[i] );
+	}
+
+	return pNewList;
+}
+
+
+namespace
+{
+
+/**
+ *	This structure is an entity found by a range query, with the square of its
+ *	distance from the centre. The nearest compare lowest. The entity is held,
+ *	since filtering it may call into script.
+ */
+struct RangeCandidate
+{
+	float		distSq;
+	EntityPtr	pEntity;
+
+	bool operator<( const RangeCandidate & other ) const
+	{
+		return distSq < other.distSq;
+	}
+};
+
+typedef std::vector< RangeCandidate > RangeCandidates;
+
+
+/**
+ *	This class collects the entities visited by a range query that are within
+ *	range and pass the filters that do not need their extras. The extras are
+ *	not touched here, since making one calls into script, which must not
+ *	happen while the range list is being traversed.
+ */
+class RangeVisitor : public EntityVisitor
+{
+public:
+	RangeVisitor( Entity & self, const GameObject::RangeQuery & query,
+			const Vector3 & centre, RangeCandidates & candidates ) :
+		self_( self ),
+		flags_( query.flags ),
+		centre_( centre ),
+		rangeSq_( query.range * query.range ),
+		candidates_( candidates )
+	{
+	}
+
+	virtual void visit( Entity * pEntity )
+	{
+		if (pEntity == &self_ && (flags_ & RANGE_QUERY_EXCLUDE_SELF))
+		{
+			return;
+		}
+
+		if ((flags_ & RANGE_QUERY_REAL_ONLY) && !pEntity->isReal())
+		{
+			return;
+		}
+
+		float distSq = (pEntity->position() - centre_).lengthSquared();
+
+		if (distSq <= rangeSq_)
+		{
+			RangeCandidate candidate = { distSq, pEntity };
+			candidates_.push_back( candidate );
+		}
+	}
+
+private:
+	Entity &			self_;
+	int					flags_;
+	Vector3				centre_;
+	float				rangeSq_;
+	RangeCandidates &	candidates_;
+};
+
+
+/**
+ *	This function returns whether an entity passes the filters of a query
+ *	that need its extra.
+ */
+bool passesExtraFilters( Entity * pEntity,
+	const GameObject::RangeQuery & query, long planesID )
+{
+	if (query.utypeMask == 0 &&
+		(query.flags & (RANGE_QUERY_SAME_PLANES | RANGE_QUERY_NOT_DEAD)) == 0)
+	{
+		return true;
+	}
+
+	GameObject * pObject = CsolExtra::extraProxy<GameObject *>( pEntity );
+
+	if (pObject == NULL)
 	{
-		pEntAround = CsolExtra::extraProxy<GameObject *>( *it );
-		if( pEntAround != NULL && this->isSamePlanesExt( *it ))
+		return false;
+	}
+
+	if (query.utypeMask != 0)
+	{
+		int utype = pObject->utype();
+
+		if (utype < 0 || utype >= 64 ||
+				(query.utypeMask & (uint64( 1 ) << utype)) == 0)
 		{
-			PyList_Append( pNewList, *it );
+			return false;
 		}
 	}
-	
-	return pNewList;
+
+	if ((query.flags & RANGE_QUERY_SAME_PLANES) &&
+			pObject->getPlanesID() != planesID)
+	{
+		return false;
+	}
+
+	if ((query.flags & RANGE_QUERY_NOT_DEAD) &&
+			pObject->hasState() &&
+			pObject->state() == ENTITY_STATE_DEAD)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+/// The candidates of the last query. This is kept, so that its memory is
+/// reused by later queries. It is only used by the outermost query, since
+/// the filters may call into script that makes another.
+RangeCandidates s_rangeCandidates;
+bool s_isRangeCandidatesInUse = false;
+
+} // anonymous namespace
+
+
+/**
+ *	This method finds the entities within range that pass the filters of the
+ *	given query. The range and the flags that only need the entity are
+ *	checked while the range list is traversed, and the rest straight after,
+ *	so no Python objects are made for entities that do not pass.
+ *
+ *	The distance is measured in 3D from the query's centre, which is the
+ *	position of this entity unless one is given.
+ *
+ *	Getting the extras for the filters may call into script, which may make
+ *	another query or destroy entities. Entities destroyed before the query
+ *	ends are left out.
+ *
+ *	@param query	The range, centre and filters.
+ *	@param result	The entities are added to this, which may be reused
+ *					between calls to avoid allocating. If query.maxCount is
+ *					above 0, only the nearest maxCount are added, nearest
+ *					first. Otherwise they are in no particular order.
+ *
+ *	@return	The number of entities added.
+ */
+int GameObject::queryEntitiesInRange( const RangeQuery & query,
+	EntityList & result )
+{
+	const Vector3 & selfPos = entity_.position();
+	const Vector3 & centre = query.pCentre ? *query.pCentre : selfPos;
+
+	// The square searched is around this entity, so it has to be big enough
+	// to hold the range around the centre.
+	float squareRange = query.range;
+
+	if (query.pCentre)
+	{
+		squareRange += std::max( fabsf( centre.x - selfPos.x ),
+			fabsf( centre.z - selfPos.z ) );
+	}
+
+	long planesID = (query.flags & RANGE_QUERY_SAME_PLANES) ?
+		this->getPlanesID() : 0;
+
+	RangeCandidates nestedCandidates;
+	bool isOutermost = !s_isRangeCandidatesInUse;
+	RangeCandidates & candidates =
+		isOutermost ? s_rangeCandidates : nestedCandidates;
+	s_isRangeCandidatesInUse = true;
+	candidates.clear();
+
+	RangeVisitor visitor( entity_, query, centre, candidates );
+	entity_.findEntitiesInSquare( squareRange, visitor );
+
+	// Filter the candidates in place. When there is a maximum count, the
+	// front of the candidates is kept as a max-heap of the nearest, so that
+	// the farthest is replaced whenever a nearer entity passes.
+	RangeCandidates::iterator heapEnd = candidates.begin();
+
+	for (RangeCandidates::iterator iter = candidates.begin();
+			iter != candidates.end(); ++iter)
+	{
+		// The script of an earlier candidate may have destroyed this one.
+		if (iter->pEntity->isDestroyed())
+		{
+			continue;
+		}
+
+		if (query.maxCount > 0 && heapEnd - candidates.begin() == query.maxCount)
+		{
+			if (!(*iter < candidates.front()) ||
+				!passesExtraFilters( iter->pEntity.get(), query,
+					planesID ))
+			{
+				continue;
+			}
+
+			std::pop_heap( candidates.begin(), heapEnd );
+			*(heapEnd - 1) = *iter;
+			std::push_heap( candidates.begin(), heapEnd );
+		}
+		else if (passesExtraFilters( iter->pEntity.get(), query, planesID ))
+		{
+			*heapEnd++ = *iter;
+
+			if (query.maxCount > 0)
+			{
+				std::push_heap( candidates.begin(), heapEnd );
+			}
+		}
+	}
+
+	candidates.erase( heapEnd, candidates.end() );
+
+	if (query.maxCount > 0)
+	{
+		std::sort_heap( candidates.begin(), candidates.end() );
+	}
+
+	int numAdded = 0;
+
+	for (RangeCandidates::const_iterator iter = candidates.begin();
+			iter != candidates.end(); ++iter)
+	{
+		// This may also have been destroyed after it passed.
+		if (!iter->pEntity->isDestroyed())
+		{
+			result.push_back( iter->pEntity.get() );
+			++numAdded;
+		}
+	}
+
+	// The entities are released, but the memory is kept.
+	candidates.clear();
+
+	if (isOutermost)
+	{
+		s_isRangeCandidatesInUse = false;
+	}
+
+	return numAdded;
+}
+
+
+/**
+ *	This method is the script interface to queryEntitiesInRange.
+ *
+ *	@param range	The range to search.
+ *	@param pUTypes	A sequence of the utypes to include, or None for all.
+ *	@param flags	A combination of the RANGE_QUERY_* flags.
+ *	@param maxCount	If above 0, only this many of the nearest are returned,
+ *					nearest first.
+ *	@param pPos		The centre of the search, or None for this entity.
+ *
+ *	@return	A tuple of the entities.
+ */
+PyObject * GameObject::entitiesInRangeFiltered( float range,
+	PyObjectPtr pUTypes, int flags, int maxCount, PyObjectPtr pPos )
+{
+	RangeQuery query;
+	query.range = range;
+	query.flags = flags;
+	query.maxCount = maxCount;
+
+	Vector3 centre;
+
+	if (pPos && pPos.get() != Py_None)
+	{
+		if (Script::setData( pPos.get(), centre,
+				"entitiesInRangeFiltered position" ) != 0)
+		{
+			return NULL;
+		}
+
+		query.pCentre = &centre;
+	}
+
+	if (pUTypes && pUTypes.get() != Py_None)
+	{
+		PyObject * pSeq = PySequence_Fast( pUTypes.get(),
+			"entitiesInRangeFiltered utypes must be a sequence" );
+
+		if (pSeq == NULL)
+		{
+			return NULL;
+		}
+
+		for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE( pSeq ); ++i)
+		{
+			long utype = PyInt_AsLong( PySequence_Fast_GET_ITEM( pSeq, i ) );
+
+			if (utype >= 0 && utype < 64)
+			{
+				query.utypeMask |= uint64( 1 ) << utype;
+			}
+		}
+
+		Py_DECREF( pSeq );
+
+		if (PyErr_Occurred())
+		{
+			return NULL;
+		}
+
+		// None of the given utypes can match.
+		if (query.utypeMask == 0)
+		{
+			return PyTuple_New( 0 );
+		}
+	}
+
+	EntityList entities;
+
+	this->queryEntitiesInRange( query, entities );
+
+	PyObject * pTuple = PyTuple_New( entities.size() );
+
+	for (size_t i = 0; i < entities.size(); ++i)
+	{
+		Py_INCREF( entities[i] );
+		PyTuple_SET_ITEM( pTuple, i, entities[i] );
+	}
+
+	return pTuple;
 }
 
 // תpositionΪǰentityڿռĵ
@@ -384,6 +751,83 @@ PyObject *GameObject::moveToPointObstacle_cpp( Vector3 destination,
 	return Script::getData( entity_.addController( new MoveToPointController( adrustDstPos, "", 0, velocity, faceMovement, moveVertically ), userArg ) );
 }
 
+/**
+ *	This method adds a controller that calls back the entity when any of the
+ *	given entities comes within or goes beyond the range.
+ *
+ *	@param range		The range in metres.
+ *	@param pEntityIDs	A sequence of the ids of the entities to watch.
+ *	@param userArg		The user argument of the controller.
+ *
+ *	@return The id of the controller.
+ *
+ *	@see DistanceController
+ */
+PyObject * GameObject::addDistanceDetecter_cpp( float range,
+		PyObjectPtr pEntityIDs, int userArg )
+{
+	if (!entity_.isReal())
+	{
+		PyErr_SetString( PyExc_TypeError,
+			"Entity.addDistanceDetecter_cpp can only be called on a real entity" );
+		return NULL;
+	}
+
+	DistanceController::Targets targets;
+
+	if (!DistanceController::readTargets( pEntityIDs.get(), targets ))
+	{
+		return NULL;
+	}
+
+	return Script::getData( entity_.addController(
+		new DistanceController( range, targets ), userArg ) );
+}
+
+
+/**
+ *	This method replaces the entities watched by a controller added with
+ *	addDistanceDetecter_cpp.
+ *
+ *	@param controllerID	The id of the controller.
+ *	@param pEntityIDs	A sequence of the ids of the entities to watch.
+ */
+PyObject * GameObject::setDistanceTargets_cpp( int controllerID,
+		PyObjectPtr pEntityIDs )
+{
+	if (!entity_.isReal())
+	{
+		PyErr_SetString( PyExc_TypeError,
+			"Entity.setDistanceTargets_cpp can only be called on a real entity" );
+		return NULL;
+	}
+
+	Controllers::iterator iter =
+		entity_.controllers().find( ControllerID( controllerID ) );
+
+	DistanceController * pController = (iter != entity_.controllers().end()) ?
+		dynamic_cast< DistanceController * >( iter->second.get() ) : NULL;
+
+	if (pController == NULL)
+	{
+		PyErr_Format( PyExc_ValueError,
+			"Entity.setDistanceTargets_cpp: %d is not a distance controller",
+			controllerID );
+		return NULL;
+	}
+
+	DistanceController::Targets targets;
+
+	if (!DistanceController::readTargets( pEntityIDs.get(), targets ))
+	{
+		return NULL;
+	}
+
+	pController->setTargets( targets );
+
+	Py_Return;
+}
+
 std::string GameObject::testPropertyIndex( const char * name )
 {
 	std::ostringstream report;
@@ -58,12 +58,26 @@ public:
 							float distance = 0.5,
 							bool faceMovement = true,
 							bool moveVertically = false );
+
+	PyObject * addDistanceDetecter_cpp( float range, PyObjectPtr pEntityIDs,
+		int userArg );
+	PyObject * setDistanceTargets_cpp( int controllerID,
+		PyObjectPtr pEntityIDs );
 public:
 	void setTemp(const char *, int);							//keyֵַͣ͵ʱ
 	int queryTemp(const char *, int);							//ڲѯkeyʱֵַͣ͵ʱ
 
     bool hasState() { return index_state_ == -1 ? false:true; }
 
+    inline int state()
+    {
+        if(index_state_ == -1)
+            return 0;
+
+        PyObjectPtr o = entity_.propertyByLocalIndex(index_state_);
+        return PyInt_AsLong(o.getObject());
+    }
+
     inline int64 flags()
     {
         if(index_GameObject_flags_ == -1)
@@ -95,6 +109,29 @@ public:
 	bool isSamePlanesExt( Entity * pEntity );
 	PyObject* entitiesInRangeExt( float fRange, PyObjectPtr pEntityName, PyObjectPtr pPos );
 
+	/**
+	 *	This structure describes a filtered range query.
+	 *
+	 *	@see GameObject::queryEntitiesInRange
+	 */
+	struct RangeQuery
+	{
+		RangeQuery() :
+			range( 0.f ), pCentre( NULL ), utypeMask( 0 ), flags( 0 ),
+			maxCount( 0 )
+		{}
+
+		float			range;
+		const Vector3 *	pCentre;	///< NULL for the position of the entity.
+		uint64			utypeMask;	///< Bit (1 << utype) of each utype, or 0.
+		int				flags;		///< The RANGE_QUERY_* flags of csdefine.
+		int				maxCount;	///< Only the nearest this many, if above 0.
+	};
+
+	int queryEntitiesInRange( const RangeQuery & query, EntityList & result );
+	PyObject * entitiesInRangeFiltered( float range, PyObjectPtr pUTypes,
+		int flags, int maxCount, PyObjectPtr pPos );
+
     //ȡdef
     int getPropertyIndex(const std::string &name);
     int getPropertyLocalIndex( const char * name ) const;
@@ -0,0 +1,52 @@
+#include "route_graph_ticker.hpp"
+
+#include "cellapp/cellapp.hpp"
+#include "waypoint/chunk_wpset_graph.hpp"
+
+DECLARE_DEBUG_COMPONENT( 0 )
+
+
+/**
+ *	Constructor.
+ */
+RouteGraphTicker::RouteGraphTicker() :
+	timerID_( 0 )
+{
+}
+
+
+/**
+ *	This static method returns the singleton instance of this class.
+ */
+RouteGraphTicker & RouteGraphTicker::instance()
+{
+	static RouteGraphTicker s_instance;
+	return s_instance;
+}
+
+
+/**
+ *	This method starts the timer, if it has not been started already. The
+ *	graphs are ticked every game tick. A tick only copies the waypoint sets
+ *	that have changed, and only when it starts an update, so it is cheap
+ *	when there is nothing to do.
+ */
+void RouteGraphTicker::start()
+{
+	if (timerID_ == 0)
+	{
+		CellApp & app = CellApp::instance();
+		timerID_ = app.timeQueue().add( app.time() + 1, 1, this, NULL );
+	}
+}
+
+
+/**
+ *	This method is called every game tick to tick the route graphs.
+ */
+void RouteGraphTicker::handleTimeout( TimeQueueId id, void * pUser )
+{
+	ChunkWPSetGraph::tick();
+}
+
+// route_graph_ticker.cpp
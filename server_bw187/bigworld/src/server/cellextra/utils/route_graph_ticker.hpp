@@ -0,0 +1,31 @@
+#ifndef SERVER_CELLEXTRA_ROUTE_GRAPH_TICKER_HPP
+#define SERVER_CELLEXTRA_ROUTE_GRAPH_TICKER_HPP
+
+#include "cstdmf/time_queue.hpp"
+
+/**
+ *	This class ticks the waypoint set route graphs of the spaces on this
+ *	CellApp from a timer. Each tick collects the updates and landmarks that
+ *	the graphs' threads have finished, and starts the next ones once their
+ *	spaces have settled.
+ *
+ *	The timer is started with the first CsolExtra, since the graphs are only
+ *	queried by entities navigating.
+ */
+class RouteGraphTicker : public TimeQueueHandler
+{
+public:
+	RouteGraphTicker();
+
+	void start();
+
+	static RouteGraphTicker & instance();
+
+private:
+	virtual void handleTimeout( TimeQueueId id, void * pUser );
+	virtual void onRelease( TimeQueueId id, void * pUser ) {}
+
+	TimeQueueId		timerID_;
+};
+
+#endif // SERVER_CELLEXTRA_ROUTE_GRAPH_TICKER_HPP
@@ -128,7 +128,9 @@ bool EntityDefs::init( DataSectionPtr pEntitiesSection,
 	} helper;
 
 	MF_ASSERT( (entityDescriptionMap_.size() == 0) && pEntitiesSection );
-	if (!entityDescriptionMap_.parse( pEntitiesSection ))
+	if (!entityDescriptionMap_.parse( pEntitiesSection,
+			BWConfig::get( "entityDefLoadingThreads",
+				EntityDescriptionMap::DEFAULT_LOADING_THREADS ) ))
 	{
 		ERROR_MSG( "EntityDefs::init: "
 				"Could not parse 'entities/entities.xml'\n" );
@@ -2325,9 +2327,21 @@ private:
 
 void WriteEntityHandler::writeEntity( BinaryIStream & data, ObjectID objectID )
 {
+	bool isDelta = (flags_ & WRITE_DELTA_DATA) != 0;
+
+	if (isDelta && !ekey_.dbID)
+	{
+		// There is nothing to apply the delta to.
+		ERROR_MSG( "Database::writeEntity: Cannot write changed properties "
+			"of new entity of type %d\n", ekey_.typeID );
+		data.retrieve( data.remainingLength() );
+		this->finalise( false );
+		return;
+	}
+
 	EntityDBRecordIn erec;
 	if (flags_ & WRITE_ALL_DATA)
-		erec.provideStrm( data );
+		erec.provideStrm( data, isDelta );
 
 	if (flags_ & WRITE_LOG_OFF)
 	{
@@ -3608,6 +3622,7 @@ public:
 	virtual ~SelfTest() {}
 
 	void nextStep();
+	void writeDelta();
 
 	// IDatabase::IGetEntityHandler overrides
 	virtual EntityDBKey& key()					{	return ekey_;	}
@@ -3858,6 +3873,34 @@ void SelfTest::nextStep()
 			db_.delEntity( ekey, *this );
 			break;
 		}
+		case 28:
+		{	// Create new entity by stream (again)
+			EntityDBRecordIn erec;
+			erec.provideStrm( entityData_ );
+			EntityDBKey	ekey( entityTypeID_, 0 );
+			db_.putEntity( ekey, erec, *this );
+			break;
+		}
+		case 29:
+		{	// Write only a changed property
+			this->writeDelta();
+			break;
+		}
+		case 30:
+		{	// Get entity data by ID, with the change
+			outRec_.unprovideBaseMB();
+			tmpEntityData_.reset();
+			outRec_.provideStrm( tmpEntityData_ );
+			ekey_ = EntityDBKey( entityTypeID_, newEntityID_ );
+			db_.getEntity( *this );
+			break;
+		}
+		case 31:
+		{	// Delete entity by ID (again)
+			EntityDBKey	ekey( entityTypeID_, newEntityID_ );
+			db_.delEntity( ekey, *this );
+			break;
+		}
 		default:
 			TRACE_MSG( "SelfTest::nextStep - completed\n", stepNum_ );
 			delete this;
@@ -3865,6 +3908,108 @@ void SelfTest::nextStep()
 	}
 }
 
+/**
+ *	This method changes a property of the test entity through a
+ *	DirtyPropertyOwner, as a base does, and writes only that property. The
+ *	full data that the database should then have is left in entityData_.
+ */
+void SelfTest::writeDelta()
+{
+	const EntityDescription & desc =
+		Database::instance().getEntityDefs().getEntityDescription(
+			entityTypeID_ );
+	const int dataDomains = EntityDescription::BASE_DATA |
+		EntityDescription::CELL_DATA | EntityDescription::ONLY_PERSISTENT_DATA;
+
+	PyObjectPtr pDict( PyDict_New(), PyObjectPtr::STEAL_REFERENCE );
+	bool readEntityData =
+		desc.readStreamToDict( entityData_, dataDomains, pDict.get() );
+	MF_ASSERT( readEntityData );
+
+	// The non-configurable cell properties follow. They are always sent.
+	int tailLength = entityData_.remainingLength();
+	std::string tail( (const char *)entityData_.retrieve( tailLength ),
+		tailLength );
+
+	// The properties are streamed from the attributes of an entity.
+	PyObjectPtr pBases( PyTuple_New( 0 ), PyObjectPtr::STEAL_REFERENCE );
+	PyObjectPtr pClassDict( PyDict_New(), PyObjectPtr::STEAL_REFERENCE );
+	PyObjectPtr pClassName( PyString_FromString( "SelfTestEntity" ),
+		PyObjectPtr::STEAL_REFERENCE );
+	PyObjectPtr pClass( PyClass_New( pBases.get(), pClassDict.get(),
+			pClassName.get() ),
+		PyObjectPtr::STEAL_REFERENCE );
+	PyObjectPtr pEntity( PyInstance_NewRaw( pClass.get(), pDict.get() ),
+		PyObjectPtr::STEAL_REFERENCE );
+	MF_ASSERT( pEntity );
+
+	EntityDescription::DirtyProperties dirtyProperties;
+	dirtyProperties.init( desc );
+	EntityDescription::DirtyPropertyOwner owner( desc, dirtyProperties );
+
+	// Increment the first integer property, or failing that, set the first
+	// property to what it already is.
+	DataDescription * pChanged = NULL;
+	PyObjectPtr pNewValue;
+
+	for (unsigned int i = 0; i < desc.propertyCount(); ++i)
+	{
+		DataDescription * pDD = desc.property( i );
+		PyObject * pValue =
+			PyDict_GetItemString( pDict.get(), pDD->name().c_str() );
+
+		if (pValue == NULL)
+		{
+			continue;
+		}
+
+		if (PyInt_CheckExact( pValue ))
+		{
+			pChanged = pDD;
+			pNewValue = PyObjectPtr(
+				PyInt_FromLong( PyInt_AS_LONG( pValue ) + 1 ),
+				PyObjectPtr::STEAL_REFERENCE );
+			break;
+		}
+
+		if (pChanged == NULL)
+		{
+			pChanged = pDD;
+			pNewValue = pValue;
+		}
+	}
+
+	MF_ASSERT( pChanged != NULL );
+
+	PyObjectPtr pAttached = owner.attach( *pChanged, pNewValue.get() );
+	MF_ASSERT( pAttached );
+	PyDict_SetItemString( pDict.get(), pChanged->name().c_str(),
+		pAttached.get() );
+
+	MF_ASSERT( dirtyProperties.isDirty( *pChanged ) );
+	TRACE_MSG( "SelfTest::writeDelta - changed %s\n",
+		pChanged->name().c_str() );
+
+	MemoryOStream delta;
+	bool addedDelta = desc.addDirtyAttributesToStream( pEntity.get(), delta,
+		dataDomains, dirtyProperties );
+	MF_ASSERT( addedDelta );
+	delta.addBlob( tail.data(), tail.size() );
+
+	entityData_.reset();
+	bool addedEntityData = desc.addAttributesToStream( pEntity.get(),
+		entityData_, dataDomains );
+	MF_ASSERT( addedEntityData );
+	entityData_.addBlob( tail.data(), tail.size() );
+
+	dirtyProperties.clear();
+
+	EntityDBRecordIn erec;
+	erec.provideStrm( delta, /* isDelta: */ true );
+	EntityDBKey	ekey( entityTypeID_, newEntityID_ );
+	db_.putEntity( ekey, erec, *this );
+}
+
 void SelfTest::onGetEntityComplete( bool isOK )
 {
 	switch (stepNum_)
@@ -3974,6 +4119,14 @@ void SelfTest::onGetEntityComplete( bool isOK )
 					(memcmp( entityData_.data(), tmpEntityData_.data(), entityData_.size()) == 0) );
 			break;
 		}
+		case 30:
+		{
+			bool getEntityDataWithDelta = isOK;
+			MF_ASSERT( getEntityDataWithDelta &&
+					(entityData_.size() == tmpEntityData_.size()) &&
+					(memcmp( entityData_.data(), tmpEntityData_.data(), entityData_.size()) == 0) );
+			break;
+		}
 		default:
 			MF_ASSERT( false );
 			break;
@@ -4041,6 +4194,22 @@ void SelfTest::onPutEntityComplete( bool isOK, DatabaseID dbID )
 			entityData_.rewind();
 			break;
 		}
+		case 28:
+		{
+			bool putEntityDataAgain = isOK;
+			MF_ASSERT( putEntityDataAgain && (dbID != 0) );
+			newEntityID_ = dbID;
+
+			entityData_.rewind();
+			break;
+		}
+		case 29:
+		{
+			bool putEntityDelta = isOK;
+			MF_ASSERT( putEntityDelta );
+			entityData_.rewind();
+			break;
+		}
 		default:
 			MF_ASSERT( false );
 			break;
@@ -4077,6 +4246,12 @@ void SelfTest::onDelEntityComplete( bool isOK )
 			MF_ASSERT( !delNonExistEntityByID );
 			break;
 		}
+		case 31:
+		{
+			bool delEntityByIDAgain = isOK;
+			MF_ASSERT( delEntityByIDAgain );
+			break;
+		}
 		default:
 			MF_ASSERT( false );
 			break;
@@ -116,21 +116,28 @@ public:
  *	BinaryOStream depending on the direction of the exchange. The stream is
  *	optional. If it is not provided, then the property data of the entity is
  *	neither set nor retrieved.
+ *
+ *	An input stream may be a delta, holding only the properties that changed
+ *	(see WRITE_DELTA_DATA). Databases that cannot apply a delta should fail
+ *	the operation.
  */
 template < class STRM_TYPE >
 class EntityDBRecord : public EntityDBRecordBase
 {
 	STRM_TYPE*	pStrm_;	// Optional stream containing entity properties
+	bool		isDelta_;
 
 public:
-	EntityDBRecord() : EntityDBRecordBase(), pStrm_(0)	{}
+	EntityDBRecord() : EntityDBRecordBase(), pStrm_(0), isDelta_(false)	{}
 
-	void provideStrm( STRM_TYPE& strm )
-	{	pStrm_ = &strm;	}
+	void provideStrm( STRM_TYPE& strm, bool isDelta = false )
+	{	pStrm_ = &strm;	isDelta_ = isDelta;	}
 	void unprovideStrm()
-	{	pStrm_ = 0;	}
+	{	pStrm_ = 0;	isDelta_ = false;	}
 	bool isStrmProvided() const
 	{	return pStrm_ != 0;	}
+	bool isDelta() const
+	{	return isDelta_;	}
 	STRM_TYPE& getStrm() const
 	{
 		MF_ASSERT(isStrmProvided());
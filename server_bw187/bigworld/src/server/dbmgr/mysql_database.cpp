@@ -3417,6 +3417,7 @@ class PutEntityTask : public THREADTASK
 	};
 
 	bool							writeEntityData_;
+	bool							isDelta_;
 	BaseRefAction					baseRefAction_;
 	IDatabase::IPutEntityHandler&	handler_;
 	BufferedEntityTasks *			pBufferedEntityTasks_;
@@ -3442,7 +3443,7 @@ PutEntityTask<THREADTASK>::PutEntityTask( typename THREADTASK::OwnerType& owner,
 							  EntityDBRecordIn& erec,
 							  IDatabase::IPutEntityHandler& handler,
 							  BufferedEntityTasks * pBufferedEntityTasks )
-	: THREADTASK(owner), writeEntityData_(false),
+	: THREADTASK(owner), writeEntityData_(false), isDelta_(false),
 	baseRefAction_(BaseRefActionNone), handler_(handler),
 	pBufferedEntityTasks_( pBufferedEntityTasks )
 {
@@ -3458,8 +3459,20 @@ PutEntityTask<THREADTASK>::PutEntityTask( typename THREADTASK::OwnerType& owner,
 	// Store entity data inside bindings, ready to be put into the database.
 	if (erec.isStrmProvided())
 	{
-		threadData.typeMapping.streamToBound( ekey.typeID, ekey.dbID,
-												erec.getStrm() );
+		if (erec.isDelta())
+		{
+			// Only the properties that changed are written. This needs an
+			// existing entity.
+			threadData.isOK = threadData.typeMapping.deltaStreamToBound(
+					ekey.typeID, ekey.dbID, erec.getStrm() ) &&
+				(ekey.dbID != 0);
+			isDelta_ = true;
+		}
+		else
+		{
+			threadData.typeMapping.streamToBound( ekey.typeID, ekey.dbID,
+													erec.getStrm() );
+		}
 		writeEntityData_ = true;
 		owner.onPutEntityOpStarted( ekey.typeID, ekey.dbID );
 	}
@@ -3498,9 +3511,14 @@ void PutEntityTask<THREADTASK>::run()
 			bool				isOK = threadData.isOK;
 			MySqlTransaction	transaction( threadData.connection );
 			bool				definitelyExists = false;
-			if (writeEntityData_)
+			if (writeEntityData_ && isOK)
 			{
-				if (dbID)
+				if (isDelta_)
+				{
+					isOK = threadData.typeMapping.updateEntityDelta(
+								transaction, typeID, dbID );
+				}
+				else if (dbID)
 				{
 					isOK = threadData.typeMapping.updateEntity( transaction,
 																typeID, dbID );
@@ -3689,7 +3707,7 @@ private:
 		{
 			BinaryIStream & stream = erec.getStrm();
 			stream_.transfer( stream, stream.remainingLength() );
-			erec_.provideStrm( stream_ );
+			erec_.provideStrm( stream_, erec.isDelta() );
 		}
 	}
 
@@ -3744,6 +3762,17 @@ void OldMySqlDatabase::putEntity( const EntityDBKey& ekey,
 	const TypeIDSet& changedTypes = pMigrationTask_->getChangedEntitiesOldTypes();
 	if ( changedTypes.find( ekey.typeID ) != changedTypes.end() )
 	{
+		if (erec.isStrmProvided() && erec.isDelta())
+		{
+			// The delta is for the new definition of the entity.
+			WARNING_MSG( "OldMySqlDatabase::putEntity: Cannot write changed "
+					"properties of entity %"FMT_DBID" of type %d while its "
+					"tables are being migrated\n", ekey.dbID, ekey.typeID );
+			erec.getStrm().retrieve( erec.getStrm().remainingLength() );
+			handler.onPutEntityComplete( false, ekey.dbID );
+			return;
+		}
+
 		PutEntityTask<OldMySqlThreadTask>* pTask =
 			new PutEntityTask<OldMySqlThreadTask>( *this, ekey, erec, handler, NULL );
 		pTask->doTask();
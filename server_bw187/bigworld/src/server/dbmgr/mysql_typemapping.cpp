@@ -4136,7 +4136,11 @@ MySqlEntityTypeMapping::MySqlEntityTypeMapping( MySql& con,
 	propsNameMap_(),
 	pInsertWithIDStmt_( NULL ),
 	pSelectNextIDStmt_( NULL ),
-	pNameProp_(0)
+	pNameProp_(0),
+	connection_( con ),
+	tableName_( tbl ),
+	deltaProps_(),
+	deltaUpdateStmts_()
 {
 	MySqlBindings b;
 
@@ -4478,6 +4482,49 @@ bool MySqlBindStreamReader::visit( const DataDescription& propDesc )
 }
 
 
+/**
+ *	This visitor class is used by MySqlEntityTypeMapping::deltaStreamToBound()
+ *	to read the changed properties of an entity from a stream into MySQL
+ *	bindings, and to collect the mappings that were set.
+ */
+class MySqlBindDeltaStreamReader : public IDataDescriptionVisitor
+{
+	MySqlEntityTypeMapping& entityTypeMap_;
+	BinaryIStream & stream_;
+	std::set< PropertyMapping* > & changedProps_;
+
+public:
+	MySqlBindDeltaStreamReader( MySqlEntityTypeMapping& entityTypeMap,
+		   BinaryIStream & stream,
+		   std::set< PropertyMapping* > & changedProps ) :
+		entityTypeMap_( entityTypeMap ),
+		stream_( stream ),
+		changedProps_( changedProps )
+	{}
+
+	// Override method from IDataDescriptionVisitor
+	virtual bool visit( const DataDescription& propDesc )
+	{
+		PropertyMapping* pPropMap =
+			entityTypeMap_.getPropMapByName( propDesc.name() );
+
+		if (pPropMap)
+		{
+			pPropMap->streamToBound( stream_ );
+			changedProps_.insert( pPropMap );
+		}
+		else
+		{
+			WARNING_MSG( "MySqlBindDeltaStreamReader::visit: Ignoring value "
+						"for property %s\n", propDesc.name().c_str() );
+			propDesc.createFromStream( stream_, false );
+		}
+
+		return true;
+	}
+};
+
+
 /**
  *	This visitor class is used by MySqlEntityTypeMapping::streamToBound()
  *	to write entity data to a stream.
@@ -4520,6 +4567,18 @@ bool MySqlBindStreamWriter::visit( const DataDescription& propDesc )
 	return true;
 }
 
+/**
+ *	Destructor.
+ */
+MySqlEntityTypeMapping::~MySqlEntityTypeMapping()
+{
+	for ( DeltaUpdateStmts::iterator i = deltaUpdateStmts_.begin();
+		i != deltaUpdateStmts_.end(); ++i )
+	{
+		delete i->second;
+	}
+}
+
 /**
  *	This method transfers the entity's data from the stream into MySQL bindings.
  */
@@ -4540,6 +4599,42 @@ void MySqlEntityTypeMapping::streamToBound( BinaryIStream& strm )
 	}
 }
 
+/**
+ *	This method transfers the properties in a delta of the entity's data from
+ *	the stream into MySQL bindings, and records which properties they were for
+ *	updateDelta(). The delta is as written by
+ *	EntityDescription::addDirtyAttributesToStream(), followed by the
+ *	non-configurable cell properties as usual.
+ */
+void MySqlEntityTypeMapping::deltaStreamToBound( BinaryIStream& strm )
+{
+	std::set< PropertyMapping* > changedProps;
+
+	MySqlBindDeltaStreamReader visitor( *this, strm, changedProps );
+	description_.visitDelta( strm,
+		EntityDescription::BASE_DATA | EntityDescription::CELL_DATA |
+		EntityDescription::ONLY_PERSISTENT_DATA, visitor );
+
+	// The non-configurable cell properties are always sent.
+	if (description_.hasCellScript())
+	{
+		for ( int i = 0; i < NumFixedCellProps; ++i )
+		{
+			fixedCellProps_[i]->streamToBound( strm );
+			changedProps.insert( fixedCellProps_[i] );
+		}
+	}
+
+	deltaProps_.resize( properties_.size() );
+
+	for ( size_t i = 0; i < properties_.size(); ++i )
+	{
+		deltaProps_[i] =
+			(changedProps.find( properties_[i].getObject() ) !=
+				changedProps.end());
+	}
+}
+
 /**
  *	This method transfers the data already in MySQL bindings into the stream.
  *	Entity data must be already set in bindings e.g. via getPropsByID() or
@@ -4644,6 +4739,100 @@ bool MySqlEntityTypeMapping::update( MySqlTransaction& transaction,
 	return isOK;
 }
 
+/**
+ * This method updates the properties of an existing entity that were set by
+ * the last call to deltaStreamToBound(). The other columns are left alone.
+ *
+ * @param	transaction	Transaction to use when updating the database.
+ * @param	dbID		The database ID if the entity.
+ * @return	Returns true if the entity was updated. False if the entity
+ * doesn't exist.
+ */
+bool MySqlEntityTypeMapping::updateDelta( MySqlTransaction& transaction,
+									 DatabaseID dbID )
+{
+	bool isOK;
+	MySqlStatement* pStmt = this->getDeltaUpdateStmt();
+
+	if (pStmt)
+	{
+		id_ = dbID;
+		transaction.execute( *pStmt );
+
+		// See update() for why affectedRows() is not used.
+		const char* infoStr = transaction.info();
+		isOK = (infoStr) && (atol( infoStr + 14 ) == 1);
+	}
+	else
+	{
+		// None of the changed properties have columns in the main table.
+		isOK = this->checkExists( transaction, dbID );
+	}
+
+	if (isOK)
+	{
+		// Update child tables of the changed properties.
+		for ( size_t i = 0; i < properties_.size(); ++i )
+		{
+			if (deltaProps_[i])
+				properties_[i]->updateTable( transaction, dbID );
+		}
+	}
+
+	return isOK;
+}
+
+/**
+ * This method returns the statement that updates the columns of the properties
+ * set by the last call to deltaStreamToBound(), creating it if this set of
+ * properties has not been updated before.
+ *
+ * @return	The statement, or NULL if none of the properties have columns in
+ * the main table.
+ */
+MySqlStatement* MySqlEntityTypeMapping::getDeltaUpdateStmt()
+{
+	DeltaUpdateStmts::iterator found = deltaUpdateStmts_.find( deltaProps_ );
+	if (found != deltaUpdateStmts_.end())
+		return found->second;
+
+	// Entities usually change the same few properties, so there should not be
+	// many of these. Start again in case there are.
+	const size_t MAX_DELTA_UPDATE_STMTS = 64;
+	if (deltaUpdateStmts_.size() >= MAX_DELTA_UPDATE_STMTS)
+	{
+		for ( DeltaUpdateStmts::iterator i = deltaUpdateStmts_.begin();
+			i != deltaUpdateStmts_.end(); ++i )
+		{
+			delete i->second;
+		}
+		deltaUpdateStmts_.clear();
+	}
+
+	PropertyMappings changedProps;
+	for ( size_t i = 0; i < properties_.size(); ++i )
+	{
+		if (deltaProps_[i])
+			changedProps.push_back( properties_[i] );
+	}
+
+	MySqlStatement* pStmt = NULL;
+	std::string stmtStr = createUpdateStatement( tableName_, changedProps );
+	if (!stmtStr.empty())
+	{
+		pStmt = new MySqlStatement( connection_, stmtStr );
+
+		MySqlBindings b;
+		addPropertyBindings( b, changedProps );
+		b << id_;
+		pStmt->bindParams( b );
+	}
+
+	deltaUpdateStmts_[ deltaProps_ ] = pStmt;
+
+	return pStmt;
+}
+
 /**
  * This method insert a new entity with a specific DBID into the database.
  * Entity data must be already set in bindings e.g. via streamToBound().
@@ -4998,6 +5187,30 @@ void MySqlTypeMapping::streamToBound( EntityTypeID typeID, DatabaseID dbID,
 	}
 }
 
+/**
+ *	This method sets the MySQL bindings for an update of only the properties
+ *	that changed.
+ *
+ *	@return	False if the delta cannot be applied. The stream is still read.
+ */
+bool MySqlTypeMapping::deltaStreamToBound( EntityTypeID typeID,
+		DatabaseID dbID, BinaryIStream& entityDataStrm )
+{
+	mappings_[typeID]->deltaStreamToBound( entityDataStrm );
+
+	// The temp tables are set from all of the properties.
+	if (pTempMappings_ &&
+			(pTempConverter_->getTempTypeID( typeID ) != INVALID_TYPEID))
+	{
+		WARNING_MSG( "MySqlTypeMapping::deltaStreamToBound: Cannot write "
+				"changed properties of entity %"FMT_DBID" of type %d while "
+				"its tables are being migrated\n", dbID, typeID );
+		return false;
+	}
+
+	return true;
+}
+
 /**
  *	This method sets the MySQL bindings for a base mailbox add/update operation.
  */
@@ -5046,6 +5259,16 @@ bool MySqlTypeMapping::updateEntity( MySqlTransaction& transaction,
 	return isOK;
 }
 
+/**
+ *	This method updates the properties of an entity that were set by
+ *	deltaStreamToBound().
+ */
+bool MySqlTypeMapping::updateEntityDelta( MySqlTransaction& transaction,
+									 EntityTypeID typeID, DatabaseID dbID )
+{
+	return mappings_[typeID]->updateDelta( transaction, dbID );
+}
+
 /**
  *	This methods stores new base mailbox for the given entity in the database.
  * 	If a base mailbox for the entity already exists, it is updated.
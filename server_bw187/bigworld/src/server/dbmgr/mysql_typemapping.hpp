@@ -18,6 +18,7 @@ criminal penalties as provided by law.
 #include "idatabase.hpp"
 #include "cstdmf/smartpointer.hpp"
 #include "pyscript/pyobject_plus.hpp"
+#include <map>
 #include <vector>
 #include <set>
 
@@ -543,10 +544,16 @@ public:
 	bool checkExists( MySqlTransaction& transaction, DatabaseID dbID );
 	bool deleteWithID( MySqlTransaction& t, DatabaseID id );
 
+	~MySqlEntityTypeMapping();
+
 	void streamToBound( BinaryIStream& strm );
 	DatabaseID insertNew( MySqlTransaction& transaction );
 	bool update( MySqlTransaction& transaction, DatabaseID dbID );
 
+	// Methods used for writing only the properties that changed
+	void deltaStreamToBound( BinaryIStream& strm );
+	bool updateDelta( MySqlTransaction& transaction, DatabaseID dbID );
+
 	bool getPropsByID( MySqlTransaction& transaction, DatabaseID dbID,
 		std::string& name );
 	DatabaseID getPropsByName( MySqlTransaction& transaction,
@@ -611,7 +618,16 @@ private:
 	// we cache what the EntityTypeID is in the database
 	int mappedType_;
 
+	// Update statements for the sets of properties that have been written by
+	// updateDelta(), and which properties were set by deltaStreamToBound().
+	MySql& connection_;
+	std::string tableName_;
+	std::vector< bool > deltaProps_;
+	typedef std::map< std::vector< bool >, MySqlStatement* > DeltaUpdateStmts;
+	DeltaUpdateStmts deltaUpdateStmts_;
+
 	bool getPropsImpl( MySqlTransaction& transaction, MySqlStatement& stmt );
+	MySqlStatement* getDeltaUpdateStmt();
 };
 
 class MySqlTypeMapping
@@ -643,6 +659,8 @@ public:
 	// Transfer data into MySQL bindings, ready for DB operation.
 	void streamToBound( EntityTypeID typeID, DatabaseID dbID,
 		BinaryIStream& entityDataStrm );
+	bool deltaStreamToBound( EntityTypeID typeID, DatabaseID dbID,
+		BinaryIStream& entityDataStrm );
 	void baseRefToBound( const EntityMailBoxRef& baseRef );
 	void logOnMappingToBound( const std::string& logOnName,
 		const std::string& password, EntityTypeID typeID,
@@ -653,6 +671,8 @@ public:
 	DatabaseID newEntity( MySqlTransaction& transaction, EntityTypeID typeID );
 	bool updateEntity( MySqlTransaction& transaction, EntityTypeID typeID,
 		DatabaseID dbID );
+	bool updateEntityDelta( MySqlTransaction& transaction,
+		EntityTypeID typeID, DatabaseID dbID );
 	void addLogOnRecord( MySqlTransaction&, EntityTypeID, DatabaseID );
 	void removeLogOnRecord( MySqlTransaction&, EntityTypeID, DatabaseID );
 	void setLogOnMapping( MySqlTransaction& transaction );
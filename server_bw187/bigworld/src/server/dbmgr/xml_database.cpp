@@ -527,9 +527,22 @@ void XMLDatabase::putEntity( const EntityDBKey& ekey, EntityDBRecordIn& erec,
 
 		// Read stream into new data section
 		DataSectionPtr pProps = pDB_->newSection( desc.name() );;
-		desc.readStreamToSection( erec.getStrm(),
-			EntityDescription::BASE_DATA | EntityDescription::CELL_DATA |
-			EntityDescription::ONLY_PERSISTENT_DATA, pProps );
+		if (erec.isDelta())
+		{
+			// Only the changed properties are on the stream.
+			if (pOldProps)
+				pProps->copy( pOldProps );
+
+			desc.readDeltaStreamToSection( erec.getStrm(),
+				EntityDescription::BASE_DATA | EntityDescription::CELL_DATA |
+				EntityDescription::ONLY_PERSISTENT_DATA, pProps );
+		}
+		else
+		{
+			desc.readStreamToSection( erec.getStrm(),
+				EntityDescription::BASE_DATA | EntityDescription::CELL_DATA |
+				EntityDescription::ONLY_PERSISTENT_DATA, pProps );
+		}
 
 		if (desc.hasCellScript())
 		{
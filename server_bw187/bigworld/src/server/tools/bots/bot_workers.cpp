@@ -0,0 +1,657 @@
+/******************************************************************************
+BigWorld Technology
+Copyright BigWorld Pty, Ltd.
+All Rights Reserved. Commercial in confidence.
+
+WARNING: This computer program is protected by copyright law and international
+treaties. Unauthorized use, reproduction or distribution of this program, or
+any portion of this program, may result in the imposition of civil and
+criminal penalties as provided by law.
+******************************************************************************/
+
+#include "bot_workers.hpp"
+
+#include "main_app.hpp"
+
+#include "cstdmf/memory_stream.hpp"
+#include "network/nub.hpp"
+#include "server/bwconfig.hpp"
+
+#ifdef unix
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
+
+DECLARE_DEBUG_COMPONENT2( "Bots", 0 )
+
+// -----------------------------------------------------------------------------
+// Section: Construction/Destruction
+// -----------------------------------------------------------------------------
+
+/**
+ *	Constructor.
+ */
+BotWorkers::BotWorkers() :
+	workers_(),
+	nextProcess_( 0 ),
+	index_( 0 ),
+	fd_( -1 ),
+	pNub_( NULL ),
+	buffer_()
+{
+}
+
+
+/**
+ *	Destructor. The master closes its sockets, which tells its workers to
+ *	shut down, and then waits for them to exit.
+ */
+BotWorkers::~BotWorkers()
+{
+#ifdef unix
+	// The nub has gone by now, so the sockets are just closed.
+	if (fd_ != -1)
+	{
+		close( fd_ );
+	}
+
+	for (Workers::iterator iter = workers_.begin();
+			iter != workers_.end(); ++iter)
+	{
+		if (iter->fd != -1)
+		{
+			close( iter->fd );
+		}
+	}
+
+	for (Workers::iterator iter = workers_.begin();
+			iter != workers_.end(); ++iter)
+	{
+		waitpid( iter->pid, NULL, 0 );
+	}
+#endif
+}
+
+
+/**
+ *	This static method returns the singleton instance of this class.
+ */
+BotWorkers & BotWorkers::instance()
+{
+	static BotWorkers s_instance;
+	return s_instance;
+}
+
+
+// -----------------------------------------------------------------------------
+// Section: Process management
+// -----------------------------------------------------------------------------
+
+/**
+ *	This method forks the worker processes, as set by bots/processes or the
+ *	-processes command line option. It must be called before the MainApp is
+ *	created, so that each process initialises everything itself.
+ *
+ *	@return	The index of the calling process, 0 in the master.
+ */
+int BotWorkers::spawn( int argc, char * argv[] )
+{
+	int numProcesses = BWConfig::get( "bots/processes", 1 );
+
+	for (int i = 0; i < argc; ++i)
+	{
+		if (strcmp( "-processes", argv[i] ) == 0 && i + 1 < argc)
+		{
+			numProcesses = atoi( argv[ i + 1 ] );
+		}
+	}
+
+	if (numProcesses <= 1)
+	{
+		return 0;
+	}
+
+#ifdef unix
+	// A worker that has died should not take the master down with it.
+	signal( SIGPIPE, SIG_IGN );
+
+	for (int i = 1; i < numProcesses; ++i)
+	{
+		int fds[2];
+
+		if (socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) != 0)
+		{
+			ERROR_MSG( "BotWorkers::spawn: socketpair failed: %s\n",
+				strerror( errno ) );
+			break;
+		}
+
+		pid_t pid = fork();
+
+		if (pid == 0)
+		{
+			close( fds[1] );
+
+			// The sockets to the workers forked before us must not stay open
+			// here, or those workers would never see their master go away.
+			for (Workers::iterator iter = workers_.begin();
+					iter != workers_.end(); ++iter)
+			{
+				close( iter->fd );
+			}
+
+			workers_.clear();
+			index_ = i;
+			fd_ = fds[0];
+
+			return index_;
+		}
+
+		close( fds[0] );
+
+		if (pid < 0)
+		{
+			ERROR_MSG( "BotWorkers::spawn: fork failed: %s\n",
+				strerror( errno ) );
+			close( fds[1] );
+			break;
+		}
+
+		Worker worker;
+		worker.pid = pid;
+		worker.fd = fds[1];
+		worker.hasStats = false;
+		workers_.push_back( worker );
+	}
+
+	INFO_MSG( "BotWorkers::spawn: Started %d worker processes\n",
+		this->numWorkers() );
+#else
+	WARNING_MSG( "BotWorkers::spawn: "
+		"Worker processes are not supported on this platform\n" );
+#endif
+
+	return 0;
+}
+
+
+/**
+ *	This method registers the sockets with the given nub, so that a worker
+ *	receives its commands from the master, and the master receives the stats
+ *	of its workers.
+ */
+void BotWorkers::attach( Mercury::Nub & nub )
+{
+	pNub_ = &nub;
+
+	if (fd_ != -1)
+	{
+		nub.registerFileDescriptor( fd_, this );
+	}
+
+	for (Workers::iterator iter = workers_.begin();
+			iter != workers_.end(); ++iter)
+	{
+		if (iter->fd != -1)
+		{
+			nub.registerFileDescriptor( iter->fd, this );
+		}
+	}
+}
+
+
+// -----------------------------------------------------------------------------
+// Section: Commands
+// -----------------------------------------------------------------------------
+
+/**
+ *	This method returns how many of the given number of bots belong to the
+ *	given process. Any remainder goes to the processes starting at first.
+ */
+int BotWorkers::share( int num, int process, int first ) const
+{
+	int numProcesses = this->numWorkers() + 1;
+	int offset = (process - first + numProcesses) % numProcesses;
+
+	return num / numProcesses + ((offset < num % numProcesses) ? 1 : 0);
+}
+
+
+/**
+ *	This method sends their share of new bots to the workers. Any remainder
+ *	goes to the processes starting at nextProcess_, so that repeatedly adding
+ *	one bot stays balanced.
+ *
+ *	@return	The number of bots that this process should add itself.
+ */
+int BotWorkers::addBots( int num, const std::string & tag,
+	const std::string & controllerType, const std::string & controllerData )
+{
+	if (workers_.empty() || num <= 0)
+	{
+		return num;
+	}
+
+	for (int i = 0; i < this->numWorkers(); ++i)
+	{
+		int count = this->share( num, i + 1, nextProcess_ );
+
+		if (count > 0)
+		{
+			MemoryOStream stream;
+			stream << uint8( ADD_BOTS ) << int32( count ) <<
+				tag << controllerType << controllerData;
+			this->sendTo( i, (char *)stream.data(), stream.size() );
+		}
+	}
+
+	int local = this->share( num, 0, nextProcess_ );
+	nextProcess_ = (nextProcess_ + num) % (this->numWorkers() + 1);
+
+	return local;
+}
+
+
+/**
+ *	This method asks the workers to remove their share of bots. The split is
+ *	that of addBots run backwards, so that the remainder is taken from the
+ *	processes that were last given one, and deleting the bots that were just
+ *	added leaves every process with the number it had.
+ *
+ *	@return	The number of bots that this process should remove itself.
+ */
+int BotWorkers::delBots( int num )
+{
+	if (workers_.empty() || num <= 0)
+	{
+		return num;
+	}
+
+	const int numProcesses = this->numWorkers() + 1;
+	nextProcess_ = ((nextProcess_ - num) % numProcesses + numProcesses) %
+		numProcesses;
+
+	for (int i = 0; i < this->numWorkers(); ++i)
+	{
+		int count = this->share( num, i + 1, nextProcess_ );
+
+		if (count > 0)
+		{
+			MemoryOStream stream;
+			stream << uint8( DEL_BOTS ) << int32( count ) <<
+				std::string() << std::string() << std::string();
+			this->sendTo( i, (char *)stream.data(), stream.size() );
+		}
+	}
+
+	return this->share( num, 0, nextProcess_ );
+}
+
+
+/**
+ *	This method relays a command to all of the workers.
+ */
+void BotWorkers::broadcast( Command command, const std::string & arg1,
+	const std::string & arg2, const std::string & arg3 )
+{
+	for (int i = 0; i < this->numWorkers(); ++i)
+	{
+		MemoryOStream stream;
+		stream << uint8( command ) << int32( 0 ) << arg1 << arg2 << arg3;
+		this->sendTo( i, (char *)stream.data(), stream.size() );
+	}
+}
+
+
+/**
+ *	This method writes a command to the socket of the given worker. A worker
+ *	that cannot be written to is dropped.
+ */
+bool BotWorkers::sendTo( int worker, const char * pData, int size )
+{
+	Worker & rWorker = workers_[ worker ];
+
+	if (rWorker.fd == -1)
+	{
+		return false;
+	}
+
+	if (!this->writeFrame( rWorker.fd, pData, size ))
+	{
+		ERROR_MSG( "BotWorkers::sendTo: Lost worker %d (pid %d)\n",
+			worker + 1, rWorker.pid );
+		this->loseWorker( worker );
+		return false;
+	}
+
+	return true;
+}
+
+
+/**
+ *	This method writes a frame, which is the length of the data followed by
+ *	the data, to the given socket.
+ */
+bool BotWorkers::writeFrame( int fd, const char * pData, int size )
+{
+#ifdef unix
+	int32 header = size;
+	std::string frame( (const char *)&header, sizeof( header ) );
+	frame.append( pData, size );
+
+	const char * pCurr = frame.data();
+	int remaining = (int)frame.size();
+
+	while (remaining > 0)
+	{
+		int written = write( fd, pCurr, remaining );
+
+		if (written < 0)
+		{
+			if (errno == EINTR) continue;
+
+			ERROR_MSG( "BotWorkers::writeFrame: write failed: %s\n",
+				strerror( errno ) );
+			return false;
+		}
+
+		pCurr += written;
+		remaining -= written;
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+
+/**
+ *	This method stops listening to a worker that has gone, or whose stream
+ *	cannot be read.
+ */
+void BotWorkers::loseWorker( int worker )
+{
+#ifdef unix
+	Worker & rWorker = workers_[ worker ];
+
+	if (rWorker.fd == -1)
+	{
+		return;
+	}
+
+	if (pNub_ != NULL)
+	{
+		pNub_->deregisterFileDescriptor( rWorker.fd );
+	}
+
+	close( rWorker.fd );
+	rWorker.fd = -1;
+	rWorker.hasStats = false;
+#endif
+}
+
+
+/*
+ *	Override from InputNotificationHandler. This is called in a worker when
+ *	there are commands from the master, and in the master when there are
+ *	stats from a worker.
+ */
+int BotWorkers::handleInputNotification( int fd )
+{
+#ifdef unix
+	if (fd == fd_)
+	{
+		if (!this->readFrames( fd_, buffer_, -1 ))
+		{
+			INFO_MSG( "BotWorkers::handleInputNotification: "
+				"Lost master, shutting down worker %d\n", index_ );
+			pNub_->deregisterFileDescriptor( fd_ );
+			close( fd_ );
+			fd_ = -1;
+			MainApp::instance().shutDown();
+		}
+
+		return 0;
+	}
+
+	for (int i = 0; i < this->numWorkers(); ++i)
+	{
+		if (workers_[i].fd == fd)
+		{
+			if (!this->readFrames( fd, workers_[i].buffer, i ))
+			{
+				WARNING_MSG( "BotWorkers::handleInputNotification: "
+						"Lost worker %d (pid %d)\n",
+					i + 1, workers_[i].pid );
+				this->loseWorker( i );
+			}
+
+			break;
+		}
+	}
+#endif
+
+	return 0;
+}
+
+
+/**
+ *	This method reads what is available on the given socket, and handles the
+ *	frames that have been read in full.
+ *
+ *	@param fd		The socket.
+ *	@param buffer	The data read from the socket that is not yet handled.
+ *	@param worker	The worker that the socket is to, or -1 for the master.
+ *
+ *	@return	False if the other end has gone, or the stream is corrupt.
+ */
+bool BotWorkers::readFrames( int fd, std::string & buffer, int worker )
+{
+#ifdef unix
+	char buf[ 4096 ];
+	int size = read( fd, buf, sizeof( buf ) );
+
+	if (size < 0)
+	{
+		if (errno == EINTR || errno == EAGAIN)
+		{
+			return true;
+		}
+
+		ERROR_MSG( "BotWorkers::readFrames: read failed: %s\n",
+			strerror( errno ) );
+		return false;
+	}
+
+	if (size == 0)
+	{
+		return false;
+	}
+
+	buffer.append( buf, size );
+
+	std::string::size_type offset = 0;
+
+	while (buffer.size() - offset >= sizeof( int32 ))
+	{
+		int32 length = *(const int32 *)(buffer.data() + offset);
+
+		if (length < 0 || length > MAX_FRAME_SIZE)
+		{
+			ERROR_MSG( "BotWorkers::readFrames: Invalid frame length %d\n",
+				length );
+			buffer.clear();
+			return false;
+		}
+
+		if (buffer.size() - offset < sizeof( int32 ) + length)
+		{
+			break;
+		}
+
+		const char * pData = buffer.data() + offset + sizeof( int32 );
+
+		if (worker < 0)
+		{
+			this->handleCommand( pData, length );
+		}
+		else
+		{
+			this->handleStats( worker, pData, length );
+		}
+
+		offset += sizeof( int32 ) + length;
+	}
+
+	buffer.erase( 0, offset );
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+
+/**
+ *	This method performs a command received from the master.
+ */
+void BotWorkers::handleCommand( const char * pData, int size )
+{
+	MemoryIStream stream( (void *)pData, size );
+
+	uint8 command;
+	int32 count;
+	std::string arg1;
+	std::string arg2;
+	std::string arg3;
+
+	stream >> command >> count >> arg1 >> arg2 >> arg3;
+
+	if (stream.error())
+	{
+		ERROR_MSG( "BotWorkers::handleCommand: Bad command from master\n" );
+		return;
+	}
+
+	MainApp & app = MainApp::instance();
+
+	switch (command)
+	{
+		case ADD_BOTS:
+			app.tag( arg1 );
+			app.controllerType( arg2 );
+			app.controllerData( arg3 );
+			app.addBots( count );
+			break;
+
+		case DEL_BOTS:
+			app.delBots( count );
+			break;
+
+		case DEL_TAGGED_ENTITIES:
+			app.delTaggedEntities( arg1 );
+			break;
+
+		case UPDATE_MOVEMENT:
+			app.controllerType( arg2 );
+			app.controllerData( arg3 );
+			app.updateMovement( arg1 );
+			break;
+
+		default:
+			ERROR_MSG( "BotWorkers::handleCommand: Unknown command %d\n",
+				int( command ) );
+			break;
+	}
+}
+
+
+// -----------------------------------------------------------------------------
+// Section: Stats
+// -----------------------------------------------------------------------------
+
+/**
+ *	This method sends the stats of a worker to its master. It does nothing in
+ *	the master.
+ */
+void BotWorkers::sendStats( const BotStats & stats )
+{
+	if (fd_ == -1)
+	{
+		return;
+	}
+
+	MemoryOStream stream;
+	stream << stats.tickRate << stats.tickDuration << stats.maxTickInterval <<
+		stats.numOnline << stats.avgLatency << stats.maxLatency;
+
+	if (!this->writeFrame( fd_, (char *)stream.data(), stream.size() ))
+	{
+		ERROR_MSG( "BotWorkers::sendStats: Could not send stats to master\n" );
+	}
+}
+
+
+/**
+ *	This method handles the stats sent by a worker.
+ */
+void BotWorkers::handleStats( int worker, const char * pData, int size )
+{
+	MemoryIStream stream( (void *)pData, size );
+
+	BotStats stats;
+	stream >> stats.tickRate >> stats.tickDuration >> stats.maxTickInterval >>
+		stats.numOnline >> stats.avgLatency >> stats.maxLatency;
+
+	if (stream.error())
+	{
+		ERROR_MSG( "BotWorkers::handleStats: Bad stats from worker %d\n",
+			worker + 1 );
+		return;
+	}
+
+	workers_[ worker ].stats = stats;
+	workers_[ worker ].hasStats = true;
+}
+
+
+/**
+ *	This method adds the last stats received from each worker to the given
+ *	stats of the master. The tick rate is that of the slowest process, the
+ *	tick times and the longest latency are the worst of any process, and the
+ *	bots online and their average latency are over all of the processes.
+ */
+void BotWorkers::addWorkerStats( BotStats & stats ) const
+{
+	float totalLatency = stats.avgLatency * stats.numOnline;
+
+	for (Workers::const_iterator iter = workers_.begin();
+			iter != workers_.end(); ++iter)
+	{
+		if (iter->fd == -1 || !iter->hasStats)
+		{
+			continue;
+		}
+
+		const BotStats & workerStats = iter->stats;
+
+		stats.tickRate = std::min( stats.tickRate, workerStats.tickRate );
+		stats.tickDuration =
+			std::max( stats.tickDuration, workerStats.tickDuration );
+		stats.maxTickInterval =
+			std::max( stats.maxTickInterval, workerStats.maxTickInterval );
+		stats.maxLatency = std::max( stats.maxLatency, workerStats.maxLatency );
+
+		totalLatency += workerStats.avgLatency * workerStats.numOnline;
+		stats.numOnline += workerStats.numOnline;
+	}
+
+	stats.avgLatency = stats.numOnline ? totalLatency / stats.numOnline : 0.f;
+}
+
+// bot_workers.cpp
@@ -0,0 +1,136 @@
+/******************************************************************************
+BigWorld Technology
+Copyright BigWorld Pty, Ltd.
+All Rights Reserved. Commercial in confidence.
+
+WARNING: This computer program is protected by copyright law and international
+treaties. Unauthorized use, reproduction or distribution of this program, or
+any portion of this program, may result in the imposition of civil and
+criminal penalties as provided by law.
+******************************************************************************/
+
+#ifndef BOT_WORKERS_HPP
+#define BOT_WORKERS_HPP
+
+#include "network/interfaces.hpp"
+
+#include <string>
+#include <vector>
+
+namespace Mercury
+{
+class Nub;
+}
+
+
+/**
+ *	This structure is how well the bots of a process, or of a group of
+ *	processes, are keeping up.
+ */
+struct BotStats
+{
+	float	tickRate;			///< Ticks per second.
+	float	tickDuration;		///< Average ms spent ticking the bots.
+	float	maxTickInterval;	///< Longest ms between two ticks.
+	int32	numOnline;			///< Number of bots that are logged on.
+	float	avgLatency;			///< Average round trip ms of those bots.
+	float	maxLatency;			///< Longest round trip ms of those bots.
+};
+
+/**
+ *	This class spreads the simulated clients of one bots process over a number
+ *	of worker processes.
+ *
+ *	Every ServerConnection needs its own socket, since the server tells its
+ *	clients apart by address, and the Nub waits on its sockets with select().
+ *	This caps a single process at well under FD_SETSIZE clients. To go past
+ *	that, the bots process forks its workers at startup, before anything else
+ *	is initialised. Each worker then runs its own MainApp with its own event
+ *	loop, watchers and Python server.
+ *
+ *	The process that was started (the master) keeps a socket pair to each
+ *	worker. addBots and delBots are split between the master and its workers
+ *	in the same way, and movement and deletion commands are relayed to all of
+ *	them, so that the group behaves like a single bots process. Python
+ *	commands are only run by the master, since they may themselves add or
+ *	remove bots. Each worker sends its BotStats back once a second, and the
+ *	master's stats watchers show those of the whole group.
+ */
+class BotWorkers : public Mercury::InputNotificationHandler
+{
+public:
+	/**
+	 *	This enumeration is the commands sent from the master to its workers.
+	 */
+	enum Command
+	{
+		ADD_BOTS,
+		DEL_BOTS,
+		DEL_TAGGED_ENTITIES,
+		UPDATE_MOVEMENT
+	};
+
+	BotWorkers();
+	virtual ~BotWorkers();
+
+	int spawn( int argc, char * argv[] );
+	void attach( Mercury::Nub & nub );
+
+	int addBots( int num, const std::string & tag,
+		const std::string & controllerType,
+		const std::string & controllerData );
+	int delBots( int num );
+	void broadcast( Command command, const std::string & arg1,
+		const std::string & arg2 = std::string(),
+		const std::string & arg3 = std::string() );
+
+	void sendStats( const BotStats & stats );
+	void addWorkerStats( BotStats & stats ) const;
+
+	/// This method returns the index of this process, 0 for the master.
+	int index() const						{ return index_; }
+
+	/// This method returns the number of workers of this master.
+	int numWorkers() const					{ return (int)workers_.size(); }
+
+	bool isWorker() const					{ return index_ != 0; }
+
+	virtual int handleInputNotification( int fd );
+
+	static BotWorkers & instance();
+
+private:
+	int share( int num, int process, int first ) const;
+	bool sendTo( int worker, const char * pData, int size );
+	bool writeFrame( int fd, const char * pData, int size );
+	bool readFrames( int fd, std::string & buffer, int worker );
+	void handleCommand( const char * pData, int size );
+	void handleStats( int worker, const char * pData, int size );
+	void loseWorker( int worker );
+
+	/// Frames longer than this are taken to mean that the stream is corrupt.
+	static const int32 MAX_FRAME_SIZE = 1 << 20;
+
+	/**
+	 *	This structure is a worker process as seen by the master.
+	 */
+	struct Worker
+	{
+		int			pid;
+		int			fd;
+		std::string	buffer;		///< Stats not yet read in full.
+		bool		hasStats;
+		BotStats	stats;		///< The last stats from the worker.
+	};
+
+	typedef std::vector< Worker > Workers;
+	Workers			workers_;
+	int				nextProcess_;
+
+	int				index_;
+	int				fd_;
+	Mercury::Nub *	pNub_;
+	std::string		buffer_;
+};
+
+#endif // BOT_WORKERS_HPP
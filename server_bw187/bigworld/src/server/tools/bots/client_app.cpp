@@ -63,7 +63,8 @@ ClientApp::ClientApp( Mercury::Nub & mainNub,
 	speed_( 6.f + float(rand())*2.f/float(RAND_MAX) ),
 	pMovementController_( NULL ),
 	autoMove_( true ),
-	pDest_( NULL )
+	pDest_( NULL ),
+	pReplayer_( NULL )
 {
 	MainApp & app = app.instance();
 	hasScripts_ = app.hasScripts();
@@ -103,6 +104,9 @@ ClientApp::~ClientApp()
 
 	delete pMovementController_;
 	pMovementController_ = NULL;
+
+	delete pReplayer_;
+	pReplayer_ = NULL;
 }
 
 
@@ -628,6 +632,18 @@ bool ClientApp::tick( float dTime )
 				}
 				else if (autoMove_)
 					this->addMove( dTime );
+
+				if (pReplayer_ != NULL &&
+					!pReplayer_->update( serverConnection_,
+						MainApp::instance().localTime() ))
+				{
+					INFO_MSG( "ClientApp::tick: %d finished replaying traffic "
+							"(%u messages sent, %u skipped)\n",
+						playerID_, pReplayer_->numSent(),
+						pReplayer_->numSkipped() );
+					delete pReplayer_;
+					pReplayer_ = NULL;
+				}
 			}
 
 			serverConnection_.send();
@@ -796,6 +812,21 @@ void ClientApp::processTimers()
 	}
 }
 
+/**
+ *	This method starts sending the entity messages of a recorded session,
+ *	replacing any session that is already being replayed.
+ *
+ *	@param pSession	The session to replay.
+ *	@param speed	How many times faster than recorded to replay it.
+ */
+void ClientApp::replayTraffic( TrafficReplaySessionPtr pSession, float speed )
+{
+	delete pReplayer_;
+	pReplayer_ = new TrafficReplayer( pSession,
+		MainApp::instance().localTime(), speed );
+}
+
+
 /**
  *	This method destroys this ClientApp.
  */
@@ -19,6 +19,7 @@ criminal penalties as provided by law.
 #include "pyscript/script.hpp"
 #include "entity.hpp"
 #include "main_app.hpp"
+#include "traffic_replay.hpp"
 
 class MovementController;
 
@@ -111,6 +112,9 @@ public:
 
 	void destroy();
 
+	void replayTraffic( TrafficReplaySessionPtr pSession, float speed );
+	bool isReplaying() const				{ return pReplayer_ != NULL; }
+
 	const ServerConnection * getServerConnection() const	{ return &serverConnection_; }
 
 
@@ -140,6 +144,8 @@ protected:
 	bool			autoMove_;
 	Vector3			*pDest_;
 
+	TrafficReplayer * pReplayer_;
+
 	// This stuff is to manage bot timers
 	class TimerRec
 	{
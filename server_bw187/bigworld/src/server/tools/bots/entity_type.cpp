@@ -14,12 +14,14 @@ criminal penalties as provided by law.
 #include "entity.hpp"
 
 #include "cstdmf/debug.hpp"
+#include "cstdmf/timestamp.hpp"
 
 #include <Python.h>
 #include "pyscript/script.hpp"
 #include "common/servconn.hpp"
 
 #include "resmgr/bwresource.hpp"
+#include "server/bwconfig.hpp"
 
 
 DECLARE_DEBUG_COMPONENT2( "Entity", 0 )
@@ -102,7 +104,9 @@ bool EntityType::init( const std::string &clientPath, MD5::Digest& digest )
 	DataSectionPtr	pEntitiesList =
 		BWResource::openSection( clientPath );
 
-	if (pEntitiesList && entityDescriptionMap_.parse( pEntitiesList ))
+	if (pEntitiesList && entityDescriptionMap_.parse( pEntitiesList,
+			BWConfig::get( "entityDefLoadingThreads",
+				EntityDescriptionMap::DEFAULT_LOADING_THREADS ) ))
 	{
 		// can check that entity definition is up to date here
 	}
@@ -125,6 +129,8 @@ bool EntityType::init( const std::string &clientPath, MD5::Digest& digest )
 
 	bool succeeded = true;
 
+	uint64 importStartTime = timestamp();
+
 	for (int i = 0; i < numEntityTypes; i++)
 	{
 		const EntityDescription & currDesc =
@@ -179,10 +185,17 @@ bool EntityType::init( const std::string &clientPath, MD5::Digest& digest )
 				new EntityType( i, currDesc, (PyTypeObject *)pClass ) );
 	}
 
+	uint64 md5StartTime = timestamp();
+
 	MD5 md5;
 	entityDescriptionMap_.addToMD5( md5 );
 	md5.getDigest( digest );
 
+	INFO_MSG( "EntityType::init: Imported scripts in %.3fs and calculated "
+			"digest in %.3fs\n",
+		double( md5StartTime - importStartTime ) / stampsPerSecondD(),
+		double( timestamp() - md5StartTime ) / stampsPerSecondD() );
+
 	return succeeded;
 }
 
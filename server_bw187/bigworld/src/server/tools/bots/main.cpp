@@ -10,6 +10,7 @@ criminal penalties as provided by law.
 ******************************************************************************/
 
 #include "main_app.hpp"
+#include "bot_workers.hpp"
 
 #include "network/logger_message_forwarder.hpp"
 #include "server/bwconfig.hpp"
@@ -37,6 +38,10 @@ int BIGWORLD_MAIN( int argc, char * argv[] )
 
 	bool shouldLog = BWConfig::get( "bots/shouldLog", true );
 
+	// Any worker processes are forked before anything else is set up, so that
+	// each of them has its own sockets, watchers and Python interpreter.
+	BotWorkers::instance().spawn( argc, argv );
+
 	MainApp app;
 	BW_MESSAGE_FORWARDER2( Bots, bots, shouldLog, app.nub() );
 
@@ -11,9 +11,11 @@ criminal penalties as provided by law.
 
 #include "main_app.hpp"
 
+#include "bot_workers.hpp"
 #include "client_app.hpp"
 #include "py_bots.hpp"
 #include "patrol_graph.hpp"
+#include "traffic_replay.hpp"
 #include "bots_interface.hpp"
 
 #include "network/watcher_glue.hpp"
@@ -93,7 +95,18 @@ MainApp::MainApp() :
 		controllerType_( "Patrol" ),
 		controllerData_( "server/bots/test.bwp" ),
 		pPythonServer_( NULL ),
-		clientTickIndex_( bots_.end() )
+		clientTickIndex_( bots_.end() ),
+		statsStart_( 0 ),
+		lastTickStart_( 0 ),
+		statsTickTime_( 0 ),
+		statsMaxInterval_( 0 ),
+		statsTicks_( 0 ),
+		tickRate_( 0.f ),
+		tickDuration_( 0.f ),
+		maxTickInterval_( 0.f ),
+		numOnline_( 0 ),
+		avgLatency_( 0.f ),
+		maxLatency_( 0.f )
 {
 	pInstance_ = this;
 
@@ -269,6 +282,31 @@ bool MainApp::init( int argc, char * argv[] )
 	MF_WATCH( "command/runPython", *this,
 			MF_WRITE_ACCESSOR( std::string, MainApp, runPython ) );
 
+	// In the master, these cover this process and all of its workers.
+	MF_WATCH( "stats/tickRate", tickRate_, Watcher::WT_READ_ONLY,
+			"Ticks per second achieved over the last second by the slowest "
+			"process" );
+	MF_WATCH( "stats/tickDuration", tickDuration_, Watcher::WT_READ_ONLY,
+			"Average time in ms spent ticking the bots, in the slowest "
+			"process" );
+	MF_WATCH( "stats/maxTickInterval", maxTickInterval_,
+			Watcher::WT_READ_ONLY,
+			"Longest time in ms between the starts of two ticks in any "
+			"process" );
+	MF_WATCH( "stats/numOnline", numOnline_, Watcher::WT_READ_ONLY,
+			"Number of bots that are logged on in all processes" );
+	MF_WATCH( "stats/avgLatency", avgLatency_, Watcher::WT_READ_ONLY,
+			"Average round trip time in ms of the logged on bots of all "
+			"processes" );
+	MF_WATCH( "stats/maxLatency", maxLatency_, Watcher::WT_READ_ONLY,
+			"Longest round trip time in ms of the logged on bots of all "
+			"processes" );
+
+	BotWorkers & workers = BotWorkers::instance();
+	MF_WATCH( "workers/index", workers, &BotWorkers::index );
+	MF_WATCH( "workers/numWorkers", workers, &BotWorkers::numWorkers );
+	workers.attach( nub_ );
+
 	Watcher::rootWatcher().addChild( "nub", Mercury::Nub::pWatcher(), &nub_ );
 
 	BotsInterface::registerWithNub( nub_ );
@@ -326,10 +364,14 @@ void MainApp::addBot()
 
 
 /**
- *	This method adds a number of simulated clients to this application.
+ *	This method adds a number of simulated clients to this application. If
+ *	there are worker processes, they are given their share of them.
  */
 void MainApp::addBots( int num )
 {
+	num = BotWorkers::instance().addBots( num,
+			tag_, controllerType_, controllerData_ );
+
 	for (int i = 0; i < num; ++i)
 	{
 		this->addBot();
@@ -342,6 +384,8 @@ void MainApp::addBots( int num )
  */
 void MainApp::delBots( int num )
 {
+	num = BotWorkers::instance().delBots( num );
+
 	while (num-- > 0 && !bots_.empty())
 	{
 		if (bots_.begin() == clientTickIndex_)
@@ -361,6 +405,9 @@ void MainApp::delBots( int num )
  */
 void MainApp::updateMovement( std::string tag )
 {
+	BotWorkers::instance().broadcast( BotWorkers::UPDATE_MOVEMENT,
+			tag, controllerType_, controllerData_ );
+
 	Bots::iterator iter = bots_.begin();
 
 	while (iter != bots_.end())
@@ -381,7 +428,9 @@ void MainApp::updateMovement( std::string tag )
 
 
 /**
- *	This method runs the input string.
+ *	This method runs the input string. It is only run in this process, not
+ *	in any workers, since a command such as BigWorld.addBots already spreads
+ *	its work over them.
  */
 void MainApp::runPython( std::string command )
 {
@@ -394,11 +443,60 @@ void MainApp::runPython( std::string command )
 }
 
 
+/**
+ *	This method gives each recorded session of a traffic recording to a bot
+ *	that is online and not already replaying one. Sessions beyond the number
+ *	of such bots are not replayed.
+ *
+ *	@param pathPrefix	The path prefix that the recording was made with.
+ *	@param speed		How many times faster than recorded to replay it.
+ *
+ *	@return	The number of sessions that are being replayed, or -1 if the
+ *			recording could not be read.
+ */
+int MainApp::replayTraffic( const std::string & pathPrefix, float speed )
+{
+	TrafficReplaySessions sessions;
+
+	if (!loadTrafficSessions( pathPrefix, sessions ))
+	{
+		return -1;
+	}
+
+	TrafficReplaySessions::iterator sessionIter = sessions.begin();
+
+	for (Bots::iterator iter = bots_.begin();
+			iter != bots_.end() && sessionIter != sessions.end(); ++iter)
+	{
+		ClientApp * pApp = iter->getObject();
+
+		if (pApp->id() != 0 && !pApp->isReplaying())
+		{
+			pApp->replayTraffic( *sessionIter, speed );
+			++sessionIter;
+		}
+	}
+
+	int numReplaying = sessionIter - sessions.begin();
+
+	if (sessionIter != sessions.end())
+	{
+		WARNING_MSG( "MainApp::replayTraffic: Only %d of %lu sessions are "
+				"being replayed. Not enough bots are free.\n",
+			numReplaying, sessions.size() );
+	}
+
+	return numReplaying;
+}
+
+
 /**
  *	This method deletes tagged entities.
  */
 void MainApp::delTaggedEntities( std::string tag )
 {
+	BotWorkers::instance().broadcast( BotWorkers::DEL_TAGGED_ENTITIES, tag );
+
 	Bots::iterator iter = bots_.begin();
 	Bots condemnedBots; //Call destructors when going out of scope
 
@@ -435,6 +533,8 @@ int MainApp::handleTimeout( int, void * )
 
 	inTick = true;
 
+	uint64 tickStart = timestamp();
+
 	static int remainder = 0;
 	int numberToUpdate = (bots_.size() + remainder) / TICK_FRAGMENTS;
 	remainder = (bots_.size() + remainder) % TICK_FRAGMENTS;
@@ -456,12 +556,86 @@ int MainApp::handleTimeout( int, void * )
 		}
 	}
 
+	this->updateStats( tickStart, timestamp() );
+
 	inTick = false;
 
 	return 0;
 }
 
 
+/**
+ *	This method accumulates the timing of a tick, and once a second updates
+ *	the achieved tick rate and the latency of the bots. A worker sends these
+ *	to its master, and the master combines them with those of its workers.
+ */
+void MainApp::updateStats( uint64 tickStart, uint64 tickEnd )
+{
+	if (statsStart_ == 0)
+	{
+		statsStart_ = tickStart;
+		lastTickStart_ = tickStart;
+		return;
+	}
+
+	statsMaxInterval_ =
+		std::max( statsMaxInterval_, tickStart - lastTickStart_ );
+	lastTickStart_ = tickStart;
+	statsTickTime_ += tickEnd - tickStart;
+	++statsTicks_;
+
+	double elapsed = double( tickEnd - statsStart_ ) / stampsPerSecondD();
+
+	if (elapsed < 1.0)
+	{
+		return;
+	}
+
+	BotStats stats;
+	stats.tickRate = float( statsTicks_ / elapsed );
+	stats.tickDuration = float( double( statsTickTime_ ) * 1000.0 /
+		stampsPerSecondD() / statsTicks_ );
+	stats.maxTickInterval = float( double( statsMaxInterval_ ) * 1000.0 /
+		stampsPerSecondD() );
+
+	stats.numOnline = 0;
+	float totalLatency = 0.f;
+	stats.maxLatency = 0.f;
+
+	for (Bots::iterator iter = bots_.begin(); iter != bots_.end(); ++iter)
+	{
+		const ServerConnection * pConnection = (*iter)->getServerConnection();
+
+		if (pConnection->online())
+		{
+			float latency = pConnection->latency() * 1000.f;
+			totalLatency += latency;
+			stats.maxLatency = std::max( stats.maxLatency, latency );
+			++stats.numOnline;
+		}
+	}
+
+	stats.avgLatency =
+		stats.numOnline ? totalLatency / stats.numOnline : 0.f;
+
+	BotWorkers & workers = BotWorkers::instance();
+	workers.sendStats( stats );
+	workers.addWorkerStats( stats );
+
+	tickRate_ = stats.tickRate;
+	tickDuration_ = stats.tickDuration;
+	maxTickInterval_ = stats.maxTickInterval;
+	numOnline_ = stats.numOnline;
+	avgLatency_ = stats.avgLatency;
+	maxLatency_ = stats.maxLatency;
+
+	statsStart_ = tickEnd;
+	statsTickTime_ = 0;
+	statsMaxInterval_ = 0;
+	statsTicks_ = 0;
+}
+
+
 /**
  *	Thie method returns personality module
  */
@@ -689,6 +863,23 @@ void delBots( int count )
 }
 PY_AUTO_MODULE_FUNCTION( RETVOID, delBots, ARG( int, END ), BigWorld )
 
+/*~ function BigWorld.replayTraffic
+ *	This function replays a recording made by the traffic_recorder BaseApp
+ *	extension. Each recorded client is replayed by a bot that is online and
+ *	not already replaying.
+ *
+ *	@param pathPrefix	The path prefix that the recording was made with.
+ *	@param speed		How many times faster than recorded to replay it.
+ *
+ *	@return	The number of clients being replayed, or -1 on failure.
+ */
+int replayTraffic( const std::string & pathPrefix, float speed )
+{
+	return MainApp::instance().replayTraffic( pathPrefix, speed );
+}
+PY_AUTO_MODULE_FUNCTION( RETDATA, replayTraffic,
+		ARG( std::string, OPTARG( float, 1.f, END ) ), BigWorld )
+
 #define DEFAULT_ACCESSOR( N1, N2 )											\
 std::string getDefault##N2()												\
 {																			\
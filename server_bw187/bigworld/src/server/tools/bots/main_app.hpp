@@ -43,6 +43,8 @@ public:
 	void updateMovement( std::string tag );
 	void runPython( std::string tag );
 
+	int replayTraffic( const std::string & pathPrefix, float speed );
+
 	MovementController * createDefaultMovementController( float & speed,
 		Vector3 & position );
 	MovementController * createMovementController( float & speed,
@@ -54,6 +56,8 @@ public:
 
 	virtual int handleTimeout( int, void * );
 
+	void updateStats( uint64 tickStart, uint64 tickEnd );
+
 	// ---- Accessors ----
 	const std::string & serverName() const 		{ return serverName_; }
 	const std::string & username() const		{ return username_; }
@@ -114,6 +118,20 @@ private:
 
 	Bots::iterator clientTickIndex_;
 
+	// Tick rate and latency, accumulated over about a second
+	uint64	statsStart_;
+	uint64	lastTickStart_;
+	uint64	statsTickTime_;
+	uint64	statsMaxInterval_;
+	int		statsTicks_;
+
+	float	tickRate_;
+	float	tickDuration_;
+	float	maxTickInterval_;
+	int		numOnline_;
+	float	avgLatency_;
+	float	maxLatency_;
+
 	static MainApp * pInstance_;
 };
 
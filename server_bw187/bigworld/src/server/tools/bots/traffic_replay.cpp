@@ -0,0 +1,186 @@
+/******************************************************************************
+BigWorld Technology
+Copyright BigWorld Pty, Ltd.
+All Rights Reserved. Commercial in confidence.
+
+WARNING: This computer program is protected by copyright law and international
+treaties. Unauthorized use, reproduction or distribution of this program, or
+any portion of this program, may result in the imposition of civil and
+criminal penalties as provided by law.
+******************************************************************************/
+
+#include "traffic_replay.hpp"
+
+#include "common/servconn.hpp"
+#include "common/traffic_record.hpp"
+#include "cstdmf/debug.hpp"
+
+#include <map>
+
+DECLARE_DEBUG_COMPONENT2( "Bots", 0 )
+
+namespace
+{
+
+/// Entity messages from 0x80 carry the id of the destination entity first,
+/// and those from 0xc0 are for the proxy itself.
+const uint8 FIRST_ENTITY_MSG_ID = 0x80;
+const uint8 FIRST_PROXY_MSG_ID = 0xc0;
+
+} // anonymous namespace
+
+
+/**
+ *	This function reads the recording with the given path prefix, and splits
+ *	it into a session for each proxy.
+ *
+ *	@return	False if the recording could not be read.
+ */
+bool loadTrafficSessions( const std::string & pathPrefix,
+		TrafficReplaySessions & sessions )
+{
+	std::vector< std::string > filenames;
+
+	if (!TrafficRecordReader::findFiles( pathPrefix, filenames ))
+	{
+		ERROR_MSG( "loadTrafficSessions: No recording found at %s\n",
+			pathPrefix.c_str() );
+		return false;
+	}
+
+	typedef std::map< ObjectID, TrafficReplaySessionPtr > SessionMap;
+	SessionMap sessionMap;
+	std::map< ObjectID, double > startTimes;
+
+	TrafficRecordReader reader;
+	TrafficRecord record;
+
+	for (std::vector< std::string >::iterator iter = filenames.begin();
+			iter != filenames.end(); ++iter)
+	{
+		if (!reader.open( *iter ))
+		{
+			continue;
+		}
+
+		while (reader.next( record ))
+		{
+			if (record.msgID < FIRST_ENTITY_MSG_ID)
+			{
+				continue;
+			}
+
+			TrafficReplaySessionPtr & pSession = sessionMap[ record.proxyID ];
+
+			if (!pSession)
+			{
+				pSession = new TrafficReplaySession( record.proxyID );
+				startTimes[ record.proxyID ] = record.time;
+			}
+
+			TrafficReplaySession::Message message;
+			message.time = record.time - startTimes[ record.proxyID ];
+			message.msgID = record.msgID;
+			message.data.assign( record.pData, record.length );
+
+			pSession->messages().push_back( message );
+		}
+	}
+
+	for (SessionMap::iterator iter = sessionMap.begin();
+			iter != sessionMap.end(); ++iter)
+	{
+		sessions.push_back( iter->second );
+	}
+
+	INFO_MSG( "loadTrafficSessions: Read %lu sessions from %lu files of %s\n",
+		sessionMap.size(), filenames.size(), pathPrefix.c_str() );
+
+	return true;
+}
+
+
+// -----------------------------------------------------------------------------
+// Section: TrafficReplayer
+// -----------------------------------------------------------------------------
+
+/**
+ *	Constructor.
+ *
+ *	@param pSession		The session to replay.
+ *	@param startTime	The local time to replay the session from.
+ *	@param speed		How many times faster than recorded to replay it.
+ */
+TrafficReplayer::TrafficReplayer( TrafficReplaySessionPtr pSession,
+		double startTime, float speed ) :
+	pSession_( pSession ),
+	next_( 0 ),
+	startTime_( startTime ),
+	speed_( (speed > 0.f) ? speed : 1.f ),
+	numSent_( 0 ),
+	numSkipped_( 0 )
+{
+}
+
+
+/**
+ *	This method adds the messages that are due by the given local time to the
+ *	connection's bundle. The caller sends the bundle.
+ *
+ *	@return	False when all of the messages have been sent.
+ */
+bool TrafficReplayer::update( ServerConnection & serverConnection,
+		double time )
+{
+	const TrafficReplaySession::Messages & messages = pSession_->messages();
+	const double sessionTime = (time - startTime_) * speed_;
+
+	// Proxy messages cannot follow entity messages on a bundle, so those due
+	// after an entity message wait for the next update.
+	bool hasEntityMessage = false;
+
+	while (next_ < messages.size() && messages[ next_ ].time <= sessionTime)
+	{
+		const TrafficReplaySession::Message & message = messages[ next_ ];
+
+		if (message.msgID >= FIRST_PROXY_MSG_ID)
+		{
+			if (hasEntityMessage)
+			{
+				break;
+			}
+
+			serverConnection.startProxyMessage( message.msgID ).addBlob(
+				message.data.data(), message.data.size() );
+			++numSent_;
+		}
+		else if (message.data.size() >= sizeof( ObjectID ))
+		{
+			ObjectID entityID =
+				*reinterpret_cast< const ObjectID * >( message.data.data() );
+
+			if (entityID == 0 || entityID == pSession_->proxyID())
+			{
+				serverConnection.startEntityMessage( message.msgID, 0 ).addBlob(
+					message.data.data() + sizeof( ObjectID ),
+					message.data.size() - sizeof( ObjectID ) );
+				hasEntityMessage = true;
+				++numSent_;
+			}
+			else
+			{
+				++numSkipped_;
+			}
+		}
+		else
+		{
+			++numSkipped_;
+		}
+
+		++next_;
+	}
+
+	return next_ < messages.size();
+}
+
+// traffic_replay.cpp
@@ -0,0 +1,92 @@
+/******************************************************************************
+BigWorld Technology
+Copyright BigWorld Pty, Ltd.
+All Rights Reserved. Commercial in confidence.
+
+WARNING: This computer program is protected by copyright law and international
+treaties. Unauthorized use, reproduction or distribution of this program, or
+any portion of this program, may result in the imposition of civil and
+criminal penalties as provided by law.
+******************************************************************************/
+
+#ifndef TRAFFIC_REPLAY_HPP
+#define TRAFFIC_REPLAY_HPP
+
+#include "cstdmf/smartpointer.hpp"
+#include "network/basictypes.hpp"
+
+#include <string>
+#include <vector>
+
+class ServerConnection;
+
+/**
+ *	This class holds the messages that one client sent to its proxy, as
+ *	recorded by the traffic_recorder BaseApp extension.
+ */
+class TrafficReplaySession : public ReferenceCount
+{
+public:
+	/**
+	 *	This structure is a recorded message.
+	 */
+	struct Message
+	{
+		double			time;	///< In seconds since the session's first message.
+		uint8			msgID;
+		std::string		data;
+	};
+
+	typedef std::vector< Message > Messages;
+
+	TrafficReplaySession( ObjectID proxyID ) : proxyID_( proxyID ) {}
+
+	ObjectID proxyID() const				{ return proxyID_; }
+	const Messages & messages() const		{ return messages_; }
+	Messages & messages()					{ return messages_; }
+
+private:
+	ObjectID	proxyID_;
+	Messages	messages_;
+};
+
+typedef SmartPointer< TrafficReplaySession > TrafficReplaySessionPtr;
+typedef std::vector< TrafficReplaySessionPtr > TrafficReplaySessions;
+
+bool loadTrafficSessions( const std::string & pathPrefix,
+	TrafficReplaySessions & sessions );
+
+
+/**
+ *	This class sends the messages of a recorded session from a bot, at the
+ *	times that they were recorded.
+ *
+ *	Only entity messages are replayed. The other messages that a client sends,
+ *	such as movement and acknowledgements, depend on the state of the
+ *	connection, so the bot keeps sending its own. Entity messages to the
+ *	recorded player are sent to the bot's player, and those to other entities
+ *	are skipped, since the entity ids of a new session differ from the
+ *	recorded ones.
+ */
+class TrafficReplayer
+{
+public:
+	TrafficReplayer( TrafficReplaySessionPtr pSession, double startTime,
+		float speed );
+
+	bool update( ServerConnection & serverConnection, double time );
+
+	uint32 numSent() const		{ return numSent_; }
+	uint32 numSkipped() const	{ return numSkipped_; }
+
+private:
+	TrafficReplaySessionPtr	pSession_;
+	uint32					next_;
+	double					startTime_;
+	float					speed_;
+
+	uint32					numSent_;
+	uint32					numSkipped_;
+};
+
+#endif // TRAFFIC_REPLAY_HPP
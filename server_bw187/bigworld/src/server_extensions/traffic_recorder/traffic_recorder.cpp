@@ -0,0 +1,211 @@
+#include "Python.h"
+#include "network/message_filter.hpp"
+#include "cstdmf/memory_stream.hpp"
+#include "cstdmf/watcher.hpp"
+#include "baseapp/proxy.hpp"
+#include "common/traffic_record.hpp"
+
+DECLARE_DEBUG_COMPONENT( 0 )
+
+namespace
+{
+
+TrafficRecorder s_recorder;
+
+} // anonymous namespace
+
+
+/**
+ *	This class records each message from a proxy's client before passing it
+ *	on to the filter that was on the channel before it, or to its handler.
+ */
+class RecordingMessageFilter : public Mercury::MessageFilter
+{
+public:
+	RecordingMessageFilter( ObjectID proxyID,
+			Mercury::MessageFilterPtr pNext ) :
+		proxyID_( proxyID ),
+		pNext_( pNext )
+	{
+	}
+
+	void filterMessage( const Mercury::Address & srcAddr,
+		Mercury::UnpackedMessageHeader & header,
+		BinaryIStream & data,
+		Mercury::InputMessageHandler * pHandler )
+	{
+		int length = data.remainingLength();
+		void * pData = data.retrieve( length );
+
+		s_recorder.record( proxyID_, header.identifier, header.flags,
+			pData, length );
+
+		MemoryIStream stream( pData, length );
+
+		if (pNext_)
+		{
+			pNext_->filterMessage( srcAddr, header, stream, pHandler );
+		}
+		else if (pHandler)
+		{
+			pHandler->handleMessage( srcAddr, header, stream );
+		}
+	}
+
+	Mercury::MessageFilterPtr pNext() const	{ return pNext_; }
+
+private:
+	ObjectID					proxyID_;
+	Mercury::MessageFilterPtr	pNext_;
+};
+
+
+/**
+ *	This function returns the client channel of the given proxy, or NULL with
+ *	the Python error set.
+ */
+Mercury::Channel * getClientChannel( PyObjectPtr pProxyObject )
+{
+	if (!Proxy::Check( pProxyObject.get() ))
+	{
+		PyErr_SetString( PyExc_ValueError, "Argument must be a proxy" );
+		return NULL;
+	}
+
+	Proxy * pProxy = static_cast< Proxy * >( pProxyObject.get() );
+
+	if (!pProxy->hasClient())
+	{
+		PyErr_SetString( PyExc_ValueError, "Proxy does not have a client" );
+		return NULL;
+	}
+
+	return &pProxy->clientChannel();
+}
+
+
+/*~ function BigWorld.startTrafficRecorder
+ *	@components{ base }
+ *	This function starts recording the messages of the proxies passed to
+ *	BigWorld.recordTraffic. The messages are written to a ring of files named
+ *	pathPrefix.NNNNNN.bwtr, which can be replayed by the bots tool.
+ *
+ *	@param pathPrefix	The path and start of the name of the files.
+ *	@param fileSizeMB	The size of each file, in megabytes.
+ *	@param maxFiles		The number of files to keep.
+ */
+bool startTrafficRecorder( const std::string & pathPrefix, int fileSizeMB,
+		int maxFiles )
+{
+	static bool s_isWatched = false;
+
+	if (!s_isWatched)
+	{
+		MF_WATCH( "trafficRecorder/numRecords", s_recorder,
+			&TrafficRecorder::numRecords );
+		MF_WATCH( "trafficRecorder/numBytes", s_recorder,
+			&TrafficRecorder::numBytes );
+		MF_WATCH( "trafficRecorder/numDropped", s_recorder,
+			&TrafficRecorder::numDropped );
+		MF_WATCH( "trafficRecorder/fileIndex", s_recorder,
+			&TrafficRecorder::fileIndex );
+		s_isWatched = true;
+	}
+
+	if (fileSizeMB <= 0 || fileSizeMB > 1024)
+	{
+		PyErr_Format( PyExc_ValueError,
+			"fileSizeMB must be from 1 to 1024, not %d", fileSizeMB );
+		return false;
+	}
+
+	if (!s_recorder.init( pathPrefix, uint32( fileSizeMB ) << 20, maxFiles ))
+	{
+		PyErr_Format( PyExc_IOError,
+			"Could not start recording to %s", pathPrefix.c_str() );
+		return false;
+	}
+
+	return true;
+}
+
+PY_AUTO_MODULE_FUNCTION( RETOK, startTrafficRecorder, ARG( std::string,
+	OPTARG( int, 64, OPTARG( int, 8, END ) ) ), BigWorld )
+
+
+/*~ function BigWorld.stopTrafficRecorder
+ *	@components{ base }
+ *	This function stops recording messages. The proxies stay attached, but
+ *	their messages are not recorded until the recorder is started again.
+ */
+void stopTrafficRecorder()
+{
+	s_recorder.fini();
+}
+
+PY_AUTO_MODULE_FUNCTION( RETVOID, stopTrafficRecorder, END, BigWorld )
+
+
+/*~ function BigWorld.recordTraffic
+ *	@components{ base }
+ *	This function records the messages from the client of the given proxy,
+ *	while the recorder is started.
+ *
+ *	@param proxy	The proxy to record.
+ */
+bool recordTraffic( PyObjectPtr pProxyObject )
+{
+	Mercury::Channel * pChannel = getClientChannel( pProxyObject );
+
+	if (pChannel == NULL)
+	{
+		return false;
+	}
+
+	Mercury::MessageFilterPtr pFilter = pChannel->pMessageFilter();
+
+	if (dynamic_cast< RecordingMessageFilter * >( pFilter.get() ) == NULL)
+	{
+		Proxy * pProxy = static_cast< Proxy * >( pProxyObject.get() );
+		pChannel->pMessageFilter(
+			new RecordingMessageFilter( pProxy->id(), pFilter ) );
+	}
+
+	return true;
+}
+
+PY_AUTO_MODULE_FUNCTION( RETOK, recordTraffic,
+	ARG( PyObjectPtr, END ), BigWorld )
+
+
+/*~ function BigWorld.stopRecordingTraffic
+ *	@components{ base }
+ *	This function stops recording the messages from the client of the given
+ *	proxy.
+ *
+ *	@param proxy	The proxy to stop recording.
+ */
+bool stopRecordingTraffic( PyObjectPtr pProxyObject )
+{
+	Mercury::Channel * pChannel = getClientChannel( pProxyObject );
+
+	if (pChannel == NULL)
+	{
+		return false;
+	}
+
+	RecordingMessageFilter * pFilter = dynamic_cast< RecordingMessageFilter * >(
+		pChannel->pMessageFilter().get() );
+
+	if (pFilter != NULL)
+	{
+		pChannel->pMessageFilter( pFilter->pNext().get() );
+	}
+
+	return true;
+}
+
+PY_AUTO_MODULE_FUNCTION( RETOK, stopRecordingTraffic,
+	ARG( PyObjectPtr, END ), BigWorld )
+
+// traffic_recorder.cpp
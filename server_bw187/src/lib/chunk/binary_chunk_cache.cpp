@@ -0,0 +1,339 @@
+/******************************************************************************
+BigWorld Technology
+Copyright BigWorld Pty, Ltd.
+All Rights Reserved. Commercial in confidence.
+
+WARNING: This computer program is protected by copyright law and international
+treaties. Unauthorized use, reproduction or distribution of this program, or
+any portion of this program, may result in the imposition of civil and
+criminal penalties as provided by law.
+******************************************************************************/
+
+#include "pch.hpp"
+
+#include "binary_chunk_cache.hpp"
+
+#include "cstdmf/debug.hpp"
+#include "cstdmf/timestamp.hpp"
+#include "cstdmf/watcher.hpp"
+#include "resmgr/auto_config.hpp"
+#include "resmgr/bwresource.hpp"
+#include "resmgr/file_system.hpp"
+#include "resmgr/multi_file_system.hpp"
+#include "resmgr/packed_section.hpp"
+
+DECLARE_DEBUG_COMPONENT2( "Chunk", 0 )
+
+static AutoConfigString s_chunkCachePath( "system/chunkCachePath" );
+
+
+// -----------------------------------------------------------------------------
+// Section: Construction/Destruction
+// -----------------------------------------------------------------------------
+
+/**
+ *	Constructor.
+ */
+BinaryChunkCache::BinaryChunkCache() :
+	path_(),
+	pFileSystem_( NULL ),
+	numHits_( 0 ),
+	numMisses_( 0 ),
+	numStale_( 0 ),
+	numWrites_( 0 ),
+	numFailedWrites_( 0 ),
+	numPacked_( 0 ),
+	hitTime_( 0.0 ),
+	missTime_( 0.0 )
+{
+	if (!s_chunkCachePath.value().empty())
+	{
+		this->path( s_chunkCachePath.value() );
+	}
+
+	this->watch();
+}
+
+
+/**
+ *	Destructor.
+ */
+BinaryChunkCache::~BinaryChunkCache()
+{
+	delete pFileSystem_;
+}
+
+
+/**
+ *	This static method returns the singleton instance of this class.
+ */
+BinaryChunkCache & BinaryChunkCache::instance()
+{
+	static BinaryChunkCache s_instance;
+	return s_instance;
+}
+
+
+/**
+ *	This method sets the directory that the packed chunks are kept in. It is
+ *	a native path, not one relative to the resource paths. An empty path
+ *	turns the cache off.
+ *
+ *	This must not be called while chunks are being loaded.
+ */
+void BinaryChunkCache::path( const std::string & path )
+{
+	delete pFileSystem_;
+	pFileSystem_ = NULL;
+
+	path_ = path;
+
+	if (!path_.empty())
+	{
+		if (path_[ path_.size() - 1 ] != '/')
+		{
+			path_ += '/';
+		}
+
+		pFileSystem_ = NativeFileSystem::create( path_ );
+		pFileSystem_->makeDirectory( "" );
+
+		INFO_MSG( "BinaryChunkCache::path: Caching packed chunks in %s\n",
+			path_.c_str() );
+	}
+}
+
+
+// -----------------------------------------------------------------------------
+// Section: Loading
+// -----------------------------------------------------------------------------
+
+/**
+ *	This method opens the given .chunk resource, from the cache if it has an
+ *	up to date copy of it.
+ *
+ *	@return	The root section of the chunk, or NULL if it could not be opened.
+ */
+DataSectionPtr BinaryChunkCache::openSection( const std::string & resourceID )
+{
+	if (!pFileSystem_)
+	{
+		return BWResource::openSection( resourceID );
+	}
+
+	uint64 startTime = timestamp();
+
+	BinaryPtr pSource =
+		BWResource::instance().fileSystem()->readFile( resourceID );
+
+	if (!pSource)
+	{
+		return NULL;
+	}
+
+	std::string tag = BWResource::getFilename( resourceID );
+
+	DataSectionPtr pSection = PackedSection::create( tag, pSource );
+
+	if (pSection)
+	{
+		SimpleMutexHolder smh( statsMutex_ );
+		++numPacked_;
+		return pSection;
+	}
+
+	// The digest must be taken before parsing, since the XML parser
+	// modifies the data in place.
+	MD5 md5;
+	md5.append( pSource->data(), pSource->len() );
+	MD5::Digest sourceDigest( md5 );
+
+	std::string cacheName = resourceID + ".packed";
+	bool isStale = false;
+
+	pSection = this->readCache( cacheName, tag, sourceDigest, isStale );
+
+	if (pSection)
+	{
+		SimpleMutexHolder smh( statsMutex_ );
+		++numHits_;
+		hitTime_ += double( timestamp() - startTime ) / stampsPerSecondD();
+		return pSection;
+	}
+
+	pSection = DataSection::createAppropriateSection( tag, pSource );
+
+	if (pSection)
+	{
+		this->writeCache( cacheName, sourceDigest, pSection );
+	}
+
+	SimpleMutexHolder smh( statsMutex_ );
+	++numMisses_;
+	if (isStale)
+	{
+		++numStale_;
+	}
+	missTime_ += double( timestamp() - startTime ) / stampsPerSecondD();
+
+	return pSection;
+}
+
+
+/**
+ *	This method reads the cached copy of a chunk.
+ *
+ *	@param cacheName	The name of the copy in the cache directory.
+ *	@param tag			The name of the root section to return.
+ *	@param sourceDigest	The MD5 of the .chunk file that it must match.
+ *	@param isStale		Set to true if there is a copy, but it cannot be used.
+ *
+ *	@return	The root section of the copy, or NULL if there is no usable copy.
+ */
+DataSectionPtr BinaryChunkCache::readCache( const std::string & cacheName,
+	const std::string & tag, const MD5::Digest & sourceDigest,
+	bool & isStale )
+{
+	if (pFileSystem_->getFileType( cacheName ) != IFileSystem::FT_FILE)
+	{
+		return NULL;
+	}
+
+	BinaryPtr pData = pFileSystem_->readFile( cacheName );
+
+	if (!pData || pData->len() <= int( sizeof( Header ) ))
+	{
+		isStale = true;
+		return NULL;
+	}
+
+	const Header & header = *(const Header *)pData->data();
+
+	if (header.magic != MAGIC || header.version != VERSION ||
+			header.sourceDigest != sourceDigest)
+	{
+		isStale = true;
+		return NULL;
+	}
+
+	// The packed section refers to the data of the file in place.
+	BinaryPtr pPacked = new BinaryBlock( pData->cdata() + sizeof( Header ),
+		pData->len() - sizeof( Header ), pData );
+
+	DataSectionPtr pSection = PackedSection::create( tag, pPacked );
+
+	if (!pSection)
+	{
+		isStale = true;
+	}
+
+	return pSection;
+}
+
+
+/**
+ *	This method writes a packed copy of a chunk to the cache. It is written
+ *	to a temporary file first, so that a process that is loading the same
+ *	chunk never reads a partial copy.
+ */
+void BinaryChunkCache::writeCache( const std::string & cacheName,
+	const MD5::Digest & sourceDigest, DataSectionPtr pSection )
+{
+	BinaryPtr pPacked = PackedSection::pack( pSection );
+
+	BinaryPtr pData = new BinaryBlock( NULL,
+		sizeof( Header ) + pPacked->len() );
+
+	Header & header = *(Header *)pData->cdata();
+	header.magic = MAGIC;
+	header.version = VERSION;
+	header.sourceDigest = sourceDigest;
+
+	memcpy( pData->cdata() + sizeof( Header ), pPacked->data(),
+		pPacked->len() );
+
+	SimpleMutexHolder smh( writeMutex_ );
+
+	// Recreate the directories of the resource path in the cache.
+	std::string::size_type pos = cacheName.find( '/' );
+
+	while (pos != std::string::npos)
+	{
+		std::string dirName = cacheName.substr( 0, pos );
+
+		if (pFileSystem_->getFileType( dirName ) == IFileSystem::FT_NOT_FOUND)
+		{
+			pFileSystem_->makeDirectory( dirName );
+		}
+
+		pos = cacheName.find( '/', pos + 1 );
+	}
+
+	std::string tempName = cacheName + ".new";
+
+	bool ok = pFileSystem_->writeFile( tempName, pData, true );
+
+	if (ok)
+	{
+		if (pFileSystem_->getFileType( cacheName ) == IFileSystem::FT_FILE)
+		{
+			pFileSystem_->eraseFileOrDirectory( cacheName );
+		}
+
+		ok = pFileSystem_->moveFileOrDirectory( tempName, cacheName );
+	}
+
+	SimpleMutexHolder statsHolder( statsMutex_ );
+
+	if (ok)
+	{
+		++numWrites_;
+	}
+	else
+	{
+		// Only complain once, since this is likely to fail for every chunk.
+		if (numFailedWrites_ == 0)
+		{
+			WARNING_MSG( "BinaryChunkCache::writeCache: "
+				"Could not write %s%s\n", path_.c_str(), cacheName.c_str() );
+		}
+
+		++numFailedWrites_;
+	}
+}
+
+
+// -----------------------------------------------------------------------------
+// Section: Watchers
+// -----------------------------------------------------------------------------
+
+/**
+ *	This method adds the watchers for the cache. The times are the total
+ *	seconds spent opening chunks with and without an up to date copy, which
+ *	together with the counts give the cost of a cold start.
+ */
+void BinaryChunkCache::watch()
+{
+	MF_WATCH( "Chunks/BinaryCache/path", path_, Watcher::WT_READ_ONLY,
+		"The directory that packed copies of chunks are kept in" );
+	MF_WATCH( "Chunks/BinaryCache/hits", numHits_, Watcher::WT_READ_ONLY,
+		"The number of chunks opened from an up to date packed copy" );
+	MF_WATCH( "Chunks/BinaryCache/misses", numMisses_, Watcher::WT_READ_ONLY,
+		"The number of chunks parsed from XML" );
+	MF_WATCH( "Chunks/BinaryCache/stale", numStale_, Watcher::WT_READ_ONLY,
+		"The number of packed copies ignored because their chunk changed" );
+	MF_WATCH( "Chunks/BinaryCache/writes", numWrites_, Watcher::WT_READ_ONLY,
+		"The number of packed copies written" );
+	MF_WATCH( "Chunks/BinaryCache/failedWrites", numFailedWrites_,
+		Watcher::WT_READ_ONLY,
+		"The number of packed copies that could not be written" );
+	MF_WATCH( "Chunks/BinaryCache/alreadyPacked", numPacked_,
+		Watcher::WT_READ_ONLY,
+		"The number of chunks that were packed by res_packer" );
+	MF_WATCH( "Chunks/BinaryCache/hitTime", hitTime_, Watcher::WT_READ_ONLY,
+		"Seconds spent opening chunks from packed copies" );
+	MF_WATCH( "Chunks/BinaryCache/missTime", missTime_, Watcher::WT_READ_ONLY,
+		"Seconds spent parsing chunks and writing their packed copies" );
+}
+
+// binary_chunk_cache.cpp
@@ -0,0 +1,103 @@
+/******************************************************************************
+BigWorld Technology
+Copyright BigWorld Pty, Ltd.
+All Rights Reserved. Commercial in confidence.
+
+WARNING: This computer program is protected by copyright law and international
+treaties. Unauthorized use, reproduction or distribution of this program, or
+any portion of this program, may result in the imposition of civil and
+criminal penalties as provided by law.
+******************************************************************************/
+
+#ifndef BINARY_CHUNK_CACHE_HPP
+#define BINARY_CHUNK_CACHE_HPP
+
+#include "cstdmf/concurrency.hpp"
+#include "cstdmf/md5.hpp"
+#include "cstdmf/stdmf.hpp"
+#include "resmgr/binary_block.hpp"
+#include "resmgr/datasection.hpp"
+
+#include <string>
+
+class IFileSystem;
+
+
+/**
+ *	This class keeps packed binary copies of .chunk files, so that loading a
+ *	chunk does not have to parse its XML every time the process starts.
+ *
+ *	The first time a chunk is loaded, its XML is parsed as usual and the
+ *	result is also written to the cache directory as a PackedSection, behind
+ *	a header holding the MD5 of the source file. Later loads read the packed
+ *	copy, whose sections refer to the file data in place, as long as the MD5
+ *	still matches. A changed, missing or unreadable copy falls back to the
+ *	XML and is rewritten.
+ *
+ *	Chunks that are already packed (by res_packer) are used as they are. The
+ *	cache is off unless a directory has been set, either by the
+ *	system/chunkCachePath value in resources.xml or by calling path().
+ *
+ *	This is used from the loading threads.
+ */
+class BinaryChunkCache
+{
+public:
+	BinaryChunkCache();
+	~BinaryChunkCache();
+
+	DataSectionPtr openSection( const std::string & resourceID );
+
+	void path( const std::string & path );
+
+	/// This method returns the cache directory, which is empty when off.
+	const std::string & path() const	{ return path_; }
+
+	static BinaryChunkCache & instance();
+
+private:
+	BinaryChunkCache( const BinaryChunkCache & );
+	BinaryChunkCache & operator=( const BinaryChunkCache & );
+
+	/**
+	 *	This structure is the start of a cache file. The packed section
+	 *	follows it.
+	 */
+	struct Header
+	{
+		uint32		magic;
+		uint32		version;
+		MD5::Digest	sourceDigest;
+	};
+
+	enum
+	{
+		MAGIC = 0x43574242,		// "BBWC"
+		VERSION = 1
+	};
+
+	DataSectionPtr readCache( const std::string & cacheName,
+		const std::string & tag, const MD5::Digest & sourceDigest,
+		bool & isStale );
+	void writeCache( const std::string & cacheName,
+		const MD5::Digest & sourceDigest, DataSectionPtr pSection );
+
+	void watch();
+
+	std::string		path_;
+	IFileSystem *	pFileSystem_;
+
+	SimpleMutex		writeMutex_;
+
+	SimpleMutex		statsMutex_;
+	uint32			numHits_;
+	uint32			numMisses_;
+	uint32			numStale_;
+	uint32			numWrites_;
+	uint32			numFailedWrites_;
+	uint32			numPacked_;
+	double			hitTime_;
+	double			missTime_;
+};
+
+#endif // BINARY_CHUNK_CACHE_HPP
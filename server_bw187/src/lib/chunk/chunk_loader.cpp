@@ -13,6 +13,7 @@ criminal penalties as provided by law.
 
 #include "resmgr/bwresource.hpp"
 
+#include "binary_chunk_cache.hpp"
 #include "chunk_loader.hpp"
 #include "chunk_manager.hpp"
 #include "chunk_space.hpp"
@@ -20,12 +21,20 @@ criminal penalties as provided by law.
 
 #include "cstdmf/debug.hpp"
 #include "cstdmf/diary.hpp"
+#include "cstdmf/timestamp.hpp"
+
+#include <algorithm>
 
 DECLARE_DEBUG_COMPONENT2( "Chunk", 0 );
 
 /// constructor. This runs in the main thread
 ChunkLoader::ChunkLoader():
-thread_( NULL )
+	nextWorker_( 0 ),
+	stopping_( false ),
+	sequence_( 0 ),
+	numOutstanding_( 0 ),
+	numInBurst_( 0 ),
+	burstStart_( 0 )
 {
 }
 
@@ -36,10 +45,58 @@ ChunkLoader::~ChunkLoader()
 }
 
 
-/// public start method. This runs in the main thread
-bool ChunkLoader::start()
+/**
+ *	Public start method. This runs in the main thread.
+ *
+ *	@param numThreads	The number of loading threads to run. Chunks are only
+ *						loaded in parallel if this is more than one.
+ */
+bool ChunkLoader::start( int numThreads )
 {
-	thread_ = new SimpleThread( ChunkLoader::s_start, this );
+	numThreads = std::max( numThreads, 1 );
+	stopping_ = false;
+
+	// Create the cache before the loading threads use it.
+	BinaryChunkCache::instance();
+
+	for (int i = 0; i < numThreads; ++i)
+	{
+		Worker * pWorker = new Worker;
+		pWorker->pLoader = this;
+		pWorker->index = i;
+		pWorker->pThread = NULL;
+		workers_.push_back( pWorker );
+	}
+
+	// chunk loads requested before we started can go to any thread
+	mutex_.grab();
+	LoadQueue::iterator it = serialQueue_.begin();
+	while (it != serialQueue_.end())
+	{
+		if (it->order.func_ == &ChunkLoader::loadChunkNow)
+		{
+			Worker & worker = *workers_[ nextWorker_++ % workers_.size() ];
+			worker.queue.push_back( *it );
+			std::push_heap( worker.queue.begin(), worker.queue.end() );
+			worker.semaphore.push();
+			it = serialQueue_.erase( it );
+		}
+		else
+		{
+			workers_.front()->semaphore.push();
+			++it;
+		}
+	}
+	std::make_heap( serialQueue_.begin(), serialQueue_.end() );
+	mutex_.give();
+
+	for (uint i = 0; i < workers_.size(); ++i)
+	{
+		workers_[i]->pThread =
+			new SimpleThread( ChunkLoader::s_start, workers_[i] );
+	}
+
+	INFO_MSG( "ChunkLoader: started %d loading threads.\n", numThreads );
 
 //	return (thread_ != NULL && thread_ != HANDLE(0xFFFFFFFF));
 	return true;
@@ -48,14 +105,41 @@ bool ChunkLoader::start()
 /// public stop method. This runs in the main thread
 void ChunkLoader::stop()
 {
-	// send ourselves the breaking condition
-	LoadOrder nolo;
-	nolo.func_ = NULL;
-	nolo.del_  = NULL;
-	this->load( nolo );
+	// tell everyone that our time is up
+	stopping_ = true;
+	for (uint i = 0; i < workers_.size(); ++i)
+	{
+		workers_[i]->semaphore.push();
+	}
+
+	// and wait for the threads to terminate
+	for (uint i = 0; i < workers_.size(); ++i)
+	{
+		delete workers_[i]->pThread;
+		workers_[i]->pThread = NULL;
+	}
 
-	// and wait for the thread to terminate
-	delete thread_;
+	// then throw away whatever was still queued
+	for (uint i = 0; i <= workers_.size(); ++i)
+	{
+		LoadQueue & queue =
+			(i < workers_.size()) ? workers_[i]->queue : serialQueue_;
+
+		for (LoadQueue::iterator it = queue.begin(); it != queue.end(); ++it)
+		{
+			if (it->order.del_ != NULL)
+			{
+				(*it->order.del_)( it->order.arg_ );
+			}
+		}
+		queue.clear();
+	}
+
+	for (uint i = 0; i < workers_.size(); ++i)
+	{
+		delete workers_[i];
+	}
+	workers_.clear();
 
 	TRACE_MSG( "ChunkLoader: stopped.\n" );
 }
@@ -63,15 +147,16 @@ void ChunkLoader::stop()
 /// thread entry point
 void ChunkLoader::s_start( void * arg )
 {
-	TRACE_MSG( "ChunkLoader: started.\n" );
+	Worker * pWorker = (Worker*)arg;
 
-	ChunkLoader * pLoader = (ChunkLoader*)arg;
-	pLoader->run();
+	TRACE_MSG( "ChunkLoader: thread %d started.\n", pWorker->index );
+
+	pWorker->pLoader->run( *pWorker );
 }
 
 
-/// main loop
-void ChunkLoader::run()
+/// main loop of one loading thread
+void ChunkLoader::run( Worker & worker )
 {
 	DiaryEntry & de = Diary::instance().add( "Chunk Loader" );
 	de.stop();
@@ -80,44 +165,132 @@ void ChunkLoader::run()
 	nice(10);
 #endif
 
-	bool hell_not_frozen_over = true;
-
-	while (hell_not_frozen_over)
+	while (!stopping_)
 	{
-		// wait until there's something in the list
-		semaphore_.pull();
-
-		// pull the front off the list
-		mutex_.grab();
-		LoadOrder lo = loadList_.front();
-		loadList_.pop_front();
-		mutex_.give();
+		// wait until there's something for us. It may have been stolen by
+		// the time we get to it, but then we'll just wait again.
+		worker.semaphore.pull();
 
-		// if it's null then our time is up
-		if (lo.func_ == NULL)
+		LoadOrder lo;
+		while (!stopping_ && this->takeOrder( worker, lo ))
 		{
-			break;
+			this->loadNow( lo );
+			this->onDone();
 		}
-
-		// ok, it's not - load away then
-		this->loadNow( lo );
 	}
+}
+
+
+/**
+ *	This method takes the most urgent load order available to the given
+ *	thread. That is the best of its own queue and, for the first thread, the
+ *	ordered queue. If there is nothing there it steals from another thread.
+ *
+ *	This is called from a loading thread
+ */
+bool ChunkLoader::takeOrder( Worker & worker, LoadOrder & lo )
+{
+	LoadQueue * pQueue = NULL;
 
-	while (!loadList_.empty())
+	worker.mutex.grab();
+	if (worker.index == 0)
 	{
-		// pull the front off the list
 		mutex_.grab();
-		LoadOrder lo = loadList_.front();
-		loadList_.pop_front();
+	}
+
+	if (!worker.queue.empty())
+	{
+		pQueue = &worker.queue;
+	}
+
+	if (worker.index == 0 && !serialQueue_.empty() &&
+		(pQueue == NULL || !(serialQueue_.front() < pQueue->front())))
+	{
+		pQueue = &serialQueue_;
+	}
+
+	if (pQueue != NULL)
+	{
+		std::pop_heap( pQueue->begin(), pQueue->end() );
+		lo = pQueue->back().order;
+		pQueue->pop_back();
+	}
+
+	if (worker.index == 0)
+	{
 		mutex_.give();
+	}
+	worker.mutex.give();
+
+	return (pQueue != NULL) || this->stealOrder( worker, lo );
+}
 
-		if (lo.del_ != NULL)
+
+/**
+ *	This method steals the most urgent chunk load from the first thread after
+ *	the given one that has any queued.
+ *
+ *	This is called from a loading thread
+ */
+bool ChunkLoader::stealOrder( Worker & thief, LoadOrder & lo )
+{
+	for (uint i = 1; i < workers_.size(); ++i)
+	{
+		Worker & victim = *workers_[ (thief.index + i) % workers_.size() ];
+
+		SimpleMutexHolder smh( victim.mutex );
+		if (!victim.queue.empty())
 		{
-			(*lo.del_)( lo.arg_ );
+			std::pop_heap( victim.queue.begin(), victim.queue.end() );
+			lo = victim.queue.back().order;
+			victim.queue.pop_back();
+			return true;
 		}
 	}
+
+	return false;
+}
+
+
+/**
+ *	This method adds a load order to the given queue. The queue's mutex
+ *	must be held.
+ *
+ *	This is called from the main thread
+ */
+void ChunkLoader::push( LoadQueue & queue, const LoadOrder & lo )
+{
+	QueuedOrder qo;
+	qo.order = lo;
+	qo.sequence = sequence_++;
+
+	queue.push_back( qo );
+	std::push_heap( queue.begin(), queue.end() );
+}
+
+
+/**
+ *	This method is called when a load order has been completed. When the last
+ *	outstanding one is done, it reports how long the whole burst of loading
+ *	took, which is the time to fully load a space after startup.
+ *
+ *	This is called from a loading thread
+ */
+void ChunkLoader::onDone()
+{
+	SimpleMutexHolder smh( countMutex_ );
+
+	if (--numOutstanding_ == 0 && numInBurst_ > 1)
+	{
+		INFO_MSG( "ChunkLoader: completed %d load orders in %.3f seconds "
+				"using %d threads\n",
+			numInBurst_,
+			double(timestamp() - burstStart_) / stampsPerSecondD(),
+			this->numThreads() );
+	}
 }
 
+
 /**
  *	Load the resource identified by the given load order.
  *
@@ -125,26 +298,44 @@ void ChunkLoader::run()
  */
 void ChunkLoader::load( const LoadOrder & lo )
 {
-	// put it on the back of the list
-	mutex_.grab();
-	//loadList_.push_back( lo );
-	if( lo.func_ )
+	if (lo.func_ == NULL)
 	{
-		LoadList::reverse_iterator it;
-		for (it = loadList_.rbegin(); it != loadList_.rend(); it++)
-		{
-			if (lo.priority_ >= it->priority_) break;
-		}
-		loadList_.insert( it.base(), lo );
+		return;
+	}
+
+	countMutex_.grab();
+	if (numOutstanding_++ == 0)
+	{
+		burstStart_ = timestamp();
+		numInBurst_ = 0;
+	}
+	++numInBurst_;
+	countMutex_.give();
+
+	// chunk loads can be done by any thread, anything else is done in
+	// priority order by the first thread
+	if (lo.func_ == &ChunkLoader::loadChunkNow && !workers_.empty())
+	{
+		Worker & worker = *workers_[ nextWorker_++ % workers_.size() ];
+
+		worker.mutex.grab();
+		this->push( worker.queue, lo );
+		worker.mutex.give();
+
+		// and let it know there's something there
+		worker.semaphore.push();
 	}
 	else
-		loadList_.insert( loadList_.begin(), lo );
-	mutex_.give();
-	// if we didn't want to do this in fifo order, we could do all this
-	// without the mutex ... using InterlockedCompareExchangePointer.
+	{
+		mutex_.grab();
+		this->push( serialQueue_, lo );
+		mutex_.give();
 
-	// and let it know there's something there
-	semaphore_.push();
+		if (!workers_.empty())
+		{
+			workers_.front()->semaphore.push();
+		}
+	}
 }
 
 /**
@@ -198,6 +389,97 @@ void ChunkLoader::findSeed( ChunkSpace * pSpace, const Vector3 & where,
 }
 
 
+/**
+ *	This method returns whether the given load order loads the given chunk.
+ */
+bool ChunkLoader::matchesChunk( const LoadOrder & lo, void * arg )
+{
+	return lo.func_ == &ChunkLoader::loadChunkNow && lo.arg_ == arg;
+}
+
+/**
+ *	This method returns whether the given load order finds a seed for the
+ *	given result pointer.
+ */
+bool ChunkLoader::matchesSeed( const LoadOrder & lo, void * arg )
+{
+	return lo.func_ == &ChunkLoader::findSeedNow &&
+		((FindSeedArgs*)lo.arg_)->ppChunk_ == arg;
+}
+
+
+/**
+ *	This method removes all queued load orders for which the given function
+ *	returns true, throwing them away with their del_ function.
+ *
+ *	@return The number of load orders removed.
+ */
+int ChunkLoader::cancel( bool (*matches)( const LoadOrder &, void * ),
+	void * arg )
+{
+	std::vector<LoadOrder> cancelled;
+
+	for (uint i = 0; i <= workers_.size(); ++i)
+	{
+		bool isSerial = (i == workers_.size());
+		SimpleMutex & mutex = isSerial ? mutex_ : workers_[i]->mutex;
+		LoadQueue & queue = isSerial ? serialQueue_ : workers_[i]->queue;
+
+		SimpleMutexHolder smh( mutex );
+		LoadQueue::iterator it = queue.begin();
+		while (it != queue.end())
+		{
+			if ((*matches)( it->order, arg ))
+			{
+				cancelled.push_back( it->order );
+				it = queue.erase( it );
+			}
+			else
+			{
+				++it;
+			}
+		}
+		std::make_heap( queue.begin(), queue.end() );
+	}
+
+	for (uint i = 0; i < cancelled.size(); ++i)
+	{
+		if (cancelled[i].del_ != NULL)
+		{
+			(*cancelled[i].del_)( cancelled[i].arg_ );
+		}
+		this->onDone();
+	}
+
+	return (int)cancelled.size();
+}
+
+
+/**
+ *	This method cancels the load of the given chunk if it has not started
+ *	yet. The caller is then responsible for the chunk again.
+ *
+ *	@return True if the load was cancelled.
+ */
+bool ChunkLoader::cancel( Chunk * pChunk )
+{
+	return this->cancel( &matchesChunk, pChunk ) > 0;
+}
+
+
+/**
+ *	This method cancels the search for a seed chunk that was requested with
+ *	the given result reference, if it has not started yet. The reference is
+ *	then left untouched.
+ *
+ *	@return True if the search was cancelled.
+ */
+bool ChunkLoader::cancelSeed( Chunk *& rpChunk )
+{
+	return this->cancel( &matchesSeed, &rpChunk ) > 0;
+}
+
+
 /**
  *	Execute the given load order now.
  *
@@ -219,7 +501,7 @@ void ChunkLoader::loadChunkNow( void * arg )
 
 	DiaryEntry & de = Diary::instance().add( "Load " + pChunk->identifier() );
 	DiaryEntry & de2 = Diary::instance().add( "cs" );
-	DataSectionPtr	pDS = BWResource::openSection(
+	DataSectionPtr	pDS = BinaryChunkCache::instance().openSection(
 		pChunk->resourceID() );
 	de2.stop();
 
@@ -13,7 +13,7 @@ criminal penalties as provided by law.
 #define CHUNK_LOADER_HPP
 
 
-#include <deque>
+#include <vector>
 
 class Chunk;
 class ChunkSpace;
@@ -27,7 +27,17 @@ class Vector3;
 
 
 /**
- *	This class loads chunks using a background thread.
+ *	This class loads chunks using a pool of background threads.
+ *
+ *	Each thread has its own queue of chunk loads, kept as a heap ordered by
+ *	priority and then by the order they were requested in. New chunk loads
+ *	are dealt out to the threads in turn, and a thread that has run out of
+ *	work steals the most urgent load from another thread's queue.
+ *
+ *	All other load orders (finding seeds, background tasks) may depend on
+ *	the order they were requested in, so they go into a single ordered queue
+ *	that only the first thread takes from. With one thread the loader
+ *	behaves as it always has.
  */
 class ChunkLoader
 {
@@ -35,7 +45,7 @@ public:
 	ChunkLoader();
 	~ChunkLoader();
 
-	bool start();
+	bool start( int numThreads = 1 );
 	void stop();
 
 	struct LoadOrder
@@ -58,25 +68,77 @@ public:
 	void findSeed( ChunkSpace * pSpace, const Vector3 & where,
 		Chunk *& rpChunk );
 
-	SimpleThread * thread() const	{ return thread_; }
+	bool cancel( Chunk * pChunk );
+	bool cancelSeed( Chunk *& rpChunk );
+
+	int numThreads() const			{ return (int)workers_.size(); }
+	SimpleThread * thread() const
+		{ return workers_.empty() ? NULL : workers_.front()->pThread; }
+
 private:
+	/**
+	 *	This structure is a load order in a queue. The heap functions put the
+	 *	greatest element first, so the greatest is the one with the lowest
+	 *	priority value, and then the one that was requested first.
+	 */
+	struct QueuedOrder
+	{
+		LoadOrder	order;
+		uint32		sequence;
+
+		bool operator<( const QueuedOrder & other ) const
+		{
+			return (order.priority_ != other.order.priority_) ?
+				(order.priority_ > other.order.priority_) :
+				(sequence > other.sequence);
+		}
+	};
+	typedef std::vector<QueuedOrder>	LoadQueue;
+
+	/**
+	 *	This structure is one thread of the pool and its queue.
+	 */
+	struct Worker
+	{
+		ChunkLoader *	pLoader;
+		int				index;
+		SimpleThread *	pThread;
+		SimpleSemaphore	semaphore;
+		SimpleMutex		mutex;
+		LoadQueue		queue;
+	};
+	typedef std::vector<Worker *>		Workers;
 
 	static void s_start( void * arg );
 
-	void run();
+	void run( Worker & worker );
+
+	bool takeOrder( Worker & worker, LoadOrder & lo );
+	bool stealOrder( Worker & thief, LoadOrder & lo );
+	int cancel( bool (*matches)( const LoadOrder &, void * ), void * arg );
+	static bool matchesChunk( const LoadOrder & lo, void * arg );
+	static bool matchesSeed( const LoadOrder & lo, void * arg );
+	void push( LoadQueue & queue, const LoadOrder & lo );
+	void onDone();
 
 	void loadNow( const LoadOrder & lo );
 	static void loadChunkNow( void * arg );
 	static void findSeedNow( void * arg );
 	static void delSeedNow( void * arg );
 
+	Workers				workers_;
+	uint				nextWorker_;
+	bool				stopping_;
 
-	SimpleThread *		thread_;
-	SimpleSemaphore		semaphore_;
-	SimpleMutex			mutex_;
+	SimpleMutex			mutex_;			///< Guards serialQueue_
+	LoadQueue			serialQueue_;
+	uint32				sequence_;		///< Only used in the main thread
 
-	typedef std::deque<LoadOrder>	LoadList;
-	LoadList	loadList_;
+	// Timing of a burst of loads, from the first order until all are done
+	SimpleMutex			countMutex_;
+	int					numOutstanding_;
+	int					numInBurst_;
+	uint64				burstStart_;
 };
 
 
@@ -24,6 +24,7 @@ criminal penalties as provided by law.
 
 #include "resmgr/bwresource.hpp"
 #include "resmgr/auto_config.hpp"
+#include "shared_geometry_counter.hpp"
 
 #ifndef EDITOR_ENABLED
 #include "chunk_overlapper.hpp"
@@ -53,6 +54,11 @@ namespace { // anonymous
 // Named constants
 const AutoConfigString s_speedTreeXML("system/speedTreeXML");
 
+// The number of threads that load chunks. 1 loads them in order on a single
+// thread, as before the loader had a pool. Only raise it once every chunk
+// item factory in use is known to be thread safe.
+BasicAutoConfig< int > s_loaderThreads( "chunks/loaderThreads", 1 );
+
 } // namespace anonymous
 
 // Force linking with chunktrees
@@ -102,12 +108,14 @@ bool ChunkManager::init()
 	// the same order of variable initialisation as they are defined
 	// in the class. It makes it easier to see if anything is missing.
 
+	SharedGeometryCounter::addWatchers();
+
 	// make a new loader
 	pLoader_ = new ChunkLoader();
 
 #ifndef EDITOR_ENABLED
-	// and start it running in a thread
-	if (!pLoader_->start())
+	// and start it running in its threads
+	if (!pLoader_->start( s_loaderThreads ))
 	{
 		delete pLoader_;
 		pLoader_ = NULL;
@@ -543,6 +551,13 @@ void ChunkManager::tick( float dTime )
 			scanSkippedFor_ = 0.f;
 		}
 
+		// if we are still looking for an unwanted seed then stop, as long
+		// as the loader has not started on it
+		if (uintptr(pFoundSeed_) == 1 && pLoader_->cancelSeed( pFoundSeed_ ))
+		{
+			pFoundSeed_ = NULL;
+		}
+
 		// if we have an unwanted seed get rid of it
 		if (uintptr(pFoundSeed_) > 1)
 		{
@@ -169,7 +169,7 @@ bool ChunkBSPObstacle::collide( const Vector3 & source,
 	DEBUG_MSG( "ChunkBSPObstacle::collide(pt): %s\n",
 			bspTree_.name().c_str() );
 #endif
-	bspTree_.pRoot()->intersects( source, extent, rd, NULL, &cscv );
+	bspTree_.intersects( source, extent, rd, NULL, &cscv );
 
 	return cscv.stop_;
 }
@@ -188,7 +188,7 @@ bool ChunkBSPObstacle::collide( const WorldTriangle & source,
 	DEBUG_MSG( "ChunkBSPObstacle::collide(tri): %s\n",
 			bspTree_.name().c_str() );
 #endif
-	bspTree_.pRoot()->intersects( source, extent - source.v0(), &cscv );
+	bspTree_.intersects( source, extent - source.v0(), &cscv );
 
 	return cscv.stop_;
 }
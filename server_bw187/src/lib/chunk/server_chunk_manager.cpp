@@ -11,6 +11,7 @@ criminal penalties as provided by law.
 
 #include "chunk_manager.hpp"
 #include "chunk_space.hpp"
+#include "shared_geometry_counter.hpp"
 
 DECLARE_DEBUG_COMPONENT2( "Chunk", 0 )
 
@@ -26,7 +27,7 @@ ChunkManager::ChunkManager() :
 	pCameraSpace_( NULL ),
 	cameraChunk_( NULL )
 {
-
+	SharedGeometryCounter::addWatchers();
 }
 
 /**
@@ -14,6 +14,7 @@ criminal penalties as provided by law.
 #include "cstdmf/smartpointer.hpp"
 #include "server_chunk_terrain.hpp"
 #include "chunk_terrain_common.hpp"
+#include "shared_geometry_counter.hpp"
 #include "moo/base_terrain_block.hpp"
 
 #include <map>
@@ -32,13 +33,19 @@ namespace Moo
 
 		static TerrainBlockPtr loadBlock( const std::string & resourceName );
 
+		bool loadShared();
+		uint32 memoryUsed() const					{ return memoryUsed_; }
+
 	private:
 		virtual ~TerrainBlock();
 
 		std::string resourceName_;
+		uint32 memoryUsed_;
 	};
 }
 
+static SharedGeometryCounter s_terrainGeometry( "terrain" );
+
 #include "chunk.hpp"
 #include "chunk_space.hpp"
 #include "chunk_obstacle.hpp"
@@ -102,7 +109,7 @@ TerrainBlockPtr
 	{
 		TerrainBlockPtr pBlock = new TerrainBlock( resourceID );
 
-		if (pBlock->load( resourceID ))
+		if (pBlock->loadShared())
 		{
 			this->add( pBlock.getObject(), resourceID );
 			return pBlock;
@@ -165,7 +172,8 @@ namespace Moo
  *	Constructor.
  */
 TerrainBlock::TerrainBlock( const std::string & resourceName ) :
-	resourceName_( resourceName )
+	resourceName_( resourceName ),
+	memoryUsed_( 0 )
 {
 }
 
@@ -176,6 +184,35 @@ TerrainBlock::TerrainBlock( const std::string & resourceName ) :
 TerrainBlock::~TerrainBlock()
 {
 	g_terrainBlockMgr.del( this );
+
+	if (memoryUsed_ != 0)
+	{
+		s_terrainGeometry.delCopy( memoryUsed_ );
+	}
+}
+
+
+/**
+ *	This method loads this block, which is to be shared by every chunk that
+ *	uses the same resource.
+ */
+bool TerrainBlock::loadShared()
+{
+	if (!this->load( resourceName_ ))
+	{
+		return false;
+	}
+
+	memoryUsed_ = sizeof( *this ) +
+		heightMap_.capacity() * sizeof( float ) +
+		blendValues_.capacity() * sizeof( uint32 ) +
+		shadowValues_.capacity() * sizeof( uint16 ) +
+		holes_.capacity() / 8 +
+		detailIDs_.capacity() * sizeof( uint8 ) +
+		materialKinds_.capacity() * sizeof( uint32 );
+	s_terrainGeometry.addCopy( memoryUsed_ );
+
+	return true;
 }
 
 
@@ -208,6 +245,10 @@ ChunkTerrain::ChunkTerrain() :
  */
 ChunkTerrain::~ChunkTerrain()
 {
+	if (block_)
+	{
+		s_terrainGeometry.delUser( block_->memoryUsed() );
+	}
 }
 
 
@@ -241,6 +282,8 @@ bool ChunkTerrain::load( DataSectionPtr pSection, Chunk * pChunk )
 		return false;
 	}
 
+	s_terrainGeometry.addUser( block_->memoryUsed() );
+
 	this->calculateBB();
 
 	return true;
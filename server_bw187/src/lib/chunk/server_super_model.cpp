@@ -10,6 +10,7 @@ criminal penalties as provided by law.
 ******************************************************************************/
 
 #include "server_super_model.hpp"
+#include "shared_geometry_counter.hpp"
 
 #include "cstdmf/debug.hpp"
 #include "cstdmf/stringmap.hpp"
@@ -27,6 +28,8 @@ criminal penalties as provided by law.
 
 DECLARE_DEBUG_COMPONENT2( "Chunk", 0 );
 
+static SharedGeometryCounter s_bspGeometry( "bsps" );
+
 // TODO: Merge this implementation with Moo::EffectMaterial::load() somehow.
 WorldTriangle::Flags calculateMaterialFlags( DataSectionPtr pMaterialSection )
 {
@@ -98,22 +101,31 @@ class ServerVisual
 public:
 	typedef BSPTree* BSPTreePtr;
 
-	// BSP cache. Indexed by the visual file path.
+	// BSP cache. Indexed by the visual file path. Every model using the same
+	// visual shares its BSP, and so do the chunks of all spaces.
 	// TODO: Should do a proper cache and reference count BSPTree so that we
 	// can delete them when we're done.
 	class BSPCache
 	{
 		typedef std::map< std::string, BSPTree * > StringBSPTreeMap;
 		StringBSPTreeMap cache_;
+		SimpleMutex mutex_;
 
 	public:
 		void add( const std::string& visualResID, BSPTree* pBSP )
 		{
-			cache_[ visualResID ] = pBSP;
+			SimpleMutexHolder smh( mutex_ );
+			BSPTree *& rpEntry = cache_[ visualResID ];
+			if (pBSP != NULL && rpEntry == NULL)
+			{
+				s_bspGeometry.addCopy( pBSP->size() );
+			}
+			rpEntry = pBSP;
 		}
 
 		BSPTree* find( const std::string& visualResID )
 		{
+			SimpleMutexHolder smh( mutex_ );
 			StringBSPTreeMap::iterator iter = cache_.find( visualResID );
 			return (iter != cache_.end()) ? iter->second : NULL;
 		}
@@ -443,6 +455,31 @@ SuperModel::SuperModel( const std::vector< std::string > & modelIDs )
 
 		iter++;
 	}
+
+	for (uint i = 0; i < models_.size(); ++i)
+	{
+		const BSPTree * pBSP = models_[i]->decompose();
+		if (pBSP != NULL)
+		{
+			s_bspGeometry.addUser( pBSP->size() );
+		}
+	}
+}
+
+
+/**
+ *	Destructor.
+ */
+SuperModel::~SuperModel()
+{
+	for (uint i = 0; i < models_.size(); ++i)
+	{
+		const BSPTree * pBSP = models_[i]->decompose();
+		if (pBSP != NULL)
+		{
+			s_bspGeometry.delUser( pBSP->size() );
+		}
+	}
 }
 
 void SuperModel::boundingBox( BoundingBox& bbRet ) const
@@ -48,6 +48,7 @@ class SuperModel
 {
 public:
 	SuperModel( const std::vector< std::string > & modelIDs );
+	~SuperModel();
 
 	int nModels() const						{ return models_.size(); }
 
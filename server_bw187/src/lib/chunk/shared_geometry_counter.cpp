@@ -0,0 +1,168 @@
+/******************************************************************************
+BigWorld Technology
+Copyright BigWorld Pty, Ltd.
+All Rights Reserved. Commercial in confidence.
+
+WARNING: This computer program is protected by copyright law and international
+treaties. Unauthorized use, reproduction or distribution of this program, or
+any portion of this program, may result in the imposition of civil and
+criminal penalties as provided by law.
+******************************************************************************/
+
+#include "pch.hpp"
+
+#include "shared_geometry_counter.hpp"
+
+#include "cstdmf/debug.hpp"
+#include "cstdmf/watcher.hpp"
+
+DECLARE_DEBUG_COMPONENT2( "Chunk", 0 )
+
+
+/**
+ *	Constructor. The name is that of the watcher directory for the counts.
+ */
+SharedGeometryCounter::SharedGeometryCounter( const char * name ) :
+	name_( name ),
+	numCopies_( 0 ),
+	numUsers_( 0 ),
+	uniqueBytes_( 0 ),
+	userBytes_( 0 )
+{
+	counters().push_back( this );
+}
+
+
+/**
+ *	This method records that a copy of the geometry has been loaded.
+ */
+void SharedGeometryCounter::addCopy( uint32 bytes )
+{
+	SimpleMutexHolder smh( mutex_ );
+	++numCopies_;
+	uniqueBytes_ += bytes;
+}
+
+
+/**
+ *	This method records that a copy of the geometry has been freed.
+ */
+void SharedGeometryCounter::delCopy( uint32 bytes )
+{
+	SimpleMutexHolder smh( mutex_ );
+	MF_ASSERT_DEV( numCopies_ > 0 && uniqueBytes_ >= bytes );
+	--numCopies_;
+	uniqueBytes_ -= bytes;
+}
+
+
+/**
+ *	This method records that a chunk item has started using a copy of the
+ *	geometry of the given size.
+ */
+void SharedGeometryCounter::addUser( uint32 bytes )
+{
+	SimpleMutexHolder smh( mutex_ );
+	++numUsers_;
+	userBytes_ += bytes;
+}
+
+
+/**
+ *	This method records that a chunk item has stopped using a copy of the
+ *	geometry of the given size.
+ */
+void SharedGeometryCounter::delUser( uint32 bytes )
+{
+	SimpleMutexHolder smh( mutex_ );
+	MF_ASSERT_DEV( numUsers_ > 0 && userBytes_ >= bytes );
+	--numUsers_;
+	userBytes_ -= bytes;
+}
+
+
+/**
+ *	This method returns the number of bytes that sharing the geometry has
+ *	saved.
+ */
+uint32 SharedGeometryCounter::sharedBytes() const
+{
+	return (userBytes_ > uniqueBytes_) ? userBytes_ - uniqueBytes_ : 0;
+}
+
+
+/**
+ *	This static method returns the bytes held by all kinds of shared geometry.
+ */
+uint32 SharedGeometryCounter::totalUniqueBytes()
+{
+	uint32 total = 0;
+	for (uint i = 0; i < counters().size(); ++i)
+	{
+		total += counters()[i]->uniqueBytes();
+	}
+	return total;
+}
+
+
+/**
+ *	This static method returns the bytes saved by all kinds of shared
+ *	geometry.
+ */
+uint32 SharedGeometryCounter::totalSharedBytes()
+{
+	uint32 total = 0;
+	for (uint i = 0; i < counters().size(); ++i)
+	{
+		total += counters()[i]->sharedBytes();
+	}
+	return total;
+}
+
+
+/**
+ *	This static method adds the watchers of all the counters. The counters are
+ *	all created during static initialisation, so this should be called once,
+ *	from the main thread, after that.
+ */
+void SharedGeometryCounter::addWatchers()
+{
+	static bool firstTime = true;
+	if (!firstTime)
+	{
+		return;
+	}
+	firstTime = false;
+
+	for (uint i = 0; i < counters().size(); ++i)
+	{
+		SharedGeometryCounter & counter = *counters()[i];
+		std::string path = "Chunks/SharedGeometry/" + counter.name_ + "/";
+
+		MF_WATCH( (path + "copies").c_str(), counter,
+			&SharedGeometryCounter::numCopies );
+		MF_WATCH( (path + "users").c_str(), counter,
+			&SharedGeometryCounter::numUsers );
+		MF_WATCH( (path + "uniqueBytes").c_str(), counter,
+			&SharedGeometryCounter::uniqueBytes );
+		MF_WATCH( (path + "sharedBytes").c_str(), counter,
+			&SharedGeometryCounter::sharedBytes );
+	}
+
+	MF_WATCH( "Chunks/SharedGeometry/uniqueBytes",
+		&SharedGeometryCounter::totalUniqueBytes );
+	MF_WATCH( "Chunks/SharedGeometry/sharedBytes",
+		&SharedGeometryCounter::totalSharedBytes );
+}
+
+
+/**
+ *	This static method returns the list of all counters.
+ */
+SharedGeometryCounter::Counters & SharedGeometryCounter::counters()
+{
+	static Counters s_counters;
+	return s_counters;
+}
+
+// shared_geometry_counter.cpp
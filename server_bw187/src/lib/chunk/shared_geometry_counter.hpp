@@ -0,0 +1,74 @@
+/******************************************************************************
+BigWorld Technology
+Copyright BigWorld Pty, Ltd.
+All Rights Reserved. Commercial in confidence.
+
+WARNING: This computer program is protected by copyright law and international
+treaties. Unauthorized use, reproduction or distribution of this program, or
+any portion of this program, may result in the imposition of civil and
+criminal penalties as provided by law.
+******************************************************************************/
+
+#ifndef SHARED_GEOMETRY_COUNTER_HPP
+#define SHARED_GEOMETRY_COUNTER_HPP
+
+#include "cstdmf/concurrency.hpp"
+#include "cstdmf/stdmf.hpp"
+
+#include <string>
+#include <vector>
+
+
+/**
+ *	This class counts the memory used by one kind of read-only chunk geometry,
+ *	such as BSPs or terrain heights, that is loaded once and then shared by
+ *	every chunk that refers to the same resource. In particular, spaces that
+ *	map the same geometry share all of it, and only their chunks, obstacles
+ *	and other per-space state are duplicated.
+ *
+ *	A copy is one loaded instance of the geometry, and a user is one chunk
+ *	item referring to a copy. The unique bytes are those actually held by the
+ *	copies, and the shared bytes are those that the users would have held on
+ *	top of that if each had loaded its own copy.
+ *
+ *	The counts are shown under Chunks/SharedGeometry in the watcher tree, once
+ *	the ChunkManager has called addWatchers.
+ */
+class SharedGeometryCounter
+{
+public:
+	SharedGeometryCounter( const char * name );
+
+	void addCopy( uint32 bytes );
+	void delCopy( uint32 bytes );
+	void addUser( uint32 bytes );
+	void delUser( uint32 bytes );
+
+	uint32 numCopies() const	{ return numCopies_; }
+	uint32 numUsers() const		{ return numUsers_; }
+	uint32 uniqueBytes() const	{ return uniqueBytes_; }
+	uint32 sharedBytes() const;
+
+	static uint32 totalUniqueBytes();
+	static uint32 totalSharedBytes();
+
+	static void addWatchers();
+
+private:
+	SharedGeometryCounter( const SharedGeometryCounter & );
+	SharedGeometryCounter & operator=( const SharedGeometryCounter & );
+
+	std::string		name_;
+	SimpleMutex		mutex_;
+
+	uint32			numCopies_;
+	uint32			numUsers_;
+	uint32			uniqueBytes_;
+	uint32			userBytes_;
+
+	typedef std::vector<SharedGeometryCounter *> Counters;
+	static Counters & counters();
+};
+
+
+#endif // SHARED_GEOMETRY_COUNTER_HPP
@@ -729,11 +729,11 @@ class PythonDataType : public DataType
 		 */
 		virtual bool isSameType( PyObject * pValue )
 		{
-			// TODO: We shouldn't have to pickle the object twice.
-			return !pickler().pickle( pValue ).empty();
-
-			// This supports any Python object that can be pickled.
-//			return true;
+			// Values of the builtin types are written without cPickle, so
+			// they can be checked without being pickled. Only other objects
+			// are pickled here to find out whether they can be.
+			return Pickler::canPickleNatively( pValue ) ||
+				!pickler().pickle( pValue ).empty();
 		}
 
 		/**
@@ -29,6 +29,7 @@ criminal penalties as provided by law.
 
 #include "pyscript/pyobject_plus.hpp"
 #include "pyscript/script.hpp"
+#include "pyscript/script_math.hpp"
 
 #include "resmgr/bwresource.hpp"
 #include "resmgr/multi_file_system.hpp"
@@ -284,6 +285,9 @@ static bool pythonScriptExists( const std::string & path )
 bool EntityDescription::parse( const std::string & name,
 		DataSectionPtr pSection, bool isFinal )
 {
+	// The properties are about to change.
+	streamPlans_.clear();
+
 	if (!pSection)
 	{
 		std::string filename = "entities/defs/" + name + ".def";
@@ -1129,11 +1133,304 @@ bool EntityDescription::addDictionaryToStream( PyObject * pDict,
 }
 
 
+// -----------------------------------------------------------------------------
+// Section: Stream plans
+// -----------------------------------------------------------------------------
+
+/**
+ *	This method returns the stream plan for the given data domains, compiling
+ *	it the first time that they are used. It has the properties that addToStream
+ *	would visit, in the same order, so the streams are the same.
+ */
+const EntityDescription::StreamPlan &
+	EntityDescription::streamPlan( int dataDomains ) const
+{
+	StreamPlans::iterator iter = streamPlans_.find( dataDomains );
+
+	if (iter != streamPlans_.end())
+	{
+		return iter->second;
+	}
+
+	StreamPlan & plan = streamPlans_[ dataDomains ];
+
+	for (int pass = 0; pass < NUM_PASSES; pass++)
+	{
+		if (!EntityDescription::shouldSkipPass( pass, dataDomains ))
+		{
+			for (uint i = 0; i < this->propertyCount(); i++)
+			{
+				DataDescription * pDD = this->property( i );
+
+				if (EntityDescription::shouldConsiderData( pass, pDD,
+							dataDomains ))
+				{
+					StreamStep step;
+					step.property = i;
+					step.pName = PyObjectPtr( PyString_InternFromString(
+							const_cast< char * >( pDD->name().c_str() ) ),
+						PyObjectPtr::STEAL_REFERENCE );
+					step.kind = EntityDescription::streamKind(
+							*pDD->dataType() );
+
+					plan.steps.push_back( step );
+				}
+			}
+
+			plan.passEnds.push_back( plan.steps.size() );
+		}
+	}
+
+	return plan;
+}
+
+
+/**
+ *	This static method returns how values of the given type are streamed.
+ */
+EntityDescription::StreamKind EntityDescription::streamKind(
+		const DataType & type )
+{
+	static const struct
+	{
+		const char *	name;
+		StreamKind		kind;
+	}
+	s_kinds[] =
+	{
+		{ "INT8",		STREAM_INT8 },
+		{ "UINT8",		STREAM_UINT8 },
+		{ "INT16",		STREAM_INT16 },
+		{ "UINT16",		STREAM_UINT16 },
+		{ "INT32",		STREAM_INT32 },
+		{ "FLOAT32",	STREAM_FLOAT32 },
+		{ "FLOAT64",	STREAM_FLOAT64 },
+		{ "VECTOR2",	STREAM_VECTOR2 },
+		{ "VECTOR3",	STREAM_VECTOR3 },
+		{ "VECTOR4",	STREAM_VECTOR4 }
+	};
+
+	const char * name = type.pMetaDataType()->name();
+
+	for (uint i = 0; i < sizeof( s_kinds )/sizeof( s_kinds[0] ); i++)
+	{
+		if (strcmp( name, s_kinds[i].name ) == 0)
+		{
+			return s_kinds[i].kind;
+		}
+	}
+
+	return STREAM_GENERIC;
+}
+
+
+namespace
+{
+
+/**
+ *	This function streams a Python int as an INT_TYPE, as IntegerDataType
+ *	would. It returns false, without streaming anything, if the value is not
+ *	an int or is out of range, so that the DataType can deal with it.
+ */
+template <class INT_TYPE>
+inline bool addIntToStream( PyObject * pValue, BinaryOStream & stream )
+{
+	if (!PyInt_CheckExact( pValue ))
+	{
+		return false;
+	}
+
+	long value = PyInt_AS_LONG( pValue );
+
+	if (value != long( INT_TYPE( value ) ))
+	{
+		return false;
+	}
+
+	stream << INT_TYPE( value );
+
+	return true;
+}
+
+
+/**
+ *	This function streams a Python float as a FLOATTYPE, as FloatDataType
+ *	would.
+ */
+template <class FLOATTYPE>
+inline bool addFloatToStream( PyObject * pValue, BinaryOStream & stream )
+{
+	if (!PyFloat_Check( pValue ))
+	{
+		return false;
+	}
+
+	stream << FLOATTYPE( PyFloat_AS_DOUBLE( pValue ) );
+
+	return true;
+}
+
+
+/**
+ *	This function streams a PyVector, as VectorDataType would. Tuples are left
+ *	to the DataType.
+ */
+template <class VECTOR>
+inline bool addVectorToStream( PyObject * pValue, BinaryOStream & stream )
+{
+	if (!PyVector< VECTOR >::Check( pValue ))
+	{
+		return false;
+	}
+
+	stream << static_cast< PyVector< VECTOR > * >( pValue )->getVector();
+
+	return true;
+}
+
+
+/**
+ *	This function reads an INT_TYPE from the stream, as IntegerDataType would.
+ */
+template <class INT_TYPE>
+inline PyObject * createIntFromStream( BinaryIStream & stream )
+{
+	INT_TYPE value = 0;
+	stream >> value;
+
+	return stream.error() ? NULL : PyInt_FromLong( (long)value );
+}
+
+
+/**
+ *	This function reads a FLOATTYPE from the stream, as FloatDataType would.
+ */
+template <class FLOATTYPE>
+inline PyObject * createFloatFromStream( BinaryIStream & stream )
+{
+	FLOATTYPE value = 0.f;
+	stream >> value;
+
+	return stream.error() ? NULL : PyFloat_FromDouble( (double)value );
+}
+
+
+/**
+ *	This function reads a VECTOR from the stream, as VectorDataType would.
+ */
+template <class VECTOR>
+inline PyObject * createVectorFromStream( BinaryIStream & stream )
+{
+	VECTOR value;
+	stream >> value;
+
+	return stream.error() ? NULL : Script::getData( value );
+}
+
+} // anonymous namespace
+
+
+/**
+ *	This static method streams a value of a simple type without going through
+ *	its DataType.
+ *
+ *	@return	True if the value was streamed, or false, without streaming
+ *			anything, if it must be streamed by addGenericToStream.
+ */
+bool EntityDescription::addSimpleToStream( StreamKind kind, PyObject * pValue,
+		BinaryOStream & stream )
+{
+	switch (kind)
+	{
+		case STREAM_INT8:		return addIntToStream< int8 >( pValue, stream );
+		case STREAM_UINT8:		return addIntToStream< uint8 >( pValue, stream );
+		case STREAM_INT16:		return addIntToStream< int16 >( pValue, stream );
+		case STREAM_UINT16:		return addIntToStream< uint16 >( pValue, stream );
+		case STREAM_INT32:		return addIntToStream< int32 >( pValue, stream );
+		case STREAM_FLOAT32:	return addFloatToStream< float >( pValue, stream );
+		case STREAM_FLOAT64:	return addFloatToStream< double >( pValue, stream );
+		case STREAM_VECTOR2:	return addVectorToStream< Vector2 >( pValue, stream );
+		case STREAM_VECTOR3:	return addVectorToStream< Vector3 >( pValue, stream );
+		case STREAM_VECTOR4:	return addVectorToStream< Vector4 >( pValue, stream );
+		default:				return false;
+	}
+}
+
+
+/**
+ *	This static method streams a value through its DataType. It does the same
+ *	as AddToStreamVisitor::addToStream, once the value has been found.
+ *
+ *	@param pValue	The value to stream, or NULL if it could not be found.
+ *
+ *	@return	False if the initial value had to be streamed instead.
+ */
+bool EntityDescription::addGenericToStream( DataDescription & dataDesc,
+		PyObjectPtr pValue, BinaryOStream & stream, bool isPersistentOnly )
+{
+	bool result = true;
+
+	if (!pValue)
+	{
+		pValue = dataDesc.pInitialValue();
+		result = false;
+	}
+
+	if (!dataDesc.isCorrectType( pValue.getObject() ))
+	{
+		ERROR_MSG( "EntityDescription::addToStream: "
+			"data for %s is wrong type\n", dataDesc.name().c_str() );
+		pValue = dataDesc.pInitialValue();
+		result = false;
+	}
+
+	dataDesc.addToStream( pValue.getObject(), stream, isPersistentOnly );
+
+	return result;
+}
+
+
+/**
+ *	This static method reads a value of a simple type without going through
+ *	its DataType.
+ *
+ *	@return	A new reference to the value, or NULL if the stream ran out.
+ */
+PyObject * EntityDescription::createSimpleFromStream( StreamKind kind,
+		BinaryIStream & stream )
+{
+	switch (kind)
+	{
+		case STREAM_INT8:		return createIntFromStream< int8 >( stream );
+		case STREAM_UINT8:		return createIntFromStream< uint8 >( stream );
+		case STREAM_INT16:		return createIntFromStream< int16 >( stream );
+		case STREAM_UINT16:		return createIntFromStream< uint16 >( stream );
+		case STREAM_INT32:		return createIntFromStream< int32 >( stream );
+		case STREAM_FLOAT32:	return createFloatFromStream< float >( stream );
+		case STREAM_FLOAT64:	return createFloatFromStream< double >( stream );
+		case STREAM_VECTOR2:	return createVectorFromStream< Vector2 >( stream );
+		case STREAM_VECTOR3:	return createVectorFromStream< Vector3 >( stream );
+		case STREAM_VECTOR4:	return createVectorFromStream< Vector4 >( stream );
+		default:
+			MF_ASSERT( 0 );
+			return NULL;
+	}
+}
+
+
+// -----------------------------------------------------------------------------
+// Section: Streaming
+// -----------------------------------------------------------------------------
+
 /**
  *	This method adds information from the input entity to the input stream.
  *	It may include base, client or cell data or any combination of these. This
  *	is specified by the dataDomains argument.
  *
+ *	This is the same as using an AddToStreamAttributeVisitor with addToStream,
+ *	but follows the stream plan for the data domains, so that the properties
+ *	do not have to be filtered and simple values skip their DataType.
+ *
  *	@see EntityDescription::addAttributesToStream
  */
 bool EntityDescription::addAttributesToStream( PyObject * pObject,
@@ -1149,10 +1446,138 @@ bool EntityDescription::addAttributesToStream( PyObject * pObject,
 		return false;
 	}
 
-	AddToStreamAttributeVisitor visitor( pObject );
+	const StreamPlan & plan = this->streamPlan( dataDomains );
+	bool isPersistentOnly = (dataDomains & ONLY_PERSISTENT_DATA) != 0;
+
+	int actualPass = 0;
+	unsigned int i = 0;
+
+	while (actualPass < int( plan.passEnds.size() ))
+	{
+		int initialStreamSize = stream.size();
+
+		for (; i < plan.passEnds[ actualPass ]; i++)
+		{
+			if (!this->addStepToStream( plan.steps[ i ], pObject, stream,
+					isPersistentOnly ))
+			{
+				return false;
+			}
+		}
+
+		if ((pDataSizes != NULL) && (actualPass < numDataSizes))
+		{
+			pDataSizes[actualPass] = stream.size() - initialStreamSize;
+		}
+
+		actualPass++;
+	}
+
+	MF_ASSERT( (numDataSizes == 0) || (numDataSizes == actualPass) ||
+			(numDataSizes == actualPass - 1) );
+
+	return true;
+}
+
+
+/**
+ *	This method adds the properties of the input entity that have changed to
+ *	the input stream, as a delta of the stream that addAttributesToStream would
+ *	write for the same data domains.
+ *
+ *	The delta starts with a bit for each property that addAttributesToStream
+ *	would stream, in the same order, packed into bytes starting with the lowest
+ *	bit. It is followed by the properties whose bits are set, streamed as
+ *	usual. The reader must use the same data domains.
+ *
+ *	@param pObject			The entity to read the properties from.
+ *	@param stream			The stream to add the delta to.
+ *	@param dataDomains		Indicates the type of data to be added.
+ *	@param dirtyProperties	The properties that have changed.
+ *
+ *	@return True on success, otherwise false.
+ */
+bool EntityDescription::addDirtyAttributesToStream( PyObject * pObject,
+		BinaryOStream & stream,
+		int dataDomains,
+		const DirtyProperties & dirtyProperties ) const
+{
+	if (pObject == NULL)
+	{
+		ERROR_MSG( "EntityDescription::addDirtyAttributesToStream: "
+				"pObject is NULL\n" );
+		return false;
+	}
+
+	const StreamPlan & plan = this->streamPlan( dataDomains );
+	bool isPersistentOnly = (dataDomains & ONLY_PERSISTENT_DATA) != 0;
+
+	uint8 * pMask =
+		(uint8 *)stream.reserve( (plan.steps.size() + 7) / 8 );
+	memset( pMask, 0, (plan.steps.size() + 7) / 8 );
+
+	for (unsigned int i = 0; i < plan.steps.size(); i++)
+	{
+		if (dirtyProperties.isDirty( plan.steps[ i ].property ))
+		{
+			pMask[ i >> 3 ] |= uint8( 1 << (i & 7) );
+		}
+	}
+
+	for (unsigned int i = 0; i < plan.steps.size(); i++)
+	{
+		if (dirtyProperties.isDirty( plan.steps[ i ].property ) &&
+			!this->addStepToStream( plan.steps[ i ], pObject, stream,
+					isPersistentOnly ))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/**
+ *	This method adds a property of the input entity to the stream. It does the
+ *	same as AddToStreamAttributeVisitor, but with the interned name of the
+ *	property and without the DataType for simple values.
+ *
+ *	@return False if the stream is now invalid.
+ */
+bool EntityDescription::addStepToStream( const StreamStep & step,
+		PyObject * pObject, BinaryOStream & stream,
+		bool isPersistentOnly ) const
+{
+	PyObject * pValue = PyObject_GetAttr( pObject, step.pName.getObject() );
+
+	if (pValue == NULL)
+	{
+		PyErr_PrintEx(0);
+	}
+	else if (addSimpleToStream( step.kind, pValue, stream ))
+	{
+		Py_DECREF( pValue );
+		return true;
+	}
+
+	DataDescription * pDD = this->property( step.property );
+
+	if (!addGenericToStream( *pDD,
+			PyObjectPtr( pValue, PyObjectPtr::STEAL_REFERENCE ),
+			stream, isPersistentOnly ))
+	{
+		// TODO: Make sure that every caller handles the false
+		// case correctly. The stream is now in an invalid state
+		// so if it is still used it may cause problems remotely
+		ERROR_MSG( "EntityDescription::addToStream: "
+					"Failed to add to stream while adding %s. "
+					"STREAM NOW INVALID!!\n",
+			pDD->name().c_str() );
+		return false;
+	}
 
-	return this->addToStream( visitor, stream, dataDomains,
-			pDataSizes, numDataSizes );
+	return true;
 }
 
 
@@ -1258,53 +1683,164 @@ bool EntityDescription::readStreamToDict( BinaryIStream & stream,
 {
 	MF_ASSERT( PyDict_Check( pDict ) );
 
-	class Visitor : public IDataDescriptionVisitor
+	const StreamPlan & plan = this->streamPlan( dataDomains );
+	bool isPersistentOnly = (dataDomains & ONLY_PERSISTENT_DATA) != 0;
+
+	for (unsigned int i = 0; i < plan.steps.size(); i++)
 	{
-		BinaryIStream & stream_;
-		PyObject * pDict_;
-		bool onlyPersistent_;
+		if (!this->readStepToDict( plan.steps[ i ], stream, isPersistentOnly,
+				pDict ))
+		{
+			return false;
+		}
+	}
 
-	public:
-		Visitor( BinaryIStream & stream, PyObject * pDict, bool onlyPersistent ) :
-			stream_( stream ),
-			pDict_( pDict ),
-			onlyPersistent_( onlyPersistent ) {}
+	return true;
+}
 
-		bool visit( const DataDescription & dataDesc )
+
+/**
+ *	This method removes a delta written by addDirtyAttributesToStream from the
+ *	input stream and sets the changed values on the input dictionary.
+ */
+bool EntityDescription::readDeltaStreamToDict( BinaryIStream & stream,
+	int dataDomains, PyObject * pDict ) const
+{
+	MF_ASSERT( PyDict_Check( pDict ) );
+
+	const StreamPlan & plan = this->streamPlan( dataDomains );
+	bool isPersistentOnly = (dataDomains & ONLY_PERSISTENT_DATA) != 0;
+
+	std::string mask;
+
+	if (!readDeltaMask( stream, plan, mask ))
+	{
+		return false;
+	}
+
+	for (unsigned int i = 0; i < plan.steps.size(); i++)
+	{
+		if (isInDeltaMask( mask, i ) &&
+			!this->readStepToDict( plan.steps[ i ], stream, isPersistentOnly,
+				pDict ))
 		{
-			// TRACE_MSG( "EntityDescription::readStream: Reading property=%s\n", pDD->name().c_str() );
+			return false;
+		}
+	}
 
-			PyObjectPtr pValue = dataDesc.createFromStream( stream_,
-									onlyPersistent_ );
+	return true;
+}
 
-			MF_ASSERT_DEV( pValue );
 
-			if (pValue)
-			{
-				if (PyDict_SetItemString( pDict_,
-						const_cast<char*>( dataDesc.name().c_str() ),
-						&*pValue ) == -1)
-				{
-					ERROR_MSG( "EntityDescription::readStream: "
-							"Failed to set %s\n", dataDesc.name().c_str() );
-					PyErr_PrintEx(0);
-				}
-			}
-			else
-			{
-				ERROR_MSG( "EntityDescription::readStream: "
-							"Could not create %s from stream.\n",
-						dataDesc.name().c_str() );
-				return false;
-			}
+/**
+ *	This method reads a property from the stream and sets it on the input
+ *	dictionary.
+ *
+ *	@return False if the stream could not be read.
+ */
+bool EntityDescription::readStepToDict( const StreamStep & step,
+	BinaryIStream & stream, bool isPersistentOnly, PyObject * pDict ) const
+{
+	const DataDescription * pDD = this->property( step.property );
 
-			return !stream_.error();
+	// TRACE_MSG( "EntityDescription::readStream: Reading property=%s\n", pDD->name().c_str() );
+
+	PyObjectPtr pValue = (step.kind == STREAM_GENERIC) ?
+		pDD->createFromStream( stream, isPersistentOnly ) :
+		PyObjectPtr( createSimpleFromStream( step.kind, stream ),
+			PyObjectPtr::STEAL_REFERENCE );
+
+	MF_ASSERT_DEV( pValue );
+
+	if (pValue)
+	{
+		if (PyDict_SetItem( pDict, step.pName.getObject(),
+				pValue.getObject() ) == -1)
+		{
+			ERROR_MSG( "EntityDescription::readStream: "
+					"Failed to set %s\n", pDD->name().c_str() );
+			PyErr_PrintEx(0);
 		}
-	};
+	}
+	else
+	{
+		ERROR_MSG( "EntityDescription::readStream: "
+					"Could not create %s from stream.\n",
+				pDD->name().c_str() );
+		return false;
+	}
 
-	Visitor visitor( stream, pDict,
-			((dataDomains & ONLY_PERSISTENT_DATA) != 0) );
-	return this->visit( dataDomains, visitor );
+	return !stream.error();
+}
+
+
+/**
+ *	This method removes a delta written by addDirtyAttributesToStream from the
+ *	input stream and calls the visitor's visit method for each property in it.
+ *	The visitor must remove the value of the property from the stream.
+ */
+bool EntityDescription::visitDelta( BinaryIStream & stream, int dataDomains,
+		IDataDescriptionVisitor & visitor ) const
+{
+	const StreamPlan & plan = this->streamPlan( dataDomains );
+
+	std::string mask;
+
+	if (!readDeltaMask( stream, plan, mask ))
+	{
+		return false;
+	}
+
+	for (unsigned int i = 0; i < plan.steps.size(); i++)
+	{
+		if (isInDeltaMask( mask, i ) &&
+			!visitor.visit( *this->property( plan.steps[ i ].property ) ))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/**
+ *	This static method removes the mask at the start of a delta from the
+ *	stream.
+ *
+ *	@param stream	The stream to read from.
+ *	@param plan		The stream plan that the delta was written with.
+ *	@param mask		Set to the mask.
+ *
+ *	@return False if the stream is too short.
+ */
+bool EntityDescription::readDeltaMask( BinaryIStream & stream,
+		const StreamPlan & plan, std::string & mask )
+{
+	int maskSize = (plan.steps.size() + 7) / 8;
+
+	// Copied, since the stream may reuse the memory on the next retrieve.
+	mask.assign( (const char *)stream.retrieve( maskSize ), maskSize );
+
+	if (stream.error())
+	{
+		ERROR_MSG( "EntityDescription::readDeltaMask: "
+				"Not enough data on stream to read mask\n" );
+		return false;
+	}
+
+	return true;
+}
+
+
+/**
+ *	This static method returns whether the given step of a stream plan is in
+ *	the mask of a delta.
+ */
+bool EntityDescription::isInDeltaMask( const std::string & mask,
+		unsigned int step )
+{
+	return (uint8( mask[ step >> 3 ] ) & (1 << (step & 7))) != 0;
 }
 
 
@@ -1386,6 +1922,51 @@ bool EntityDescription::readStreamToSection( BinaryIStream & stream,
 }
 
 
+/**
+ *	This method removes a delta written by addDirtyAttributesToStream from the
+ *	input stream and replaces the changed properties in the input DataSection.
+ */
+bool EntityDescription::readDeltaStreamToSection( BinaryIStream & stream,
+	int dataDomains, DataSectionPtr pSection ) const
+{
+	class Visitor : public IDataDescriptionVisitor
+	{
+		BinaryIStream & stream_;
+		DataSection * pSection_;
+		bool onlyPersistent_;
+
+	public:
+		Visitor( BinaryIStream & stream,
+				DataSectionPtr pSection, bool onlyPersistent ) :
+			stream_( stream ),
+			pSection_( pSection.getObject() ),
+			onlyPersistent_( onlyPersistent ) {}
+
+		bool visit( const DataDescription & dataDesc )
+		{
+			// The old value is removed first, since sequences would otherwise
+			// be added to it.
+			pSection_->deleteSections( dataDesc.name() );
+
+			DataSectionPtr pCurr = pSection_->openSection( dataDesc.name(),
+					true );
+
+			MF_ASSERT( pCurr );
+
+			if (pCurr)
+			{
+				dataDesc.fromStreamToSection( stream_, pCurr, onlyPersistent_ );
+			}
+			return !stream_.error();
+		}
+	};
+
+	Visitor visitor( stream, pSection,
+			((dataDomains & ONLY_PERSISTENT_DATA) != 0) );
+	return this->visitDelta( stream, dataDomains, visitor );
+}
+
+
 /**
  *	This method adds this object to the input MD5 object.
  */
@@ -1940,4 +2521,120 @@ void EntityDescription::PropertyEventStamps::removeFromStream(
 	}
 }
 
+
+// -----------------------------------------------------------------------------
+// Section: DirtyProperties
+// -----------------------------------------------------------------------------
+
+/**
+ *	Constructor.
+ */
+EntityDescription::DirtyProperties::DirtyProperties() :
+	flags_(),
+	numDirty_( 0 )
+{
+}
+
+
+/**
+ *	This method initialises this object for an entity of the given type, with
+ *	no properties marked as changed.
+ */
+void EntityDescription::DirtyProperties::init(
+		const EntityDescription & entityDescription )
+{
+	flags_.assign( entityDescription.propertyCount(), false );
+	numDirty_ = 0;
+}
+
+
+/**
+ *	This method marks all of the properties as changed. This is used when the
+ *	destination may not have a full copy, so that the next delta holds
+ *	everything.
+ */
+void EntityDescription::DirtyProperties::setAll()
+{
+	flags_.assign( flags_.size(), true );
+	numDirty_ = flags_.size();
+}
+
+
+/**
+ *	This method marks all of the properties as unchanged.
+ */
+void EntityDescription::DirtyProperties::clear()
+{
+	if (numDirty_ != 0)
+	{
+		flags_.assign( flags_.size(), false );
+		numDirty_ = 0;
+	}
+}
+
+
+// -----------------------------------------------------------------------------
+// Section: DirtyPropertyOwner
+// -----------------------------------------------------------------------------
+
+/**
+ *	Constructor.
+ *
+ *	@param entityDescription	The type of the entity.
+ *	@param dirtyProperties		The flags to mark. These should have been
+ *								initialised for the same type.
+ */
+EntityDescription::DirtyPropertyOwner::DirtyPropertyOwner(
+		const EntityDescription & entityDescription,
+		DirtyProperties & dirtyProperties ) :
+	entityDescription_( entityDescription ),
+	dirtyProperties_( dirtyProperties )
+{
+}
+
+
+/**
+ *	This method attaches a new value of a property to this owner, and marks
+ *	the property as changed. The entity should store the returned value,
+ *	which may differ from the one passed in, as the property.
+ *
+ *	@return The attached value, or NULL if it is not of the property's type.
+ */
+PyObjectPtr EntityDescription::DirtyPropertyOwner::attach(
+		DataDescription & dataDescription, PyObject * pValue )
+{
+	PyObjectPtr pAttached = dataDescription.dataType()->attach( pValue,
+		this, dataDescription.index() );
+
+	if (pAttached)
+	{
+		dirtyProperties_.set( dataDescription );
+	}
+
+	return pAttached;
+}
+
+
+/**
+ *	This method is called when a value within one of the properties has
+ *	changed. The last element of the path is the reference that the property
+ *	was attached with, which is its index.
+ */
+void EntityDescription::DirtyPropertyOwner::propertyChanged( PyObjectPtr val,
+		const DataType & type, ChangePath path )
+{
+	if (path.empty() ||
+			uint( path[ path.size() - 1 ] ) >=
+				entityDescription_.propertyCount())
+	{
+		ERROR_MSG( "EntityDescription::DirtyPropertyOwner::propertyChanged: "
+				"Bad path for entity type %s\n",
+			entityDescription_.name().c_str() );
+		return;
+	}
+
+	dirtyProperties_.set(
+		*entityDescription_.property( path[ path.size() - 1 ] ) );
+}
+
 // entity_description.cpp
@@ -212,6 +212,66 @@ public:
 		Stamps eventStamps_;
 	};
 
+	/**
+	 *	This class is used to record which properties of an entity have
+	 *	changed since they were last written somewhere, such as to a backup
+	 *	or to the database. The owner of the properties sets the flag of a
+	 *	property whenever it is changed, and clears the flags once the changes
+	 *	have been streamed with addDirtyAttributesToStream. Each destination
+	 *	that is written to on its own schedule needs its own object.
+	 */
+	class DirtyProperties
+	{
+	public:
+		DirtyProperties();
+
+		void init( const EntityDescription & entityDescription );
+
+		void set( const DataDescription & dataDescription );
+		void setAll();
+		void clear();
+
+		bool isDirty( const DataDescription & dataDescription ) const;
+		bool isDirty( unsigned int index ) const;
+
+		/// This method returns whether any property has changed.
+		bool any() const	{ return numDirty_ != 0; }
+
+	private:
+		std::vector< bool >	flags_;
+		unsigned int		numDirty_;
+	};
+
+	/**
+	 *	This class is a property owner that marks the properties of an entity
+	 *	in a DirtyProperties as they are changed. A value attached to it with
+	 *	attach marks its property, as does any later change within the value,
+	 *	such as to an element of an array. It is for entities whose properties
+	 *	are not sent on to anything else, such as bases, so it has no
+	 *	divisions.
+	 */
+	class DirtyPropertyOwner : public PropertyOwnerBase
+	{
+	public:
+		DirtyPropertyOwner( const EntityDescription & entityDescription,
+			DirtyProperties & dirtyProperties );
+
+		PyObjectPtr attach( DataDescription & dataDescription,
+			PyObject * pValue );
+
+		virtual void propertyChanged( PyObjectPtr val, const DataType & type,
+			ChangePath path );
+
+		virtual int propertyDivisions()				{ return 0; }
+		virtual PropertyOwnerBase * propertyVassal( int ref )	{ return NULL; }
+		virtual PyObjectPtr propertyRenovate( int ref, BinaryIStream & data,
+			PyObjectPtr & pValue, DataType *& pType )	{ return NULL; }
+
+	private:
+		const EntityDescription &	entityDescription_;
+		DirtyProperties &			dirtyProperties_;
+	};
+
 	class Methods
 	{
 	public:
@@ -276,10 +336,26 @@ public:
 				int * pDataSizes = NULL,
 		   		int numDataSizes = 0 ) const;
 
+	bool	addDirtyAttributesToStream( PyObject * pObject,
+				BinaryOStream & stream,
+				int dataDomains,
+				const DirtyProperties & dirtyProperties ) const;
+
 	bool	readStreamToDict( BinaryIStream & stream,
 				int dataDomains,
 				PyObject * pDest ) const;
 
+	bool	readDeltaStreamToDict( BinaryIStream & stream,
+				int dataDomains,
+				PyObject * pDest ) const;
+
+	bool	readDeltaStreamToSection( BinaryIStream & stream,
+				int dataDomains,
+				DataSectionPtr pSection ) const;
+
+	bool	visitDelta( BinaryIStream & stream, int dataDomains,
+				IDataDescriptionVisitor & visitor ) const;
+
 	// Deprecated but here for backwards compatibility
 	inline bool	readStream( BinaryIStream & stream,
 				int dataDomains,
@@ -379,6 +455,66 @@ private:
 		int dataDomains );
 	static bool shouldSkipPass( int pass, int dataDomains );
 
+	/**
+	 *	This enumeration is how a property is streamed by a StreamPlan. Values
+	 *	of the simple types are streamed directly, when they have the usual
+	 *	Python type, instead of through their DataType.
+	 */
+	enum StreamKind
+	{
+		STREAM_GENERIC,
+		STREAM_INT8,
+		STREAM_UINT8,
+		STREAM_INT16,
+		STREAM_UINT16,
+		STREAM_INT32,
+		STREAM_FLOAT32,
+		STREAM_FLOAT64,
+		STREAM_VECTOR2,
+		STREAM_VECTOR3,
+		STREAM_VECTOR4
+	};
+
+	/**
+	 *	This structure is a property to stream, as one step of a StreamPlan.
+	 */
+	struct StreamStep
+	{
+		unsigned int	property;
+		PyObjectPtr		pName;
+		StreamKind		kind;
+	};
+
+	/**
+	 *	This structure is the properties that are streamed for a combination
+	 *	of data domains, in stream order. passEnds holds the number of steps
+	 *	that are done by the end of each pass that is not skipped.
+	 */
+	struct StreamPlan
+	{
+		std::vector< StreamStep >	steps;
+		std::vector< unsigned int >	passEnds;
+	};
+
+	const StreamPlan & streamPlan( int dataDomains ) const;
+
+	bool addStepToStream( const StreamStep & step, PyObject * pObject,
+		BinaryOStream & stream, bool isPersistentOnly ) const;
+	bool readStepToDict( const StreamStep & step, BinaryIStream & stream,
+		bool isPersistentOnly, PyObject * pDict ) const;
+
+	static bool readDeltaMask( BinaryIStream & stream,
+		const StreamPlan & plan, std::string & mask );
+	static bool isInDeltaMask( const std::string & mask, unsigned int step );
+
+	static StreamKind streamKind( const DataType & type );
+	static bool addSimpleToStream( StreamKind kind, PyObject * pValue,
+		BinaryOStream & stream );
+	static bool addGenericToStream( DataDescription & dataDesc,
+		PyObjectPtr pValue, BinaryOStream & stream, bool isPersistentOnly );
+	static PyObject * createSimpleFromStream( StreamKind kind,
+		BinaryIStream & stream );
+
 	typedef std::vector< DataDescription >		Properties;
 	typedef std::vector< unsigned int >			PropertyIndices;
 
@@ -418,6 +554,10 @@ private:
 	/// time that they changed.
 	unsigned int		numEventStampedProperties_;
 
+	/// Stores the stream plans that have been used, by their data domains.
+	typedef std::map< int, StreamPlan > StreamPlans;
+	mutable StreamPlans	streamPlans_;
+
 #ifdef MF_SERVER
 	DataLoDLevels		lodLevels_;
 #endif
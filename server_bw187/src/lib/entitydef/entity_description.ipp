@@ -140,6 +140,49 @@ INLINE EventNumber EntityDescription::PropertyEventStamps::get(
 }
 
 
+// -----------------------------------------------------------------------------
+// Section: DirtyProperties
+// -----------------------------------------------------------------------------
+
+/**
+ *	This method marks the given property as changed.
+ */
+INLINE void EntityDescription::DirtyProperties::set(
+		const DataDescription & dataDescription )
+{
+	const int index = dataDescription.index();
+	MF_ASSERT( 0 <= index && index < (int)flags_.size() );
+
+	if (!flags_[ index ])
+	{
+		flags_[ index ] = true;
+		++numDirty_;
+	}
+}
+
+
+/**
+ *	This method returns whether the given property has changed.
+ */
+INLINE bool EntityDescription::DirtyProperties::isDirty(
+		const DataDescription & dataDescription ) const
+{
+	return this->isDirty( dataDescription.index() );
+}
+
+
+/**
+ *	This method returns whether the property with the given index has changed.
+ */
+INLINE bool EntityDescription::DirtyProperties::isDirty(
+		unsigned int index ) const
+{
+	MF_ASSERT( index < flags_.size() );
+
+	return flags_[ index ];
+}
+
+
 // -----------------------------------------------------------------------------
 // Section: Accessors
 // -----------------------------------------------------------------------------
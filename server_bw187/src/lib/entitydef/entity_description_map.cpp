@@ -16,14 +16,211 @@ criminal penalties as provided by law.
 #include "entity_description_map.hpp"
 // #include "cstdmf/md5.hpp"
 
+#include "cstdmf/concurrency.hpp"
 #include "cstdmf/debug.hpp"
+#include "cstdmf/timestamp.hpp"
 #include "resmgr/bwresource.hpp"
 
+#include <set>
+
 DECLARE_DEBUG_COMPONENT2( "DataDescription", 0 )
 
 namespace // anonymous
 {
 std::vector< EntityDescriptionMap * >& s_mapCollection = *new std::vector< EntityDescriptionMap*>;
+
+
+/**
+ *	This class opens the .def files of a set of entity types on a pool of
+ *	threads, before they are parsed. It follows the Parent and Implements tags
+ *	of each file that it opens, so that the ancestors and interfaces are
+ *	opened too.
+ *
+ *	The opened sections are held on to until this object is destroyed, so
+ *	that BWResource finds them in its census when the parse opens them again.
+ *	Only the file system access and XML parsing happen on the threads. The
+ *	descriptions are still parsed on the main thread, in the order of
+ *	entities.xml, because creating the data types needs Python.
+ */
+class DefLoader
+{
+public:
+	DefLoader();
+
+	void load( DataSectionPtr pEntities, int numThreads );
+
+	int numLoaded() const	{ return sections_.size(); }
+
+private:
+	static void s_run( void * arg );
+	void run();
+
+	void addDef( const std::string & filename );
+	void addDependencies( DataSectionPtr pSection );
+
+	SimpleMutex		mutex_;
+	SimpleSemaphore	semaphore_;
+	int				numThreads_;
+	int				numBusy_;
+
+	std::vector< std::string >		pending_;
+	std::set< std::string >			seen_;
+	std::vector< DataSectionPtr >	sections_;
+};
+
+
+/**
+ *	Constructor.
+ */
+DefLoader::DefLoader() :
+	numThreads_( 0 ),
+	numBusy_( 0 )
+{
+}
+
+
+/**
+ *	This method opens the .def files of the given entity types, and returns
+ *	once they have all been opened.
+ *
+ *	@param pEntities	The entities.xml section.
+ *	@param numThreads	The number of threads to open them on.
+ */
+void DefLoader::load( DataSectionPtr pEntities, int numThreads )
+{
+	numThreads_ = numThreads;
+
+	{
+		SimpleMutexHolder holder( mutex_ );
+
+		for (int i = 0; i < pEntities->countChildren(); ++i)
+		{
+			this->addDef( "entities/defs/" +
+				pEntities->openChild( i )->sectionName() + ".def" );
+		}
+
+		if (pending_.empty())
+		{
+			return;
+		}
+	}
+
+	std::vector< SimpleThread * > threads;
+
+	for (int i = 0; i < numThreads_; ++i)
+	{
+		threads.push_back( new SimpleThread( &DefLoader::s_run, this ) );
+	}
+
+	// Deleting the threads joins them.
+	for (unsigned int i = 0; i < threads.size(); ++i)
+	{
+		delete threads[i];
+	}
+}
+
+
+/**
+ *	This static method is the entry point of the loading threads.
+ */
+void DefLoader::s_run( void * arg )
+{
+	static_cast< DefLoader * >( arg )->run();
+}
+
+
+/**
+ *	This method opens pending files until there are none left. Each pending
+ *	file has been pushed onto the semaphore. Once the last file has been
+ *	opened, the semaphore is pushed once for each thread, to wake them up to
+ *	find that there is nothing left to do.
+ */
+void DefLoader::run()
+{
+	while (true)
+	{
+		semaphore_.pull();
+
+		std::string filename;
+
+		{
+			SimpleMutexHolder holder( mutex_ );
+
+			if (pending_.empty())
+			{
+				return;
+			}
+
+			filename = pending_.back();
+			pending_.pop_back();
+			++numBusy_;
+		}
+
+		DataSectionPtr pSection = BWResource::openSection( filename );
+
+		SimpleMutexHolder holder( mutex_ );
+
+		if (pSection)
+		{
+			sections_.push_back( pSection );
+			this->addDependencies( pSection );
+		}
+
+		--numBusy_;
+
+		if (numBusy_ == 0 && pending_.empty())
+		{
+			for (int i = 0; i < numThreads_; ++i)
+			{
+				semaphore_.push();
+			}
+		}
+	}
+}
+
+
+/**
+ *	This method adds a file to be opened, if it has not been already. The
+ *	mutex must be held.
+ */
+void DefLoader::addDef( const std::string & filename )
+{
+	if (seen_.insert( filename ).second)
+	{
+		pending_.push_back( filename );
+		semaphore_.push();
+	}
+}
+
+
+/**
+ *	This method adds the parent and interfaces of an opened .def file to be
+ *	opened. The mutex must be held.
+ */
+void DefLoader::addDependencies( DataSectionPtr pSection )
+{
+	std::string parentName = pSection->readString( "Parent" );
+
+	if (!parentName.empty())
+	{
+		this->addDef( "entities/defs/" + parentName + ".def" );
+	}
+
+	DataSectionPtr pInterfaces = pSection->openSection( "Implements" );
+
+	if (pInterfaces)
+	{
+		DataSection::iterator iter = pInterfaces->begin();
+
+		while (iter != pInterfaces->end())
+		{
+			this->addDef( "entities/defs/interfaces/" +
+				(*iter)->asString() + ".def" );
+			++iter;
+		}
+	}
+}
+
 } // anonymous
 
 
@@ -43,10 +240,15 @@ protected:
 static EntityDefFiniTimeJob s_entityDefFiniTimeJob;
 
 
+const int EntityDescriptionMap::DEFAULT_LOADING_THREADS;
+
+
 /**
  *	Constructor.
  */
-EntityDescriptionMap::EntityDescriptionMap()
+EntityDescriptionMap::EntityDescriptionMap() :
+	loadTime_( 0.0 ),
+	parseTime_( 0.0 )
 {
 	// NOTE: Not thread safe.
 	s_mapCollection.push_back( this );
@@ -65,11 +267,19 @@ EntityDescriptionMap::~EntityDescriptionMap()
 /**
  *	This method parses the entity description map from a datasection.
  *
+ *	If numLoadingThreads is set, the .def files are first opened on a pool of
+ *	that many threads, and are then parsed in order on this thread. It
+ *	defaults to DEFAULT_LOADING_THREADS, which starts none. The servers read
+ *	it from entityDefLoadingThreads in bw.xml, with the same default.
+ *
  *	@param pSection	Datasection containing the entity descriptions.
+ *	@param numLoadingThreads	The number of threads to open the .def files on.
+ *					If this is 0, they are opened as they are parsed.
  *
  *	@return true if successful, false otherwise.
  */
-bool EntityDescriptionMap::parse( DataSectionPtr pSection )
+bool EntityDescriptionMap::parse( DataSectionPtr pSection,
+		int numLoadingThreads )
 {
 	if (!pSection)
 	{
@@ -77,6 +287,18 @@ bool EntityDescriptionMap::parse( DataSectionPtr pSection )
 		return false;
 	}
 
+	uint64 startTime = timestamp();
+
+	// The loader holds on to the opened files until the parse is done.
+	DefLoader loader;
+
+	if (numLoadingThreads > 0)
+	{
+		loader.load( pSection, numLoadingThreads );
+	}
+
+	uint64 loadedTime = timestamp();
+
 	bool isOkay = true;
 	int size = pSection->countChildren();
 	vector_.resize( size );
@@ -202,6 +424,13 @@ bool EntityDescriptionMap::parse( DataSectionPtr pSection )
 						&EntityDescription::exposedCellMethodCount, 62, 62*256);
 	INFO_MSG( "\n" );
 
+	loadTime_ = double( loadedTime - startTime ) / stampsPerSecondD();
+	parseTime_ = double( timestamp() - loadedTime ) / stampsPerSecondD();
+
+	INFO_MSG( "EntityDescriptionMap::parse: "
+			"Opened %d .def files in %.3fs and parsed %d types in %.3fs\n",
+		loader.numLoaded(), loadTime_, size, parseTime_ );
+
 	return isOkay;
 }
 
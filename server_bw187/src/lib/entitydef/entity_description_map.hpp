@@ -30,9 +30,14 @@ class MD5;
 class EntityDescriptionMap
 {
 public:
+	/// The number of threads that the .def files are opened on, unless
+	/// another number is configured. None are started by default.
+	static const int DEFAULT_LOADING_THREADS = 0;
+
 	EntityDescriptionMap();
 	~EntityDescriptionMap();
-	bool 	parse( DataSectionPtr pSection );
+	bool 	parse( DataSectionPtr pSection,
+				int numLoadingThreads = DEFAULT_LOADING_THREADS );
 	bool	nameToIndex( const std::string& name, EntityTypeID& index ) const;
 	int		size() const;
 
@@ -42,6 +47,15 @@ public:
 
 	void clear();
 	bool isEntity( const std::string& name ) const;
+
+	/// This method returns the seconds that the last parse spent opening the
+	/// .def files.
+	double loadTime() const		{ return loadTime_; }
+
+	/// This method returns the seconds that the last parse spent parsing the
+	/// opened .def files.
+	double parseTime() const	{ return parseTime_; }
+
 private:
 	bool checkCount( char * description,
 		unsigned int (EntityDescription::*fn)() const,
@@ -52,6 +66,9 @@ private:
 
 	DescriptionVector 	vector_;
 	DescriptionMap 		map_;
+
+	double				loadTime_;
+	double				parseTime_;
 };
 
 #endif // ENTITY_DESCRIPTION_MAP_HPP
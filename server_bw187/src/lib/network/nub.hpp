@@ -251,6 +251,11 @@ public:
 		return interfaceTable_[ msgID ].name();
 	}
 
+	const InterfaceElement & interfaceElement( MessageID msgID ) const
+	{
+		return interfaceTable_[ msgID ];
+	}
+
 	static const char *USE_BWMACHINED;
 private:
 	Endpoint		socket_;
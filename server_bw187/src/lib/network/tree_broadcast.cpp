@@ -0,0 +1,548 @@
+/******************************************************************************
+BigWorld Technology
+Copyright BigWorld Pty, Ltd.
+All Rights Reserved. Commercial in confidence.
+
+WARNING: This computer program is protected by copyright law and international
+treaties. Unauthorized use, reproduction or distribution of this program, or
+any portion of this program, may result in the imposition of civil and
+criminal penalties as provided by law.
+******************************************************************************/
+
+#include "pch.hpp"
+
+#include "tree_broadcast.hpp"
+
+#include "bundle.hpp"
+#include "nub.hpp"
+
+#include "cstdmf/memory_stream.hpp"
+#include "cstdmf/timestamp.hpp"
+#include "cstdmf/watcher.hpp"
+
+#include <algorithm>
+
+DECLARE_DEBUG_COMPONENT2( "Network", 0 )
+
+namespace Mercury
+{
+
+namespace
+{
+
+/**
+ *	This structure is a recipient of a relay message.
+ */
+struct Node
+{
+	Address		addr;
+	uint32		prevID;		///< The broadcast sent to it before this one.
+};
+
+/**
+ *	The number of messages from a sender that a relay holds while waiting
+ *	for an earlier one. Past this, the missing message is given up on.
+ */
+const size_t MAX_HELD_MESSAGES = 256;
+
+
+/**
+ *	This function sends a relay message to each part of a subtree. The
+ *	subtree is split into at most fanOut contiguous parts, and each part is
+ *	sent to its first node along with the addresses of the rest of it.
+ *
+ *	The relay message is made up of:
+ *		uint32		broadcastID
+ *		Address		origin
+ *		MessageID	ackMsgID
+ *		MessageID	msgID
+ *		uint8		fanOut
+ *		uint32		prevID
+ *		uint16		numNodes
+ *		Node		nodes[ numNodes ]
+ *		char		data[]
+ *
+ *	@return The number of messages sent.
+ */
+int sendToSubtrees( Nub & nub, const InterfaceElement & relayIE,
+	uint32 broadcastID, const Address & origin, MessageID ackMsgID,
+	MessageID msgID, uint8 fanOut, const Node * pBegin, const Node * pEnd,
+	const char * data, int size )
+{
+	MF_ASSERT( fanOut > 0 );
+
+	const int numNodes = pEnd - pBegin;
+	const int numParts = std::min( int( fanOut ), numNodes );
+
+	const Node * pPart = pBegin;
+
+	for (int i = 0; i < numParts; ++i)
+	{
+		// The first parts take one each of the remainder.
+		const int partSize =
+			numNodes / numParts + ((i < numNodes % numParts) ? 1 : 0);
+
+		Bundle bundle;
+		bundle.startMessage( relayIE );
+
+		bundle << broadcastID << origin << ackMsgID << msgID << fanOut <<
+			pPart->prevID << uint16( partSize - 1 );
+
+		for (const Node * pNode = pPart + 1; pNode != pPart + partSize; ++pNode)
+		{
+			bundle << pNode->addr << pNode->prevID;
+		}
+
+		bundle.addBlob( data, size );
+
+		nub.send( pPart->addr, bundle );
+
+		pPart += partSize;
+	}
+
+	return numParts;
+}
+
+} // anonymous namespace
+
+
+// -----------------------------------------------------------------------------
+// Section: TreeBroadcaster
+// -----------------------------------------------------------------------------
+
+/**
+ *	Constructor.
+ *
+ *	@param nub		The nub to send from. Acknowledgements are sent to its
+ *					address.
+ *	@param relayIE	The message that the recipients serve with a
+ *					TreeBroadcastRelay.
+ *	@param ackIE	The message that this process passes to onAck.
+ */
+TreeBroadcaster::TreeBroadcaster( Nub & nub, const InterfaceElement & relayIE,
+		const InterfaceElement & ackIE ) :
+	nub_( nub ),
+	relayIE_( relayIE ),
+	ackIE_( ackIE ),
+	fanOut_( 4 ),
+	resendPeriod_( 1.f ),
+	maxAttempts_( 5 ),
+	lastBroadcastID_( 0 ),
+	broadcasts_(),
+	lastSent_(),
+	timerID_( TIMER_ID_NONE ),
+	numBroadcasts_( 0 ),
+	numPacketsSent_( 0 ),
+	numAcks_( 0 ),
+	numResends_( 0 ),
+	numFailures_( 0 ),
+	sendTime_( 0.0 ),
+	lastLatency_( 0.0 ),
+	maxLatency_( 0.0 )
+{
+}
+
+
+/**
+ *	Destructor.
+ */
+TreeBroadcaster::~TreeBroadcaster()
+{
+	if (timerID_ != TIMER_ID_NONE)
+	{
+		nub_.cancelTimer( timerID_ );
+	}
+}
+
+
+/**
+ *	This method broadcasts a message to the given processes.
+ *
+ *	@param ie			The message to send. Only its id is used, since it is
+ *						the recipients' own handler for it that is called.
+ *	@param destinations	The processes to send to.
+ *	@param data			The body of the message.
+ *	@param size			The size of the body.
+ */
+void TreeBroadcaster::broadcast( const InterfaceElement & ie,
+		const std::vector< Address > & destinations,
+		const void * data, int size )
+{
+	if (destinations.empty())
+	{
+		return;
+	}
+
+	uint64 startTime = timestamp();
+
+	uint32 broadcastID = ++lastBroadcastID_;
+
+	Broadcast & broadcast = broadcasts_[ broadcastID ];
+	broadcast.msgID = ie.id();
+	broadcast.data.assign( (const char *)data, size );
+	broadcast.startTime = startTime;
+	broadcast.lastSendTime = startTime;
+	broadcast.numAttempts = 1;
+
+	std::vector< Node > nodes( destinations.size() );
+
+	for (size_t i = 0; i < destinations.size(); ++i)
+	{
+		uint32 & lastSent = lastSent_[ destinations[i] ];
+
+		nodes[i].addr = destinations[i];
+		nodes[i].prevID = lastSent;
+
+		broadcast.unacked[ destinations[i] ] = lastSent;
+		lastSent = broadcastID;
+	}
+
+	numPacketsSent_ += sendToSubtrees( nub_, relayIE_, broadcastID,
+		nub_.address(), ackIE_.id(), broadcast.msgID,
+		uint8( std::max( 1, std::min( fanOut_, 255 ) ) ),
+		&nodes.front(), &nodes.front() + nodes.size(),
+		broadcast.data.data(), size );
+
+	++numBroadcasts_;
+
+	if (timerID_ == TIMER_ID_NONE)
+	{
+		timerID_ = nub_.registerTimer( int( resendPeriod_ * 1000000 ), this );
+	}
+
+	sendTime_ += double( timestamp() - startTime ) / stampsPerSecondD();
+}
+
+
+/**
+ *	This method handles an acknowledgement of a broadcast.
+ */
+void TreeBroadcaster::onAck( const Address & source, uint32 broadcastID )
+{
+	Broadcasts::iterator iter = broadcasts_.find( broadcastID );
+
+	// Late acknowledgements of resent messages are expected.
+	if (iter == broadcasts_.end())
+	{
+		return;
+	}
+
+	if (iter->second.unacked.erase( source ))
+	{
+		++numAcks_;
+
+		if (iter->second.unacked.empty())
+		{
+			this->onComplete( iter );
+		}
+	}
+}
+
+
+/**
+ *	This method stops waiting for acknowledgements from the given process.
+ */
+void TreeBroadcaster::onAddressDead( const Address & addr )
+{
+	lastSent_.erase( addr );
+
+	Broadcasts::iterator iter = broadcasts_.begin();
+
+	while (iter != broadcasts_.end())
+	{
+		Broadcasts::iterator current = iter++;
+
+		if (current->second.unacked.erase( addr ) &&
+				current->second.unacked.empty())
+		{
+			this->onComplete( current );
+		}
+	}
+}
+
+
+/**
+ *	This method is called when a broadcast has been acknowledged by all of
+ *	its recipients.
+ */
+void TreeBroadcaster::onComplete( Broadcasts::iterator iter )
+{
+	lastLatency_ = double( timestamp() - iter->second.startTime ) * 1000.0 /
+		stampsPerSecondD();
+	maxLatency_ = std::max( maxLatency_, lastLatency_ );
+
+	broadcasts_.erase( iter );
+}
+
+
+/**
+ *	This method resends the broadcasts that have not been acknowledged within
+ *	the resend period. They are sent directly to each of the recipients that
+ *	have not acknowledged them, since their relay may be the one that failed.
+ */
+int TreeBroadcaster::handleTimeout( TimerID id, void * arg )
+{
+	const uint64 now = timestamp();
+	const uint64 resendStamps = uint64( resendPeriod_ * stampsPerSecondD() );
+
+	Broadcasts::iterator iter = broadcasts_.begin();
+
+	while (iter != broadcasts_.end())
+	{
+		Broadcast & broadcast = iter->second;
+
+		if (now - broadcast.lastSendTime < resendStamps)
+		{
+			++iter;
+			continue;
+		}
+
+		if (broadcast.numAttempts >= maxAttempts_)
+		{
+			ERROR_MSG( "TreeBroadcaster::handleTimeout: "
+					"Broadcast %u of %s was not acknowledged by %d processes "
+					"after %d attempts\n",
+				iter->first, nub_.msgName( broadcast.msgID ),
+				int( broadcast.unacked.size() ), broadcast.numAttempts );
+
+			numFailures_ += broadcast.unacked.size();
+			broadcasts_.erase( iter++ );
+			continue;
+		}
+
+		std::map< Address, uint32 >::const_iterator nodeIter =
+			broadcast.unacked.begin();
+
+		while (nodeIter != broadcast.unacked.end())
+		{
+			Node node = { nodeIter->first, nodeIter->second };
+
+			numPacketsSent_ += sendToSubtrees( nub_, relayIE_, iter->first,
+				nub_.address(), ackIE_.id(), broadcast.msgID, 1,
+				&node, &node + 1,
+				broadcast.data.data(), broadcast.data.size() );
+			++numResends_;
+
+			++nodeIter;
+		}
+
+		broadcast.lastSendTime = now;
+		++broadcast.numAttempts;
+
+		++iter;
+	}
+
+	if (broadcasts_.empty())
+	{
+		nub_.cancelTimer( timerID_ );
+		timerID_ = TIMER_ID_NONE;
+	}
+
+	return 0;
+}
+
+
+/**
+ *	This static method returns a watcher that can be used to watch a
+ *	TreeBroadcaster. The time spent sending and the latency of the last
+ *	broadcast measure the cost of the tree at the number of recipients.
+ */
+WatcherPtr TreeBroadcaster::pWatcher()
+{
+	static DirectoryWatcherPtr watchMe = NULL;
+
+#if ENABLE_WATCHERS
+	if (watchMe == NULL)
+	{
+		watchMe = new DirectoryWatcher();
+
+		TreeBroadcaster * pNull = NULL;
+
+		watchMe->addChild( "fanOut",
+			makeWatcher( pNull->fanOut_, Watcher::WT_READ_WRITE ) );
+		watchMe->addChild( "resendPeriod",
+			makeWatcher( pNull->resendPeriod_, Watcher::WT_READ_WRITE ) );
+		watchMe->addChild( "maxAttempts",
+			makeWatcher( pNull->maxAttempts_, Watcher::WT_READ_WRITE ) );
+
+		watchMe->addChild( "numBroadcasts",
+			makeWatcher( pNull->numBroadcasts_ ) );
+		watchMe->addChild( "numPacketsSent",
+			makeWatcher( pNull->numPacketsSent_ ) );
+		watchMe->addChild( "numAcks", makeWatcher( pNull->numAcks_ ) );
+		watchMe->addChild( "numResends", makeWatcher( pNull->numResends_ ) );
+		watchMe->addChild( "numFailures", makeWatcher( pNull->numFailures_ ) );
+
+		// In seconds
+		watchMe->addChild( "sendTime", makeWatcher( pNull->sendTime_ ) );
+
+		// In milliseconds
+		watchMe->addChild( "lastLatency", makeWatcher( pNull->lastLatency_ ) );
+		watchMe->addChild( "maxLatency",
+			makeWatcher( pNull->maxLatency_, Watcher::WT_READ_WRITE ) );
+	}
+#endif
+
+	return watchMe;
+}
+
+
+// -----------------------------------------------------------------------------
+// Section: TreeBroadcastRelay
+// -----------------------------------------------------------------------------
+
+/**
+ *	This static method returns the singleton instance of this class.
+ */
+TreeBroadcastRelay & TreeBroadcastRelay::instance()
+{
+	static TreeBroadcastRelay s_instance;
+	return s_instance;
+}
+
+
+/**
+ *	This method handles a relay message from a TreeBroadcaster or another
+ *	relay.
+ */
+void TreeBroadcastRelay::handleMessage( const Address & source,
+		UnpackedMessageHeader & header,
+		BinaryIStream & data )
+{
+	uint32 broadcastID;
+	Address origin;
+	MessageID ackMsgID;
+	MessageID msgID;
+	uint8 fanOut;
+	uint32 prevID;
+	uint16 numNodes;
+
+	data >> broadcastID >> origin >> ackMsgID >> msgID >> fanOut >>
+		prevID >> numNodes;
+
+	std::vector< Node > nodes( numNodes );
+
+	for (uint16 i = 0; i < numNodes; ++i)
+	{
+		data >> nodes[i].addr >> nodes[i].prevID;
+	}
+
+	const int size = data.remainingLength();
+	const char * pData = (const char *)data.retrieve( size );
+
+	if (data.error() || fanOut == 0)
+	{
+		ERROR_MSG( "TreeBroadcastRelay::handleMessage: "
+				"Bad relay message from %s\n",
+			(char *)source );
+		return;
+	}
+
+	Nub & nub = *header.pNub;
+
+	// Pass it on first, so that the subtree is not held up by the handler.
+	if (!nodes.empty())
+	{
+		sendToSubtrees( nub, nub.interfaceElement( header.identifier ),
+			broadcastID, origin, ackMsgID, msgID, fanOut,
+			&nodes.front(), &nodes.front() + nodes.size(), pData, size );
+	}
+
+	{
+		InterfaceElement ackIE( "treeBroadcastAck", ackMsgID,
+			FIXED_LENGTH_MESSAGE, sizeof( uint32 ) );
+
+		Bundle bundle;
+		bundle.startMessage( ackIE );
+		bundle << broadcastID;
+		nub.send( origin, bundle );
+	}
+
+	Origin & state = origins_[ origin ];
+
+	if ((broadcastID <= state.lastHandled) || state.held.count( prevID ))
+	{
+		// A resend of one that has already arrived.
+		return;
+	}
+
+	if ((prevID != 0) && (prevID != state.lastHandled))
+	{
+		HeldMessage & held = state.held[ prevID ];
+		held.broadcastID = broadcastID;
+		held.msgID = msgID;
+		held.data.assign( pData, size );
+
+		if (state.held.size() <= MAX_HELD_MESSAGES)
+		{
+			return;
+		}
+
+		WARNING_MSG( "TreeBroadcastRelay::handleMessage: "
+				"Gave up waiting for broadcast %u from %s\n",
+			state.held.begin()->first, (char *)origin );
+
+		// Carry on from the earliest held message.
+		state.lastHandled = state.held.begin()->first;
+	}
+	else
+	{
+		state.lastHandled = broadcastID;
+		this->deliver( nub, origin, msgID, pData, size );
+	}
+
+	// Handle the held messages that are now in order.
+	for (;;)
+	{
+		std::map< uint32, HeldMessage >::iterator heldIter =
+			state.held.find( state.lastHandled );
+
+		if (heldIter == state.held.end())
+		{
+			// Drop any that were sent before the last one handled.
+			state.held.erase( state.held.begin(),
+				state.held.lower_bound( state.lastHandled ) );
+			break;
+		}
+
+		HeldMessage held;
+		held.msgID = heldIter->second.msgID;
+		held.data.swap( heldIter->second.data );
+		state.lastHandled = heldIter->second.broadcastID;
+		state.held.erase( heldIter );
+
+		this->deliver( nub, origin, held.msgID, held.data.data(),
+			held.data.size() );
+	}
+}
+
+
+/**
+ *	This method hands a broadcast message to the handler that this process
+ *	serves it with.
+ */
+void TreeBroadcastRelay::deliver( Nub & nub, const Address & origin,
+		MessageID msgID, const char * data, int size )
+{
+	const InterfaceElement & ie = nub.interfaceElement( msgID );
+
+	if (ie.pHandler() == NULL)
+	{
+		ERROR_MSG( "TreeBroadcastRelay::deliver: "
+				"No handler for message %d from %s\n",
+			int( msgID ), (char *)origin );
+		return;
+	}
+
+	UnpackedMessageHeader header;
+	header.identifier = msgID;
+	header.length = size;
+	header.pNub = &nub;
+
+	MemoryIStream stream( const_cast< char * >( data ), size );
+	ie.pHandler()->handleMessage( origin, header, stream );
+}
+
+} // namespace Mercury
+
+// tree_broadcast.cpp
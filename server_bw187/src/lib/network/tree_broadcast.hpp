@@ -0,0 +1,187 @@
+/******************************************************************************
+BigWorld Technology
+Copyright BigWorld Pty, Ltd.
+All Rights Reserved. Commercial in confidence.
+
+WARNING: This computer program is protected by copyright law and international
+treaties. Unauthorized use, reproduction or distribution of this program, or
+any portion of this program, may result in the imposition of civil and
+criminal penalties as provided by law.
+******************************************************************************/
+
+#ifndef TREE_BROADCAST_HPP
+#define TREE_BROADCAST_HPP
+
+#include "interfaces.hpp"
+#include "interface_element.hpp"
+#include "misc.hpp"
+
+#include "cstdmf/smartpointer.hpp"
+
+#include <map>
+#include <string>
+#include <vector>
+
+class Watcher;
+typedef SmartPointer< Watcher > WatcherPtr;
+
+namespace Mercury
+{
+
+class Nub;
+
+/**
+ *	This class sends a message to a set of processes along a k-ary tree,
+ *	instead of sending a copy to each of them. The sender sends to at most
+ *	fanOut relays, and each relay passes the message on to at most fanOut of
+ *	the processes below it, before handling the message itself.
+ *
+ *	Each relay message carries the addresses of the subtree below its
+ *	recipient. The recipient splits that list into fanOut contiguous parts,
+ *	and sends each part to its first address.
+ *
+ *	Every recipient acknowledges the broadcast directly to the sender. The
+ *	recipients that have not done so within the resend period are sent the
+ *	message directly, so that a dead or slow relay only delays its subtree.
+ *	A recipient that has not acknowledged after maxAttempts sends is given up
+ *	on.
+ *
+ *	The recipients must serve relayIE with a TreeBroadcastRelay handler, and
+ *	the sender must pass the ackIE messages it receives to onAck.
+ */
+class TreeBroadcaster : public TimerExpiryHandler
+{
+public:
+	TreeBroadcaster( Nub & nub, const InterfaceElement & relayIE,
+			const InterfaceElement & ackIE );
+	virtual ~TreeBroadcaster();
+
+	void broadcast( const InterfaceElement & ie,
+			const std::vector< Address > & destinations,
+			const void * data, int size );
+
+	void onAck( const Address & source, uint32 broadcastID );
+	void onAddressDead( const Address & addr );
+
+	/// This method returns the number of relays each process sends to.
+	int fanOut() const					{ return fanOut_; }
+	void fanOut( int value )			{ fanOut_ = value; }
+
+	/// This method sets the seconds before unacknowledged sends are resent.
+	void resendPeriod( float seconds )	{ resendPeriod_ = seconds; }
+
+	/// This method sets the number of sends before a recipient is given up on.
+	void maxAttempts( int value )		{ maxAttempts_ = value; }
+
+	static WatcherPtr pWatcher();
+
+private:
+	virtual int handleTimeout( TimerID id, void * arg );
+
+	/**
+	 *	This structure holds a broadcast that has not been acknowledged by all
+	 *	of its recipients.
+	 */
+	struct Broadcast
+	{
+		MessageID		msgID;
+		std::string		data;
+		uint64			startTime;
+		uint64			lastSendTime;
+		int				numAttempts;
+
+		/// The recipients that have not acknowledged, with the previous
+		/// broadcast that each of them was sent.
+		std::map< Address, uint32 >	unacked;
+	};
+
+	typedef std::map< uint32, Broadcast > Broadcasts;
+
+	void onComplete( Broadcasts::iterator iter );
+
+	Nub &					nub_;
+	const InterfaceElement	relayIE_;
+	const InterfaceElement	ackIE_;
+
+	int						fanOut_;
+	float					resendPeriod_;
+	int						maxAttempts_;
+
+	uint32					lastBroadcastID_;
+	Broadcasts				broadcasts_;
+
+	/// The last broadcast sent to each recipient. This lets each recipient
+	/// handle the broadcasts in the order that they were sent.
+	typedef std::map< Address, uint32 > LastSent;
+	LastSent				lastSent_;
+
+	TimerID					timerID_;
+
+	uint32					numBroadcasts_;
+	uint32					numPacketsSent_;
+	uint32					numAcks_;
+	uint32					numResends_;
+	uint32					numFailures_;
+	double					sendTime_;
+	double					lastLatency_;
+	double					maxLatency_;
+};
+
+
+/**
+ *	This class handles the relay messages of a TreeBroadcaster. It passes the
+ *	message on to the rest of its subtree, acknowledges it, and then hands
+ *	the original message to the handler that this process serves it with, as
+ *	if it had come straight from the sender.
+ *
+ *	Repeated messages are acknowledged again, but only handled once. The
+ *	messages from each sender are handled in the order that they were sent.
+ */
+class TreeBroadcastRelay : public InputMessageHandler
+{
+public:
+	virtual void handleMessage( const Address & source,
+		UnpackedMessageHeader & header,
+		BinaryIStream & data );
+
+	static TreeBroadcastRelay & instance();
+
+private:
+	void deliver( Nub & nub, const Address & origin, MessageID msgID,
+		const char * data, int size );
+
+	/**
+	 *	This structure holds a message that arrived before the one that was
+	 *	sent before it.
+	 */
+	struct HeldMessage
+	{
+		uint32			broadcastID;
+		MessageID		msgID;
+		std::string		data;
+	};
+
+	/**
+	 *	This structure holds the state of the broadcasts from one sender.
+	 */
+	struct Origin
+	{
+		Origin() : lastHandled( 0 ) {}
+
+		uint32			lastHandled;
+
+		/// The held messages, by the broadcast that was sent before them.
+		std::map< uint32, HeldMessage >	held;
+	};
+
+	typedef std::map< Address, Origin > Origins;
+	Origins		origins_;
+};
+
+} // namespace Mercury
+
+#define MF_TREE_BROADCAST_MSG( NAME )	\
+		MERCURY_VARIABLE_MESSAGE( NAME, 4,	\
+			&Mercury::TreeBroadcastRelay::instance() )
+
+#endif // TREE_BROADCAST_HPP
@@ -21,10 +21,13 @@ criminal penalties as provided by law.
 #include <vector>
 
 #include "cstdmf/stpwatch.hpp"
+#include "cstdmf/timestamp.hpp"
+#include "cstdmf/watcher.hpp"
 #include "cstdmf/vectornodest.hpp"
 #include "cstdmf/memory_counter.hpp"
 #include "resmgr/multi_file_system.hpp"
 #include "resmgr/bwresource.hpp"
+#include "math/boundbox.hpp"
 
 
 #ifndef MF_SERVER
@@ -90,6 +93,25 @@ memoryCounterDefine( bsp, Geometry );
  *	List of triangle indexes as uint16s (index into file's global triangle list)
  *	At the end of the file is user data. Each user data is a 4 byte key followed
  *	by a uint32 size prefixed blob.
+ *
+ *	Version 1 of the format is the flat layout, which can be used in place:
+ *	<bsp_file>     ::= <header><triangle>*<padding><flatNode>*<flatIndex>*
+ *	                   <userData>*
+ *	<header>       ::= <magic><numTriangles><numNodes><numIndexes>
+ *	<magic>        ::= 0x01505342  // 32 bits
+ *	<numIndexes>   ::= uint32  // Number of <flatIndex> to follow the nodes
+ *	<padding>      ::= 0 to 15 zero bytes  // Aligns <flatNode>* to 16 bytes
+ *	<flatNode>     ::= <planeEq><front><back><firstIndex><numNodeIndexes>
+ *	                   <nodeFlags><reserved8>  // 32 bytes, see BSPFlatNode
+ *	<front>        ::= uint32  // Index of front child node, or 0xffffffff
+ *	<back>         ::= uint32  // Index of back child node, or 0xffffffff
+ *	<firstIndex>   ::= uint32  // First of this node's <flatIndex>
+ *	<numNodeIndexes>::= uint16  // Number of this node's <flatIndex>
+ *	<reserved8>    ::= uint8   // Must be 0
+ *	<flatIndex>    ::= uint32  // Index into the <triangle>* list of triangles
+ *
+ *	The nodes are in prefix order as in version 0, and a child always has a
+ *	greater index than its parent.
  */
 
 
@@ -1071,6 +1093,24 @@ public:
 		return size_;
 	}
 
+	/**
+	 *	This method skips over the given number of bytes, as a read would.
+	 */
+	int skip( int skipSize )
+	{
+		size_ -= skipSize;
+
+		if (size_ >= 0)
+		{
+			pData_ += skipSize;
+			return skipSize;
+		}
+		else
+		{
+			return 0;
+		}
+	}
+
 	int close()
 	{
 		size_ = 0;
@@ -1344,19 +1384,56 @@ uint32 BSP::size() const
 // -----------------------------------------------------------------------------
 
 const uint8 BSP_FILE_VERSION = 0;
+const uint8 BSP_FILE_VERSION_FLAT = 1;
 const uint32 BSP_FILE_MAGIC = 0x505342;
 const uint32 BSP_FILE_TOKEN = BSP_FILE_MAGIC | (BSP_FILE_VERSION << 24);
+const uint32 BSP_FILE_TOKEN_FLAT = BSP_FILE_MAGIC | (BSP_FILE_VERSION_FLAT << 24);
 // char * BSPTree::s_pNodeMemory = NULL;
 // int BSPTree::s_nodeMemorySize = 0;
 
+/// If true, trees loaded from the original layout are also loaded as a tree
+/// of BSP objects and the two are compared for speed and results.
+bool BSPTree::s_compareLegacy_ = false;
+
+/// If true, rays are tested against the triangles of a node in blocks of four.
+#ifdef BW_SSE_COLLISION
+bool BSPTree::s_useBlocks_ = true;
+#else
+bool BSPTree::s_useBlocks_ = false;
+#endif
+
+/// If true, the ways of testing rays are compared as trees are loaded.
+bool BSPTree::s_compareBlocks_ = false;
+
+/// The number of queries where compared methods have disagreed.
+uint32 BSPTree::s_mismatches_ = 0;
+
+namespace
+{
+
+/**
+ *	This function returns the padding needed after the given number of bytes
+ *	so that what follows is 16 byte aligned.
+ */
+inline int flatPadding( int offset )
+{
+	return (16 - offset % 16) % 16;
+}
+
+} // anon namespace
+
+
 /**
  *	This is the constructor that is used when the BSP is created from a set of
  *	world triangles.
  */
-BSPTree::BSPTree( RealWTriangleSet & triangles ) : pRoot_( NULL ),
+BSPTree::BSPTree( RealWTriangleSet & triangles ) :
+	pNodes_( NULL ),
+	numNodes_( 0 ),
+	pTriangleIndices_( NULL ),
+	numTriangleIndices_( 0 ),
 	pIndices_( NULL ),
-	indicesSize_( 0 ),
-	pNodeMemory_( NULL )
+	indicesSize_( 0 )
 {
 	triangles_.swap( triangles );
 
@@ -1372,9 +1449,14 @@ BSPTree::BSPTree( RealWTriangleSet & triangles ) : pRoot_( NULL ),
 		tris[i] = &triangles_[i];
 	}
 
-	BSPAllocator allocator( pNodeMemory_ );
+	BSPAllocator allocator( NULL );
 	BSPConstructor constructor( allocator );
-	pRoot_ = constructor.construct( tris );
+	BSP * pRoot = constructor.construct( tris );
+
+	this->flatten( pRoot );
+	allocator.destroy( pRoot );
+
+	this->buildBlocks();
 }
 
 
@@ -1382,10 +1464,13 @@ BSPTree::BSPTree( RealWTriangleSet & triangles ) : pRoot_( NULL ),
  *	Default constructor. This is the constructor that is used when reading the
  *	BSP tree from a file.
  */
-BSPTree::BSPTree() : pRoot_( NULL ),
+BSPTree::BSPTree() :
+	pNodes_( NULL ),
+	numNodes_( 0 ),
+	pTriangleIndices_( NULL ),
+	numTriangleIndices_( 0 ),
 	pIndices_( NULL ),
-	indicesSize_( 0 ),
-	pNodeMemory_( NULL )
+	indicesSize_( 0 )
 {
 	memoryCounterAdd( bsp );
 	memoryClaim( this );
@@ -1399,20 +1484,139 @@ BSPTree::~BSPTree()
 {
 	memoryCounterSub( bsp );
 
-	// We need to let the allocator free the child nodes.
-	// Note: pNodeMemory_ may be NULL.
-	BSPAllocator allocator( pNodeMemory_ );
+	memoryClaim( nodeStorage_ );
+	memoryClaim( indexStorage_ );
+	memoryClaim( blocks_ );
+	memoryClaim( firstBlocks_ );
+	memoryClaim( triangles_ );
+	memoryClaim( this );
+}
+
+
+/**
+ *	This method converts the tree of BSP objects rooted at the input node to
+ *	the flat layout. The nodes are added in prefix order.
+ */
+void BSPTree::flatten( const BSP * pRoot )
+{
+	nodeStorage_.clear();
+	indexStorage_.clear();
+
+	// Each pending node is paired with the link to it from its parent, being
+	// the index of the parent times two, plus one if it is the back child.
+	typedef std::vector< std::pair< const BSP *, uint32 > > Stack;
+	Stack stack;
+	stack.push_back( std::make_pair( pRoot, BSPFlatNode::NO_NODE ) );
 
-	if (pRoot_)
-		allocator.destroy( pRoot_ );
-	if (pNodeMemory_ != NULL)
+	while (!stack.empty())
 	{
-		memoryClaim( pNodeMemory_ );
-		delete [] pNodeMemory_;
+		const BSP * pBSP = stack.back().first;
+		uint32 link = stack.back().second;
+		stack.pop_back();
+
+		uint32 index = nodeStorage_.size();
+
+		if (link != BSPFlatNode::NO_NODE)
+		{
+			BSPFlatNode & parent = nodeStorage_[ link >> 1 ];
+			((link & 1) ? parent.back : parent.front) = index;
+		}
+
+		MF_ASSERT( pBSP->triangles_.size() < 1 << 16 );
+
+		BSPFlatNode node;
+		node.planeEq = pBSP->planeEq_;
+		node.front = BSPFlatNode::NO_NODE;
+		node.back = BSPFlatNode::NO_NODE;
+		node.firstIndex = indexStorage_.size();
+		node.numIndices = pBSP->triangles_.size();
+		node.flags = BSP_MAGIC |
+			(pBSP->partitioned_ ? BSP_IS_PARTITIONED : 0) |
+			(pBSP->pFront_ ? BSP_HAS_FRONT : 0) |
+			(pBSP->pBack_ ? BSP_HAS_BACK : 0);
+		node.reserved = 0;
+		nodeStorage_.push_back( node );
+
+		WTriangleSet::const_iterator iter = pBSP->triangles_.begin();
+		while (iter != pBSP->triangles_.end())
+		{
+			indexStorage_.push_back( *iter - &triangles_.front() );
+			++iter;
+		}
+
+		// The back child is pushed first so that the front subtree is
+		// added first.
+		if (pBSP->pBack_)
+		{
+			stack.push_back( std::make_pair( pBSP->pBack_, index * 2 + 1 ) );
+		}
+
+		if (pBSP->pFront_)
+		{
+			stack.push_back( std::make_pair( pBSP->pFront_, index * 2 ) );
+		}
 	}
 
-	memoryClaim( triangles_ );
-	memoryClaim( this );
+	memoryClaim( nodeStorage_ );
+	memoryClaim( indexStorage_ );
+	this->useStorage();
+}
+
+
+/**
+ *	This method sets the flat layout to be the one in our own storage.
+ */
+void BSPTree::useStorage()
+{
+	pFlatData_ = NULL;
+
+	numNodes_ = nodeStorage_.size();
+	pNodes_ = numNodes_ ? &nodeStorage_.front() : NULL;
+
+	numTriangleIndices_ = indexStorage_.size();
+	pTriangleIndices_ = numTriangleIndices_ ? &indexStorage_.front() : NULL;
+}
+
+
+/**
+ *	This method puts the triangles of each node into blocks of four, if
+ *	blocks are being used. The unused lanes of the last block of each node
+ *	are empty, and never hit anything.
+ */
+void BSPTree::buildBlocks()
+{
+	blocks_.clear();
+	firstBlocks_.clear();
+
+	if (!s_useBlocks_) return;
+
+	const int SIZE = WorldTriangleBlock::SIZE;
+
+	firstBlocks_.resize( numNodes_ );
+	uint32 numBlocks = 0;
+
+	for (uint32 i = 0; i < numNodes_; i++)
+	{
+		firstBlocks_[i] = numBlocks;
+		numBlocks += (pNodes_[i].numIndices + SIZE - 1) / SIZE;
+	}
+
+	blocks_.resize( numBlocks );
+
+	for (uint32 i = 0; i < numNodes_; i++)
+	{
+		const BSPFlatNode & node = pNodes_[i];
+		WorldTriangleBlock * pBlock = &blocks_.front() + firstBlocks_[i];
+
+		for (int j = 0; j < node.numIndices; j++)
+		{
+			uint32 index = pTriangleIndices_[ node.firstIndex + j ];
+			pBlock[ j / SIZE ].set( j % SIZE, triangles_[ index ], index );
+		}
+	}
+
+	memoryClaim( blocks_ );
+	memoryClaim( firstBlocks_ );
 }
 
 
@@ -1424,119 +1628,366 @@ BSPTree::~BSPTree()
 bool BSPTree::load( BinaryPtr bp )
 {
 	MF_ASSERT( sizeof( WorldTriangle ) == 40 );
-	bool result = false;
+	MF_ASSERT( sizeof( BSPFlatNode ) == 32 );
+
+	static bool firstTime = true;
+	if (firstTime)
+	{
+		firstTime = false;
+		MF_WATCH( "Physics/BSP/compareLegacy", s_compareLegacy_,
+			Watcher::WT_READ_WRITE,
+			"If true, BSPs stored in the original layout are also loaded "
+			"as a tree of nodes, and the speed and results of both are "
+			"compared and logged" );
+		MF_WATCH( "Physics/BSP/useBlocks", s_useBlocks_,
+			Watcher::WT_READ_WRITE,
+			"If true, rays are tested against four triangles at a time. "
+			"Only BSPs loaded while this is set have the blocks needed" );
+		MF_WATCH( "Physics/BSP/compareBlocks", s_compareBlocks_,
+			Watcher::WT_READ_WRITE,
+			"If true, rays are cast through each BSP as it is loaded, one "
+			"triangle at a time, four triangles at a time and four rays at "
+			"a time, and the speed and results of each are compared and "
+			"logged" );
+		MF_WATCH( "Physics/BSP/mismatches", s_mismatches_,
+			Watcher::WT_READ_WRITE,
+			"Number of compared queries where the layouts disagreed" );
+	}
+
+	if (pNodes_ != NULL)
+	{
+		ERROR_MSG( "BSPTree::load: Already been initialised.\n" );
+		return false;
+	}
+
+	uint64 loadStart = timestamp();
+
+	BSPFile bspFile( bp );
+
+	// In the flat layout the last member is the number of triangle indices.
+	struct
+	{
+		uint32 magic;
+		int32 numTriangles;
+		int32 numNodes;
+		int32 maxTriangles;
+	} header;
+
+	if (!bspFile.read( &header, sizeof(header), 1 ))
+	{
+		bspFile.close();
+		return false;
+	}
+
+	const uint8 version = header.magic >> 24;
+
+	if ((header.magic & 0xffffff) != BSP_FILE_MAGIC)
+	{
+		ERROR_MSG( "BSPTree::load: Bad magic\n" );
+		bspFile.close();
+		return false;
+	}
+
+	if (version != BSP_FILE_VERSION && version != BSP_FILE_VERSION_FLAT)
+	{
+		ERROR_MSG( "BSPTree::load: "
+			"Bad version. Expected %d or %d. Got %d.\n",
+			BSP_FILE_VERSION, BSP_FILE_VERSION_FLAT, version );
+		bspFile.close();
+		return false;
+	}
+
+	// This is a bit dodgy.
+	triangles_.resize( header.numTriangles );
+	memoryCounterAdd( bsp );
+	memoryClaim( triangles_ );
+	bspFile.read( triangles_.empty() ? NULL : &triangles_.front(), 
+		sizeof( WorldTriangle ), header.numTriangles );
+
+	bool result = (version == BSP_FILE_VERSION) ?
+		this->loadLegacyNodes( bspFile, header.numNodes, header.maxTriangles ) :
+		this->loadFlatNodes( bp, bspFile, header.numNodes, header.maxTriangles );
+
+	// read user data
+	while (result && bspFile.size() > 0)
+	{
+		MF_ASSERT( unsigned( bspFile.size() ) >=
+			sizeof( UserDataKey ) + sizeof( int ) );
+		
+		UserDataKey type;
+		bspFile.read(&type, sizeof(UserDataKey), 1);
+		
+		int size = 0;
+		bspFile.read(&size, sizeof(int), 1);
+		
+		MF_ASSERT(bspFile.size() >= size);
+		char * data = new char[size];
+		bspFile.read(data, sizeof(char), size);			
+		this->setUserData(type, new BinaryBlock(data, size));
+		delete [] data;
+	}
+
+	bspFile.close();
+
+	if (!result)
+	{
+		ERROR_MSG( "BSPTree::load: Loading failed.\n" );
+		return false;
+	}
+
+	this->buildBlocks();
+
+	if (s_compareLegacy_ && version == BSP_FILE_VERSION)
+	{
+		this->compareLegacy( bp, timestamp() - loadStart );
+	}
+
+	if (s_compareBlocks_)
+	{
+		this->compareBlocks();
+	}
+
+	return result;
+}
+
+
+/**
+ *	This method reads the nodes of a tree saved in the original layout, and
+ *	converts them to the flat layout as it goes.
+ */
+bool BSPTree::loadLegacyNodes( BSPFile & bspFile,
+	int numNodes, int maxTriangles )
+{
+	nodeStorage_.reserve( numNodes );
 
-	if (pRoot_ == NULL)
+	std::vector<uint16> indices( std::max( maxTriangles, 1 ) );
+	const uint32 maxSize = triangles_.size();
+
+	// Links to the pending nodes from their parents, as in flatten.
+	std::vector<uint32> stack;
+	stack.push_back( BSPFlatNode::NO_NODE );
+
+	while (!stack.empty())
 	{
-		BSPFile bspFile( bp );
+		uint32 link = stack.back();
+		stack.pop_back();
 
-		struct
+		BSPFlatNode node;
+		uint16 numTris;
+
+		if (!bspFile.read( &node.flags, 1, 1 ) ||
+			!bspFile.read( &node.planeEq, sizeof( node.planeEq ), 1 ) ||
+			!bspFile.read( &numTris, sizeof( uint16 ), 1 ))
 		{
-			uint32 magic;
-			int32 numTriangles;
-			int32 numNodes;
-			int32 maxTriangles;
-		} header;
+			return false;
+		}
 
-		if (!bspFile.read( &header, sizeof(header), 1 ))
+		if ((node.flags & BSP_MAGIC_MASK) != BSP_MAGIC)
 		{
-			bspFile.close();
+			ERROR_MSG( "BSPTree::loadLegacyNodes: Bad magic mask 0x%x.\n",
+				(int)node.flags );
 			return false;
 		}
 
-		if (header.magic != BSP_FILE_TOKEN)
+		if (numTris > maxTriangles)
 		{
-			if ((header.magic & 0xffffff) == BSP_FILE_MAGIC)
-			{
-				ERROR_MSG( "BSPTree::load: "
-					"Bad version. Expected %d. Got %d.\n",
-					BSP_FILE_VERSION, header.magic >> 24 );
-			}
-			else
-			{
-				ERROR_MSG( "BSPTree::load: Bad magic\n" );
-			}
-			bspFile.close();
+			ERROR_MSG( "BSPTree::loadLegacyNodes: "
+				"Wanted to load %d but can only handle %d\n",
+				numTris, maxTriangles );
 			return false;
 		}
 
-		// This is a bit dodgy.
-		triangles_.resize( header.numTriangles );
-		memoryCounterAdd( bsp );
-		memoryClaim( triangles_ );
-		bspFile.read( triangles_.empty() ? NULL : &triangles_.front(), 
-			sizeof( WorldTriangle ), header.numTriangles );
+		if (numTris > 0 &&
+			!bspFile.read( &indices.front(), sizeof( uint16 ), numTris ))
+		{
+			ERROR_MSG( "BSPTree::loadLegacyNodes: "
+				"Failed to read %d indices.\n", numTris );
+			return false;
+		}
 
-		pIndices_ = new uint16[ header.maxTriangles ];
-		indicesSize_ = header.maxTriangles;
+		if ((node.flags & BSP_IS_PARTITIONED) &&
+			!isValidPlane( node.planeEq ))
+		{
+			ERROR_MSG( "BSPTree::loadLegacyNodes: "
+				"Bad plane equation: n = (%f, %f, %f). d = %f\n",
+				node.planeEq.normal().x, node.planeEq.normal().y,
+				node.planeEq.normal().z, node.planeEq.d() );
+			return false;
+		}
 
-		pNodeMemory_ = new char[ header.numNodes * sizeof(BSP) ];
-		memoryClaim( pNodeMemory_ );
+		node.front = BSPFlatNode::NO_NODE;
+		node.back = BSPFlatNode::NO_NODE;
+		node.firstIndex = indexStorage_.size();
+		node.numIndices = numTris;
+		node.reserved = 0;
 
-		BSPAllocator allocator( pNodeMemory_ );
+		for (int i = 0; i < numTris; i++)
+		{
+			if (indices[i] >= maxSize)
+			{
+				ERROR_MSG( "BSPTree::loadLegacyNodes: "
+					"Index too big %d >= %d.\n", indices[i], maxSize );
+				return false;
+			}
 
-		pRoot_ = allocator.newBSP();
-		result = pRoot_->load( *this, bspFile, allocator );
+			indexStorage_.push_back( indices[i] );
+		}
 
-		delete [] pIndices_;
-		pIndices_ = NULL;
-		indicesSize_ = 0;
+		uint32 index = nodeStorage_.size();
 
-		// read user data
-		while (bspFile.size() > 0)
+		if (link != BSPFlatNode::NO_NODE)
 		{
-			MF_ASSERT( unsigned( bspFile.size() ) >=
-				sizeof( UserDataKey ) + sizeof( int ) );
-			
-			UserDataKey type;
-			bspFile.read(&type, sizeof(UserDataKey), 1);
-			
-			int size = 0;
-			bspFile.read(&size, sizeof(int), 1);
-			
-			MF_ASSERT(bspFile.size() >= size);
-			char * data = new char[size];
-			bspFile.read(data, sizeof(char), size);			
-			this->setUserData(type, new BinaryBlock(data, size));
-			delete [] data;
+			BSPFlatNode & parent = nodeStorage_[ link >> 1 ];
+			((link & 1) ? parent.back : parent.front) = index;
 		}
 
-		bspFile.close();
+		nodeStorage_.push_back( node );
+
+		if (node.flags & BSP_HAS_BACK)
+		{
+			stack.push_back( index * 2 + 1 );
+		}
 
-		if (!result)
+		if (node.flags & BSP_HAS_FRONT)
 		{
-			ERROR_MSG( "BSPTree::load: Loading failed.\n" );
+			stack.push_back( index * 2 );
 		}
 	}
+
+	memoryClaim( nodeStorage_ );
+	memoryClaim( indexStorage_ );
+	this->useStorage();
+
+	return true;
+}
+
+
+/**
+ *	This method reads the nodes of a tree saved in the flat layout. If the
+ *	node array in the input data is suitably aligned, it and the triangle
+ *	indices are used where they are and the data is kept, otherwise they are
+ *	copied.
+ */
+bool BSPTree::loadFlatNodes( BinaryPtr bp, BSPFile & bspFile,
+	int numNodes, int numIndices )
+{
+	char padding[16];
+	const int offset = bp->len() - bspFile.size();
+	const int paddingSize = flatPadding( offset );
+
+	const int nodesSize = numNodes * sizeof( BSPFlatNode );
+	const int indicesSize = numIndices * sizeof( uint32 );
+
+	if (numNodes <= 0 || numIndices < 0 ||
+		bspFile.size() < paddingSize + nodesSize + indicesSize)
+	{
+		ERROR_MSG( "BSPTree::loadFlatNodes: "
+			"Not enough data for %d nodes and %d indices\n",
+			numNodes, numIndices );
+		return false;
+	}
+
+	bspFile.read( padding, 1, paddingSize );
+
+	const char * pNodeData =
+		static_cast<const char *>( bp->data() ) + offset + paddingSize;
+
+	if (size_t( pNodeData ) % sizeof( float ) == 0)
+	{
+		pNodes_ = reinterpret_cast<const BSPFlatNode *>( pNodeData );
+		numNodes_ = numNodes;
+		pTriangleIndices_ = numIndices ?
+			reinterpret_cast<const uint32 *>( pNodeData + nodesSize ) : NULL;
+		numTriangleIndices_ = numIndices;
+		pFlatData_ = bp;
+
+		bspFile.skip( nodesSize + indicesSize );
+	}
 	else
 	{
-		ERROR_MSG( "BSPTree::load: Already been initialised.\n" );
-		result = false;
+		nodeStorage_.resize( numNodes );
+		indexStorage_.resize( numIndices );
+		bspFile.read( &nodeStorage_.front(), sizeof( BSPFlatNode ), numNodes );
+		bspFile.read( indexStorage_.empty() ? NULL : &indexStorage_.front(),
+			sizeof( uint32 ), numIndices );
+
+		memoryClaim( nodeStorage_ );
+		memoryClaim( indexStorage_ );
+		this->useStorage();
 	}
 
-	return result;
+	// Check the data so that the queries need not. Children always come
+	// after their parent, so there can be no cycles.
+	const uint32 maxSize = triangles_.size();
+
+	for (uint32 i = 0; i < numNodes_; i++)
+	{
+		const BSPFlatNode & node = pNodes_[i];
+
+		bool isValid =
+			((node.flags & BSP_MAGIC_MASK) == BSP_MAGIC) &&
+			(node.front == BSPFlatNode::NO_NODE ||
+				(node.front > i && node.front < numNodes_)) &&
+			(node.back == BSPFlatNode::NO_NODE ||
+				(node.back > i && node.back < numNodes_)) &&
+			node.firstIndex <= numTriangleIndices_ &&
+			node.numIndices <= numTriangleIndices_ - node.firstIndex;
+
+		if (!isValid)
+		{
+			ERROR_MSG( "BSPTree::loadFlatNodes: Bad node %d\n", i );
+			return false;
+		}
+
+		if ((node.flags & BSP_IS_PARTITIONED) &&
+			!isValidPlane( node.planeEq ))
+		{
+			ERROR_MSG( "BSPTree::loadFlatNodes: "
+				"Bad plane equation: n = (%f, %f, %f). d = %f\n",
+				node.planeEq.normal().x, node.planeEq.normal().y,
+				node.planeEq.normal().z, node.planeEq.d() );
+			return false;
+		}
+	}
+
+	for (uint32 i = 0; i < numTriangleIndices_; i++)
+	{
+		if (pTriangleIndices_[i] >= maxSize)
+		{
+			ERROR_MSG( "BSPTree::loadFlatNodes: "
+				"Index too big %d >= %d.\n", pTriangleIndices_[i], maxSize );
+			return false;
+		}
+	}
+
+	return true;
 }
 
 
 /**
  *	This method saves this BSP tree to the input file.
  *
+ *	@param filename		The file to save to.
+ *	@param flatLayout	If true, the tree is saved in the flat layout, which
+ *						can be used in place when it is loaded. Otherwise it
+ *						is saved in the original layout.
+ *
  *	@return True if successful, otherwise false.
  */
-bool BSPTree::save( const std::string & filename ) const
+bool BSPTree::save( const std::string & filename, bool flatLayout ) const
 {
 	TRACE_MSG( "BSPTree::save: %s\n", filename.c_str() );
 	MF_ASSERT( sizeof( WorldTriangle ) == 40 );
 
 	bool result = false;
 
-	if (triangles_.size() > 0xffff)
+	if (!flatLayout && triangles_.size() > 0xffff)
 	{
 		ERROR_MSG( "BSPTree::save: "
 				"Tree size (%d) is bigger than max size (%d)\n",
 				triangles_.size(), 0xffff );
 	}
-	else if (pRoot_ != NULL)
+	else if (pNodes_ != NULL)
 	{
 		FILE * pFile = BWResource::instance().fileSystem()->posixFileOpen( filename, "wb" );
 
@@ -1548,22 +1999,96 @@ bool BSPTree::save( const std::string & filename ) const
 		}
 
 		int numTriangles = triangles_.size();
-		int numNodes = 0;
+		int numNodes = numNodes_;
 		int maxTriangles = 0;
 
-		pRoot_->getNumNodes( numNodes, maxTriangles );
+		for (uint32 i = 0; i < numNodes_; i++)
+		{
+			maxTriangles = std::max( maxTriangles,
+				int( pNodes_[i].numIndices ) );
+		}
+
+		uint32 token = flatLayout ? BSP_FILE_TOKEN_FLAT : BSP_FILE_TOKEN;
+		int lastField = flatLayout ? numTriangleIndices_ : maxTriangles;
 
-		fwrite( &BSP_FILE_TOKEN, sizeof( BSP_FILE_TOKEN ), 1, pFile );
+		fwrite( &token, sizeof( token ), 1, pFile );
 		fwrite( &numTriangles, sizeof( numTriangles ), 1, pFile );
 		fwrite( &numNodes, sizeof( numNodes ), 1, pFile );
-		fwrite( &maxTriangles, sizeof( maxTriangles ), 1, pFile );
+		fwrite( &lastField, sizeof( lastField ), 1, pFile );
 
 		if( triangles_.size() )
 			fwrite( &triangles_.front(),
 				sizeof( WorldTriangle ), triangles_.size(), pFile );
 
-		result = pRoot_->save( pFile,
-				triangles_.empty() ? NULL : &triangles_.front() );
+		result = true;
+
+		if (flatLayout)
+		{
+			const char padding[16] = { 0 };
+			int paddingSize = flatPadding( sizeof( token ) + 3 * sizeof( int ) +
+				triangles_.size() * sizeof( WorldTriangle ) );
+
+			if (paddingSize > 0)
+			{
+				result &= (fwrite( padding, paddingSize, 1, pFile ) != 0);
+			}
+
+			result &= (fwrite( pNodes_, sizeof( BSPFlatNode ),
+				numNodes_, pFile ) == numNodes_);
+
+			if (numTriangleIndices_ > 0)
+			{
+				result &= (fwrite( pTriangleIndices_, sizeof( uint32 ),
+					numTriangleIndices_, pFile ) == numTriangleIndices_);
+			}
+		}
+		else
+		{
+			// The original layout is in prefix order, with the front subtree
+			// before the back subtree.
+			std::vector<uint32> stack;
+			stack.push_back( 0 );
+
+			while (!stack.empty() && result)
+			{
+				const BSPFlatNode & node = pNodes_[ stack.back() ];
+				stack.pop_back();
+
+				if (!isValidPlane( node.planeEq ))
+				{
+					ERROR_MSG( "BSPTree::save: "
+						"Invalid planeEq n = (%f, %f, %f) d = %f. len = %f\n",
+						node.planeEq.normal().x, node.planeEq.normal().y,
+						node.planeEq.normal().z, node.planeEq.d(),
+						node.planeEq.normal().length() );
+					result = false;
+					break;
+				}
+
+				uint16 numTris = node.numIndices;
+				result &= (fwrite( &node.flags, 1, 1, pFile ) != 0);
+				result &= (fwrite( &node.planeEq,
+					sizeof( node.planeEq ), 1, pFile ) != 0);
+				result &= (fwrite( &numTris, sizeof( numTris ), 1, pFile ) != 0);
+
+				for (uint16 i = 0; i < numTris && result; i++)
+				{
+					uint16 index = pTriangleIndices_[ node.firstIndex + i ];
+					result &= (fwrite( &index,
+						sizeof( uint16 ), 1, pFile ) != 0);
+				}
+
+				if (node.back != BSPFlatNode::NO_NODE)
+				{
+					stack.push_back( node.back );
+				}
+
+				if (node.front != BSPFlatNode::NO_NODE)
+				{
+					stack.push_back( node.front );
+				}
+			}
+		}
 				
 		UserDataMap::const_iterator dataIt  = this->userData_.begin();
 		UserDataMap::const_iterator dataEnd = this->userData_.end();
@@ -1588,17 +2113,81 @@ bool BSPTree::save( const std::string & filename ) const
 
 
 /**
- *	This is a helper method used by BSP's load method.
+ *	This method loads the input data, which must be in the original layout,
+ *	into a tree of BSP objects as this class used to. The nodes refer to our
+ *	triangles. It is only used to compare against the flat layout.
+ *
+ *	@param bp			The data to load.
+ *	@param pRoot		Set to the root of the loaded tree.
+ *	@param pNodeMemory	Set to the memory that the nodes were allocated from.
+ *						This must be freed by the caller, even on failure.
  */
-bool BSPTree::loadTrianglesForNode( BSPFile & bspFile,
-									BSP & node, int numTriangles ) const
+bool BSPTree::loadLegacyTree( BinaryPtr bp, BSP * & pRoot,
+	char * & pNodeMemory )
 {
-	if (numTriangles > indicesSize_)
+	BSPFile bspFile( bp );
+
+	struct
 	{
-		ERROR_MSG( "BSPTree::loadTrianglesForNode: "
-			"Wanted to load %d but can only handle %d\n", numTriangles, indicesSize_ );
-		return false;
-	}
+		uint32 magic;
+		int32 numTriangles;
+		int32 numNodes;
+		int32 maxTriangles;
+	} header;
+
+	// The triangles are read to time them as before, but then discarded.
+	RealWTriangleSet triangles;
+
+	if (!bspFile.read( &header, sizeof(header), 1 ) ||
+		header.magic != BSP_FILE_TOKEN ||
+		header.numTriangles != int( triangles_.size() ))
+	{
+		bspFile.close();
+		return false;
+	}
+
+	triangles.resize( header.numTriangles );
+	bspFile.read( triangles.empty() ? NULL : &triangles.front(),
+		sizeof( WorldTriangle ), header.numTriangles );
+
+	pIndices_ = new uint16[ header.maxTriangles ];
+	indicesSize_ = header.maxTriangles;
+
+	pNodeMemory = new char[ header.numNodes * sizeof(BSP) ];
+
+	BSPAllocator allocator( pNodeMemory );
+
+	pRoot = allocator.newBSP();
+	bool result = pRoot->load( *this, bspFile, allocator );
+
+	if (!result)
+	{
+		allocator.destroy( pRoot );
+		pRoot = NULL;
+	}
+
+	delete [] pIndices_;
+	pIndices_ = NULL;
+	indicesSize_ = 0;
+
+	bspFile.close();
+
+	return result;
+}
+
+
+/**
+ *	This is a helper method used by BSP's load method.
+ */
+bool BSPTree::loadTrianglesForNode( BSPFile & bspFile,
+									BSP & node, int numTriangles ) const
+{
+	if (numTriangles > indicesSize_)
+	{
+		ERROR_MSG( "BSPTree::loadTrianglesForNode: "
+			"Wanted to load %d but can only handle %d\n", numTriangles, indicesSize_ );
+		return false;
+	}
 
 	if (numTriangles == 0)
 		return true;
@@ -1631,6 +2220,805 @@ bool BSPTree::loadTrianglesForNode( BSPFile & bspFile,
 }
 
 
+namespace
+{
+
+/**
+ *	This function fills the input vector with random points in the bounding
+ *	box of the input triangles, which must not be empty.
+ */
+void randomPoints( const RealWTriangleSet & triangles,
+	std::vector<Vector3> & points )
+{
+	BoundingBox bb;
+	for (uint i = 0; i < triangles.size(); i++)
+	{
+		bb.addBounds( triangles[i].v0() );
+		bb.addBounds( triangles[i].v1() );
+		bb.addBounds( triangles[i].v2() );
+	}
+
+	const Vector3 & minB = bb.minBounds();
+	const Vector3 & maxB = bb.maxBounds();
+
+	for (uint i = 0; i < points.size(); i++)
+	{
+		points[i] = Vector3(
+			minB.x + (maxB.x - minB.x) * (rand() / float( RAND_MAX )),
+			minB.y + (maxB.y - minB.y) * (rand() / float( RAND_MAX )),
+			minB.z + (maxB.z - minB.z) * (rand() / float( RAND_MAX )) );
+	}
+}
+
+} // anon namespace
+
+
+/**
+ *	This method loads the input data again as a tree of BSP objects, and
+ *	compares its loading time, query speed and query results with the flat
+ *	layout. The results are logged, and any disagreement is counted in
+ *	s_mismatches_.
+ *
+ *	@param bp				The data that was loaded.
+ *	@param flatLoadTime		The time taken to load it in the flat layout.
+ */
+void BSPTree::compareLegacy( BinaryPtr bp, uint64 flatLoadTime )
+{
+	BSP * pRoot = NULL;
+	char * pNodeMemory = NULL;
+
+	uint64 legacyLoadTime = timestamp();
+	bool loaded = this->loadLegacyTree( bp, pRoot, pNodeMemory );
+	legacyLoadTime = timestamp() - legacyLoadTime;
+
+	if (loaded && !triangles_.empty())
+	{
+		const int NUM_QUERIES = 1000;
+
+		std::vector<Vector3> points( NUM_QUERIES * 3 );
+		randomPoints( triangles_, points );
+
+		std::vector<float> flatDists( NUM_QUERIES, 1.f );
+		std::vector<float> legacyDists( NUM_QUERIES, 1.f );
+		std::vector<bool> flatHits( NUM_QUERIES * 2 );
+		std::vector<bool> legacyHits( NUM_QUERIES * 2 );
+
+		uint64 flatRayTime = timestamp();
+		for (int i = 0; i < NUM_QUERIES; i++)
+		{
+			flatHits[i] = this->intersects( points[i*3], points[i*3+1],
+				flatDists[i] );
+		}
+		flatRayTime = timestamp() - flatRayTime;
+
+		uint64 legacyRayTime = timestamp();
+		for (int i = 0; i < NUM_QUERIES; i++)
+		{
+			legacyHits[i] = pRoot->intersects( points[i*3], points[i*3+1],
+				legacyDists[i] );
+		}
+		legacyRayTime = timestamp() - legacyRayTime;
+
+		uint64 flatTriTime = timestamp();
+		for (int i = 0; i < NUM_QUERIES; i++)
+		{
+			flatHits[ NUM_QUERIES + i ] = this->intersects( WorldTriangle(
+				points[i*3], points[i*3+1], points[i*3+2] ) );
+		}
+		flatTriTime = timestamp() - flatTriTime;
+
+		uint64 legacyTriTime = timestamp();
+		for (int i = 0; i < NUM_QUERIES; i++)
+		{
+			legacyHits[ NUM_QUERIES + i ] = pRoot->intersects( WorldTriangle(
+				points[i*3], points[i*3+1], points[i*3+2] ) );
+		}
+		legacyTriTime = timestamp() - legacyTriTime;
+
+		int mismatches = 0;
+		for (int i = 0; i < NUM_QUERIES * 2; i++)
+		{
+			if (flatHits[i] != legacyHits[i] ||
+				(i < NUM_QUERIES && flatDists[i] != legacyDists[i]))
+			{
+				++mismatches;
+			}
+		}
+		s_mismatches_ += mismatches;
+
+		const double stampsPerSecond = stampsPerSecondD();
+
+		INFO_MSG( "BSPTree::compareLegacy: %d nodes, %d triangles. "
+				"Load %.3fms flat, %.3fms legacy. "
+				"Rays %.0f/s flat, %.0f/s legacy. "
+				"Triangles %.0f/s flat, %.0f/s legacy. %d mismatches\n",
+			numNodes_, (int)triangles_.size(),
+			flatLoadTime * 1000.0 / stampsPerSecond,
+			legacyLoadTime * 1000.0 / stampsPerSecond,
+			NUM_QUERIES * stampsPerSecond / std::max( flatRayTime, uint64( 1 ) ),
+			NUM_QUERIES * stampsPerSecond / std::max( legacyRayTime, uint64( 1 ) ),
+			NUM_QUERIES * stampsPerSecond / std::max( flatTriTime, uint64( 1 ) ),
+			NUM_QUERIES * stampsPerSecond / std::max( legacyTriTime, uint64( 1 ) ),
+			mismatches );
+	}
+	else if (!loaded)
+	{
+		ERROR_MSG( "BSPTree::compareLegacy: Could not load the legacy tree\n" );
+	}
+
+	BSPAllocator allocator( pNodeMemory );
+
+	if (pRoot)
+		allocator.destroy( pRoot );
+	delete [] pNodeMemory;
+}
+
+
+/**
+ *	This method casts random rays through the tree one triangle at a time,
+ *	four triangles at a time and four rays at a time, and compares the speed
+ *	and the results of each. The results are logged, and any disagreement is
+ *	counted in s_mismatches_.
+ */
+void BSPTree::compareBlocks()
+{
+	if (blocks_.empty() || triangles_.empty()) return;
+
+	const int NUM_QUERIES = 1000;
+	const int SIZE = WorldRayPacket::SIZE;
+
+	std::vector<Vector3> points( NUM_QUERIES * 2 );
+	randomPoints( triangles_, points );
+
+	std::vector<float> scalarDists( NUM_QUERIES, 1.f );
+	std::vector<float> blockDists( NUM_QUERIES, 1.f );
+	std::vector<const WorldTriangle *> scalarHits( NUM_QUERIES );
+	std::vector<const WorldTriangle *> blockHits( NUM_QUERIES );
+	std::vector<WorldRayPacket> packets( NUM_QUERIES / SIZE );
+
+	for (int i = 0; i < NUM_QUERIES; i++)
+	{
+		packets[ i / SIZE ].set( i % SIZE, points[i*2], points[i*2+1] );
+	}
+
+	s_useBlocks_ = false;
+	uint64 scalarTime = timestamp();
+	for (int i = 0; i < NUM_QUERIES; i++)
+	{
+		this->intersects( points[i*2], points[i*2+1],
+			scalarDists[i], &scalarHits[i] );
+	}
+	scalarTime = timestamp() - scalarTime;
+	s_useBlocks_ = true;
+
+	uint64 blockTime = timestamp();
+	for (int i = 0; i < NUM_QUERIES; i++)
+	{
+		this->intersects( points[i*2], points[i*2+1],
+			blockDists[i], &blockHits[i] );
+	}
+	blockTime = timestamp() - blockTime;
+
+	uint64 packetTime = timestamp();
+	for (uint i = 0; i < packets.size(); i++)
+	{
+		this->intersects( packets[i] );
+	}
+	packetTime = timestamp() - packetTime;
+
+	int blockMismatches = 0;
+	int packetMismatches = 0;
+
+	for (int i = 0; i < NUM_QUERIES; i++)
+	{
+		const WorldRayPacket & packet = packets[ i / SIZE ];
+
+		// the blocks must agree exactly
+		if (blockDists[i] != scalarDists[i] || blockHits[i] != scalarHits[i])
+		{
+			++blockMismatches;
+		}
+
+		// the packets find the nearest hit, not the first one confirmed
+		if ((packet.pHitTriangle( i % SIZE ) != NULL) !=
+				(scalarHits[i] != NULL) ||
+			packet.dist( i % SIZE ) > scalarDists[i])
+		{
+			++packetMismatches;
+		}
+	}
+
+	s_mismatches_ += blockMismatches + packetMismatches;
+
+	const double stampsPerSecond = stampsPerSecondD();
+
+	INFO_MSG( "BSPTree::compareBlocks: %d nodes, %d triangles. "
+			"Rays %.0f/s by triangle, %.0f/s by block, %.0f/s by packet. "
+			"%d block and %d packet mismatches\n",
+		numNodes_, (int)triangles_.size(),
+		NUM_QUERIES * stampsPerSecond / std::max( scalarTime, uint64( 1 ) ),
+		NUM_QUERIES * stampsPerSecond / std::max( blockTime, uint64( 1 ) ),
+		NUM_QUERIES * stampsPerSecond / std::max( packetTime, uint64( 1 ) ),
+		blockMismatches, packetMismatches );
+}
+
+
+// -----------------------------------------------------------------------------
+// Section: BSPTree queries
+// -----------------------------------------------------------------------------
+
+/**
+ *	This method returns whether the input triangle intersects any triangle in
+ *	the tree.
+ *
+ *	@see BSP::intersects
+ */
+bool BSPTree::intersects( const WorldTriangle & triangle,
+	const WorldTriangle ** ppHitTriangle ) const
+{
+	return numNodes_ > 0 &&
+		this->intersectsNode( 0, triangle, ppHitTriangle );
+}
+
+
+/**
+ *	This method returns whether the input triangle intersects any triangle in
+ *	the given node or its descendants.
+ */
+bool BSPTree::intersectsNode( uint32 index, const WorldTriangle & triangle,
+	const WorldTriangle ** ppHitTriangle ) const
+{
+	const BSPFlatNode & node = pNodes_[ index ];
+
+	if (!(node.flags & BSP_IS_PARTITIONED))
+	{
+		return this->intersectsThisNode( node, triangle, ppHitTriangle );
+	}
+
+	const float TOLERANCE = BSP::TOLERANCE;
+	bool intersects = false;
+
+	float d0 = node.planeEq.distanceTo(triangle.v0());
+	float d1 = node.planeEq.distanceTo(triangle.v1());
+	float d2 = node.planeEq.distanceTo(triangle.v2());
+
+	float min = ::min(d0, d1, d2);
+	float max = ::max(d0, d1, d2);
+
+	// Check the side with the first point of the triangle first.
+
+	if (d0 < 0.f)
+	{
+		if (node.back != BSPFlatNode::NO_NODE && min < TOLERANCE)
+		{
+			intersects = this->intersectsNode( node.back, triangle,
+				ppHitTriangle );
+		}
+
+		if (min < TOLERANCE && max > -TOLERANCE && !intersects)
+		{
+			intersects = this->intersectsThisNode( node, triangle,
+				ppHitTriangle );
+		}
+
+		if (node.front != BSPFlatNode::NO_NODE && max > -TOLERANCE &&
+			!intersects)
+		{
+			intersects = this->intersectsNode( node.front, triangle,
+				ppHitTriangle );
+		}
+	}
+	else
+	{
+		if (node.front != BSPFlatNode::NO_NODE && max > -TOLERANCE)
+		{
+			intersects = this->intersectsNode( node.front, triangle,
+				ppHitTriangle );
+		}
+
+		if (min < TOLERANCE && max > -TOLERANCE && !intersects)
+		{
+			intersects = this->intersectsThisNode( node, triangle,
+				ppHitTriangle );
+		}
+
+		if (node.back != BSPFlatNode::NO_NODE && min < TOLERANCE &&
+			!intersects)
+		{
+			intersects = this->intersectsNode( node.back, triangle,
+				ppHitTriangle );
+		}
+	}
+
+	return intersects;
+}
+
+
+/**
+ *	This method returns whether the input triangle intersects any triangle
+ *	assigned to the given node.
+ */
+bool BSPTree::intersectsThisNode( const BSPFlatNode & node,
+	const WorldTriangle & triangle,
+	const WorldTriangle ** ppHitTriangle ) const
+{
+	const uint32 * pIndex = pTriangleIndices_ + node.firstIndex;
+	const uint32 * pEnd = pIndex + node.numIndices;
+
+	while (pIndex != pEnd)
+	{
+		const WorldTriangle & tri = triangles_[ *pIndex++ ];
+
+		if (tri.collisionFlags() != TRIANGLE_NOT_IN_BSP &&
+			tri.intersects( triangle ))
+		{
+			if (ppHitTriangle != NULL)
+			{
+				*ppHitTriangle = &tri;
+			}
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/**
+ *	This struct is the stack node used for keeping track of the current state
+ *	of a traversal of the flat layout.
+ */
+struct BSPFlatStackNode
+{
+	BSPFlatStackNode();
+	BSPFlatStackNode( uint32 node, int eBack, float sDist, float eDist ) :
+		node_( node ), eBack_( eBack ), sDist_( sDist ), eDist_( eDist )
+	{ }
+
+	uint32		node_;
+	int			eBack_;		// or -1 for unseen
+	float		sDist_;
+	float		eDist_;
+};
+
+
+/**
+ *	This method returns whether the input interval intersects any triangle in
+ *	the tree. It is the same traversal as BSP::intersects, which describes
+ *	the parameters.
+ *
+ *	@see BSP::intersects
+ */
+bool BSPTree::intersects( const Vector3 & start,
+	const Vector3 & end,
+	float & dist,
+	const WorldTriangle ** ppHitTriangle,
+	CollisionVisitor * pVisitor ) const
+{
+	if (numNodes_ == 0) return false;
+
+	const float TOLERANCE = BSP::TOLERANCE;
+	const WorldTriangle * pHitTriangle = NULL;
+
+	if (ppHitTriangle == NULL) ppHitTriangle = &pHitTriangle;
+	if (pVisitor == NULL) pVisitor = &s_nullCV;
+
+	float origDist = dist;	
+	const WorldTriangle * origHT = *ppHitTriangle;
+
+	Vector3 delta = end - start;
+	float tolerancePct = TOLERANCE / delta.length();
+
+	static VectorNoDestructor< BSPFlatStackNode > stack;
+	stack.clear();
+	stack.push_back( BSPFlatStackNode( 0, -1, 0, 1 ) );
+
+	while (!stack.empty())
+	{
+		// get the next node to look at
+		BSPFlatStackNode cur = stack.back();
+		stack.pop_back();
+
+		const BSPFlatNode & node = pNodes_[ cur.node_ ];
+
+		// set default / initial values for the line segment range
+		float sDist = cur.sDist_;
+		float eDist = cur.eDist_;
+
+		// set up for plane intersection
+		float iDist = 0.f;
+		const PlaneEq & pe = node.planeEq;
+
+		// variables saying is points are on back side of plane
+		int sBack, eBack;
+
+		// see if this is a really simple node
+		if (!(node.flags & BSP_IS_PARTITIONED))
+		{
+			// just look at the triangles and don't try to add to the stack
+			sBack = -2;
+			eBack = -2;
+		}
+		// see if this is the first time we've seen it
+		else if (cur.eBack_ == -1)
+		{
+			// ok, this is the first time at this node
+			float sOut = pe.distanceTo( start + delta * (sDist - tolerancePct) );
+			float eOut = pe.distanceTo( start + delta * (eDist + tolerancePct) );
+			sBack = int(sOut < 0.f);
+			eBack = int(eOut < 0.f);
+
+			// find which side the start is on
+			uint32 startSide = (&node.front)[sBack];
+
+			// are they both on the same side?
+			if (sBack == eBack)
+			{
+				// but first check if either are within tolerance
+				if (fabs(sOut) < TOLERANCE || fabs(eOut) < TOLERANCE)
+				{
+					// and come back to check the triangles later if they are,
+					//  but don't bother with the back side
+					stack.push_back( BSPFlatStackNode(
+						cur.node_, -2, sDist, eDist ) );
+				}
+
+				// now go down the start side
+				if (startSide != BSPFlatNode::NO_NODE)
+				{
+					stack.push_back( BSPFlatStackNode(
+						startSide, -1, sDist, eDist ) );
+				}
+
+				continue;
+			}
+
+			// ok, points are on different sides. find intersect distance
+			iDist = pe.intersectRayHalf( start, pe.normal().dotProduct( delta ) );
+
+			// if there's anything on the start side we'll have to do it first
+			if (startSide != BSPFlatNode::NO_NODE)
+			{
+				// remember to come to the end side
+				stack.push_back( BSPFlatStackNode(
+					cur.node_, eBack, sDist, eDist ) );
+
+				// and then look at start side
+				stack.push_back( BSPFlatStackNode(
+					startSide, -1, sDist, iDist ) );
+
+				continue;
+			}
+
+			// ok, there's nothing on the start side, so fall through to
+			//  check the triangles on the plane, and later add the end side
+		}
+		// ok we've been here before
+		else
+		{
+			sBack = cur.eBack_;
+			eBack = cur.eBack_;
+
+			iDist = pe.intersectRayHalf( start, pe.normal().dotProduct( delta ) );
+		}
+
+		// ok, check the triangles on this node, and get out immediately
+		//  if we get a (confirmed) hit
+		if (this->intersectsThisNode( node, start, end, dist,
+				ppHitTriangle, pVisitor ) &&
+			dist <= (cur.eDist_+tolerancePct) )
+		{
+			return true;
+		}
+
+		// reset stuff
+		dist = origDist;
+		*ppHitTriangle = origHT;
+
+		// now add the other side if it's there (and eBack is ok)
+		if (eBack >= 0)
+		{
+			uint32 endSide = (&node.front)[eBack];
+			if (endSide != BSPFlatNode::NO_NODE) stack.push_back(
+				BSPFlatStackNode( endSide, -1, iDist, eDist ) );
+		}
+	}
+
+	return false;
+}
+
+
+/**
+ *	This method returns whether the input interval intersects a triangle
+ *	assigned to the given node. If it does, dist is set to the fraction of
+ *	the distance along the vector that the intersection point lies.
+ *
+ *	@see BSP::intersectsThisNode
+ */
+bool BSPTree::intersectsThisNode( const BSPFlatNode & node,
+	const Vector3 & start,
+	const Vector3 & end,
+	float & dist,
+	const WorldTriangle ** ppHitTriangle,
+	CollisionVisitor * pVisitor ) const
+{
+	bool intersects = false;
+
+	const uint32 * pIndex = pTriangleIndices_ + node.firstIndex;
+	const uint32 * pEnd = pIndex + node.numIndices;
+	const Vector3 direction(end - start);
+
+	if (s_useBlocks_ && !blocks_.empty())
+	{
+		// The blocks find the same hits as the loop below, and the hits are
+		// then visited in the same order.
+		const int SIZE = WorldTriangleBlock::SIZE;
+		const WorldTriangleBlock * pBlock =
+			&blocks_.front() + firstBlocks_[ &node - pNodes_ ];
+		const WorldTriangleBlock * pBlockEnd =
+			pBlock + (node.numIndices + SIZE - 1) / SIZE;
+
+		float dists[ SIZE ];
+
+		while (pBlock != pBlockEnd)
+		{
+			uint32 mask = pBlock->intersects( start, direction, dists );
+
+			for (int lane = 0; mask != 0; ++lane, mask >>= 1)
+			{
+				if (!(mask & 1)) continue;
+
+				const WorldTriangle & tri = triangles_[ pBlock->index( lane ) ];
+
+				if (tri.collisionFlags() != TRIANGLE_NOT_IN_BSP &&
+					dists[ lane ] < dist &&
+					(!pVisitor || pVisitor->visit( tri, dists[ lane ] )))
+				{
+					dist = dists[ lane ];
+					intersects = true;
+
+					if (ppHitTriangle != NULL)
+					{
+						*ppHitTriangle = &tri;
+					}
+				}
+			}
+
+			++pBlock;
+		}
+
+		return intersects;
+	}
+
+	// We go through all triangles because we need to find the closest one.
+
+	while (pIndex != pEnd)
+	{
+		const WorldTriangle & tri = triangles_[ *pIndex++ ];
+
+		if (tri.collisionFlags() != TRIANGLE_NOT_IN_BSP)
+		{
+			float originalDist = dist;
+
+			if (tri.intersects( start, direction, dist ) &&
+				(!pVisitor || pVisitor->visit( tri, dist )))
+			{
+				intersects = true;
+
+				if (ppHitTriangle != NULL)
+				{
+					*ppHitTriangle = &tri;
+				}
+			}
+			else
+			{
+				dist = originalDist;
+			}
+		}
+	}
+
+	return intersects;
+}
+
+
+/**
+ *	This method finds the nearest hit of each ray in the input packet. Rays
+ *	are tested four at a time against each triangle, and a node is visited
+ *	if any of the rays that could reach it have not yet hit something closer.
+ *
+ *	Unlike the single ray version, there is no visitor and every hit nearer
+ *	than the packet's current distance for that ray is considered, so this is
+ *	suited to visibility queries.
+ *
+ *	@param packet	The rays to test. The distance and hit triangle of each
+ *					ray are set to those of its nearest hit.
+ *
+ *	@return The mask of the rays that hit something.
+ */
+uint32 BSPTree::intersects( WorldRayPacket & packet ) const
+{
+	if (numNodes_ == 0) return 0;
+
+	const float TOLERANCE = BSP::TOLERANCE;
+	const int SIZE = WorldRayPacket::SIZE;
+
+	uint32 hitMask = 0;
+	float dists[ SIZE ];
+
+	// Each pending node is paired with the mask of rays that could reach it.
+	static VectorNoDestructor< std::pair< uint32, uint32 > > stack;
+	stack.clear();
+	stack.push_back( std::make_pair( 0, packet.activeMask() ) );
+
+	while (!stack.empty())
+	{
+		const BSPFlatNode & node = pNodes_[ stack.back().first ];
+		uint32 mask = stack.back().second;
+		stack.pop_back();
+
+		uint32 frontMask = 0;
+		uint32 backMask = 0;
+		uint32 onMask = mask;
+
+		if (node.flags & BSP_IS_PARTITIONED)
+		{
+			onMask = 0;
+
+			for (int lane = 0; lane < SIZE; lane++)
+			{
+				const uint32 bit = 1 << lane;
+				if (!(mask & bit)) continue;
+
+				// only the part of the ray before its nearest hit matters
+				const Vector3 start = packet.start( lane );
+				const Vector3 end = start + packet.dir( lane ) * packet.dist( lane );
+
+				float sOut = node.planeEq.distanceTo( start );
+				float eOut = node.planeEq.distanceTo( end );
+				float minOut = std::min( sOut, eOut );
+				float maxOut = std::max( sOut, eOut );
+
+				if (maxOut > -TOLERANCE) frontMask |= bit;
+				if (minOut < TOLERANCE) backMask |= bit;
+				if (minOut < TOLERANCE && maxOut > -TOLERANCE) onMask |= bit;
+			}
+		}
+
+		if (onMask != 0)
+		{
+			const uint32 * pIndex = pTriangleIndices_ + node.firstIndex;
+			const uint32 * pEnd = pIndex + node.numIndices;
+
+			while (pIndex != pEnd)
+			{
+				const WorldTriangle & tri = triangles_[ *pIndex++ ];
+				if (tri.collisionFlags() == TRIANGLE_NOT_IN_BSP) continue;
+
+				uint32 hits = packet.intersects( tri, dists ) & onMask;
+
+				for (int lane = 0; hits != 0; ++lane, hits >>= 1)
+				{
+					if ((hits & 1) && packet.hit( lane, tri, dists[ lane ] ))
+					{
+						hitMask |= 1 << lane;
+					}
+				}
+			}
+		}
+
+		if (backMask != 0 && node.back != BSPFlatNode::NO_NODE)
+		{
+			stack.push_back( std::make_pair( node.back, backMask ) );
+		}
+
+		if (frontMask != 0 && node.front != BSPFlatNode::NO_NODE)
+		{
+			stack.push_back( std::make_pair( node.front, frontMask ) );
+		}
+	}
+
+	return hitMask;
+}
+
+
+/**
+ *	This method intersects the volume formed by moving a triangle by a given
+ *	translation, with the tree.
+ *
+ *	@see BSP::intersects
+ */
+bool BSPTree::intersects( const WorldTriangle & triangle,
+	const Vector3 & translation,
+	CollisionVisitor * pVisitor ) const
+{
+	return numNodes_ > 0 &&
+		this->intersectsNode( 0, triangle, translation, pVisitor );
+}
+
+
+/**
+ *	This method intersects the volume formed by moving a triangle by a given
+ *	translation, with the given node and its descendants.
+ */
+bool BSPTree::intersectsNode( uint32 index, const WorldTriangle & triangle,
+	const Vector3 & translation, CollisionVisitor * pVisitor ) const
+{
+	const BSPFlatNode & node = pNodes_[ index ];
+
+	// if we're not partitioned it's easy
+	if (!(node.flags & BSP_IS_PARTITIONED))
+	{
+		return this->intersectsThisNode( node, triangle, translation,
+			pVisitor );
+	}
+
+	const float TOLERANCE = BSP::TOLERANCE;
+	const PlaneEq & pe = node.planeEq;
+
+	// ok, see if the volume crosses this plane
+	float dA0 = pe.distanceTo(triangle.v0());
+	float dA1 = pe.distanceTo(triangle.v1());
+	float dA2 = pe.distanceTo(triangle.v2());
+	float dB0 = pe.distanceTo(triangle.v0()+translation);
+	float dB1 = pe.distanceTo(triangle.v1()+translation);
+	float dB2 = pe.distanceTo(triangle.v2()+translation);
+
+	float min = std::min( ::min(dA0, dA1, dA2), ::min(dB0, dB1, dB2) );
+	float max = std::max( ::max(dA0, dA1, dA2), ::max(dB0, dB1, dB2) );
+
+	if (min < TOLERANCE && max > -TOLERANCE)
+	{
+		if (this->intersectsThisNode( node, triangle, translation, pVisitor ))
+			return true;
+	}
+
+	if (node.back != BSPFlatNode::NO_NODE && min < TOLERANCE)
+	{
+		if (this->intersectsNode( node.back, triangle, translation,
+				pVisitor ))
+			return true;
+	}
+
+	if (node.front != BSPFlatNode::NO_NODE && max > -TOLERANCE)
+	{
+		if (this->intersectsNode( node.front, triangle, translation,
+				pVisitor ))
+			return true;
+	}
+
+	return false;
+}
+
+
+/**
+ *	This method returns whether the volume formed by moving the input
+ *	triangle by a given translation intersects any triangle assigned
+ *	to the given node.
+ */
+bool BSPTree::intersectsThisNode( const BSPFlatNode & node,
+	const WorldTriangle & triangle,
+	const Vector3 & translation,
+	CollisionVisitor * pVisitor ) const
+{
+	const uint32 * pIndex = pTriangleIndices_ + node.firstIndex;
+	const uint32 * pEnd = pIndex + node.numIndices;
+
+	while (pIndex != pEnd)
+	{
+		const WorldTriangle & tri = triangles_[ *pIndex++ ];
+
+		if (tri.collisionFlags() != TRIANGLE_NOT_IN_BSP &&
+			tri.intersects( triangle, translation ))
+		{
+			if (pVisitor == NULL || pVisitor->visit( tri, 0.f )) return true;
+		}
+	}
+
+	return false;
+}
+
+
 /**
  *	Retrieves the user data entry identified by the given key,
  *	if present. Returns a NULL BinaryPtr if it entry was not found.
@@ -1659,8 +3047,10 @@ uint32 BSPTree::size() const
 {
 	uint32 sz = sizeof( BSPTree );
 	sz += triangles_.capacity() * sizeof( triangles_.front() );
-	if (pRoot_)
-		sz += pRoot_->size();
+	sz += numNodes_ * sizeof( BSPFlatNode );
+	sz += numTriangleIndices_ * sizeof( uint32 );
+	sz += blocks_.capacity() * sizeof( WorldTriangleBlock );
+	sz += firstBlocks_.capacity() * sizeof( uint32 );
 	return sz;
 }
 
@@ -23,6 +23,7 @@ criminal penalties as provided by law.
 #include "cstdmf/smartpointer.hpp"
 #include "worldpoly.hpp"
 #include "worldtri.hpp"
+#include "worldtri_block.hpp"
 
 #include <string>
 #include <map>
@@ -66,9 +67,40 @@ namespace Moo
 
 typedef std::vector< WorldTriangle::Flags > BSPFlagsMap;
 
+
+/**
+ *	This structure is a node of the flattened layout that BSPTree uses for its
+ *	queries. The nodes are stored contiguously in prefix order (front subtree
+ *	before back subtree) and refer to their children and triangles by index,
+ *	so a tree saved in this layout can be used in place from its loaded data.
+ *	The plane equation comes first so that it is 16 byte aligned whenever the
+ *	node array is.
+ */
+struct BSPFlatNode
+{
+	PlaneEq		planeEq;
+	uint32		front;			///< Index of the front child, or NO_NODE
+	uint32		back;			///< Index of the back child, or NO_NODE
+	uint32		firstIndex;		///< First of this node's triangle indices
+	uint16		numIndices;		///< Number of triangles on this node's plane
+	uint8		flags;			///< Node flags as they are in the file
+	uint8		reserved;
+
+	static const uint32 NO_NODE = 0xffffffff;
+};
+
+
 /**
  *	This class is used to store a BSP tree. It is responsible for the triangles
  *	that are in its member nodes.
+ *
+ *	The tree is queried through a flat array of nodes and a single array of
+ *	triangle indices rather than a tree of BSP objects. When the tree is loaded
+ *	from data that was saved in the flat layout, these arrays refer directly to
+ *	the loaded BinaryBlock, so loading does no per-node allocation at all.
+ *
+ *	The triangles of each node are also kept in blocks of four, so that rays
+ *	can be tested against four triangles at a time.
  */
 class BSPTree
 {
@@ -78,10 +110,25 @@ public:
 	~BSPTree();
 
 	bool load( BinaryPtr bp );
-	bool save( const std::string & filename ) const;
+	bool save( const std::string & filename, bool flatLayout = false ) const;
 	void remapFlags( BSPFlagsMap& flagsMap );
 
-	const BSP * pRoot() const		{ return pRoot_; }
+	bool intersects( const WorldTriangle & triangle,
+		const WorldTriangle ** ppHitTriangle = NULL ) const;
+
+	bool intersects( const Vector3 & start,
+		const Vector3 & end,
+		float & dist,
+		const WorldTriangle ** ppHitTriangle = NULL,
+		CollisionVisitor * pVisitor = NULL ) const;
+
+	bool intersects( const WorldTriangle & triangle,
+		const Vector3 & translation,
+		CollisionVisitor * pVisitor = NULL ) const;
+
+	uint32 intersects( WorldRayPacket & packet ) const;
+
+	uint32 numNodes() const			{ return numNodes_; }
 
 	uint32 size() const;
 	bool empty() const { return triangles_.empty(); }
@@ -114,19 +161,67 @@ public:
 
 	bool canCollide() const;
 
+	static bool s_compareLegacy_;
+	static bool s_useBlocks_;
+	static bool s_compareBlocks_;
+	static uint32 s_mismatches_;
+
 private:
+	bool loadLegacyNodes( BSPFile & bspFile, int numNodes, int maxTriangles );
+	bool loadFlatNodes( BinaryPtr bp, BSPFile & bspFile,
+		int numNodes, int numIndices );
+	void flatten( const BSP * pRoot );
+	void useStorage();
+	void buildBlocks();
+
+	void compareLegacy( BinaryPtr bp, uint64 flatLoadTime );
+	void compareBlocks();
+	bool loadLegacyTree( BinaryPtr bp, BSP * & pRoot, char * & pNodeMemory );
 	bool loadTrianglesForNode( BSPFile & bspFile,
 		BSP & node, int numTriangles ) const;
 
-	BSP * pRoot_;
+	bool intersectsNode( uint32 node, const WorldTriangle & triangle,
+		const WorldTriangle ** ppHitTriangle ) const;
+
+	bool intersectsNode( uint32 node, const WorldTriangle & triangle,
+		const Vector3 & translation, CollisionVisitor * pVisitor ) const;
+
+	bool intersectsThisNode( const BSPFlatNode & node,
+		const WorldTriangle & triangle,
+		const WorldTriangle ** ppHitTriangle ) const;
+
+	bool intersectsThisNode( const BSPFlatNode & node,
+		const Vector3 & start,
+		const Vector3 & end,
+		float & dist,
+		const WorldTriangle ** ppHitTriangle,
+		CollisionVisitor * pVisitor ) const;
+
+	bool intersectsThisNode( const BSPFlatNode & node,
+		const WorldTriangle & triangle,
+		const Vector3 & translation,
+		CollisionVisitor * pVisitor ) const;
+
 	RealWTriangleSet triangles_;
 
-	// Used for storage when loading.
+	const BSPFlatNode * pNodes_;
+	uint32 numNodes_;
+	const uint32 * pTriangleIndices_;
+	uint32 numTriangleIndices_;
+
+	// Storage for the flat layout when it is not used in place.
+	std::vector<BSPFlatNode> nodeStorage_;
+	std::vector<uint32> indexStorage_;
+	BinaryPtr pFlatData_;
+
+	// The triangles of each node in blocks of four, for testing rays.
+	std::vector<WorldTriangleBlock> blocks_;
+	std::vector<uint32> firstBlocks_;
+
+	// Used for storage when loading the legacy tree.
 	mutable uint16 * pIndices_;
 	int indicesSize_;
 
-	char * pNodeMemory_;
-
 	typedef std::map<UserDataKey, BinaryPtr> UserDataMap;
 	UserDataMap userData_;
 
@@ -138,6 +233,11 @@ private:
  *	This class is used to implement a BSP (Binary Space Partitioning) tree.
  *	Objects of this type can be thought of as both a node of a BSP tree and the
  *	BSP tree that is root at that node.
+ *
+ *	BSPTree only uses these while constructing a tree, which it then flattens,
+ *	and when comparing its flat layout against them.
+ *
+ *	@see BSPTree
  */
 class BSP
 {
@@ -0,0 +1,359 @@
+/******************************************************************************
+BigWorld Technology
+Copyright BigWorld Pty, Ltd.
+All Rights Reserved. Commercial in confidence.
+
+WARNING: This computer program is protected by copyright law and international
+treaties. Unauthorized use, reproduction or distribution of this program, or
+any portion of this program, may result in the imposition of civil and
+criminal penalties as provided by law.
+******************************************************************************/
+
+/**
+ *	@file
+ */
+
+#include "pch.hpp"
+
+#include "worldtri_block.hpp"
+
+#include "cstdmf/debug.hpp"
+
+#ifdef BW_SSE_COLLISION
+#include <xmmintrin.h>
+#endif
+
+
+// -----------------------------------------------------------------------------
+// Section: Kernels
+// -----------------------------------------------------------------------------
+
+namespace
+{
+
+/// The determinant below which a ray is considered parallel to a triangle,
+/// as in WorldTriangle::intersects.
+const float BLOCK_EPSILON = 0.000001f;
+
+#ifdef BW_SSE_COLLISION
+
+/**
+ *	This function returns the four dot products of the input vectors, added
+ *	in the same order as Vector3::dotProduct.
+ */
+inline __m128 dot4( __m128 ax, __m128 ay, __m128 az,
+	__m128 bx, __m128 by, __m128 bz )
+{
+	return _mm_add_ps( _mm_add_ps( _mm_mul_ps( ax, bx ), _mm_mul_ps( ay, by ) ),
+		_mm_mul_ps( az, bz ) );
+}
+
+
+/**
+ *	This function is WorldTriangle::intersects for four rays and four
+ *	triangles at once. Each step is the same single precision operation as
+ *	the scalar code, so the results are the same.
+ *
+ *	@return The mask of the lanes that hit, with their distances in dists.
+ *		Whether the hit is closer than the current distance is left to the
+ *		caller.
+ */
+inline uint32 intersect4( __m128 sx, __m128 sy, __m128 sz,
+	__m128 dx, __m128 dy, __m128 dz,
+	__m128 v0x, __m128 v0y, __m128 v0z,
+	__m128 e1x, __m128 e1y, __m128 e1z,
+	__m128 e2x, __m128 e2y, __m128 e2z,
+	float * dists )
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps( 1.f );
+	const __m128 signMask = _mm_set1_ps( -0.f );
+
+	// p = dir x edge2
+	__m128 px = _mm_sub_ps( _mm_mul_ps( dy, e2z ), _mm_mul_ps( dz, e2y ) );
+	__m128 py = _mm_sub_ps( _mm_mul_ps( dz, e2x ), _mm_mul_ps( dx, e2z ) );
+	__m128 pz = _mm_sub_ps( _mm_mul_ps( dx, e2y ), _mm_mul_ps( dy, e2x ) );
+
+	// reject where the ray lies in the plane of the triangle
+	__m128 det = dot4( e1x, e1y, e1z, px, py, pz );
+	__m128 valid = _mm_cmpnlt_ps( _mm_andnot_ps( signMask, det ),
+		_mm_set1_ps( BLOCK_EPSILON ) );
+
+	__m128 invDet = _mm_div_ps( one, det );
+
+	// t = start - v0, and the U parameter
+	__m128 tx = _mm_sub_ps( sx, v0x );
+	__m128 ty = _mm_sub_ps( sy, v0y );
+	__m128 tz = _mm_sub_ps( sz, v0z );
+
+	__m128 u = _mm_mul_ps( dot4( tx, ty, tz, px, py, pz ), invDet );
+	valid = _mm_and_ps( valid, _mm_and_ps(
+		_mm_cmpnlt_ps( u, zero ), _mm_cmpnlt_ps( one, u ) ) );
+
+	// q = t x edge1, and the V parameter
+	__m128 qx = _mm_sub_ps( _mm_mul_ps( ty, e1z ), _mm_mul_ps( tz, e1y ) );
+	__m128 qy = _mm_sub_ps( _mm_mul_ps( tz, e1x ), _mm_mul_ps( tx, e1z ) );
+	__m128 qz = _mm_sub_ps( _mm_mul_ps( tx, e1y ), _mm_mul_ps( ty, e1x ) );
+
+	__m128 v = _mm_mul_ps( dot4( dx, dy, dz, qx, qy, qz ), invDet );
+	valid = _mm_and_ps( valid, _mm_and_ps(
+		_mm_cmpnlt_ps( v, zero ), _mm_cmpnlt_ps( one, _mm_add_ps( u, v ) ) ) );
+
+	// the distance along the ray
+	__m128 dist = _mm_mul_ps( dot4( e2x, e2y, e2z, qx, qy, qz ), invDet );
+	valid = _mm_and_ps( valid, _mm_cmplt_ps( zero, dist ) );
+
+	_mm_storeu_ps( dists, dist );
+
+	return _mm_movemask_ps( valid );
+}
+
+#else // BW_SSE_COLLISION
+
+/**
+ *	This function is WorldTriangle::intersects for one ray and one triangle
+ *	given as its first vertex and edges. It is the fallback for the four
+ *	wide kernel.
+ *
+ *	@return Whether the ray hit, with its distance in dist. Whether the hit
+ *		is closer than the current distance is left to the caller.
+ */
+inline bool intersect1( const Vector3 & start, const Vector3 & dir,
+	const Vector3 & v0, const Vector3 & edge1, const Vector3 & edge2,
+	float & dist )
+{
+	const Vector3 p( dir.crossProduct( edge2 ) );
+
+	float det = edge1.dotProduct( p );
+
+	if (almostZero( det, BLOCK_EPSILON ))
+		return false;
+
+	float invDet = 1.f / det;
+
+	const Vector3 t( start - v0 );
+
+	float u = t.dotProduct( p ) * invDet;
+
+	if (u < 0.f || 1.f < u)
+		return false;
+
+	const Vector3 q( t.crossProduct( edge1 ) );
+
+	float v = dir.dotProduct( q ) * invDet;
+
+	if (v < 0.f || 1.f < u + v)
+		return false;
+
+	dist = edge2.dotProduct( q ) * invDet;
+
+	return 0.f < dist;
+}
+
+#endif // BW_SSE_COLLISION
+
+} // anon namespace
+
+
+// -----------------------------------------------------------------------------
+// Section: WorldTriangleBlock
+// -----------------------------------------------------------------------------
+
+/**
+ *	Constructor. All lanes are empty, and never hit anything.
+ */
+WorldTriangleBlock::WorldTriangleBlock()
+{
+	for (int i = 0; i < SIZE; i++)
+	{
+		v0x_[i] = v0y_[i] = v0z_[i] = 0.f;
+		e1x_[i] = e1y_[i] = e1z_[i] = 0.f;
+		e2x_[i] = e2y_[i] = e2z_[i] = 0.f;
+		indices_[i] = 0;
+	}
+}
+
+
+/**
+ *	This method sets the triangle in the given lane.
+ *
+ *	@param lane		The lane to set.
+ *	@param triangle	The triangle.
+ *	@param index	The index of the triangle, returned by index().
+ */
+void WorldTriangleBlock::set( int lane, const WorldTriangle & triangle,
+	uint32 index )
+{
+	MF_ASSERT_DEBUG( 0 <= lane && lane < SIZE );
+
+	const Vector3 edge1( triangle.v1() - triangle.v0() );
+	const Vector3 edge2( triangle.v2() - triangle.v0() );
+
+	v0x_[ lane ] = triangle.v0().x;
+	v0y_[ lane ] = triangle.v0().y;
+	v0z_[ lane ] = triangle.v0().z;
+	e1x_[ lane ] = edge1.x;
+	e1y_[ lane ] = edge1.y;
+	e1z_[ lane ] = edge1.z;
+	e2x_[ lane ] = edge2.x;
+	e2y_[ lane ] = edge2.y;
+	e2z_[ lane ] = edge2.z;
+	indices_[ lane ] = index;
+}
+
+
+/**
+ *	This method tests the interval from start to (start + dir) against the
+ *	triangles in this block.
+ *
+ *	@param start	The start of the interval.
+ *	@param dir		The direction and length of the interval.
+ *	@param dists	Set to the fraction along the interval of each hit.
+ *
+ *	@return The mask of lanes that were hit. Unlike WorldTriangle::intersects
+ *		this does not check the hits against a maximum distance.
+ */
+uint32 WorldTriangleBlock::intersects( const Vector3 & start,
+	const Vector3 & dir, float * dists ) const
+{
+#ifdef BW_SSE_COLLISION
+	return intersect4(
+		_mm_set1_ps( start.x ), _mm_set1_ps( start.y ), _mm_set1_ps( start.z ),
+		_mm_set1_ps( dir.x ), _mm_set1_ps( dir.y ), _mm_set1_ps( dir.z ),
+		_mm_loadu_ps( v0x_ ), _mm_loadu_ps( v0y_ ), _mm_loadu_ps( v0z_ ),
+		_mm_loadu_ps( e1x_ ), _mm_loadu_ps( e1y_ ), _mm_loadu_ps( e1z_ ),
+		_mm_loadu_ps( e2x_ ), _mm_loadu_ps( e2y_ ), _mm_loadu_ps( e2z_ ),
+		dists );
+#else
+	uint32 mask = 0;
+
+	for (int i = 0; i < SIZE; i++)
+	{
+		if (intersect1( start, dir,
+				Vector3( v0x_[i], v0y_[i], v0z_[i] ),
+				Vector3( e1x_[i], e1y_[i], e1z_[i] ),
+				Vector3( e2x_[i], e2y_[i], e2z_[i] ), dists[i] ))
+		{
+			mask |= 1 << i;
+		}
+	}
+
+	return mask;
+#endif
+}
+
+
+// -----------------------------------------------------------------------------
+// Section: WorldRayPacket
+// -----------------------------------------------------------------------------
+
+/**
+ *	Constructor. All lanes are empty.
+ */
+WorldRayPacket::WorldRayPacket() :
+	activeMask_( 0 )
+{
+	for (int i = 0; i < SIZE; i++)
+	{
+		sx_[i] = sy_[i] = sz_[i] = 0.f;
+		dx_[i] = dy_[i] = dz_[i] = 0.f;
+		dists_[i] = 0.f;
+		pHitTriangles_[i] = NULL;
+	}
+}
+
+
+/**
+ *	This method sets the ray in the given lane.
+ *
+ *	@param lane		The lane to set.
+ *	@param start	The start of the interval to test.
+ *	@param end		The end of the interval to test.
+ *	@param dist		The fraction of the interval to consider, as for
+ *					BSPTree::intersects. It is lowered to the fraction of
+ *					the nearest hit.
+ */
+void WorldRayPacket::set( int lane, const Vector3 & start, const Vector3 & end,
+	float dist )
+{
+	MF_ASSERT_DEBUG( 0 <= lane && lane < SIZE );
+
+	const Vector3 dir( end - start );
+
+	sx_[ lane ] = start.x;
+	sy_[ lane ] = start.y;
+	sz_[ lane ] = start.z;
+	dx_[ lane ] = dir.x;
+	dy_[ lane ] = dir.y;
+	dz_[ lane ] = dir.z;
+	dists_[ lane ] = dist;
+	pHitTriangles_[ lane ] = NULL;
+
+	activeMask_ |= 1 << lane;
+}
+
+
+/**
+ *	This method tests the rays in this packet against the input triangle.
+ *
+ *	@param triangle	The triangle to test.
+ *	@param dists	Set to the fraction along each ray of its hit.
+ *
+ *	@return The mask of active lanes that hit the triangle. Unlike
+ *		WorldTriangle::intersects this does not check the hits against the
+ *		nearest hit so far.
+ */
+uint32 WorldRayPacket::intersects( const WorldTriangle & triangle,
+	float * dists ) const
+{
+	const Vector3 edge1( triangle.v1() - triangle.v0() );
+	const Vector3 edge2( triangle.v2() - triangle.v0() );
+
+#ifdef BW_SSE_COLLISION
+	const Vector3 & v0 = triangle.v0();
+
+	return activeMask_ & intersect4(
+		_mm_loadu_ps( sx_ ), _mm_loadu_ps( sy_ ), _mm_loadu_ps( sz_ ),
+		_mm_loadu_ps( dx_ ), _mm_loadu_ps( dy_ ), _mm_loadu_ps( dz_ ),
+		_mm_set1_ps( v0.x ), _mm_set1_ps( v0.y ), _mm_set1_ps( v0.z ),
+		_mm_set1_ps( edge1.x ), _mm_set1_ps( edge1.y ), _mm_set1_ps( edge1.z ),
+		_mm_set1_ps( edge2.x ), _mm_set1_ps( edge2.y ), _mm_set1_ps( edge2.z ),
+		dists );
+#else
+	uint32 mask = 0;
+
+	for (int i = 0; i < SIZE; i++)
+	{
+		if ((activeMask_ & (1 << i)) &&
+			intersect1( this->start( i ), this->dir( i ),
+				triangle.v0(), edge1, edge2, dists[i] ))
+		{
+			mask |= 1 << i;
+		}
+	}
+
+	return mask;
+#endif
+}
+
+
+/**
+ *	This method records a hit on the given ray if it is nearer than its
+ *	nearest hit so far.
+ *
+ *	@return True if the hit was recorded.
+ */
+bool WorldRayPacket::hit( int lane, const WorldTriangle & triangle,
+	float dist )
+{
+	if (dist < dists_[ lane ])
+	{
+		dists_[ lane ] = dist;
+		pHitTriangles_[ lane ] = &triangle;
+		return true;
+	}
+
+	return false;
+}
+
+// worldtri_block.cpp
@@ -0,0 +1,126 @@
+/******************************************************************************
+BigWorld Technology
+Copyright BigWorld Pty, Ltd.
+All Rights Reserved. Commercial in confidence.
+
+WARNING: This computer program is protected by copyright law and international
+treaties. Unauthorized use, reproduction or distribution of this program, or
+any portion of this program, may result in the imposition of civil and
+criminal penalties as provided by law.
+******************************************************************************/
+
+/**
+ *	@file
+ */
+
+#ifndef WORLDTRI_BLOCK_HPP
+#define WORLDTRI_BLOCK_HPP
+
+#include "worldtri.hpp"
+
+#include "cstdmf/stdmf.hpp"
+#include "math/vector3.hpp"
+
+// The four wide kernels use SSE when the compiler targets it, and otherwise
+// fall back to plain loops that do exactly the same arithmetic.
+#if defined( SSE_MATH ) || defined( __SSE__ ) || \
+	(defined( _M_IX86_FP ) && _M_IX86_FP >= 1)
+#define BW_SSE_COLLISION
+#endif
+
+
+/**
+ *	This class is four world triangles stored as a structure of arrays, so
+ *	that one ray can be tested against all of them at once. Each triangle is
+ *	kept as its first vertex and the two edges from it, which is what
+ *	WorldTriangle::intersects computes every time it is called.
+ *
+ *	The results are bit for bit those of WorldTriangle::intersects, provided
+ *	that it is also compiled to single precision SSE arithmetic (rather than
+ *	x87) and to the Vector3 code (rather than D3DX).
+ */
+class WorldTriangleBlock
+{
+public:
+	enum { SIZE = 4 };
+
+	WorldTriangleBlock();
+
+	void set( int lane, const WorldTriangle & triangle, uint32 index );
+
+	uint32 intersects( const Vector3 & start, const Vector3 & dir,
+		float * dists ) const;
+
+	uint32 index( int lane ) const		{ return indices_[ lane ]; }
+
+private:
+	float	v0x_[ SIZE ];
+	float	v0y_[ SIZE ];
+	float	v0z_[ SIZE ];
+	float	e1x_[ SIZE ];
+	float	e1y_[ SIZE ];
+	float	e1z_[ SIZE ];
+	float	e2x_[ SIZE ];
+	float	e2y_[ SIZE ];
+	float	e2z_[ SIZE ];
+	uint32	indices_[ SIZE ];
+};
+
+
+/**
+ *	This class is a packet of up to four rays (line segments) stored as a
+ *	structure of arrays, so that all of them can be tested against one
+ *	triangle at once. It is used for batched visibility queries, and also
+ *	holds the nearest hit found so far for each ray.
+ *
+ *	@see BSPTree::intersects
+ */
+class WorldRayPacket
+{
+public:
+	enum { SIZE = 4 };
+
+	WorldRayPacket();
+
+	void set( int lane, const Vector3 & start, const Vector3 & end,
+		float dist = 1.f );
+
+	uint32 intersects( const WorldTriangle & triangle, float * dists ) const;
+
+	/// This method returns the mask of lanes that have been set.
+	uint32 activeMask() const			{ return activeMask_; }
+
+	Vector3 start( int lane ) const
+		{ return Vector3( sx_[ lane ], sy_[ lane ], sz_[ lane ] ); }
+	Vector3 dir( int lane ) const
+		{ return Vector3( dx_[ lane ], dy_[ lane ], dz_[ lane ] ); }
+
+	/**
+	 *	This method returns the fraction along the given ray of its nearest
+	 *	hit, or its initial value if it has not hit anything.
+	 */
+	float dist( int lane ) const		{ return dists_[ lane ]; }
+
+	/**
+	 *	This method returns the triangle of the nearest hit of the given ray,
+	 *	or NULL if it has not hit anything.
+	 */
+	const WorldTriangle * pHitTriangle( int lane ) const
+		{ return pHitTriangles_[ lane ]; }
+
+	bool hit( int lane, const WorldTriangle & triangle, float dist );
+
+private:
+	float	sx_[ SIZE ];
+	float	sy_[ SIZE ];
+	float	sz_[ SIZE ];
+	float	dx_[ SIZE ];
+	float	dy_[ SIZE ];
+	float	dz_[ SIZE ];
+	float	dists_[ SIZE ];
+	const WorldTriangle * pHitTriangles_[ SIZE ];
+	uint32	activeMask_;
+};
+
+
+#endif // WORLDTRI_BLOCK_HPP
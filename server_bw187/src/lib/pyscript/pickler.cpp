@@ -13,8 +13,12 @@ criminal penalties as provided by law.
 
 #include "pickler.hpp"
 #include "cstdmf/debug.hpp"
+#include "cstdmf/timestamp.hpp"
+#include "cstdmf/watcher.hpp"
 #include "pyscript/pyobject_plus.hpp"
 
+#include <set>
+
 DECLARE_DEBUG_COMPONENT2( "Script", 0)
 
 
@@ -35,6 +39,471 @@ PY_BEGIN_ATTRIBUTES( FailedUnpickle )
 PY_END_ATTRIBUTES()
 
 
+// -----------------------------------------------------------------------------
+// Section: NativePickler
+// -----------------------------------------------------------------------------
+
+namespace
+{
+
+/**
+ *	This class writes pickles of objects that only contain the common builtin
+ *	types, without calling into cPickle. The output is in the same protocol 2
+ *	format as cPickle.dumps( obj, 2 ), except that it has no memo opcodes, so
+ *	it is read back with cPickle.loads as usual.
+ *
+ *	Anything it cannot write in the same way as cPickle is refused, and left
+ *	to cPickle. This is any object that is not exactly one of the supported
+ *	types (including subclasses of them), a list or dictionary that appears
+ *	more than once (since cPickle would keep it shared), which is also how
+ *	cycles through them are caught, and anything nested deeper than
+ *	MAX_DEPTH.
+ *
+ *	When constructed without an output string, it only checks whether an
+ *	object could be written.
+ */
+class NativePickler
+{
+public:
+	NativePickler( std::string * pOut ) : pOut_( pOut ) {}
+
+	bool pickle( PyObject * pObj );
+
+private:
+	enum
+	{
+		MAX_DEPTH = 64
+	};
+
+	bool save( PyObject * pObj, int depth );
+	bool saveInt( PyObject * pObj );
+	bool saveLong( PyObject * pObj );
+	bool saveFloat( PyObject * pObj );
+	bool saveString( PyObject * pObj );
+	bool saveUnicode( PyObject * pObj );
+	bool saveTuple( PyObject * pObj, int depth );
+	bool saveList( PyObject * pObj, int depth );
+	bool saveDict( PyObject * pObj, int depth );
+
+	void put( char c )
+	{
+		if (pOut_)
+		{
+			pOut_->push_back( c );
+		}
+	}
+
+	void put( const char * pData, size_t size )
+	{
+		if (pOut_)
+		{
+			pOut_->append( pData, size );
+		}
+	}
+
+	void putUInt32( uint32 value )
+	{
+		if (pOut_)
+		{
+			char buf[4];
+			buf[0] = char( value & 0xff );
+			buf[1] = char( (value >> 8) & 0xff );
+			buf[2] = char( (value >> 16) & 0xff );
+			buf[3] = char( (value >> 24) & 0xff );
+			pOut_->append( buf, sizeof( buf ) );
+		}
+	}
+
+	void putSized( char shortOp, char longOp, const char * pData,
+		size_t size );
+
+	std::string * pOut_;
+	std::set< PyObject * > containers_;
+};
+
+
+/**
+ *	This method writes the pickle of the given object.
+ *
+ *	@return	True on success, false if it must be left to cPickle. In that case
+ *		the output string is left in an unspecified state.
+ */
+bool NativePickler::pickle( PyObject * pObj )
+{
+	this->put( '\x80' );	// PROTO
+	this->put( '\x02' );
+
+	if (!this->save( pObj, 0 ))
+	{
+		return false;
+	}
+
+	this->put( '.' );		// STOP
+
+	return true;
+}
+
+
+/**
+ *	This method writes a single object.
+ */
+bool NativePickler::save( PyObject * pObj, int depth )
+{
+	if (depth > MAX_DEPTH)
+	{
+		return false;
+	}
+
+	if (pObj == Py_None)
+	{
+		this->put( 'N' );	// NONE
+		return true;
+	}
+
+	if (PyBool_Check( pObj ))
+	{
+		this->put( (pObj == Py_True) ? '\x88' : '\x89' ); // NEWTRUE, NEWFALSE
+		return true;
+	}
+
+	if (PyInt_CheckExact( pObj ))		return this->saveInt( pObj );
+	if (PyFloat_CheckExact( pObj ))		return this->saveFloat( pObj );
+	if (PyString_CheckExact( pObj ))	return this->saveString( pObj );
+	if (PyDict_CheckExact( pObj ))		return this->saveDict( pObj, depth );
+	if (PyList_CheckExact( pObj ))		return this->saveList( pObj, depth );
+	if (PyTuple_CheckExact( pObj ))		return this->saveTuple( pObj, depth );
+	if (PyLong_CheckExact( pObj ))		return this->saveLong( pObj );
+	if (PyUnicode_CheckExact( pObj ))	return this->saveUnicode( pObj );
+
+	return false;
+}
+
+
+/**
+ *	This method writes an int in the smallest of the binary forms, like
+ *	cPickle does.
+ */
+bool NativePickler::saveInt( PyObject * pObj )
+{
+	long value = PyInt_AS_LONG( pObj );
+
+#if SIZEOF_LONG > 4
+	if (value > 0x7fffffffL || value < -0x80000000L)
+	{
+		char buf[32];
+		int len = PyOS_snprintf( buf, sizeof( buf ), "I%ld\n", value );
+		this->put( buf, len );		// INT
+		return true;
+	}
+#endif
+
+	uint32 bits = uint32( value );
+
+	if ((bits >> 8) == 0)
+	{
+		this->put( 'K' );			// BININT1
+		this->put( char( bits ) );
+	}
+	else if ((bits >> 16) == 0)
+	{
+		this->put( 'M' );			// BININT2
+		this->put( char( bits & 0xff ) );
+		this->put( char( bits >> 8 ) );
+	}
+	else
+	{
+		this->put( 'J' );			// BININT
+		this->putUInt32( bits );
+	}
+
+	return true;
+}
+
+
+/**
+ *	This method writes a long as little-endian two's complement bytes.
+ */
+bool NativePickler::saveLong( PyObject * pObj )
+{
+	size_t numBits = _PyLong_NumBits( pObj );
+
+	if (numBits == size_t( -1 ) && PyErr_Occurred())
+	{
+		PyErr_Clear();
+		return false;
+	}
+
+	// One extra bit for the sign. Zero is written with no bytes at all.
+	size_t numBytes = (numBits == 0) ? 0 : (numBits >> 3) + 1;
+
+	if (numBytes > 0x7fffffff)
+	{
+		return false;
+	}
+
+	std::string bytes( numBytes, '\0' );
+
+	if (numBytes > 0)
+	{
+		if (_PyLong_AsByteArray( (PyLongObject *)pObj,
+				(unsigned char *)&bytes[0], numBytes,
+				/* little_endian: */ 1, /* is_signed: */ 1 ) < 0)
+		{
+			PyErr_Clear();
+			return false;
+		}
+
+		// Like cPickle, drop a redundant sign byte of a negative value,
+		// such as for -128, which fits in one byte.
+		if (numBytes > 1 &&
+				(unsigned char)bytes[ numBytes - 1 ] == 0xff &&
+				(bytes[ numBytes - 2 ] & 0x80) != 0)
+		{
+			--numBytes;
+		}
+	}
+
+	if (numBytes < 256)
+	{
+		this->put( '\x8a' );			// LONG1
+		this->put( char( numBytes ) );
+	}
+	else
+	{
+		this->put( '\x8b' );			// LONG4
+		this->putUInt32( uint32( numBytes ) );
+	}
+
+	this->put( bytes.data(), numBytes );
+
+	return true;
+}
+
+
+/**
+ *	This method writes a float as a big-endian IEEE double.
+ */
+bool NativePickler::saveFloat( PyObject * pObj )
+{
+	unsigned char buf[8];
+
+	if (_PyFloat_Pack8( PyFloat_AS_DOUBLE( pObj ), buf,
+			/* little_endian: */ 0 ) < 0)
+	{
+		PyErr_Clear();
+		return false;
+	}
+
+	this->put( 'G' );			// BINFLOAT
+	this->put( (const char *)buf, sizeof( buf ) );
+
+	return true;
+}
+
+
+/**
+ *	This method writes a length prefixed run of bytes, with a one byte length
+ *	if it is short enough and a four byte length otherwise.
+ */
+void NativePickler::putSized( char shortOp, char longOp, const char * pData,
+	size_t size )
+{
+	if (size < 256)
+	{
+		this->put( shortOp );
+		this->put( char( size ) );
+	}
+	else
+	{
+		this->put( longOp );
+		this->putUInt32( uint32( size ) );
+	}
+
+	this->put( pData, size );
+}
+
+
+/**
+ *	This method writes a str.
+ */
+bool NativePickler::saveString( PyObject * pObj )
+{
+	Py_ssize_t size = PyString_GET_SIZE( pObj );
+
+	if (size > 0x7fffffff)
+	{
+		return false;
+	}
+
+	// SHORT_BINSTRING, BINSTRING
+	this->putSized( 'U', 'T', PyString_AS_STRING( pObj ), size );
+
+	return true;
+}
+
+
+/**
+ *	This method writes a unicode object as UTF-8.
+ */
+bool NativePickler::saveUnicode( PyObject * pObj )
+{
+	if (!pOut_)
+	{
+		return true;
+	}
+
+	PyObject * pUTF8 = PyUnicode_AsUTF8String( pObj );
+
+	if (!pUTF8)
+	{
+		PyErr_Clear();
+		return false;
+	}
+
+	bool isOkay = PyString_GET_SIZE( pUTF8 ) <= 0x7fffffff;
+
+	if (isOkay)
+	{
+		this->put( 'X' );		// BINUNICODE
+		this->putUInt32( uint32( PyString_GET_SIZE( pUTF8 ) ) );
+		this->put( PyString_AS_STRING( pUTF8 ), PyString_GET_SIZE( pUTF8 ) );
+	}
+
+	Py_DECREF( pUTF8 );
+
+	return isOkay;
+}
+
+
+/**
+ *	This method writes a tuple. Tuples of up to three items have their own
+ *	opcodes in protocol 2.
+ */
+bool NativePickler::saveTuple( PyObject * pObj, int depth )
+{
+	Py_ssize_t size = PyTuple_GET_SIZE( pObj );
+
+	if (size == 0)
+	{
+		this->put( ')' );		// EMPTY_TUPLE
+		return true;
+	}
+
+	if (size > 3)
+	{
+		this->put( '(' );		// MARK
+	}
+
+	for (Py_ssize_t i = 0; i < size; ++i)
+	{
+		if (!this->save( PyTuple_GET_ITEM( pObj, i ), depth + 1 ))
+		{
+			return false;
+		}
+	}
+
+	static const char ops[] = { 't', '\x85', '\x86', '\x87' };
+	this->put( (size > 3) ? ops[0] : ops[ size ] ); // TUPLE, TUPLE1/2/3
+
+	return true;
+}
+
+
+/**
+ *	This method writes a list. A list that has already been visited is
+ *	refused as soon as it is seen again, since it would be written twice
+ *	rather than shared, and unpickled as two separate lists. Stopping there
+ *	also keeps a graph of shared lists from being walked once per path.
+ */
+bool NativePickler::saveList( PyObject * pObj, int depth )
+{
+	if (!containers_.insert( pObj ).second)
+	{
+		return false;
+	}
+
+	this->put( ']' );			// EMPTY_LIST
+
+	Py_ssize_t size = PyList_GET_SIZE( pObj );
+
+	if (size == 0)
+	{
+		return true;
+	}
+
+	if (size > 1)
+	{
+		this->put( '(' );		// MARK
+	}
+
+	for (Py_ssize_t i = 0; i < size; ++i)
+	{
+		// The list is not changed while it is being written, since only
+		// builtin types are visited.
+		if (!this->save( PyList_GET_ITEM( pObj, i ), depth + 1 ))
+		{
+			return false;
+		}
+	}
+
+	this->put( (size > 1) ? 'e' : 'a' );	// APPENDS, APPEND
+
+	return true;
+}
+
+
+/**
+ *	This method writes a dictionary. As with lists, one that has already been
+ *	visited is refused.
+ */
+bool NativePickler::saveDict( PyObject * pObj, int depth )
+{
+	if (!containers_.insert( pObj ).second)
+	{
+		return false;
+	}
+
+	this->put( '}' );			// EMPTY_DICT
+
+	Py_ssize_t size = PyDict_Size( pObj );
+
+	if (size == 0)
+	{
+		return true;
+	}
+
+	if (size > 1)
+	{
+		this->put( '(' );		// MARK
+	}
+
+	Py_ssize_t pos = 0;
+	PyObject * pKey;
+	PyObject * pValue;
+
+	while (PyDict_Next( pObj, &pos, &pKey, &pValue ))
+	{
+		if (!this->save( pKey, depth + 1 ) ||
+				!this->save( pValue, depth + 1 ))
+		{
+			return false;
+		}
+	}
+
+	this->put( (size > 1) ? 'u' : 's' );	// SETITEMS, SETITEM
+
+	return true;
+}
+
+
+uint32 s_numNativePickles = 0;
+uint32 s_numFallbackPickles = 0;
+double s_nativePickleTime = 0.0;
+double s_fallbackPickleTime = 0.0;
+
+} // anonymous namespace
+
+
 // -----------------------------------------------------------------------------
 // Section: Pickler
 // -----------------------------------------------------------------------------
@@ -71,6 +540,20 @@ bool Pickler::init()
 		}
 
 		Py_DECREF( pModule );
+
+		MF_WATCH( "script/pickler/nativePickles", s_numNativePickles,
+			Watcher::WT_READ_ONLY,
+			"The number of objects pickled without calling cPickle" );
+		MF_WATCH( "script/pickler/fallbackPickles", s_numFallbackPickles,
+			Watcher::WT_READ_ONLY,
+			"The number of objects pickled by cPickle" );
+		MF_WATCH( "script/pickler/nativeTime", s_nativePickleTime,
+			Watcher::WT_READ_ONLY,
+			"Seconds spent pickling without calling cPickle" );
+		MF_WATCH( "script/pickler/fallbackTime", s_fallbackPickleTime,
+			Watcher::WT_READ_ONLY,
+			"Seconds spent pickling with cPickle, including failed "
+				"native attempts" );
 	}
 	else
 	{
@@ -92,6 +575,9 @@ bool Pickler::init()
 /**
  * 	This method pickles the given object into a binary string.
  *
+ * 	Objects made only of the common builtin types are written natively, and
+ * 	everything else is passed to cPickle. Both are in protocol 2.
+ *
  * 	@param pObj	Object to pickle
  * 	@return		The pickled string
  */
@@ -102,6 +588,21 @@ std::string Pickler::pickle( PyObject* pObj )
 		return static_cast< FailedUnpickle * >( pObj )->pickleData();
 	}
 
+	uint64 startTime = timestamp();
+
+	std::string str;
+
+	if (NativePickler( &str ).pickle( pObj ))
+	{
+		++s_numNativePickles;
+		s_nativePickleTime +=
+			double( timestamp() - startTime ) / stampsPerSecondD();
+
+		return str;
+	}
+
+	str.clear();
+
 	if (s_pPickleMethod != NULL)
 	{
 		PyObject* pResult;
@@ -112,16 +613,27 @@ std::string Pickler::pickle( PyObject* pObj )
 
 		if (pResult != NULL)
 		{
-			std::string str;
-
 			str.assign( PyString_AsString( pResult ), PyString_Size( pResult ));
 			Py_DECREF( pResult );
-
-			return str;
 		}
 	}
 
-	return "";
+	++s_numFallbackPickles;
+	s_fallbackPickleTime +=
+		double( timestamp() - startTime ) / stampsPerSecondD();
+
+	return str;
+}
+
+
+/**
+ * 	This method returns whether the given object can be pickled without
+ * 	calling cPickle. This is much cheaper than pickling it, since nothing is
+ * 	written.
+ */
+bool Pickler::canPickleNatively( PyObject * pObj )
+{
+	return NativePickler( NULL ).pickle( pObj );
 }
 
 
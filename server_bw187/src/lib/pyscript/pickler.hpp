@@ -29,6 +29,8 @@ public:
 	static std::string 		pickle( PyObject * pObj );
 	static PyObject * 		unpickle( const std::string & str );
 
+	static bool				canPickleNatively( PyObject * pObj );
+
 	static bool			init();
 	static void			finalise();
 
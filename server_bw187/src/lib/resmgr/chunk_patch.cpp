@@ -0,0 +1,401 @@
+/******************************************************************************
+BigWorld Technology
+Copyright BigWorld Pty, Ltd.
+All Rights Reserved. Commercial in confidence.
+
+WARNING: This computer program is protected by copyright law and international
+treaties. Unauthorized use, reproduction or distribution of this program, or
+any portion of this program, may result in the imposition of civil and
+criminal penalties as provided by law.
+******************************************************************************/
+
+
+#include "chunk_patch.hpp"
+
+#include "cstdmf/binary_stream.hpp"
+#include "cstdmf/debug.hpp"
+
+#include <algorithm>
+
+DECLARE_DEBUG_COMPONENT( 0 )
+
+namespace
+{
+
+/// A chunk ends where the top CHUNK_MASK_BITS of the rolling hash are zero,
+/// so chunks average 2^CHUNK_MASK_BITS bytes past the minimum size.
+const int CHUNK_MASK_BITS = 13;
+const uint32 CHUNK_MASK = ((1U << CHUNK_MASK_BITS) - 1) <<
+	(32 - CHUNK_MASK_BITS);
+
+
+/**
+ *	This function returns the table of random values that the rolling hash
+ *	adds for each byte. It is generated the same way everywhere, so that
+ *	every process chooses the same chunk boundaries.
+ */
+const uint32 * gearTable()
+{
+	static uint32 s_table[ 256 ];
+	static bool s_isInitialised = false;
+
+	if (!s_isInitialised)
+	{
+		uint32 state = 0x9e3779b9;
+
+		for (int i = 0; i < 256; ++i)
+		{
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			s_table[i] = state;
+		}
+
+		s_isInitialised = true;
+	}
+
+	return s_table;
+}
+
+
+/**
+ *	This function returns the length of the chunk that starts at pData.
+ */
+uint32 chunkLength( const unsigned char * pData, uint32 remaining )
+{
+	if (remaining <= ChunkManifest::MIN_CHUNK_SIZE)
+	{
+		return remaining;
+	}
+
+	const uint32 * gear = gearTable();
+	const uint32 end =
+		std::min( remaining, uint32( ChunkManifest::MAX_CHUNK_SIZE ) );
+
+	uint32 hash = 0;
+
+	for (uint32 i = ChunkManifest::MIN_CHUNK_SIZE; i < end; ++i)
+	{
+		hash = (hash << 1) + gear[ pData[i] ];
+
+		if ((hash & CHUNK_MASK) == 0)
+		{
+			return i + 1;
+		}
+	}
+
+	return end;
+}
+
+
+/**
+ *	This function returns the digest of the given data.
+ */
+MD5::Digest digestOf( const char * pData, uint32 length )
+{
+	MD5 md5;
+	md5.append( pData, length );
+
+	return MD5::Digest( md5 );
+}
+
+} // anonymous namespace
+
+
+// -----------------------------------------------------------------------------
+// Section: ChunkManifest
+// -----------------------------------------------------------------------------
+
+/**
+ *	Constructor.
+ */
+ChunkManifest::ChunkManifest() :
+	length_( 0 )
+{
+}
+
+
+/**
+ *	This method splits the given data into chunks.
+ */
+void ChunkManifest::build( const char * pData, uint32 length )
+{
+	chunks_.clear();
+	index_.clear();
+	length_ = length;
+
+	uint32 offset = 0;
+
+	while (offset < length)
+	{
+		Chunk chunk;
+		chunk.offset = offset;
+		chunk.length = chunkLength(
+			reinterpret_cast< const unsigned char * >( pData + offset ),
+			length - offset );
+		chunk.digest = digestOf( pData + offset, chunk.length );
+
+		// Only the first of identical chunks is indexed.
+		index_.insert( std::make_pair( chunk.digest, chunks_.size() ) );
+		chunks_.push_back( chunk );
+
+		offset += chunk.length;
+	}
+}
+
+
+/**
+ *	This method returns the chunk with the given digest, or NULL if there is
+ *	none.
+ */
+const ChunkManifest::Chunk * ChunkManifest::find(
+		const MD5::Digest & digest ) const
+{
+	Index::const_iterator iter = index_.find( digest );
+
+	return (iter != index_.end()) ? &chunks_[ iter->second ] : NULL;
+}
+
+
+// -----------------------------------------------------------------------------
+// Section: ChunkPatch
+// -----------------------------------------------------------------------------
+
+/**
+ *	Constructor.
+ */
+ChunkPatch::ChunkPatch() :
+	resultLength_( 0 ),
+	numCopiedBytes_( 0 )
+{
+	resultDigest_.clear();
+}
+
+
+/**
+ *	This method makes the patch from the version of a file described by
+ *	oldManifest to the given new version.
+ */
+void ChunkPatch::make( const ChunkManifest & oldManifest,
+		const char * pNewData, uint32 newLength )
+{
+	ops_.clear();
+	literals_.clear();
+	numCopiedBytes_ = 0;
+	resultLength_ = newLength;
+	resultDigest_ = digestOf( pNewData, newLength );
+
+	ChunkManifest newManifest;
+	newManifest.build( pNewData, newLength );
+
+	const ChunkManifest::Chunks & chunks = newManifest.chunks();
+
+	for (ChunkManifest::Chunks::const_iterator iter = chunks.begin();
+			iter != chunks.end(); ++iter)
+	{
+		const ChunkManifest::Chunk * pOld = oldManifest.find( iter->digest );
+
+		if (pOld != NULL && pOld->length == iter->length)
+		{
+			this->addOp( COPY_OLD, pOld->offset, iter->length );
+			numCopiedBytes_ += iter->length;
+			continue;
+		}
+
+		const ChunkManifest::Chunk * pEarlier =
+			newManifest.find( iter->digest );
+
+		if (pEarlier != NULL && pEarlier->offset < iter->offset)
+		{
+			this->addOp( COPY_NEW, pEarlier->offset, iter->length );
+			numCopiedBytes_ += iter->length;
+			continue;
+		}
+
+		this->addOp( LITERAL, literals_.size(), iter->length );
+		literals_.append( pNewData + iter->offset, iter->length );
+	}
+}
+
+
+/**
+ *	This method adds an operation, merging it with the previous one if they
+ *	copy adjacent data.
+ */
+void ChunkPatch::addOp( OpType type, uint32 offset, uint32 length )
+{
+	if (!ops_.empty())
+	{
+		Op & last = ops_.back();
+
+		if (last.type == type && last.offset + last.length == offset)
+		{
+			last.length += length;
+			return;
+		}
+	}
+
+	Op op;
+	op.type = type;
+	op.offset = offset;
+	op.length = length;
+
+	ops_.push_back( op );
+}
+
+
+/**
+ *	This method applies the patch to the old version of a file.
+ *
+ *	@return	False if the patch does not apply to the given data.
+ */
+bool ChunkPatch::apply( const char * pOldData, uint32 oldLength,
+		std::string & result ) const
+{
+	result.clear();
+	result.reserve( resultLength_ );
+
+	for (Ops::const_iterator iter = ops_.begin(); iter != ops_.end(); ++iter)
+	{
+		const uint32 end = iter->offset + iter->length;
+
+		switch (iter->type)
+		{
+		case COPY_OLD:
+			if (end > oldLength || end < iter->offset)
+			{
+				return false;
+			}
+			result.append( pOldData + iter->offset, iter->length );
+			break;
+
+		case COPY_NEW:
+			if (end > result.size() || end < iter->offset)
+			{
+				return false;
+			}
+			result.append( result, iter->offset, iter->length );
+			break;
+
+		case LITERAL:
+			if (end > literals_.size() || end < iter->offset)
+			{
+				return false;
+			}
+			result.append( literals_, iter->offset, iter->length );
+			break;
+
+		default:
+			return false;
+		}
+	}
+
+	if (result.size() != resultLength_ ||
+			digestOf( result.data(), result.size() ) != resultDigest_)
+	{
+		ERROR_MSG( "ChunkPatch::apply: The patched data does not match\n" );
+		return false;
+	}
+
+	return true;
+}
+
+
+/**
+ *	This method writes the patch to the given stream.
+ */
+void ChunkPatch::addToStream( BinaryOStream & stream ) const
+{
+	stream << resultLength_;
+	stream.addBlob( resultDigest_.bytes, sizeof( resultDigest_.bytes ) );
+
+	stream << uint32( ops_.size() );
+
+	for (Ops::const_iterator iter = ops_.begin(); iter != ops_.end(); ++iter)
+	{
+		stream << iter->type << iter->offset << iter->length;
+	}
+
+	stream << literals_;
+}
+
+
+/**
+ *	This method reads the patch from the given stream. The patch may come
+ *	from the network, so it is checked to be consistent: the operations must
+ *	add up to the result length, which must be no more than
+ *	MAX_RESULT_LENGTH, and their literal data must all be present.
+ *
+ *	@return	False if the stream was invalid.
+ */
+bool ChunkPatch::readFromStream( BinaryIStream & stream )
+{
+	uint32 numOps;
+
+	stream >> resultLength_;
+	memcpy( resultDigest_.bytes,
+		stream.retrieve( sizeof( resultDigest_.bytes ) ),
+		sizeof( resultDigest_.bytes ) );
+	stream >> numOps;
+
+	if (stream.error() || resultLength_ > MAX_RESULT_LENGTH ||
+		uint32( stream.remainingLength() ) / (sizeof( uint8 ) +
+			2 * sizeof( uint32 )) < numOps)
+	{
+		ERROR_MSG( "ChunkPatch::readFromStream: Invalid header\n" );
+		return false;
+	}
+
+	ops_.resize( numOps );
+	numCopiedBytes_ = 0;
+
+	uint32 totalLength = 0;
+	uint32 literalLength = 0;
+
+	for (Ops::iterator iter = ops_.begin(); iter != ops_.end(); ++iter)
+	{
+		stream >> iter->type >> iter->offset >> iter->length;
+
+		if (iter->type > LITERAL ||
+			iter->length > resultLength_ - totalLength ||
+			(iter->type == LITERAL &&
+				iter->offset > resultLength_ - iter->length))
+		{
+			ERROR_MSG( "ChunkPatch::readFromStream: Invalid operation\n" );
+			return false;
+		}
+
+		totalLength += iter->length;
+
+		if (iter->type == LITERAL)
+		{
+			literalLength = std::max( literalLength,
+				iter->offset + iter->length );
+		}
+		else
+		{
+			numCopiedBytes_ += iter->length;
+		}
+	}
+
+	if (totalLength != resultLength_)
+	{
+		ERROR_MSG( "ChunkPatch::readFromStream: "
+			"Operations make %u bytes rather than %u\n",
+			totalLength, resultLength_ );
+		return false;
+	}
+
+	stream >> literals_;
+
+	if (stream.error() || literals_.size() < literalLength)
+	{
+		ERROR_MSG( "ChunkPatch::readFromStream: Missing literal data\n" );
+		return false;
+	}
+
+	return true;
+}
+
+
+// chunk_patch.cpp
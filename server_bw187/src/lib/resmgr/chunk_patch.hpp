@@ -0,0 +1,131 @@
+/******************************************************************************
+BigWorld Technology
+Copyright BigWorld Pty, Ltd.
+All Rights Reserved. Commercial in confidence.
+
+WARNING: This computer program is protected by copyright law and international
+treaties. Unauthorized use, reproduction or distribution of this program, or
+any portion of this program, may result in the imposition of civil and
+criminal penalties as provided by law.
+******************************************************************************/
+
+#ifndef CHUNK_PATCH_HPP
+#define CHUNK_PATCH_HPP
+
+#include "cstdmf/md5.hpp"
+#include "cstdmf/stdmf.hpp"
+
+#include <map>
+#include <string>
+#include <vector>
+
+class BinaryIStream;
+class BinaryOStream;
+
+
+/**
+ *	This class describes the contents of a file as a list of chunks, each
+ *	identified by the MD5 digest of its data.
+ *
+ *	Chunk boundaries are chosen by a rolling hash of the data, rather than at
+ *	fixed offsets. Inserting or removing data only changes the chunks around
+ *	the change, so the rest of a new version of a file matches chunks of the
+ *	previous version.
+ */
+class ChunkManifest
+{
+public:
+	/**
+	 *	This structure describes a chunk of the file.
+	 */
+	struct Chunk
+	{
+		MD5::Digest	digest;
+		uint32		offset;
+		uint32		length;
+	};
+
+	typedef std::vector< Chunk > Chunks;
+
+	static const uint32 MIN_CHUNK_SIZE = 2048;
+	static const uint32 MAX_CHUNK_SIZE = 65536;
+
+	ChunkManifest();
+
+	void build( const char * pData, uint32 length );
+
+	const Chunk * find( const MD5::Digest & digest ) const;
+
+	const Chunks & chunks() const	{ return chunks_; }
+	uint32 length() const			{ return length_; }
+
+private:
+	Chunks		chunks_;
+	uint32		length_;
+
+	typedef std::map< MD5::Digest, uint32 > Index;
+	Index		index_;
+};
+
+
+/**
+ *	This class is a patch from one version of a file to the next. The new
+ *	version is made of chunks copied from the old version, chunks copied
+ *	from earlier in the new version, and literal data for the chunks that are
+ *	in neither.
+ *
+ *	Applying a patch checks the digest of the result, so a patch applied to
+ *	the wrong old version fails rather than producing a corrupt file. The
+ *	client applies these as download method 4.
+ */
+class ChunkPatch
+{
+public:
+	/// The longest result that a patch read from a stream may have.
+	static const uint32 MAX_RESULT_LENGTH = 256 * 1024 * 1024;
+
+	ChunkPatch();
+
+	void make( const ChunkManifest & oldManifest,
+		const char * pNewData, uint32 newLength );
+
+	bool apply( const char * pOldData, uint32 oldLength,
+		std::string & result ) const;
+
+	void addToStream( BinaryOStream & stream ) const;
+	bool readFromStream( BinaryIStream & stream );
+
+	uint32 numCopiedBytes() const	{ return numCopiedBytes_; }
+	uint32 numLiteralBytes() const	{ return literals_.size(); }
+
+private:
+	enum OpType
+	{
+		COPY_OLD,		///< Copy from the old version.
+		COPY_NEW,		///< Copy from earlier in the new version.
+		LITERAL			///< Copy from the literal data.
+	};
+
+	/**
+	 *	This structure is an operation that appends data to the new version.
+	 */
+	struct Op
+	{
+		uint8		type;
+		uint32		offset;
+		uint32		length;
+	};
+
+	typedef std::vector< Op > Ops;
+
+	void addOp( OpType type, uint32 offset, uint32 length );
+
+	Ops				ops_;
+	std::string		literals_;
+	uint32			resultLength_;
+	MD5::Digest		resultDigest_;
+	uint32			numCopiedBytes_;
+};
+
+
+#endif // CHUNK_PATCH_HPP
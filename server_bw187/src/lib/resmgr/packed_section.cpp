@@ -1450,6 +1450,19 @@ bool PackedSection::convert( DataSectionPtr pDS, const std::string & path )
 }
 
 
+/**
+ *	This static method converts the input DataSection tree to the contents of
+ *	a packed section file, without saving it anywhere.
+ */
+BinaryPtr PackedSection::pack( DataSectionPtr pDS )
+{
+	OutputWriter output;
+	convertToPackedFile( pDS, output );
+
+	return output.getBinary();
+}
+
+
 // -----------------------------------------------------------------------------
 // Section: ChildRecord
 // -----------------------------------------------------------------------------
@@ -107,6 +107,7 @@ public:
 			const std::string & outPath,
 			std::vector< std::string > * pStripStrings = NULL,
 			bool shouldEncrypt = false );
+	static BinaryPtr pack( DataSectionPtr pDS );
 
 	PackedSection( const char * name, const char * pData, int dataLen,
 			SectionType type, PackedSectionFilePtr pFile );
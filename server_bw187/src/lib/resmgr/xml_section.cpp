@@ -124,6 +124,146 @@ void XMLSection::operator delete( void * addr )
 }
 
 
+// -----------------------------------------------------------------------------
+// Section: ChildIndex
+// -----------------------------------------------------------------------------
+
+namespace
+{
+/// Sections with fewer children than this are searched linearly.
+const uint MIN_INDEXED_CHILDREN = 8;
+
+/**
+ *	This function returns the hash of a tag.
+ */
+inline uint32 hashTag( const char * tag )
+{
+	uint32 hash = 2166136261U;
+
+	while (*tag)
+	{
+		hash = (hash ^ uint8( *tag++ )) * 16777619U;
+	}
+
+	return hash;
+}
+}
+
+
+/**
+ *	This class is a hash table from a tag to the first child with that tag,
+ *	for sections with many children. It only holds the indices of the
+ *	children, so that their tags, which point into the parsed file, are not
+ *	copied.
+ */
+class XMLSection::ChildIndex
+{
+public:
+	ChildIndex( const Children & children );
+
+	int find( const Children & children, const char * tag ) const;
+	void add( const Children & children, int index );
+
+private:
+	void insert( const Children & children, int index );
+
+	std::vector< int >	slots_;
+	uint				numUsed_;
+};
+
+
+/**
+ *	Constructor. This indexes all of the given children.
+ */
+XMLSection::ChildIndex::ChildIndex( const Children & children ) :
+	numUsed_( 0 )
+{
+	uint size = 16;
+
+	while (size < children.size() * 2)
+	{
+		size *= 2;
+	}
+
+	slots_.resize( size, -1 );
+
+	for (uint i = 0; i < children.size(); ++i)
+	{
+		this->insert( children, i );
+	}
+}
+
+
+/**
+ *	This method returns the index of the first child with the given tag, or
+ *	-1 if there is none.
+ */
+int XMLSection::ChildIndex::find( const Children & children,
+	const char * tag ) const
+{
+	uint mask = slots_.size() - 1;
+	uint slot = hashTag( tag ) & mask;
+
+	while (slots_[ slot ] != -1)
+	{
+		if (strcmp( children[ slots_[ slot ] ]->ctag(), tag ) == 0)
+		{
+			return slots_[ slot ];
+		}
+
+		slot = (slot + 1) & mask;
+	}
+
+	return -1;
+}
+
+
+/**
+ *	This method indexes the child at the given index, which must be the last
+ *	one, growing the table if it is getting full.
+ */
+void XMLSection::ChildIndex::add( const Children & children, int index )
+{
+	if ((numUsed_ + 1) * 2 > slots_.size())
+	{
+		slots_.assign( slots_.size() * 2, -1 );
+		numUsed_ = 0;
+
+		for (int i = 0; i < index; ++i)
+		{
+			this->insert( children, i );
+		}
+	}
+
+	this->insert( children, index );
+}
+
+
+/**
+ *	This method adds the child at the given index to the table, unless an
+ *	earlier child has the same tag.
+ */
+void XMLSection::ChildIndex::insert( const Children & children, int index )
+{
+	const char * tag = children[ index ]->ctag();
+	uint mask = slots_.size() - 1;
+	uint slot = hashTag( tag ) & mask;
+
+	while (slots_[ slot ] != -1)
+	{
+		if (strcmp( children[ slots_[ slot ] ]->ctag(), tag ) == 0)
+		{
+			return;
+		}
+
+		slot = (slot + 1) & mask;
+	}
+
+	slots_[ slot ] = index;
+	++numUsed_;
+}
+
+
 // -----------------------------------------------------------------------------
 //	Constructor(s) for XMLSection.
 // -----------------------------------------------------------------------------
@@ -138,7 +278,8 @@ void XMLSection::operator delete( void * addr )
 XMLSection::XMLSection( const std::string & tag ) :
 	ctag_( NULL ),
 	cval_( NULL ),
-	tag_( tag )
+	tag_( tag ),
+	pChildIndex_( NULL )
 {
 	memoryCounterAdd( xml );
 	memoryClaim( tag_ );
@@ -149,7 +290,8 @@ XMLSection::XMLSection( const std::string & tag ) :
  */
 XMLSection::XMLSection( const char * tag, bool /*cstrToken*/ ) :
 	ctag_( tag ),
-	cval_( NULL )
+	cval_( NULL ),
+	pChildIndex_( NULL )
 {
 }
 
@@ -195,11 +337,19 @@ DataSectionPtr XMLSection::openChild( int index )
  */
 DataSectionPtr XMLSection::findChild( const std::string & tag ) const
 {
+	if (pChildIndex_)
+	{
+		int index = pChildIndex_->find( children_, tag.c_str() );
+
+		return (index != -1) ?
+			children_[ index ].getObject() : (DataSection *)NULL;
+	}
+
 	Children::const_iterator iter = children_.begin();
 
 	while (iter != children_.end())
 	{
-		if ((*iter)->sectionName() == tag)
+		if (strcmp( (*iter)->ctag(), tag.c_str() ) == 0)
 		{
 			return (*iter).getObject();
 		}
@@ -221,11 +371,8 @@ DataSectionPtr XMLSection::findChild( const std::string & tag ) const
  */
 DataSectionPtr XMLSection::newSection( const std::string &tag )
 {
-	XMLSection * pNewSect = this->addChild( NULL );
-	pNewSect->tag_ = tag;
-
-	memoryCounterAdd( xml );
-	memoryClaim( pNewSect->tag_ );
+	XMLSection * pNewSect = new XMLSection( tag );
+	this->attachChild( pNewSect, -1 );
 
 	return pNewSect;
 }
@@ -242,11 +389,8 @@ DataSectionPtr XMLSection::newSection( const std::string &tag )
  */
 DataSectionPtr XMLSection::insertSection( const std::string &tag, int index /* = -1 */ )
 {
-	XMLSection * pNewSect = this->addChild( NULL, index );
-	pNewSect->tag_ = tag;
-
-	memoryCounterAdd( xml );
-	memoryClaim( pNewSect->tag_ );
+	XMLSection * pNewSect = new XMLSection( tag );
+	this->attachChild( pNewSect, index );
 
 	return pNewSect;
 }
@@ -262,7 +406,7 @@ void XMLSection::delChild( const std::string & tag )
 
 	while (iter != children_.end())
 	{
-		if ((*iter)->sectionName() == tag)
+		if (strcmp( (*iter)->ctag(), tag.c_str() ) == 0)
 		{
 			{
 				memoryCounterSub( xml );
@@ -273,6 +417,7 @@ void XMLSection::delChild( const std::string & tag )
 				memoryCounterAdd( xml );
 				memoryClaim( children_ );
 			}
+			this->indexChildren();
 			return;
 		}
 
@@ -301,6 +446,7 @@ void XMLSection::delChild( DataSectionPtr pSection )
 				memoryCounterAdd( xml );
 				memoryClaim( children_ );
 			}
+			this->indexChildren();
 			return;
 		}
 
@@ -316,6 +462,7 @@ void XMLSection::delChildren()
 	memoryCounterSub( xml );
 	memoryClaim( children_ );
 	children_.clear();
+	this->indexChildren();
 }
 
 
@@ -961,6 +1108,8 @@ bool XMLSection::setBlob( const std::string &value )
  */
 XMLSection::~XMLSection()
 {
+	delete pChildIndex_;
+
 	memoryCounterSub( xml );
 
 	memoryClaim( children_ );
@@ -1019,28 +1168,58 @@ char *XMLSection::stripWhitespace( char *inputString )
 XMLSection * XMLSection::addChild( const char * tag, int index /* = -1 */ )
 {
 	XMLSection * pNewSection = new XMLSection( tag, true );
+	this->attachChild( pNewSection, index );
+
+	return pNewSection;
+}
 
+
+/**
+ * This method is used to add the given section as a child of this one, at
+ * the given index or at the end if it is -1.
+ */
+void XMLSection::attachChild( XMLSection * pChild, int index )
+{
 	{
 		memoryCounterSub( xml );
 		memoryClaim( children_ );
 	}
 
-	if (index == -1)
+	if (index == -1 || index >= (int)children_.size())
 	{
-		children_.push_back( pNewSection );
+		children_.push_back( pChild );
+
+		if (pChildIndex_)
+		{
+			pChildIndex_->add( children_, children_.size() - 1 );
+		}
+		else if (children_.size() >= MIN_INDEXED_CHILDREN)
+		{
+			this->indexChildren();
+		}
 	}
 	else
 	{
-		if (index > (int)children_.size()) index = children_.size(); // Just in case
-		children_.insert( children_.begin() + index, pNewSection );
+		children_.insert( children_.begin() + index, pChild );
+		this->indexChildren();
 	}
 
 	{
 		memoryCounterAdd( xml );
 		memoryClaim( children_ );
 	}
+}
 
-	return pNewSection;
+
+/**
+ * This method rebuilds the index of the children by tag, which only
+ * sections with many children have.
+ */
+void XMLSection::indexChildren()
+{
+	delete pChildIndex_;
+	pChildIndex_ = (children_.size() >= MIN_INDEXED_CHILDREN) ?
+		new ChildIndex( children_ ) : NULL;
 }
 
 
@@ -1598,6 +1777,8 @@ XMLSectionPtr XMLSection::createFromBinary(
 
 							memoryClaim( pCurrNode->children_ );
 
+							pCurrNode->indexChildren();
+
 							if(!s_parseStack->empty())
 							{
 								pCurrNode = s_parseStack->back();
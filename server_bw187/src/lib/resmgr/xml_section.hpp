@@ -152,6 +152,12 @@ private:
 
 	/// This method adds a new XMLSection to the current node.
 	XMLSection * addChild( const char * tag, int index = -1 );
+	void attachChild( XMLSection * pChild, int index );
+
+	/// This method returns the tag of this section without copying it.
+	const char * ctag() const	{ return ctag_ ? ctag_ : tag_.c_str(); }
+
+	void indexChildren();
 	//@}
 
 	static bool processBang( class WrapperStream & stream,
@@ -159,6 +165,7 @@ private:
 	static bool processQuestionMark( class WrapperStream & stream );
 
 	typedef std::vector< XMLSectionPtr > Children;
+	class ChildIndex;
 
 	const char		* ctag_;
 	const char		* cval_;
@@ -166,6 +173,7 @@ private:
 	std::string		value_;
 
 	Children		children_;
+	ChildIndex *	pChildIndex_;
 	DataSectionPtr	parent_;
 
 	BinaryPtr		block_;
@@ -16,6 +16,13 @@ criminal penalties as provided by law.
 #include "zip/zlib.h"
 #include "cstdmf/debug.hpp"
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 
 DECLARE_DEBUG_COMPONENT2( "ResMgr", 0 )
 
@@ -120,6 +127,211 @@ struct LocalHeader
 	unsigned short	extraFieldLength PACKED;
 };
 
+
+// -----------------------------------------------------------------------------
+// Section: MappedFile
+// -----------------------------------------------------------------------------
+
+/**
+ *	This class is a zip file mapped read-only into memory. Its reference
+ *	count is thread safe, since the blocks that refer into it can be released
+ *	on any thread.
+ *
+ *	A mapped archive must not be rewritten in place, e.g. by a resource
+ *	update, since reading a page of the mapping that is past the new end of
+ *	the file raises SIGBUS. Replace it by writing the new archive to another
+ *	file and renaming it over the old one. The mapping keeps the old file.
+ */
+class ZipFileSystem::MappedFile : public SafeReferenceCount
+{
+public:
+	MappedFile() : pData_( NULL ), size_( 0 ) {}
+	~MappedFile();
+
+	bool map( const std::string & path );
+
+	const char * data() const	{ return pData_; }
+	uint32 size() const			{ return size_; }
+
+private:
+	const char *	pData_;
+	uint32			size_;
+};
+
+
+/**
+ *	Destructor.
+ */
+ZipFileSystem::MappedFile::~MappedFile()
+{
+	if (pData_ != NULL)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile( pData_ );
+#else
+		munmap( (void *)pData_, size_ );
+#endif
+	}
+}
+
+
+/**
+ *	This method maps the given file.
+ *
+ *	@return True if successful.
+ */
+bool ZipFileSystem::MappedFile::map( const std::string & path )
+{
+#ifdef _WIN32
+	HANDLE hFile = CreateFile( path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+		NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	DWORD size = GetFileSize( hFile, NULL );
+	HANDLE hMapping = (size != 0 && size != INVALID_FILE_SIZE) ?
+		CreateFileMapping( hFile, NULL, PAGE_READONLY, 0, 0, NULL ) : NULL;
+	CloseHandle( hFile );
+
+	if (hMapping == NULL)
+	{
+		return false;
+	}
+
+	// The view keeps the mapping open.
+	void * pData = MapViewOfFile( hMapping, FILE_MAP_READ, 0, 0, 0 );
+	CloseHandle( hMapping );
+
+	if (pData == NULL)
+	{
+		return false;
+	}
+#else
+	int fd = open( path.c_str(), O_RDONLY );
+
+	if (fd == -1)
+	{
+		return false;
+	}
+
+	struct stat fileStat;
+
+	if (fstat( fd, &fileStat ) != 0 || fileStat.st_size == 0)
+	{
+		close( fd );
+		return false;
+	}
+
+	uint32 size = fileStat.st_size;
+
+	// The mapping stays valid after the file is closed. It is private, since
+	// it is never written and other processes' writes should not be seen.
+	void * pData = mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+
+	if (pData == MAP_FAILED)
+	{
+		return false;
+	}
+#endif
+
+	pData_ = (const char *)pData;
+	size_ = size;
+
+	return true;
+}
+
+
+namespace
+{
+
+/**
+ *	This class keeps a mapped zip file alive for a block that refers into it.
+ *	There is one of these for each such block, since the reference counts of
+ *	BinaryBlocks are not thread safe.
+ */
+class MappedFileOwner : public BinaryBlock
+{
+public:
+	MappedFileOwner( SafeReferenceCount * pMappedFile ) :
+		BinaryBlock( NULL, 0 ),
+		pMappedFile_( pMappedFile )
+	{
+	}
+
+private:
+	SmartPointer< SafeReferenceCount > pMappedFile_;
+};
+
+
+/**
+ *	This function inflates the data of a file in a zip file straight into the
+ *	given buffer. Each call has its own zlib stream, so that it can be called
+ *	from any thread without leaving a stream behind when the thread exits.
+ *
+ *	@return	Z_STREAM_END if successful, otherwise a zlib error.
+ */
+int inflateInto( const char * pSrc, uint32 srcLen, char * pDst, uint32 dstLen )
+{
+	z_stream stream;
+	memset( &stream, 0, sizeof( z_stream ) );
+
+	// Note that we dont use the uncompress wrapper function in zlib,
+	// because we need to pass in -MAX_WBITS to inflateInit2_ as the
+	// window size. This is an "undocumented feature" in zlib that
+	// disables the zlib header. This is what we want, since zip files
+	// don't contain zlib headers.
+
+	int r = inflateInit2_( &stream, -MAX_WBITS, ZLIB_VERSION,
+		sizeof( z_stream ) );
+
+	if (r != Z_OK)
+	{
+		return r;
+	}
+
+	stream.next_in = (unsigned char *)pSrc;
+	stream.avail_in = srcLen;
+	stream.next_out = (unsigned char *)pDst;
+	stream.avail_out = dstLen;
+
+	r = inflate( &stream, Z_FINISH );
+	inflateEnd( &stream );
+
+	return r;
+}
+
+
+/**
+ *	This function returns whether the given data looks like XML. XMLSection
+ *	parses in place, so such data cannot be handed out as a view of the
+ *	read-only mapping.
+ */
+bool isXML( const char * pData, uint32 len )
+{
+	for (uint32 i = 0; i < len; ++i)
+	{
+		char c = pData[i];
+
+		if (c != ' ' && c != '\t' && c != '\r' && c != '\n')
+		{
+			return c == '<';
+		}
+	}
+
+	return false;
+}
+
+} // anonymous namespace
+
+
+// -----------------------------------------------------------------------------
+// Section: ZipFileSystem
+// -----------------------------------------------------------------------------
+
 /**
  *	This is the constructor.
  *
@@ -127,7 +339,8 @@ struct LocalHeader
  */
 ZipFileSystem::ZipFileSystem( const std::string& zipFile ) :
 	path_( zipFile ),
-	pFile_(NULL)
+	pFile_(NULL),
+	pMappedFile_(NULL)
 {
 	SimpleMutexHolder mtx( mutex_ );
 	this->openZip(zipFile);
@@ -167,6 +380,22 @@ bool ZipFileSystem::openZip(const std::string& path)
 		return false;
 	}
 
+	// The directory is still read through pFile_, but files are read from
+	// the mapping if there is one.
+	const char * mappedStr = ::getenv( "BW_ZIP_MAPPED" );
+
+	if (!mappedStr || atoi( mappedStr ) != 0)
+	{
+		pMappedFile_ = new MappedFile;
+
+		if (!pMappedFile_->map( conformSlash(path) ))
+		{
+			WARNING_MSG( "ZipFileSystem::openZip: Could not map %s, "
+				"reading it through a single file\n", path.c_str() );
+			pMappedFile_ = NULL;
+		}
+	}
+
 	if(fseek(pFile_, -(int)sizeof(footer), SEEK_END) != 0)
 	{
 		ERROR_MSG("ZipFileSystem::openZip Failed to seek to footer (opening %s)\n",
@@ -291,7 +520,8 @@ bool ZipFileSystem::openZip(const std::string& path)
 }
 
 /**
- *	This method reads the contents of a file through readFileInternal.
+ *	This method reads the contents of a file, from the mapping if there is
+ *	one and otherwise through readFileInternal.
  *
  *	@param path		Path relative to the base of the filesystem.
  *
@@ -301,10 +531,126 @@ BinaryPtr ZipFileSystem::readFile(const std::string& path)
 {
 	BWResource::checkAccessFromCallingThread( path, "ZipFileSystem::readFile" );
 
+	if (pMappedFile_)
+	{
+		return readMappedFile( path );
+	}
+
 	SimpleMutexHolder mtx( mutex_ );
 	return readFileInternal( path );
 }
 
+/**
+ *	This method reads the contents of a file from the mapping. It is thread
+ *	safe without a lock, since nothing is changed after the zip file has been
+ *	opened.
+ *
+ *	@param path		Path relative to the base of the filesystem.
+ *
+ *	@return A BinaryBlock object containing the file data.
+ */
+BinaryPtr ZipFileSystem::readMappedFile(const std::string& path)
+{
+	std::string path2 = path;
+	std::replace(path2.begin(), path2.end(), '\\', '/');
+
+	if(path2[0] == '/')
+		path2.erase(0,1 );
+
+	FileMap::const_iterator it = fileMap_.find( adjustCase( path2 ) );
+
+	if (it == fileMap_.end())
+		return static_cast<BinaryBlock *>( NULL );
+
+	LocalHeader hdr;
+
+	if (!this->readLocalHeader( it->second, &hdr ))
+	{
+		ERROR_MSG("ZipFileSystem::readFile Failed to read local header (%s in %s)\n",
+			path.c_str(), path_.c_str());
+		return static_cast<BinaryBlock *>( NULL );
+	}
+
+	if(hdr.signature != LOCAL_HEADER_SIGNATURE)
+	{
+		ERROR_MSG("ZipFileSystem::readFile Invalid local header signature (%s in %s)\n",
+			path.c_str(), path_.c_str());
+		return static_cast<BinaryBlock *>( NULL );
+	}
+
+	if(hdr.compressionMethod != METHOD_STORE &&
+		hdr.compressionMethod != METHOD_DEFLATE)
+	{
+		ERROR_MSG("ZipFileSystem::readFile Compression method %d not yet supported (%s in %s)\n",
+			hdr.compressionMethod, path.c_str(), path_.c_str());
+		return static_cast<BinaryBlock *>( NULL );
+	}
+
+	uint32 dataOffset = it->second + sizeof(hdr) +
+		hdr.filenameLength + hdr.extraFieldLength;
+
+	if (dataOffset > pMappedFile_->size() ||
+		hdr.compressedSize > pMappedFile_->size() - dataOffset)
+	{
+		ERROR_MSG("ZipFileSystem::readFile Data read error (%s in %s)\n",
+			path.c_str(), path_.c_str());
+		return static_cast<BinaryBlock *>( NULL );
+	}
+
+	const char * pData = pMappedFile_->data() + dataOffset;
+
+	if(hdr.compressionMethod == METHOD_DEFLATE)
+	{
+		BinaryPtr pBinaryBlock = new BinaryBlock( NULL, hdr.uncompressedSize );
+
+		int r = inflateInto( pData, hdr.compressedSize,
+			pBinaryBlock->cdata(), hdr.uncompressedSize );
+
+		if (r != Z_STREAM_END)
+		{
+			ERROR_MSG("ZipFileSystem::readFile Decompression error %d (%s in %s)\n", r,
+				path.c_str(), path_.c_str());
+			return static_cast<BinaryBlock *>( NULL );
+		}
+
+		return pBinaryBlock;
+	}
+
+	if (isXML( pData, hdr.compressedSize ))
+	{
+		return new BinaryBlock( pData, hdr.compressedSize );
+	}
+
+	return new BinaryBlock( pData, hdr.compressedSize,
+		new MappedFileOwner( pMappedFile_.getObject() ) );
+}
+
+/**
+ *	This method reads the local header at the given offset, from the mapping
+ *	if there is one.
+ *
+ *	@return True if successful.
+ */
+bool ZipFileSystem::readLocalHeader( long offset, void * pHeader )
+{
+	if (pMappedFile_)
+	{
+		if (offset < 0 ||
+			uint32(offset) + sizeof(LocalHeader) > pMappedFile_->size())
+		{
+			return false;
+		}
+
+		memcpy( pHeader, pMappedFile_->data() + offset, sizeof(LocalHeader) );
+		return true;
+	}
+
+	SimpleMutexHolder mtx( mutex_ );
+
+	return fseek(pFile_, offset, SEEK_SET) == 0 &&
+		fread(pHeader, sizeof(LocalHeader), 1, pFile_) == 1;
+}
+
 /**
  *	This method reads the contents of a file. It is not thread safe.
  *
@@ -383,10 +729,6 @@ BinaryPtr ZipFileSystem::readFileInternal(const std::string& path)
 
 	if(hdr.compressionMethod == METHOD_DEFLATE)
 	{
-		unsigned long uncompressedSize = hdr.uncompressedSize;
-		z_stream zs;
-		memset( &zs, 0, sizeof(zs) );
-
 		if(!(pUncompressed = new char[hdr.uncompressedSize]))
 		{
 			ERROR_MSG("ZipFileSystem::readFile Failed to alloc data buffer (%s in %s)\n",
@@ -395,40 +737,16 @@ BinaryPtr ZipFileSystem::readFileInternal(const std::string& path)
 			return static_cast<BinaryBlock *>( NULL );
 		}
 
-		// Note that we dont use the uncompress wrapper function in zlib,
-		// because we need to pass in -MAX_WBITS to inflateInit2_ as the
-		// window size. This is an "undocumented feature" in zlib that
-		// disables the zlib header. This is what we want, since zip files
-		// don't contain zlib headers.
-
-		if(inflateInit2_(&zs, -MAX_WBITS, ZLIB_VERSION,
-			sizeof(z_stream)) != Z_OK)
-		{
-			ERROR_MSG("ZipFileSystem::readFile inflateInit2 failed (%s in %s)\n",
-				path.c_str(), path_.c_str());
-			delete[] pCompressed;
-			delete[] pUncompressed;
-			return static_cast<BinaryBlock *>( NULL );
-		}
-
-		zs.next_in = (unsigned char *)pCompressed;
-		zs.avail_in = hdr.compressedSize;
-		zs.next_out = (unsigned char *)pUncompressed;
-		zs.avail_out = uncompressedSize;
-		zs.zalloc = NULL;
-		zs.zfree = NULL;
-
-		if((r = inflate(&zs, Z_FINISH)) != Z_STREAM_END)
+		if((r = inflateInto(pCompressed, hdr.compressedSize,
+			pUncompressed, hdr.uncompressedSize)) != Z_STREAM_END)
 		{
 			ERROR_MSG("ZipFileSystem::readFile Decompression error %d (%s in %s)\n", r,
 				path.c_str(), path_.c_str());
 			delete[] pCompressed;
 			delete[] pUncompressed;
-			inflateEnd(&zs);
 			return static_cast<BinaryBlock *>( NULL );
 		}
 
-		inflateEnd(&zs);
 		pBinaryBlock = new BinaryBlock(pUncompressed, hdr.uncompressedSize);
 		//HACK_MSG("Read compressed file %s\n", path.c_str());
 	}
@@ -448,6 +766,8 @@ BinaryPtr ZipFileSystem::readFileInternal(const std::string& path)
  */
 void ZipFileSystem::closeZip()
 {
+	pMappedFile_ = NULL;
+
 	if(pFile_)
 	{
 		fclose(pFile_);
@@ -469,7 +789,6 @@ IFileSystem::Directory ZipFileSystem::readDirectory(const std::string& path)
 {
 	BWResource::checkAccessFromCallingThread( path, "ZipFileSystem::readDirectory" );
 
-	SimpleMutexHolder mtx( mutex_ );
 	std::string path2 = path;
 	std::replace(path2.begin(), path2.end(), '\\', '/');
 
@@ -500,7 +819,6 @@ IFileSystem::FileType ZipFileSystem::getFileType(const std::string& path,
 {
 	BWResource::checkAccessFromCallingThread( path, "ZipFileSystem::getFileType" );
 
-	SimpleMutexHolder mtx( mutex_ );
 	std::string path2 = path;
 	std::replace(path2.begin(), path2.end(), '\\', '/');
 
@@ -518,14 +836,7 @@ IFileSystem::FileType ZipFileSystem::getFileType(const std::string& path,
 	{
 		LocalHeader hdr;
 
-		if (fseek(pFile_, ffound->second, SEEK_SET) != 0)
-		{
-			ERROR_MSG("ZipFileSystem::getFileType Failed to seek to local header (%s in %s)\n",
-				path.c_str(), path_.c_str());
-			return FT_NOT_FOUND;
-		}
-
-		if (fread(&hdr, sizeof(hdr), 1, pFile_) != 1)
+		if (!this->readLocalHeader( ffound->second, &hdr ))
 		{
 			ERROR_MSG("ZipFileSystem::getFileType Failed to read local header (%s in %s)\n",
 				path.c_str(), path_.c_str());
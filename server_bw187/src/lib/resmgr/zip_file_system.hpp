@@ -17,10 +17,20 @@ criminal penalties as provided by law.
 #include <string>
 #include <stdio.h>
 #include "cstdmf/concurrency.hpp"
+#include "cstdmf/smartpointer.hpp"
+#include "cstdmf/stringmap.hpp"
 
 /**
  *	This class provides an implementation of IFileSystem
  *	that reads from a zip file.	
+ *
+ *	The zip file is mapped into memory when possible, so that any number of
+ *	threads can read from it at once without a lock. Each thread inflates
+ *	with its own zlib stream, straight into the returned block. Stored
+ *	files are returned as blocks that refer to the mapping, except for XML,
+ *	which is parsed in place and so is still copied. If the file cannot be
+ *	mapped, or BW_ZIP_MAPPED is set to 0, reads go through a single FILE
+ *	under a lock instead.
  */	
 class ZipFileSystem : public IFileSystem 
 {
@@ -48,8 +58,11 @@ public:
 	virtual IFileSystem*	clone();
 
 private:
-	SimpleMutex mutex_; // to make sure only one thread access the zlib stream
-	typedef std::map<std::string, long> FileMap;
+	class MappedFile;
+	typedef SmartPointer< MappedFile > MappedFilePtr;
+
+	SimpleMutex mutex_; // to make sure only one thread access pFile_
+	typedef StringHashMap< long > FileMap;
 	typedef std::map<std::string, Directory > DirMap;
 
 	std::string			path_;
@@ -57,10 +70,14 @@ private:
 	FileMap				fileMap_;
 	DirMap				dirMap_;
 	FILE*				pFile_;
+	MappedFilePtr		pMappedFile_;
 
 	bool				openZip(const std::string& path);	
 	void				closeZip();
 
+	bool				readLocalHeader( long offset, void * pHeader );
+	BinaryPtr			readMappedFile( const std::string & path );
+
 	ZipFileSystem( const ZipFileSystem & other );
 	ZipFileSystem & operator=( const ZipFileSystem & other );
 
@@ -12,6 +12,7 @@ criminal penalties as provided by law.
 #include "id_client.hpp"
 #include "cstdmf/debug.hpp"
 #include "cstdmf/timestamp.hpp"
+#include "cstdmf/watcher.hpp"
 
 #include "network/blocking_reply_handler.hpp"
 #include "network/bundle.hpp"
@@ -19,6 +20,17 @@ criminal penalties as provided by law.
 
 DECLARE_DEBUG_COMPONENT( 0 );
 
+namespace
+{
+// The period over which the rate that ids are used is measured.
+const double CONSUMPTION_SAMPLE_PERIOD = 1.0;
+
+// How many times the ids expected to be used while a request is outstanding
+// are kept ready.
+const double PREDICTION_SAFETY_FACTOR = 2.0;
+}
+
+
 /**
  *	Constructor.
  */
@@ -32,6 +44,16 @@ IDClient::IDClient() :
 
 	pendingRequest_( false ),
 	inEmergency_( false ),
+	sampleStartTime_( 0 ),
+	numUsedInSample_( 0 ),
+	consumptionRate_( 0.0 ),
+	requestTime_( 0 ),
+	requestLatency_( 0.0 ),
+	numIDsUsed_( 0 ),
+	numRequests_( 0 ),
+	numEmergencies_( 0 ),
+	numExhausted_( 0 ),
+	minReadyIDs_( 0 ),
 	pGetMoreMethod_( NULL ),
 	pPutBackMethod_( NULL )
 {
@@ -80,7 +102,14 @@ bool IDClient::init(
 				highSize );
 	}
 
-	return this->getMoreIDsBlocking() && isSorted;
+	Watcher::rootWatcher().addChild( "idClient", IDClient::pWatcher(), this );
+
+	sampleStartTime_ = timestamp();
+
+	bool gotIDs = this->getMoreIDsBlocking();
+	minReadyIDs_ = readyIDs_.size();
+
+	return gotIDs && isSorted;
 }
 
 
@@ -125,12 +154,19 @@ ObjectID IDClient::getID()
 		if (readyIDs_.empty())
 		{
 			ERROR_MSG("IDClient::getID: no id's left (really bad)\n");
+			++numExhausted_;
 			// return zero... what else can we do?
 			return 0;
 		}
 	}
 	ObjectID id = readyIDs_.front();
 	readyIDs_.pop();
+
+	++numIDsUsed_;
+	++numUsedInSample_;
+	minReadyIDs_ = std::min( minReadyIDs_, uint32( readyIDs_.size() ) );
+	this->updateConsumptionRate( timestamp() );
+
 	this->performUpdates( false );
 	return id;
 }
@@ -178,6 +214,7 @@ void IDClient::performUpdates( bool isEmergency )
 					"increased sizes to (%d, %d, %d)\n",
 				lowSize_, desiredSize_, highSize_ );
 		inEmergency_ = true;
+		++numEmergencies_;
 	}
 
 #if MF_ID_RECYCLING
@@ -198,7 +235,7 @@ void IDClient::performUpdates( bool isEmergency )
 	// have we fewer readyID's than we need?
 	else
 #endif
-	if (((readyIDs_.size() < lowSize_) || inEmergency_) &&
+	if (((readyIDs_.size() < this->lowMark()) || inEmergency_) &&
 			!pendingRequest_)
 	{
 		this->getMoreIDs();
@@ -261,17 +298,82 @@ void IDClient::getMoreIDs( Mercury::ReplyMessageHandler * pHandler )
 	}
 
 	MF_ASSERT( !pendingRequest_ );
-	if ((pChannel_ != NULL) && (readyIDs_.size() < desiredSize_))
+	size_t desiredMark = this->desiredMark();
+
+	if ((pChannel_ != NULL) && (readyIDs_.size() < desiredMark))
 	{
 		Mercury::Bundle & bundle = pChannel_->bundle();
 
 		bundle.startRequest( *pGetMoreMethod_, pHandler, NULL, 5000000 );
 
-		int numIDs = desiredSize_ - readyIDs_.size();
+		int numIDs = desiredMark - readyIDs_.size();
 		bundle << numIDs;
 		pChannel_->send();
 		pendingRequest_ = true;
+		requestTime_ = timestamp();
+		++numRequests_;
+	}
+}
+
+
+/**
+ *	This method updates the rate that ids are being used. The rate rises as
+ *	soon as a busier period is measured, so that a burst of entity creation is
+ *	caught early, but falls off gradually.
+ */
+void IDClient::updateConsumptionRate( uint64 now )
+{
+	double elapsed = double( now - sampleStartTime_ ) / stampsPerSecondD();
+
+	if (elapsed < CONSUMPTION_SAMPLE_PERIOD)
+	{
+		return;
 	}
+
+	double rate = numUsedInSample_ / elapsed;
+
+	consumptionRate_ = (rate > consumptionRate_) ?
+		rate : 0.5 * (consumptionRate_ + rate);
+
+	sampleStartTime_ = now;
+	numUsedInSample_ = 0;
+}
+
+
+/**
+ *	This method returns the number of ids that are expected to be used while
+ *	a request for more is outstanding. The ids used so far in the current
+ *	sample are included, since a burst may well be repeated.
+ */
+size_t IDClient::predictedUse() const
+{
+	double expected = consumptionRate_ * requestLatency_ *
+		PREDICTION_SAFETY_FACTOR;
+
+	return std::max( size_t( expected ), size_t( numUsedInSample_ ) );
+}
+
+
+/**
+ *	This method returns the number of ready ids below which more are
+ *	requested. This is raised above lowSize_ when ids are being used quickly
+ *	enough that they would otherwise run out before the request is answered.
+ */
+size_t IDClient::lowMark() const
+{
+	return std::max( lowSize_,
+			std::min( this->predictedUse(), highSize_ / 2 ) );
+}
+
+
+/**
+ *	This method returns the number of ready ids that a request tries to bring
+ *	this client up to.
+ */
+size_t IDClient::desiredMark() const
+{
+	return std::max( desiredSize_,
+			std::min( this->lowMark() + this->predictedUse(), highSize_ ) );
 }
 
 
@@ -289,8 +391,12 @@ void IDClient::handleMessage( const Mercury::Address& source,
 	size_t oldSize = readyIDs_.size();
 	this->retrieveIDsFromStream( readyIDs_, data );
 	INFO_MSG( "IDClient::handleMessage: "
-				"Number of ids increased from %d to %d\n",
-			oldSize, readyIDs_.size() );
+				"Number of ids increased from %d to %d in %d ranges\n",
+			oldSize, readyIDs_.size(), readyIDs_.numRanges() );
+
+	double latency = double( timestamp() - requestTime_ ) / stampsPerSecondD();
+	requestLatency_ = (requestLatency_ == 0.0) ?
+		latency : 0.8 * requestLatency_ + 0.2 * latency;
 
 	pendingRequest_ = false;
 	inEmergency_ = false;
@@ -312,6 +418,54 @@ void IDClient::handleException( const Mercury::NubException& exception,
 }
 
 
+/**
+ *	This static method returns the watcher for this class.
+ */
+WatcherPtr IDClient::pWatcher()
+{
+	static DirectoryWatcherPtr watchMe = NULL;
+
+#if ENABLE_WATCHERS
+	if (watchMe == NULL)
+	{
+		watchMe = new DirectoryWatcher();
+
+		IDClient * pNull = NULL;
+
+		watchMe->addChild( "readyIDs",
+			makeWatcher( *pNull, &IDClient::numReadyIDs ) );
+		watchMe->addChild( "readyRanges",
+			makeWatcher( *pNull, &IDClient::numReadyRanges ) );
+		watchMe->addChild( "minReadyIDs", makeWatcher( pNull->minReadyIDs_ ) );
+
+		watchMe->addChild( "lowSize", makeWatcher( pNull->lowSize_ ) );
+		watchMe->addChild( "desiredSize", makeWatcher( pNull->desiredSize_ ) );
+		watchMe->addChild( "highSize", makeWatcher( pNull->highSize_ ) );
+		watchMe->addChild( "lowMark",
+			makeWatcher( *pNull, &IDClient::lowMark ) );
+		watchMe->addChild( "desiredMark",
+			makeWatcher( *pNull, &IDClient::desiredMark ) );
+
+		// In ids per second
+		watchMe->addChild( "consumptionRate",
+			makeWatcher( pNull->consumptionRate_ ) );
+		// In seconds
+		watchMe->addChild( "requestLatency",
+			makeWatcher( pNull->requestLatency_ ) );
+
+		watchMe->addChild( "numIDsUsed", makeWatcher( pNull->numIDsUsed_ ) );
+		watchMe->addChild( "numRequests", makeWatcher( pNull->numRequests_ ) );
+		watchMe->addChild( "numEmergencies",
+			makeWatcher( pNull->numEmergencies_ ) );
+		watchMe->addChild( "numExhausted",
+			makeWatcher( pNull->numExhausted_ ) );
+	}
+#endif
+
+	return watchMe;
+}
+
+
 /**
  *	This method adds ids from the input queue to the input stream.
  *
@@ -12,9 +12,13 @@ criminal penalties as provided by law.
 #ifndef ID_CLIENT_HPP
 #define ID_CLIENT_HPP
 
+#include <deque>
 #include <queue>
 #include "network/nub.hpp"
 
+class Watcher;
+typedef SmartPointer< Watcher > WatcherPtr;
+
 // #define MF_ID_RECYCLING
 
 /**
@@ -44,8 +48,68 @@ public:
 	// we're done.. return all ID's to the upstream pool
 	void returnIDs();
 
+	static WatcherPtr pWatcher();
+
 protected:
-	typedef std::queue<ObjectID> IDQueue;
+	/**
+	 *	This class is a queue of IDs that stores each run of consecutive IDs
+	 *	as a single range. The parent hands out IDs in blocks, so thousands of
+	 *	ready IDs usually take only a handful of ranges.
+	 */
+	class IDQueue
+	{
+	public:
+		IDQueue() : size_( 0 ) {}
+
+		bool empty() const			{ return size_ == 0; }
+		size_t size() const			{ return size_; }
+		size_t numRanges() const	{ return ranges_.size(); }
+
+		ObjectID front() const		{ return ranges_.front().first; }
+
+		/// This method adds an id to the back of the queue.
+		void push( ObjectID id )
+		{
+			if (!ranges_.empty() && (ranges_.back().last + 1 == id))
+			{
+				++ranges_.back().last;
+			}
+			else
+			{
+				Range range = { id, id };
+				ranges_.push_back( range );
+			}
+
+			++size_;
+		}
+
+		/// This method removes the id at the front of the queue.
+		void pop()
+		{
+			Range & range = ranges_.front();
+
+			if (range.first == range.last)
+			{
+				ranges_.pop_front();
+			}
+			else
+			{
+				++range.first;
+			}
+
+			--size_;
+		}
+
+	private:
+		struct Range
+		{
+			ObjectID	first;
+			ObjectID	last;
+		};
+
+		std::deque< Range >	ranges_;
+		size_t				size_;
+	};
 
 	// this function places n ID's from a stack onto a binary stream
 	static void placeIDsOntoStream( size_t n, IDQueue&, BinaryOStream& );
@@ -101,6 +165,30 @@ private:
 	// save runaway high/low sizes
 	bool inEmergency_;
 
+	// These are used to request more ids before they are needed, based on
+	// how quickly they are being used and how long a request takes.
+	void updateConsumptionRate( uint64 now );
+	size_t predictedUse() const;
+	size_t lowMark() const;
+	size_t desiredMark() const;
+
+	uint64 sampleStartTime_;
+	uint32 numUsedInSample_;
+	double consumptionRate_;
+
+	uint64 requestTime_;
+	double requestLatency_;
+
+	// statistics
+	size_t numReadyIDs() const		{ return readyIDs_.size(); }
+	size_t numReadyRanges() const	{ return readyIDs_.numRanges(); }
+
+	uint32 numIDsUsed_;
+	uint32 numRequests_;
+	uint32 numEmergencies_;
+	uint32 numExhausted_;
+	uint32 minReadyIDs_;
+
 	void getMoreIDs();
 	bool getMoreIDsBlocking();
 	void getMoreIDs( Mercury::ReplyMessageHandler * pHandler );
@@ -11,11 +11,122 @@ criminal penalties as provided by law.
 
 #include "time_keeper.hpp"
 #include "cstdmf/debug.hpp"
+#include "cstdmf/watcher.hpp"
 #include "network/bundle.hpp"
 
+#include <math.h>
+
 DECLARE_DEBUG_COMPONENT( 0 )
 
 
+namespace
+{
+
+/// The upper bounds of the tick lateness buckets, in milliseconds. The last
+/// bucket holds the rest.
+const double LATENESS_BUCKET_BOUNDS[] = { 1, 2, 5, 10, 20, 50, 100, 200 };
+
+const char * LATENESS_BUCKET_NAMES[] =
+{
+	"0-1ms", "1-2ms", "2-5ms", "5-10ms", "10-20ms", "20-50ms",
+	"50-100ms", "100-200ms", "200ms+"
+};
+
+/// Readings whose round trip is longer than this many times the shortest
+/// recent round trip, plus MAX_ROUND_TRIP_SLACK seconds, are not used. The
+/// delay there and back is then likely to be lopsided.
+const double MAX_ROUND_TRIP_FACTOR = 2.0;
+const double MAX_ROUND_TRIP_SLACK = 0.002;
+
+/// The most readings in a row that are not used. After this many, the
+/// network is assumed to have become slower.
+const int MAX_REJECTED_IN_A_ROW = 3;
+
+/// If a reading is out from the prediction by this many seconds, the master
+/// is assumed to have restarted, and the estimates are started again.
+const double MAX_RESIDUAL = 1.0;
+
+} // anonymous namespace
+
+
+// -----------------------------------------------------------------------------
+// Section: ClockDriftFilter
+// -----------------------------------------------------------------------------
+
+/**
+ *	Constructor.
+ *
+ *	@param alpha	The fraction of the error that corrects the offset.
+ *	@param beta		The fraction of the error that corrects the drift.
+ */
+ClockDriftFilter::ClockDriftFilter( double alpha, double beta ) :
+	alpha_( alpha ),
+	beta_( beta ),
+	hasEstimate_( false ),
+	offset_( 0.0 ),
+	drift_( 0.0 ),
+	residual_( 0.0 )
+{
+}
+
+
+/**
+ *	This method discards the estimates.
+ */
+void ClockDriftFilter::reset()
+{
+	hasEstimate_ = false;
+	offset_ = 0.0;
+	drift_ = 0.0;
+	residual_ = 0.0;
+}
+
+
+/**
+ *	This method returns the offset predicted after the given time.
+ *
+ *	@param elapsed	The time since the last reading.
+ *	@param ownRate	How much faster than our clock we have been keeping time
+ *					since the last reading.
+ */
+double ClockDriftFilter::predict( double elapsed, double ownRate ) const
+{
+	return offset_ + (drift_ - ownRate) * elapsed;
+}
+
+
+/**
+ *	This method corrects the estimates with a new reading.
+ *
+ *	@param measuredOffset	The offset of the master from us.
+ *	@param elapsed			The time since the last reading.
+ *	@param ownRate			How much faster than our clock we have been
+ *							keeping time since the last reading.
+ */
+void ClockDriftFilter::update( double measuredOffset, double elapsed,
+		double ownRate )
+{
+	if (!hasEstimate_)
+	{
+		hasEstimate_ = true;
+		offset_ = measuredOffset;
+		drift_ = 0.0;
+		residual_ = 0.0;
+		return;
+	}
+
+	double predictedOffset = this->predict( elapsed, ownRate );
+
+	residual_ = measuredOffset - predictedOffset;
+	offset_ = predictedOffset + alpha_ * residual_;
+
+	if (elapsed > 0.0)
+	{
+		drift_ += beta_ * residual_ / elapsed;
+	}
+}
+
+
 // -----------------------------------------------------------------------------
 // Section: TimeKeeper
 // -----------------------------------------------------------------------------
@@ -36,8 +147,27 @@ TimeKeeper::TimeKeeper( Mercury::Nub & nub, int trackingTimerID,
 	syncCheckTimerID_( 0 ),
 	masterAddress_( masterAddress ),
 	masterRequest_( masterRequest ),
-	lastSyncRequestStamps_( 0 )
+	lastSyncRequestStamps_( 0 ),
+	filter_(),
+	lastReadingStamps_( 0 ),
+	correctionPeriod_( 2.0 ),
+	maxAdjustment_( 0.05 ),
+	roundTripTime_( 0.0 ),
+	minRoundTripTime_( 0.0 ),
+	numRejectedInARow_( 0 ),
+	numReadings_( 0 ),
+	numRejectedReadings_( 0 ),
+	numTicks_( 0 ),
+	numMissedTicks_( 0 ),
+	averageLateness_( 0.0 ),
+	maxLateness_( 0.0 ),
+	recentMaxLateness_( 0.0 ),
+	lastRecentMaxLateness_( 0.0 )
 {
+	for (int i = 0; i < NUM_LATENESS_BUCKETS; ++i)
+	{
+		latenessBuckets_[i] = 0;
+	}
 }
 
 /**
@@ -61,94 +191,123 @@ bool TimeKeeper::inputMasterReading( double reading )
 	double roundTripTime = double( roundTripStamps ) / stampsPerSecondD();
 	double readingNowValue = readingNow();
 
+	lastSyncRequestStamps_ = 0;
+
+	if (!this->isReadingUsable( roundTripTime ))
+	{
+		return false;
+	}
+
 	// assume that half the round trip time ago, the master read from its
 	// reading, and take the offset from that
 	double offset = (reading + roundTripTime / 2) - readingNowValue;
-	int64 offsetStamps = int64( offset * stampsPerSecond() );
 
-	uint64 & intervalStamps = nub_.timerIntervalTime( trackingTimerID_ );
-	uint64 increment = nominalIntervalStamps_ / 20;
-/*
-	TRACE_MSG( "TimeKeeper::inputMasterReading: \n"
-			"reading = %.9f readingNowValue = %.9f\n "
-			"offset = %.6fus, rtt=%.3fus\n",
-		reading, readingNowValue,
-		1000000 * offsetStamps / stampsPerSecondD(),
-		1000000 * roundTripStamps / stampsPerSecondD() );
-*/
+	double elapsed = (lastReadingStamps_ != 0) ?
+		double( now - lastReadingStamps_ ) / stampsPerSecondD() : 0.0;
+	double ownRate = this->intervalAdjustment();
 
-	lastSyncRequestStamps_ = 0;
+	if (filter_.hasEstimate() &&
+		fabs( offset - filter_.predict( elapsed, ownRate ) ) > MAX_RESIDUAL)
+	{
+		WARNING_MSG( "TimeKeeper::inputMasterReading: "
+				"Reading is out by %.3fs. Restarting the drift estimate\n",
+			offset - filter_.predict( elapsed, ownRate ) );
+		filter_.reset();
+	}
+
+	filter_.update( offset, elapsed, ownRate );
+	lastReadingStamps_ = now;
+	++numReadings_;
+
+	this->adjustInterval();
+
+	// While we are out by more than the tolerance, check again after the
+	// next tick, rather than waiting for the next regular sync.
+	double tolerance = double( nominalIntervalStamps_ / 20 ) /
+		stampsPerSecondD() + roundTripTime / 2;
 
-	int64 threshold = int64( nominalIntervalStamps_ / 20 +
-		roundTripStamps / 2 );
-	if (offsetStamps >  threshold )
+	if (fabs( filter_.offset() ) > tolerance)
 	{
-		// we are slow
-		if (intervalStamps == nominalIntervalStamps_)
-		{
-			DEBUG_MSG( "TimeKeeper::inputMasterReading: "
-				"shortening tick interval because we are slow "
-				"by %.0fms\n",
-				1000 * offsetStamps / stampsPerSecondD()
-			);
-			intervalStamps = nominalIntervalStamps_ - increment;
-			this->scheduleSyncCheck();
-		}
-		else if (intervalStamps > nominalIntervalStamps_)
-		{
-			// we are now slow, and our interval was longer than normal
-			DEBUG_MSG( "TimeKeeper:: we have slowed down enough, "
-				"reverting to nominal tick interval\n" );
-			intervalStamps = nominalIntervalStamps_;
-		}
-		else // if (intervalStamps < nominalIntervalStamps_)
-		{
-			// we are still slow, and our interval was shorter than normal
-			// so we keep at it, and check after the next tick
-			this->scheduleSyncCheck();
-		}
+		this->scheduleSyncCheck();
 	}
-	else if (offsetStamps < -threshold)
+
+	return true;
+}
+
+
+/**
+ *	This method returns whether a reading with the given round trip time
+ *	should be used. The master's reading is assumed to have been taken half
+ *	way through the round trip, so the longer the round trip, the more the
+ *	reading can be out.
+ */
+bool TimeKeeper::isReadingUsable( double roundTripTime )
+{
+	if (minRoundTripTime_ <= 0.0 || roundTripTime < minRoundTripTime_)
 	{
-		// we are fast
-		if (intervalStamps == nominalIntervalStamps_)
-		{
-			DEBUG_MSG( "TimeKeeper::inputMasterReading: "
-				"lengthening tick interval because we are fast "
-				"by %.0fms\n",
-				-1000 * offsetStamps / stampsPerSecondD()
-			);
-			intervalStamps = nominalIntervalStamps_ + increment;
-			this->scheduleSyncCheck();
-		}
-		else if (intervalStamps < nominalIntervalStamps_)
-		{
-			// we are now fast, and our interval was shorter than normal
-			DEBUG_MSG( "TimeKeeper:: we sped up enough, "
-					"reverting back to nominal tick interval\n" );
-			intervalStamps = nominalIntervalStamps_;
-		}
-		else // if (intervalStamps > nominalIntervalStamps_)
-		{
-			// we are still fast, and our interval was longer than normal
-			// so we keep at it, and check after the next tick
-			this->scheduleSyncCheck();
-		}
+		minRoundTripTime_ = roundTripTime;
 	}
 	else
 	{
-		// we are within tolerance
-		if (intervalStamps != nominalIntervalStamps_)
-		{
-			DEBUG_MSG( "TimeKeeper::inputMasterReading: "
-				"reverting back to nominal tick interval\n" );
-			intervalStamps = nominalIntervalStamps_;
-		}
+		// Let the shortest round trip creep up, in case the network has
+		// become slower.
+		minRoundTripTime_ += 0.01 * (roundTripTime - minRoundTripTime_);
+	}
+
+	if (filter_.hasEstimate() &&
+		roundTripTime > MAX_ROUND_TRIP_FACTOR * minRoundTripTime_ +
+			MAX_ROUND_TRIP_SLACK &&
+		numRejectedInARow_ < MAX_REJECTED_IN_A_ROW)
+	{
+		++numRejectedInARow_;
+		++numRejectedReadings_;
+		return false;
 	}
 
+	numRejectedInARow_ = 0;
+	roundTripTime_ = roundTripTime;
+
 	return true;
 }
 
+
+/**
+ *	This method sets the interval of the tracking timer so that the estimated
+ *	drift is cancelled, and the estimated offset is removed over the
+ *	correction period.
+ */
+void TimeKeeper::adjustInterval()
+{
+	double ownRate = filter_.drift() + filter_.offset() / correctionPeriod_;
+
+	if (ownRate > maxAdjustment_)
+	{
+		ownRate = maxAdjustment_;
+	}
+	else if (ownRate < -maxAdjustment_)
+	{
+		ownRate = -maxAdjustment_;
+	}
+
+	uint64 & intervalStamps = nub_.timerIntervalTime( trackingTimerID_ );
+	intervalStamps = uint64( double( nominalIntervalStamps_ ) / (1.0 + ownRate) );
+}
+
+
+/**
+ *	This method returns how much faster than our clock we are keeping time,
+ *	because of the adjustment of the tracking timer's interval. It is positive
+ *	when ticks are shorter than nominal.
+ */
+double TimeKeeper::intervalAdjustment() const
+{
+	double intervalStamps =
+		double( nub_.timerIntervalTime( trackingTimerID_ ) );
+
+	return double( nominalIntervalStamps_ ) / intervalStamps - 1.0;
+}
+
+
 /**
  *	Schedules a synchronization check; a timer is set which calls
  *	synchronizeWithMaster().
@@ -203,6 +362,109 @@ double TimeKeeper::readingAtNextTick() const
 }
 
 
+/**
+ *	This method should be called at the start of each tick, from the handler
+ *	of the tracking timer. It records how late the tick is.
+ */
+void TimeKeeper::onTick()
+{
+	// The tracking timer is executing, so its delivery time is that of the
+	// next tick.
+	uint64 intervalStamps = nub_.timerIntervalTime( trackingTimerID_ );
+	uint64 scheduledStamps =
+		nub_.timerDeliveryTime( trackingTimerID_ ) - intervalStamps;
+
+	double lateness = std::max( 0.0,
+		double( int64( timestamp() - scheduledStamps ) ) / stampsPerSecondD() );
+
+	int bucket = 0;
+
+	while (bucket < NUM_LATENESS_BUCKETS - 1 &&
+			lateness * 1000.0 >= LATENESS_BUCKET_BOUNDS[ bucket ])
+	{
+		++bucket;
+	}
+
+	++latenessBuckets_[ bucket ];
+
+	if (lateness * stampsPerSecondD() >= double( intervalStamps ))
+	{
+		++numMissedTicks_;
+	}
+
+	averageLateness_ += 0.01 * (lateness - averageLateness_);
+	maxLateness_ = std::max( maxLateness_, lateness );
+	recentMaxLateness_ = std::max( recentMaxLateness_, lateness );
+
+	// Keep the maximum over the last second of ticks.
+	if (++numTicks_ % uint32( idealTickFrequency_ ) == 0)
+	{
+		lastRecentMaxLateness_ = recentMaxLateness_;
+		recentMaxLateness_ = 0.0;
+	}
+}
+
+
+/**
+ *	This static method returns the watchers for the drift estimates and the
+ *	tick lateness histogram. Times are in seconds.
+ */
+WatcherPtr TimeKeeper::pWatcher()
+{
+	static DirectoryWatcherPtr watchMe = NULL;
+
+#if ENABLE_WATCHERS
+	if (watchMe == NULL)
+	{
+		watchMe = new DirectoryWatcher();
+
+		TimeKeeper * pNull = NULL;
+
+		watchMe->addChild( "offset",
+			makeWatcher( *pNull, &TimeKeeper::estimatedOffset ) );
+		watchMe->addChild( "drift",
+			makeWatcher( *pNull, &TimeKeeper::estimatedDrift ) );
+		watchMe->addChild( "residual",
+			makeWatcher( *pNull, &TimeKeeper::lastResidual ) );
+		watchMe->addChild( "intervalAdjustment",
+			makeWatcher( *pNull, &TimeKeeper::intervalAdjustment ) );
+		watchMe->addChild( "roundTripTime",
+			makeWatcher( pNull->roundTripTime_ ) );
+		watchMe->addChild( "numReadings",
+			makeWatcher( pNull->numReadings_ ) );
+		watchMe->addChild( "numRejectedReadings",
+			makeWatcher( pNull->numRejectedReadings_ ) );
+
+		watchMe->addChild( "config/correctionPeriod",
+			makeWatcher( pNull->correctionPeriod_, Watcher::WT_READ_WRITE ) );
+		watchMe->addChild( "config/maxAdjustment",
+			makeWatcher( pNull->maxAdjustment_, Watcher::WT_READ_WRITE ) );
+
+		watchMe->addChild( "tickLateness/numTicks",
+			makeWatcher( pNull->numTicks_ ) );
+		watchMe->addChild( "tickLateness/numMissedTicks",
+			makeWatcher( pNull->numMissedTicks_ ) );
+		watchMe->addChild( "tickLateness/average",
+			makeWatcher( pNull->averageLateness_ ) );
+		watchMe->addChild( "tickLateness/max",
+			makeWatcher( pNull->maxLateness_ ) );
+		watchMe->addChild( "tickLateness/maxLastSecond",
+			makeWatcher( pNull->lastRecentMaxLateness_ ) );
+
+		for (int i = 0; i < NUM_LATENESS_BUCKETS; ++i)
+		{
+			std::string path = std::string( "tickLateness/histogram/" ) +
+				LATENESS_BUCKET_NAMES[i];
+			watchMe->addChild( path.c_str(),
+				makeWatcher( pNull->latenessBuckets_[i] ) );
+		}
+	}
+#endif
+
+	return watchMe;
+}
+
+
 /**
  *	This method synchronises the time maintained by this time keeper
  *	with that maintained by the given peer. A reply is not expected.
@@ -14,10 +14,62 @@ criminal penalties as provided by law.
 
 #include "network/interfaces.hpp"
 #include "network/nub.hpp"
+#include "cstdmf/smartpointer.hpp"
+
+class Watcher;
+typedef SmartPointer< Watcher > WatcherPtr;
+
+/**
+ *	This class estimates the offset of a master clock from ours, and the rate
+ *	at which it drifts from ours, from a series of noisy offset readings.
+ *
+ *	It is an alpha-beta filter, which is the steady-state form of a Kalman
+ *	filter for a clock that drifts at a constant rate. Each reading corrects
+ *	the predicted offset by alpha times the error, and the drift by beta times
+ *	the error over the time since the last reading.
+ *
+ *	Offsets and times are in seconds, and rates are in seconds per second.
+ */
+class ClockDriftFilter
+{
+public:
+	ClockDriftFilter( double alpha = 0.5, double beta = 0.1 );
+
+	void reset();
+
+	void update( double measuredOffset, double elapsed, double ownRate );
+	double predict( double elapsed, double ownRate ) const;
+
+	bool hasEstimate() const	{ return hasEstimate_; }
+	double offset() const		{ return offset_; }
+	double drift() const		{ return drift_; }
+	double residual() const		{ return residual_; }
+
+private:
+	double	alpha_;
+	double	beta_;
+
+	bool	hasEstimate_;
+	double	offset_;
+	double	drift_;
+	double	residual_;
+};
+
 
 /**
  *	This class keeps track of tick times and makes sure they are synchronised
  *	with clocks running in other other places around the system.
+ *
+ *	The offset from the master and the drift from it are estimated by a
+ *	ClockDriftFilter. After each reading, the interval of the tracking timer
+ *	is set so that the drift is cancelled and the offset is removed over
+ *	correctionPeriod seconds. The interval is never changed by more than
+ *	maxAdjustment of the nominal interval, so ticks are corrected smoothly
+ *	rather than in steps.
+ *
+ *	If the owner calls onTick at the start of each tick, the lateness of each
+ *	tick is kept in a histogram. The pWatcher method returns watchers for the
+ *	histogram and the estimates.
  */
 class TimeKeeper : public Mercury::TimerExpiryHandler,
 	public Mercury::ReplyMessageHandler
@@ -39,11 +91,24 @@ public:
 			const Mercury::InterfaceElement & request );
 	void synchroniseWithMaster();
 
+	void onTick();
+
+	static WatcherPtr pWatcher();
+
 private:
 	int64 offsetOfReading( double reading, uint64 stampsAtReceiptExt );
 
 	void scheduleSyncCheck();
 
+	bool isReadingUsable( double roundTripTime );
+	void adjustInterval();
+
+	double intervalAdjustment() const;
+
+	double estimatedOffset() const		{ return filter_.offset(); }
+	double estimatedDrift() const		{ return filter_.drift(); }
+	double lastResidual() const			{ return filter_.residual(); }
+
 	virtual int handleTimeout( int id, void * arg );
 
 	virtual void handleMessage( const Mercury::Address & source,
@@ -64,6 +129,29 @@ private:
 	const Mercury::InterfaceElement	* masterRequest_;
 
 	uint64 lastSyncRequestStamps_;
+
+	// Drift compensation
+	ClockDriftFilter	filter_;
+	uint64				lastReadingStamps_;
+	double				correctionPeriod_;
+	double				maxAdjustment_;
+
+	double				roundTripTime_;
+	double				minRoundTripTime_;
+	int					numRejectedInARow_;
+	uint32				numReadings_;
+	uint32				numRejectedReadings_;
+
+	// Tick lateness, in seconds
+	static const int NUM_LATENESS_BUCKETS = 9;
+
+	uint32				latenessBuckets_[ NUM_LATENESS_BUCKETS ];
+	uint32				numTicks_;
+	uint32				numMissedTicks_;
+	double				averageLateness_;
+	double				maxLateness_;
+	double				recentMaxLateness_;
+	double				lastRecentMaxLateness_;
 };
 
 
@@ -19,7 +19,12 @@ enum WriteDBFlags
 	WRITE_BASE_DATA			= 4,
 	WRITE_CELL_DATA			= 8,
 	WRITE_ALL_DATA			= WRITE_BASE_DATA|WRITE_CELL_DATA,
-	WRITE_DELETE_FROM_DB	= 16
+	WRITE_DELETE_FROM_DB	= 16,
+	// The data only holds the properties that changed since the last write,
+	// as written by EntityDescription::addDirtyAttributesToStream. It is
+	// rejected for new entities, and by databases that cannot apply it, in
+	// which case the caller should write all of the data instead.
+	WRITE_DELTA_DATA		= 32
 };
 
 #endif // SERVER_WRITEDB_HPP
@@ -115,7 +115,7 @@ ChunkItemFactory::Result ChunkNavPolySet::navmeshFactory( Chunk * pChunk, DataSe
 				if ((*iter)->incRefTry())
 				{
 					ChunkNavPolySet * pSet = new ChunkNavPolySet();
-					pSet->data_ = *iter;
+					pSet->data( *iter );
 					(*iter)->decRef();
 					sets.push_back( pSet );
 				}
@@ -219,10 +219,11 @@ ChunkItemFactory::Result ChunkNavPolySet::navmeshFactory( Chunk * pChunk, DataSe
 		dataPtr = edgePtr;
 
 		cwsd->source_ = fullName;
+		cwsd->countMemory();
 		newRecord.push_back( &*cwsd );
 
 		ChunkNavPolySet * pSet = new ChunkNavPolySet();
-		pSet->data_ = cwsd;
+		pSet->data( cwsd );
 		pChunk->addStaticItem( pSet );
 	}
 
@@ -13,11 +13,27 @@ criminal penalties as provided by law.
 
 #include "chunk_waypoint_set.hpp"
 #include "chunk/chunk_space.hpp"
+#include "chunk/shared_geometry_counter.hpp"
 
 #include "waypoint/waypoint.hpp"
+#include "waypoint/chunk_wpset_graph.hpp"
 
 DECLARE_DEBUG_COMPONENT2( "Waypoint", 0 )
 
+static SharedGeometryCounter s_waypointGeometry( "waypoints" );
+
+namespace
+{
+
+/// The waypoint set data loaded from chunk XML, by the key made in
+/// ChunkWaypointSet::load. Like the navmesh population, this lets the chunks
+/// of all the spaces that map the same geometry share the same data.
+typedef std::map< std::string, ChunkWaypointSetData * > XMLPopulation;
+XMLPopulation s_xmlPopulation;
+SimpleMutex s_xmlPopulationLock;
+
+} // anonymous namespace
+
 // -----------------------------------------------------------------------------
 // Section: ChunkWaypoint
 // -----------------------------------------------------------------------------
@@ -224,7 +240,8 @@ extern void NavmeshPopulation_remove( const std::string & source );
 ChunkWaypointSetData::ChunkWaypointSetData() :
 	girth_( 0.f ),
 	source_(),
-	edges_( NULL )
+	edges_( NULL ),
+	memoryUsed_( 0 )
 {
 }
 
@@ -238,7 +255,45 @@ ChunkWaypointSetData::~ChunkWaypointSetData()
 		NavmeshPopulation_remove( source_ );
 	}
 
+	if (!xmlKey_.empty())
+	{
+		SimpleMutexHolder smh( s_xmlPopulationLock );
+
+		// Another copy may have been loaded after our last reference went.
+		XMLPopulation::iterator found = s_xmlPopulation.find( xmlKey_ );
+		if (found != s_xmlPopulation.end() && found->second == this)
+		{
+			s_xmlPopulation.erase( found );
+		}
+	}
+
 	if (edges_) delete [] edges_;
+
+	if (memoryUsed_ != 0)
+	{
+		s_waypointGeometry.delCopy( memoryUsed_ );
+	}
+}
+
+
+/**
+ *	This method records the memory used by this data once it has been loaded.
+ *	The data may then be shared by the waypoint sets of several chunks.
+ */
+void ChunkWaypointSetData::countMemory()
+{
+	MF_ASSERT( memoryUsed_ == 0 );
+
+	memoryUsed_ = sizeof( *this ) +
+		waypoints_.capacity() * sizeof( ChunkWaypoint );
+
+	for (ChunkWaypoints::const_iterator it = waypoints_.begin();
+			it != waypoints_.end(); ++it)
+	{
+		memoryUsed_ += it->edges_.size() * sizeof( ChunkWaypoint::Edge );
+	}
+
+	s_waypointGeometry.addCopy( memoryUsed_ );
 }
 
 
@@ -498,6 +553,27 @@ ChunkWaypointSet::ChunkWaypointSet():
  */
 ChunkWaypointSet::~ChunkWaypointSet()
 {
+	this->data( NULL );
+}
+
+
+/**
+ *	This method sets the waypoint data used by this set, which may be shared
+ *	with other sets.
+ */
+void ChunkWaypointSet::data( ChunkWaypointSetDataPtr pData )
+{
+	if (data_)
+	{
+		s_waypointGeometry.delUser( data_->memoryUsed() );
+	}
+
+	data_ = pData;
+
+	if (data_)
+	{
+		s_waypointGeometry.addUser( data_->memoryUsed() );
+	}
 }
 
 
@@ -511,12 +587,55 @@ ChunkWaypointSet::~ChunkWaypointSet()
  *   load navPoly sections.
  * @param inWorldCoords indicates whether or not the coordinates are in world
  *	coordinates.
+ *
+ * The loaded data is shared with the same set of the same chunk in every
+ * other space that maps the same geometry. Data in world coordinates is
+ * converted to chunk coordinates, so it is only shared between chunks with
+ * the same transform.
  */
 bool ChunkWaypointSet::load( Chunk * pChunk, DataSectionPtr pSection,
 	const char * sectionName, bool inWorldCoords )
 {
 	std::string sectionNameStr = sectionName;
 
+	// The sets of a chunk are told apart by their ids. Sets without one are
+	// not shared.
+	std::string key;
+	std::string setID = pSection->asString();
+
+	if (!setID.empty())
+	{
+		key = pChunk->mapping()->path() + pChunk->identifier() + "/" +
+			sectionNameStr + "/" + setID;
+
+		if (inWorldCoords)
+		{
+			key.append( reinterpret_cast< const char * >(
+				&pChunk->transform() ), sizeof( Matrix ) );
+		}
+
+		ChunkWaypointSetDataPtr pShared;
+
+		{ // s_xmlPopulationLock
+			SimpleMutexHolder smh( s_xmlPopulationLock );
+
+			XMLPopulation::iterator found = s_xmlPopulation.find( key );
+
+			// Only use it if it is not already being destroyed.
+			if (found != s_xmlPopulation.end() && found->second->incRefTry())
+			{
+				pShared = found->second;
+				found->second->decRef();
+			}
+		} // !s_xmlPopulationLock
+
+		if (pShared)
+		{
+			this->data( pShared );
+			return true;
+		}
+	}
+
 	ChunkWaypointSetDataPtr cwsd = new ChunkWaypointSetData();
 	bool ok = cwsd->loadFromXML( pSection, sectionNameStr );
 	if (!ok) return false;
@@ -524,7 +643,19 @@ bool ChunkWaypointSet::load( Chunk * pChunk, DataSectionPtr pSection,
 	if (inWorldCoords)
 		cwsd->transform( pChunk->transformInverse() );
 
-	data_ = cwsd;
+	cwsd->countMemory();
+
+	if (!key.empty())
+	{
+		SimpleMutexHolder smh( s_xmlPopulationLock );
+
+		// Another thread may have loaded the same set meanwhile, in which
+		// case ours replaces it for later loads.
+		cwsd->xmlKey_ = key;
+		s_xmlPopulation[ key ] = &*cwsd;
+	}
+
+	this->data( cwsd );
 	return true;
 }
 
@@ -598,6 +729,7 @@ void ChunkWaypointSet::deleteConnection( ChunkWaypointSetPtr pSet )
 	// connections_.erase( connections_.begin() + conNum );
 	connections_.erase( pSet );
 
+	ChunkWPSetGraph::onSetChanged( this );
 }
 
 
@@ -706,6 +838,23 @@ void ChunkWaypointSet::connect(
 
 	}
 	edgeLabels_[edgeIndex] = pWaypointSet;
+
+	ChunkWPSetGraph::onSetChanged( this );
+}
+
+
+/**
+ *	Get the waypoint set that the given edge has been connected to, without
+ *	adding a label for it if there is none.
+ *
+ *	@return The connected set, or NULL if the edge is not connected.
+ */
+ChunkWaypointSet * ChunkWaypointSet::edgeLabel(
+	const ChunkWaypoint::Edge & edge ) const
+{
+	ChunkWaypointEdgeLabels::const_iterator found =
+		edgeLabels_.find( data_->getAbsoluteEdgeIndex( edge ) );
+	return (found != edgeLabels_.end()) ? found->second.getObject() : NULL;
 }
 
 /**
@@ -727,6 +876,7 @@ void ChunkWaypointSet::toss( Chunk * pChunk )
 		this->removeOurConnections();
 
 		ChunkNavigator::instance( *pChunk_ ).del( this );
+		ChunkWPSetGraph::onSetRemoved( this );
 	}
 
 	this->ChunkItem::toss( pChunk );
@@ -745,6 +895,7 @@ void ChunkWaypointSet::toss( Chunk * pChunk )
 		// now that we are in local co-ords we can add ourselves to the
 		// cache maintained by ChunkNavigator
 		ChunkNavigator::instance( *pChunk_ ).add( this );
+		ChunkWPSetGraph::onSetAdded( this );
 	}
 }
 
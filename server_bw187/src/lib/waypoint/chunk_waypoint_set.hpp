@@ -222,11 +222,16 @@ public:
 
 	int getAbsoluteEdgeIndex( const ChunkWaypoint::Edge & edge ) const;
 
+	void countMemory();
+	uint32 memoryUsed() const				{ return memoryUsed_; }
+
 private:
 	float						girth_;
 	ChunkWaypoints				waypoints_;
 	std::string					source_;
 	ChunkWaypoint::Edge 	* edges_;
+	uint32						memoryUsed_;
+	std::string					xmlKey_;	///< The key it is shared by
 
 	friend class ChunkWaypointSet;
 	friend class ChunkNavPolySet;
@@ -295,6 +300,8 @@ public:
 			const ChunkWaypoint::Edge & edge )
 		{ return edgeLabels_[data_->getAbsoluteEdgeIndex( edge )]; }
 
+	ChunkWaypointSet * edgeLabel( const ChunkWaypoint::Edge & edge ) const;
+
 	void addBacklink( ChunkWaypointSetPtr pWaypointSet );
 	void removeBacklink( ChunkWaypointSetPtr pWaypointSet );
 
@@ -327,6 +334,7 @@ private:
 		ChunkWaypoint::Edge & edge );
 
 protected:
+	void data( ChunkWaypointSetDataPtr pData );
 
 	ChunkWaypointSetDataPtr	data_;
 	ChunkWaypointConns			connections_;
@@ -0,0 +1,1285 @@
+/******************************************************************************
+BigWorld Technology
+Copyright BigWorld Pty, Ltd.
+All Rights Reserved. Commercial in confidence.
+
+WARNING: This computer program is protected by copyright law and international
+treaties. Unauthorized use, reproduction or distribution of this program, or
+any portion of this program, may result in the imposition of civil and
+criminal penalties as provided by law.
+******************************************************************************/
+
+#include "pch.hpp"
+
+#include "chunk_wpset_graph.hpp"
+
+#include "chunk/chunk.hpp"
+#include "chunk/chunk_space.hpp"
+
+#include "cstdmf/concurrency.hpp"
+#include "cstdmf/debug.hpp"
+#include "cstdmf/timestamp.hpp"
+#include "cstdmf/watcher.hpp"
+
+#include <algorithm>
+#include <float.h>
+#include <functional>
+#include <queue>
+
+DECLARE_DEBUG_COMPONENT2( "Waypoint", 0 )
+
+
+// -----------------------------------------------------------------------------
+// Section: Statics
+// -----------------------------------------------------------------------------
+
+bool ChunkWPSetGraph::s_enabled_ = true;
+bool ChunkWPSetGraph::s_verify_ = false;
+float ChunkWPSetGraph::s_settleTime_ = 2.f;
+int ChunkWPSetGraph::s_landmarkCount_ = 8;
+
+uint32 ChunkWPSetGraph::s_queries_ = 0;
+uint32 ChunkWPSetGraph::s_fallbacks_ = 0;
+uint32 ChunkWPSetGraph::s_rebuilds_ = 0;
+uint32 ChunkWPSetGraph::s_tables_ = 0;
+uint32 ChunkWPSetGraph::s_mismatches_ = 0;
+
+ChunkWPSetGraph::Graphs ChunkWPSetGraph::s_graphs_;
+uint32 ChunkWPSetGraph::s_lastVersion_ = 0;
+ChunkWPSetGraph::Jobs ChunkWPSetGraph::s_orphanJobs_;
+
+
+namespace
+{
+	typedef std::pair<float, uint32> OpenEntry;
+	typedef std::priority_queue< OpenEntry, std::vector<OpenEntry>,
+		std::greater<OpenEntry> > OpenQueue;
+
+	/**
+	 *	This function returns the centre of a waypoint in its chunk's local
+	 *	coordinates.
+	 */
+	inline Vector3 waypointCentre( const ChunkWaypoint & wp )
+	{
+		return Vector3( wp.centre_.x, wp.maxHeight_, wp.centre_.y );
+	}
+
+	/**
+	 *	This function returns whether or not the chunk we go to through the
+	 *	given portal has a portal back to the chunk we come from. The set
+	 *	search treats one way portals as impassable, so must we.
+	 */
+	bool hasBackPortal( Chunk * pFromChunk, ChunkBoundary::Portal * pPortal )
+	{
+		Chunk * pToChunk = pPortal->pChunk;
+		if (pToChunk == NULL) return false;
+
+		for (Chunk::piterator it = pToChunk->pbegin();
+			it != pToChunk->pend(); it++)
+		{
+			if (it->pChunk == pFromChunk) return true;
+		}
+
+		return false;
+	}
+
+	/**
+	 *	This structure is a connection between two nodes found while
+	 *	laying out the portals of the graph.
+	 */
+	struct Outgoing
+	{
+		uint32					target;
+		ChunkBoundary::Portal *	pChunkPortal;
+		Vector3					point;
+	};
+
+	/**
+	 *	This structure is a copy of what is needed from a waypoint set to
+	 *	compute its table, so that it can be computed in another thread.
+	 */
+	struct TableInput
+	{
+		uint32					node;
+		std::vector<Vector3>	centres;		///< Of each waypoint
+		std::vector<uint32>		firstNeighbour;	///< Per waypoint, plus one
+		std::vector<int>		neighbours;
+		std::vector<Vector3>	localPoints;	///< Of each portal
+		std::vector< std::vector<int> >	seeds;	///< Waypoints it touches
+	};
+
+	/**
+	 *	This function computes the portal-to-portal distance table of a set
+	 *	by searching its waypoint graph from each portal.
+	 */
+	void buildTable( const TableInput & input, float * table )
+	{
+		const uint32 np = input.localPoints.size();
+		const uint32 nw = input.centres.size();
+		std::vector<float> wpDists;
+
+		for (uint32 i = 0; i < np; ++i)
+		{
+			table[ i*np + i ] = 0.f;
+
+			wpDists.assign( nw, FLT_MAX );
+			OpenQueue open;
+			for (uint s = 0; s < input.seeds[i].size(); ++s)
+			{
+				int w = input.seeds[i][s];
+				float d = (input.centres[w] - input.localPoints[i]).length();
+				if (d < wpDists[w])
+				{
+					wpDists[w] = d;
+					open.push( OpenEntry( d, w ) );
+				}
+			}
+
+			while (!open.empty())
+			{
+				OpenEntry top = open.top();
+				open.pop();
+				if (top.first > wpDists[ top.second ]) continue;
+
+				const Vector3 & centre = input.centres[ top.second ];
+				for (uint32 e = input.firstNeighbour[ top.second ];
+					e < input.firstNeighbour[ top.second + 1 ]; ++e)
+				{
+					int neigh = input.neighbours[e];
+					float d = top.first +
+						(input.centres[ neigh ] - centre).length();
+					if (d < wpDists[ neigh ])
+					{
+						wpDists[ neigh ] = d;
+						open.push( OpenEntry( d, neigh ) );
+					}
+				}
+			}
+
+			for (uint32 j = 0; j < np; ++j)
+			{
+				if (j == i) continue;
+
+				for (uint s = 0; s < input.seeds[j].size(); ++s)
+				{
+					int w = input.seeds[j][s];
+					if (wpDists[w] == FLT_MAX) continue;
+
+					float d = wpDists[w] +
+						(input.centres[w] - input.localPoints[j]).length();
+					table[ i*np + j ] = std::min( table[ i*np + j ], d );
+				}
+			}
+		}
+
+		// The waypoint graph is undirected, but the seeding is not exactly
+		// symmetric. Keep the smaller of the two.
+		for (uint32 i = 0; i < np; ++i)
+		{
+			for (uint32 j = i + 1; j < np; ++j)
+			{
+				float d = std::min( table[ i*np + j ], table[ j*np + i ] );
+				table[ i*np + j ] = d;
+				table[ j*np + i ] = d;
+			}
+		}
+	}
+}
+
+
+// -----------------------------------------------------------------------------
+// Section: ChunkWPSetGraph::Job
+// -----------------------------------------------------------------------------
+
+/**
+ *	This class is work for a graph that is done in a thread of its own. It
+ *	only uses its own data, so the graph may be deleted while it runs. The
+ *	main thread does not look at it again until isDone() says so.
+ */
+class ChunkWPSetGraph::Job
+{
+public:
+	Job() : pThread_( NULL ), isDone_( false ) {}
+
+	/// Deleting the thread joins it.
+	virtual ~Job()		{ delete pThread_; }
+
+	void start()		{ pThread_ = new SimpleThread( &Job::s_run, this ); }
+
+	bool isDone()
+	{
+		SimpleMutexHolder smh( mutex_ );
+		return isDone_;
+	}
+
+	/// This method is called from the main thread once the job is done.
+	virtual void finish( ChunkWPSetGraph & graph ) = 0;
+
+protected:
+	/// This method is called in the job's thread.
+	virtual void run() = 0;
+
+private:
+	static void s_run( void * arg )
+	{
+		Job * pJob = (Job *)arg;
+		pJob->run();
+
+		SimpleMutexHolder smh( pJob->mutex_ );
+		pJob->isDone_ = true;
+	}
+
+	SimpleThread *	pThread_;
+	SimpleMutex		mutex_;
+	bool			isDone_;
+};
+
+
+/**
+ *	This class is an update of the graph. Its layout is built in the main
+ *	thread, along with a copy of each set whose table must be recomputed,
+ *	and the tables are then computed in the job's thread.
+ */
+class ChunkWPSetGraph::UpdateJob : public ChunkWPSetGraph::Job
+{
+public:
+	UpdateJob( uint32 version ) :
+		pLayout_( new Layout ),
+		version_( version ),
+		startTime_( timestamp() )
+	{}
+
+	void addTable( uint32 node );
+
+	virtual void finish( ChunkWPSetGraph & graph )
+		{ graph.finishUpdate( *this ); }
+
+	LayoutPtr				pLayout_;
+	NodeMap					nodeMap_;
+	std::vector<PortalKeys>	keys_;		///< Of each node
+	std::vector<TableInput>	inputs_;
+	uint32					version_;	///< Of the graph it was made from
+	uint64					startTime_;
+
+protected:
+	virtual void run();
+};
+
+
+/**
+ *	This method copies what is needed to compute the table of the given node
+ *	of the layout. It is called from the main thread.
+ */
+void ChunkWPSetGraph::UpdateJob::addTable( uint32 n )
+{
+	const Layout & layout = *pLayout_;
+	const Node & node = layout.nodes[n];
+	ChunkWaypointSet * pSet = node.pSet;
+	const Matrix & toLocal = pSet->chunk()->transformInverse();
+	const uint32 np = node.numPortals;
+	const int nw = pSet->waypointCount();
+
+	inputs_.push_back( TableInput() );
+	TableInput & input = inputs_.back();
+	input.node = n;
+
+	input.centres.resize( nw );
+	input.firstNeighbour.resize( nw + 1 );
+	for (int w = 0; w < nw; ++w)
+	{
+		const ChunkWaypoint & wp = pSet->waypoint( w );
+		input.centres[w] = waypointCentre( wp );
+		input.firstNeighbour[w] = input.neighbours.size();
+
+		for (uint e = 0; e < wp.edges_.size(); ++e)
+		{
+			int neigh = wp.edges_[e].neighbouringWaypoint();
+			if (neigh >= 0) input.neighbours.push_back( neigh );
+		}
+	}
+	input.firstNeighbour[ nw ] = input.neighbours.size();
+
+	// find the waypoints that each portal touches
+	input.seeds.assign( np, std::vector<int>() );
+	input.localPoints.resize( np );
+	for (uint32 i = 0; i < np; ++i)
+	{
+		const Portal & portal = layout.portals[ node.firstPortal + i ];
+		input.localPoints[i] = toLocal.applyPoint( portal.point );
+
+		if (portal.pChunkPortal == NULL)
+		{
+			int wp = pSet->find( input.localPoints[i], true );
+			if (wp < 0)
+			{
+				float bestDistSq = FLT_MAX;
+				wp = pSet->find( input.localPoints[i], bestDistSq );
+			}
+			if (wp >= 0) input.seeds[i].push_back( wp );
+		}
+	}
+
+	for (int w = 0; w < nw; ++w)
+	{
+		const ChunkWaypoint & wp = pSet->waypoint( w );
+		for (uint e = 0; e < wp.edges_.size(); ++e)
+		{
+			ChunkWaypointSet * pLabel = pSet->edgeLabel( wp.edges_[e] );
+			if (pLabel == NULL) continue;
+
+			NodeMap::iterator found = nodeMap_.find( pLabel );
+			if (found == nodeMap_.end()) continue;
+
+			for (uint32 i = 0; i < np; ++i)
+			{
+				const Portal & portal = layout.portals[ node.firstPortal + i ];
+				std::vector<int> & seeds = input.seeds[i];
+				if (portal.pChunkPortal != NULL &&
+					portal.target != NO_PORTAL &&
+					layout.portals[ portal.target ].node == found->second &&
+					(seeds.empty() || seeds.back() != w))
+				{
+					seeds.push_back( w );
+				}
+			}
+		}
+	}
+}
+
+
+/**
+ *	This method computes the tables that were copied by addTable.
+ */
+void ChunkWPSetGraph::UpdateJob::run()
+{
+	Layout & layout = *pLayout_;
+
+	for (uint i = 0; i < inputs_.size(); ++i)
+	{
+		const Node & node = layout.nodes[ inputs_[i].node ];
+		buildTable( inputs_[i], &layout.tables[0] + node.firstEntry );
+	}
+}
+
+
+/**
+ *	This class finds the distances from a landmark to every portal of a
+ *	layout.
+ */
+class ChunkWPSetGraph::LandmarkJob : public ChunkWPSetGraph::Job
+{
+public:
+	LandmarkJob( const Layout * pLayout, uint32 landmark ) :
+		pLayout_( pLayout ),
+		landmark_( landmark )
+	{}
+
+	virtual void finish( ChunkWPSetGraph & graph )
+		{ graph.finishLandmark( *this ); }
+
+	ConstLayoutPtr		pLayout_;
+	uint32				landmark_;
+	std::vector<float>	dists_;
+
+protected:
+	virtual void run()
+	{
+		dists_.resize( pLayout_->portals.size() );
+		pLayout_->dijkstra( landmark_, &dists_[0] );
+	}
+};
+
+
+// -----------------------------------------------------------------------------
+// Section: ChunkWPSetGraph
+// -----------------------------------------------------------------------------
+
+/**
+ *	Constructor.
+ */
+ChunkWPSetGraph::ChunkWPSetGraph( ChunkSpace * pSpace ) :
+	pSpace_( pSpace ),
+	lastChange_( timestamp() ),
+	version_( ++s_lastVersion_ ),
+	publishedVersion_( 0 ),
+	settledVersion_( 0 ),
+	rebuildTime_( 0 ),
+	pJob_( NULL ),
+	pLayout_( new Layout ),
+	numLandmarks_( 0 ),
+	landmarkTarget_( 0 ),
+	generation_( 0 )
+{
+}
+
+
+/**
+ *	Destructor. A job that is still running is left for tick() to delete
+ *	once it is done.
+ */
+ChunkWPSetGraph::~ChunkWPSetGraph()
+{
+	if (pJob_ != NULL)
+	{
+		s_orphanJobs_.push_back( pJob_ );
+	}
+}
+
+
+/**
+ *	This static method returns the graph for the given space.
+ *
+ *	@param pSpace		The space whose graph is wanted.
+ *	@param canCreate	Whether or not to create the graph if it does not
+ *						exist yet.
+ *	@return The graph, or NULL if it does not exist and canCreate is false.
+ */
+ChunkWPSetGraph * ChunkWPSetGraph::instance( ChunkSpace * pSpace,
+	bool canCreate )
+{
+	Graphs::iterator found = s_graphs_.find( pSpace );
+	if (found != s_graphs_.end()) return found->second;
+
+	if (!canCreate) return NULL;
+
+	static bool firstTime = true;
+	if (firstTime)
+	{
+		MF_WATCH( "Navigation/RouteGraph/enabled", s_enabled_,
+			Watcher::WT_READ_WRITE,
+			"Whether the precomputed waypoint set graph is used for "
+			"routing between waypoint sets" );
+		MF_WATCH( "Navigation/RouteGraph/verify", s_verify_,
+			Watcher::WT_READ_WRITE,
+			"Whether every route is also searched for with A-Star and "
+			"compared against the route graph" );
+		MF_WATCH( "Navigation/RouteGraph/settleTime", s_settleTime_,
+			Watcher::WT_READ_WRITE,
+			"Seconds without any waypoint set changes before the graph "
+			"is updated" );
+		MF_WATCH( "Navigation/RouteGraph/landmarkCount", s_landmarkCount_,
+			Watcher::WT_READ_WRITE,
+			"Number of landmarks used for the heuristic after next update" );
+		MF_WATCH( "Navigation/RouteGraph/queries", s_queries_,
+			Watcher::WT_READ_ONLY, "Number of route queries" );
+		MF_WATCH( "Navigation/RouteGraph/fallbacks", s_fallbacks_,
+			Watcher::WT_READ_ONLY,
+			"Number of queries made while the graph was out of date, or "
+			"that it had no path for before it had settled" );
+		MF_WATCH( "Navigation/RouteGraph/rebuilds", s_rebuilds_,
+			Watcher::WT_READ_ONLY, "Number of graph updates" );
+		MF_WATCH( "Navigation/RouteGraph/tables", s_tables_,
+			Watcher::WT_READ_ONLY,
+			"Number of waypoint set distance tables computed by updates" );
+		MF_WATCH( "Navigation/RouteGraph/mismatches", s_mismatches_,
+			Watcher::WT_READ_ONLY,
+			"Number of verified routes that differed from A-Star" );
+		firstTime = false;
+	}
+
+	ChunkWPSetGraph * pGraph = new ChunkWPSetGraph( pSpace );
+	s_graphs_[ pSpace ] = pGraph;
+	return pGraph;
+}
+
+
+/**
+ *	This static method is called when a waypoint set is tossed into a chunk.
+ */
+void ChunkWPSetGraph::onSetAdded( ChunkWaypointSet * pSet )
+{
+	MF_ASSERT( pSet->chunk() != NULL );
+	instance( pSet->chunk()->space() )->addSet( pSet );
+}
+
+
+/**
+ *	This static method is called when a waypoint set is tossed out of its
+ *	chunk. The set must still know its chunk.
+ */
+void ChunkWPSetGraph::onSetRemoved( ChunkWaypointSet * pSet )
+{
+	MF_ASSERT( pSet->chunk() != NULL );
+	ChunkSpace * pSpace = pSet->chunk()->space();
+	ChunkWPSetGraph * pGraph = instance( pSpace, false );
+	if (pGraph == NULL) return;
+
+	pGraph->delSet( pSet );
+
+	if (pGraph->infos_.empty())
+	{
+		s_graphs_.erase( pSpace );
+		delete pGraph;
+	}
+}
+
+
+/**
+ *	This static method is called when the connections of a waypoint set
+ *	change.
+ */
+void ChunkWPSetGraph::onSetChanged( ChunkWaypointSet * pSet )
+{
+	if (pSet->chunk() == NULL) return;
+
+	ChunkWPSetGraph * pGraph = instance( pSet->chunk()->space(), false );
+	if (pGraph != NULL)
+	{
+		pGraph->changeSet( pSet );
+	}
+}
+
+
+/**
+ *	This static method returns the current topology version of the given
+ *	space, or 0 if it has no waypoint sets.
+ */
+uint32 ChunkWPSetGraph::version( ChunkSpace * pSpace )
+{
+	Graphs::iterator found = s_graphs_.find( pSpace );
+	return (found != s_graphs_.end()) ? found->second->version_ : 0;
+}
+
+
+/**
+ *	This static method ticks the graphs of all spaces. It should be called
+ *	regularly from the main thread, e.g. from the game or loading tick. At
+ *	most one update is started per call, so that a server with many spaces
+ *	does not copy the sets of them all in the same tick.
+ */
+void ChunkWPSetGraph::tick()
+{
+	for (Jobs::iterator it = s_orphanJobs_.begin();
+		it != s_orphanJobs_.end(); )
+	{
+		if ((*it)->isDone())
+		{
+			delete *it;
+			it = s_orphanJobs_.erase( it );
+		}
+		else
+		{
+			++it;
+		}
+	}
+
+	if (!s_enabled_) return;
+
+	const uint64 settleStamps = uint64( s_settleTime_ * stampsPerSecondD() );
+	bool hasStarted = false;
+
+	for (Graphs::iterator it = s_graphs_.begin(); it != s_graphs_.end(); ++it)
+	{
+		it->second->tickGraph( settleStamps, hasStarted );
+	}
+}
+
+
+/**
+ *	This method ticks this graph. A graph has at most one job at a time. Once
+ *	that is done, the graph starts an update if its space has settled since
+ *	it last changed, or else finds its next landmark. It is marked as settled
+ *	if it has not changed for a settle period since it was updated.
+ *
+ *	@param settleStamps	The settle period in timestamp units.
+ *	@param hasStarted	Whether an update has been started in this tick. It
+ *						is set if this graph starts one.
+ */
+void ChunkWPSetGraph::tickGraph( uint64 settleStamps, bool & hasStarted )
+{
+	if (pJob_ != NULL)
+	{
+		if (!pJob_->isDone()) return;
+
+		pJob_->finish( *this );
+		delete pJob_;
+		pJob_ = NULL;
+	}
+
+	const uint64 now = timestamp();
+
+	if (publishedVersion_ != version_)
+	{
+		// Wait for the space to settle before updating, otherwise
+		// we would be updating for every chunk that loads.
+		if (!hasStarted && now - lastChange_ >= settleStamps)
+		{
+			this->startUpdate();
+			hasStarted = true;
+		}
+	}
+	else
+	{
+		if (numLandmarks_ < landmarkTarget_)
+		{
+			this->startLandmark();
+		}
+
+		if (settledVersion_ != version_ &&
+				now - rebuildTime_ >= settleStamps)
+		{
+			settledVersion_ = version_;
+		}
+	}
+}
+
+
+/**
+ *	This method adds a waypoint set to the graph.
+ */
+void ChunkWPSetGraph::addSet( ChunkWaypointSet * pSet )
+{
+	infos_[ pSet ] = SetInfo();
+	this->touch();
+}
+
+
+/**
+ *	This method removes a waypoint set from the graph. The graph holds dumb
+ *	pointers to sets, so it must not be used again until it is updated.
+ *	The neighbours of the set are told of the change by ChunkWaypointSet
+ *	when it disconnects from them.
+ */
+void ChunkWPSetGraph::delSet( ChunkWaypointSet * pSet )
+{
+	SetInfos::iterator found = infos_.find( pSet );
+	MF_ASSERT( found != infos_.end() );
+	infos_.erase( found );
+
+	this->touch();
+}
+
+
+/**
+ *	This method notes that the connections of a waypoint set have changed,
+ *	so that the next update looks at it again.
+ */
+void ChunkWPSetGraph::changeSet( ChunkWaypointSet * pSet )
+{
+	SetInfos::iterator found = infos_.find( pSet );
+	if (found != infos_.end())
+	{
+		found->second.isDirty = true;
+	}
+
+	this->touch();
+}
+
+
+/**
+ *	This method marks the graph as out of date.
+ */
+void ChunkWPSetGraph::touch()
+{
+	lastChange_ = timestamp();
+	version_ = ++s_lastVersion_;
+}
+
+
+/**
+ *	This method returns whether the graph can be used. The graph is only
+ *	updated by tick(), so that a query never pays for an update.
+ *
+ *	@return True if the graph can be used.
+ */
+bool ChunkWPSetGraph::prepare() const
+{
+	return s_enabled_ && this->isUpToDate();
+}
+
+
+/**
+ *	This method finds the connections of the given set to the other sets of
+ *	the graph. There is one for each connection of the set, at the average
+ *	midpoint of the edges that are labelled with it.
+ */
+void ChunkWPSetGraph::findConnections( ChunkWaypointSet * pSet,
+	SetInfo & info ) const
+{
+	Chunk * pChunk = pSet->chunk();
+	info.connections.clear();
+
+	for (ChunkWaypointConns::const_iterator cit = pSet->connectionsBegin();
+		cit != pSet->connectionsEnd(); ++cit)
+	{
+		ChunkWaypointSet * pTarget = cit->first.getObject();
+		if (infos_.find( pTarget ) == infos_.end()) continue;
+		if (cit->second == NULL || !hasBackPortal( pChunk, cit->second ))
+			continue;
+
+		// find where we cross into this set
+		Vector3 sum( 0.f, 0.f, 0.f );
+		int count = 0;
+		for (int w = 0; w < pSet->waypointCount(); ++w)
+		{
+			const ChunkWaypoint & wp = pSet->waypoint( w );
+			for (uint e = 0; e < wp.edges_.size(); ++e)
+			{
+				if (pSet->edgeLabel( wp.edges_[e] ) != pTarget) continue;
+
+				const Vector2 & p1 = wp.edges_[e].start_;
+				const Vector2 & p2 =
+					wp.edges_[ (e+1) % wp.edges_.size() ].start_;
+				sum += Vector3( (p1.x + p2.x) * 0.5f, wp.maxHeight_,
+					(p1.y + p2.y) * 0.5f );
+				++count;
+			}
+		}
+		if (count == 0) continue;
+
+		Connection conn;
+		conn.pTarget = pTarget;
+		conn.pChunkPortal = cit->second;
+		conn.point = pChunk->transform().applyPoint( sum / float(count) );
+		info.connections.push_back( conn );
+	}
+}
+
+
+/**
+ *	This method starts an update of the graph. The connections of the sets
+ *	that have changed are found again, and the portals of every set are laid
+ *	out from them. Where a neighbour connects to a set that does not connect
+ *	back, an entry-only portal is added to the set.
+ *
+ *	A set keeps its table if it has not changed and has the same portals as
+ *	when its table was computed. The others are copied for the job to
+ *	compute in its thread.
+ */
+void ChunkWPSetGraph::startUpdate()
+{
+	UpdateJob * pJob = new UpdateJob( version_ );
+	Layout & layout = *pJob->pLayout_;
+	NodeMap & nodeMap = pJob->nodeMap_;
+
+	std::vector<SetInfo *> nodeInfos;
+
+	for (SetInfos::iterator it = infos_.begin(); it != infos_.end(); ++it)
+	{
+		if (it->first->chunk() == NULL) continue;
+
+		if (it->second.isDirty)
+		{
+			this->findConnections( it->first, it->second );
+		}
+
+		Node node;
+		node.pSet = it->first;
+		node.firstPortal = 0;
+		node.numPortals = 0;
+		node.firstEntry = 0;
+
+		nodeMap[ it->first ] = layout.nodes.size();
+		layout.nodes.push_back( node );
+		nodeInfos.push_back( &it->second );
+	}
+
+	const uint32 numNodes = layout.nodes.size();
+
+	std::vector< std::vector<Outgoing> > outgoing( numNodes );
+	for (uint32 n = 0; n < numNodes; ++n)
+	{
+		const std::vector<Connection> & conns = nodeInfos[n]->connections;
+		for (uint i = 0; i < conns.size(); ++i)
+		{
+			NodeMap::iterator found = nodeMap.find( conns[i].pTarget );
+			if (found == nodeMap.end()) continue;
+
+			Outgoing og;
+			og.target = found->second;
+			og.pChunkPortal = conns[i].pChunkPortal;
+			og.point = conns[i].point;
+			outgoing[n].push_back( og );
+		}
+	}
+
+	// find the entry-only portals
+	std::vector< std::vector<Outgoing> > entries( numNodes );
+	for (uint32 n = 0; n < numNodes; ++n)
+	{
+		for (uint i = 0; i < outgoing[n].size(); ++i)
+		{
+			const Outgoing & og = outgoing[n][i];
+			const std::vector<Outgoing> & back = outgoing[ og.target ];
+
+			bool hasBack = false;
+			for (uint j = 0; j < back.size() && !hasBack; ++j)
+			{
+				hasBack = (back[j].target == n);
+			}
+
+			if (!hasBack)
+			{
+				Outgoing entry;
+				entry.target = n;
+				entry.pChunkPortal = NULL;
+				entry.point = og.point;
+				entries[ og.target ].push_back( entry );
+			}
+		}
+	}
+
+	// now lay them out contiguously
+	std::vector<uint32> targetNodes;
+	pJob->keys_.resize( numNodes );
+	for (uint32 n = 0; n < numNodes; ++n)
+	{
+		Node & node = layout.nodes[n];
+		node.firstPortal = layout.portals.size();
+		node.numPortals = outgoing[n].size() + entries[n].size();
+
+		for (int e = 0; e < 2; ++e)
+		{
+			const std::vector<Outgoing> & links = e ? entries[n] : outgoing[n];
+			for (uint i = 0; i < links.size(); ++i)
+			{
+				Portal portal;
+				portal.pChunkPortal = links[i].pChunkPortal;
+				portal.point = links[i].point;
+				portal.node = n;
+				portal.target = NO_PORTAL;
+				layout.portals.push_back( portal );
+				targetNodes.push_back( links[i].target );
+
+				PortalKey key;
+				key.pTarget = layout.nodes[ links[i].target ].pSet;
+				key.point = links[i].point;
+				key.isEntry = (e != 0);
+				pJob->keys_[n].push_back( key );
+			}
+		}
+	}
+
+	// resolve each outgoing portal to the portal on the other side, which
+	// is either its outgoing portal back to us or an entry-only portal.
+	// Entry-only portals cannot be left through so keep NO_PORTAL.
+	for (uint32 p = 0; p < layout.portals.size(); ++p)
+	{
+		Portal & portal = layout.portals[p];
+		if (portal.pChunkPortal == NULL) continue;
+
+		const Node & other = layout.nodes[ targetNodes[p] ];
+		for (uint32 q = other.firstPortal;
+			q < other.firstPortal + other.numPortals; ++q)
+		{
+			if (targetNodes[q] == portal.node)
+			{
+				portal.target = q;
+				break;
+			}
+		}
+	}
+
+	// reuse the tables that are still good, and copy the rest for the job
+	for (uint32 n = 0; n < numNodes; ++n)
+	{
+		Node & node = layout.nodes[n];
+		SetInfo & info = *nodeInfos[n];
+		const uint32 np = node.numPortals;
+
+		node.firstEntry = layout.tables.size();
+		layout.tables.resize( layout.tables.size() + np * np, FLT_MAX );
+
+		if (!info.isDirty && info.tableKeys == pJob->keys_[n])
+		{
+			std::copy( info.table.begin(), info.table.end(),
+				layout.tables.begin() + node.firstEntry );
+		}
+		else if (np != 0)
+		{
+			pJob->addTable( n );
+		}
+
+		info.isDirty = false;
+	}
+
+	pJob_ = pJob;
+	pJob_->start();
+}
+
+
+/**
+ *	This method is called when an update job is done. The sets keep the
+ *	tables that it computed, whether or not the graph has changed since it
+ *	was started, so that the next update can use them if they are still
+ *	good. The layout is only used if the graph has not changed.
+ */
+void ChunkWPSetGraph::finishUpdate( UpdateJob & job )
+{
+	const Layout & layout = *job.pLayout_;
+
+	for (uint i = 0; i < job.inputs_.size(); ++i)
+	{
+		const uint32 n = job.inputs_[i].node;
+		const Node & node = layout.nodes[n];
+
+		SetInfos::iterator found = infos_.find( node.pSet );
+		if (found == infos_.end()) continue;
+
+		std::vector<float>::const_iterator table =
+			layout.tables.begin() + node.firstEntry;
+		found->second.tableKeys = job.keys_[n];
+		found->second.table.assign( table,
+			table + node.numPortals * node.numPortals );
+	}
+
+	s_tables_ += job.inputs_.size();
+
+	if (job.version_ != version_) return;
+
+	pLayout_ = job.pLayout_;
+	nodeMap_.swap( job.nodeMap_ );
+
+	const uint32 numPortals = layout.portals.size();
+
+	numLandmarks_ = 0;
+	landmarkTarget_ = std::min( uint32( std::max( s_landmarkCount_, 0 ) ),
+		std::min( numPortals, MAX_LANDMARKS ) );
+	landmarkDists_.clear();
+	minLandmarkDists_.assign( numPortals, FLT_MAX );
+
+	gScores_.assign( numPortals + 1, FLT_MAX );
+	fScores_.assign( numPortals + 1, FLT_MAX );
+	parents_.assign( numPortals + 1, NO_PORTAL );
+	visited_.assign( numPortals + 1, 0 );
+	generation_ = 0;
+
+	publishedVersion_ = version_;
+	rebuildTime_ = timestamp();
+	++s_rebuilds_;
+
+	INFO_MSG( "ChunkWPSetGraph::finishUpdate: Space %u: %u sets, %u portals, "
+			"%u tables computed, %u bytes in %.3fs\n",
+		pSpace_->id(), layout.nodes.size(), numPortals, job.inputs_.size(),
+		this->memoryUsed(),
+		double(rebuildTime_ - job.startTime_) / stampsPerSecondD() );
+}
+
+
+/**
+ *	This method finds the shortest distance from the source portal to every
+ *	other portal over the whole graph. Permissiveness is ignored, so these
+ *	are always lower bounds.
+ */
+void ChunkWPSetGraph::Layout::dijkstra( uint32 source, float * dist ) const
+{
+	const uint32 numPortals = portals.size();
+	for (uint32 p = 0; p < numPortals; ++p)
+	{
+		dist[p] = FLT_MAX;
+	}
+
+	OpenQueue open;
+	dist[ source ] = 0.f;
+	open.push( OpenEntry( 0.f, source ) );
+
+	while (!open.empty())
+	{
+		OpenEntry top = open.top();
+		open.pop();
+		if (top.first > dist[ top.second ]) continue;
+
+		const Portal & portal = portals[ top.second ];
+		const Node & node = nodes[ portal.node ];
+		const float * table = &tables[0] + node.firstEntry;
+		uint32 i = top.second - node.firstPortal;
+
+		for (uint32 j = 0; j < node.numPortals; ++j)
+		{
+			float edge = table[ i*node.numPortals + j ];
+			if (j == i || edge == FLT_MAX) continue;
+
+			uint32 q = node.firstPortal + j;
+			if (top.first + edge < dist[q])
+			{
+				dist[q] = top.first + edge;
+				open.push( OpenEntry( dist[q], q ) );
+			}
+		}
+
+		if (portal.target != NO_PORTAL)
+		{
+			uint32 q = portal.target;
+			float d = top.first + (portals[q].point - portal.point).length();
+			if (d < dist[q])
+			{
+				dist[q] = d;
+				open.push( OpenEntry( d, q ) );
+			}
+		}
+	}
+}
+
+
+/**
+ *	This method starts finding the next landmark. Each landmark is the
+ *	portal furthest from those already found, preferring portals that none
+ *	of them can reach, so that every connected part of the space gets a
+ *	landmark if possible.
+ */
+void ChunkWPSetGraph::startLandmark()
+{
+	const uint32 numPortals = pLayout_->portals.size();
+	const std::vector<float> & minDist = minLandmarkDists_;
+
+	uint32 landmark = 0;
+	for (uint32 p = 0; p < numPortals; ++p)
+	{
+		if (minDist[p] > minDist[ landmark ]) landmark = p;
+		if (minDist[ landmark ] == FLT_MAX) break;
+	}
+
+	pJob_ = new LandmarkJob( pLayout_.get(), landmark );
+	pJob_->start();
+}
+
+
+/**
+ *	This method is called when a landmark job is done. Its distances are
+ *	only used if the graph has not been updated since it was started.
+ */
+void ChunkWPSetGraph::finishLandmark( LandmarkJob & job )
+{
+	if (job.pLayout_.get() != pLayout_.get()) return;
+
+	const uint32 numPortals = job.dists_.size();
+	for (uint32 p = 0; p < numPortals; ++p)
+	{
+		minLandmarkDists_[p] = std::min( minLandmarkDists_[p], job.dists_[p] );
+	}
+
+	landmarkDists_.insert( landmarkDists_.end(),
+		job.dists_.begin(), job.dists_.end() );
+	++numLandmarks_;
+}
+
+
+/**
+ *	This method returns a lower bound of the distance from the given portal
+ *	to the goal. It is the larger of the straight line distance and the
+ *	landmark bound d(L,goal) - d(L,portal), which holds by the triangle
+ *	inequality since all edge costs are at least their straight line length.
+ *
+ *	@return The bound, or FLT_MAX if the goal cannot be reached.
+ */
+float ChunkWPSetGraph::heuristic( uint32 portal, const Vector3 & dstPoint,
+	const float * goalBounds ) const
+{
+	const Layout & layout = *pLayout_;
+
+	float h = (layout.portals[ portal ].point - dstPoint).length();
+	if (numLandmarks_ == 0) return h;
+
+	const uint32 numPortals = layout.portals.size();
+	for (uint32 l = 0; l < numLandmarks_; ++l)
+	{
+		float dist = landmarkDists_[ l*numPortals + portal ];
+		if (dist == FLT_MAX) continue;
+		if (goalBounds[l] == FLT_MAX) return FLT_MAX;
+
+		h = std::max( h, goalBounds[l] - dist );
+	}
+
+	return h;
+}
+
+
+/**
+ *	This method finds the path amongst the waypoint sets from the source
+ *	set to the destination set, using an A-Star search of the portal graph.
+ *
+ *	@param pSrc			The set to start from.
+ *	@param srcPoint		The point to start from, in world coords.
+ *	@param pDst			The set to go to. Must be different from pSrc.
+ *	@param dstPoint		The point to go to, in world coords.
+ *	@param maxDistance	Portals further than this from srcPoint are not
+ *						considered. Negative means no limit.
+ *	@param blockNonPermissive	Whether non permissive portals are blocked.
+ *	@param path			The path is returned here, including both pSrc
+ *						and pDst.
+ *
+ *	@return	The result of the search.
+ */
+ChunkWPSetGraph::Result ChunkWPSetGraph::findSetPath(
+	ChunkWaypointSet * pSrc, const Vector3 & srcPoint,
+	ChunkWaypointSet * pDst, const Vector3 & dstPoint,
+	float maxDistance, bool blockNonPermissive, SetPath & path )
+{
+	++s_queries_;
+
+	if (!this->prepare())
+	{
+		++s_fallbacks_;
+		return UNAVAILABLE;
+	}
+
+	const Layout & layout = *pLayout_;
+
+	NodeMap::iterator srcIter = nodeMap_.find( pSrc );
+	NodeMap::iterator dstIter = nodeMap_.find( pDst );
+	if (srcIter == nodeMap_.end() || dstIter == nodeMap_.end())
+	{
+		++s_fallbacks_;
+		return UNAVAILABLE;
+	}
+
+	const Node & srcNode = layout.nodes[ srcIter->second ];
+	const Node & dstNode = layout.nodes[ dstIter->second ];
+	const uint32 GOAL = layout.portals.size();
+	const bool checkMaxDist = maxDistance > 0.f;
+
+	// the landmark bound to the nearest portal of the destination set
+	float goalBounds[ MAX_LANDMARKS ];
+	for (uint32 l = 0; l < numLandmarks_; ++l)
+	{
+		goalBounds[l] = FLT_MAX;
+		for (uint32 p = dstNode.firstPortal;
+			p < dstNode.firstPortal + dstNode.numPortals; ++p)
+		{
+			goalBounds[l] = std::min( goalBounds[l],
+				landmarkDists_[ l*GOAL + p ] );
+		}
+	}
+
+	// The scratch arrays are only valid where visited_ matches generation_.
+	if (++generation_ == 0)
+	{
+		visited_.assign( visited_.size(), 0 );
+		generation_ = 1;
+	}
+
+	OpenQueue open;
+
+#define RELAX( TO, FROM, G )												\
+	{																		\
+		uint32 relaxTo = (TO);												\
+		float relaxG = (G);													\
+		if (visited_[ relaxTo ] != generation_ ||							\
+			relaxG < gScores_[ relaxTo ])									\
+		{																	\
+			float relaxH = (relaxTo == GOAL) ? 0.f :						\
+				this->heuristic( relaxTo, dstPoint, goalBounds );			\
+			if (relaxH != FLT_MAX)											\
+			{																\
+				visited_[ relaxTo ] = generation_;							\
+				gScores_[ relaxTo ] = relaxG;								\
+				fScores_[ relaxTo ] = relaxG + relaxH;						\
+				parents_[ relaxTo ] = (FROM);								\
+				open.push( OpenEntry( relaxG + relaxH, relaxTo ) );		\
+			}																\
+		}																	\
+	}
+
+	for (uint32 p = srcNode.firstPortal;
+		p < srcNode.firstPortal + srcNode.numPortals; ++p)
+	{
+		if (layout.portals[p].target == NO_PORTAL) continue;
+		RELAX( p, NO_PORTAL, (layout.portals[p].point - srcPoint).length() )
+	}
+
+	bool found = false;
+	while (!open.empty())
+	{
+		OpenEntry top = open.top();
+		open.pop();
+
+		uint32 cur = top.second;
+		if (top.first > fScores_[ cur ]) continue;	// stale entry
+
+		if (cur == GOAL)
+		{
+			found = true;
+			break;
+		}
+
+		const Portal & portal = layout.portals[ cur ];
+		float g = gScores_[ cur ];
+
+		const Node & node = layout.nodes[ portal.node ];
+
+		if (&node == &dstNode)
+		{
+			RELAX( GOAL, cur, g + (dstPoint - portal.point).length() )
+		}
+
+		if (portal.target != NO_PORTAL &&
+			(!blockNonPermissive || portal.pChunkPortal->permissive))
+		{
+			const Portal & other = layout.portals[ portal.target ];
+			if (!checkMaxDist ||
+				(other.point - srcPoint).length() <= maxDistance)
+			{
+				RELAX( portal.target, cur,
+					g + (other.point - portal.point).length() )
+			}
+		}
+
+		const float * table = &layout.tables[0] + node.firstEntry;
+		uint32 i = cur - node.firstPortal;
+		for (uint32 j = 0; j < node.numPortals; ++j)
+		{
+			float edge = table[ i*node.numPortals + j ];
+			if (j == i || edge == FLT_MAX) continue;
+
+			uint32 q = node.firstPortal + j;
+			if (checkMaxDist &&
+				(layout.portals[q].point - srcPoint).length() > maxDistance)
+				continue;
+
+			RELAX( q, cur, g + edge )
+		}
+	}
+
+#undef RELAX
+
+	if (!found) return NO_PATH;
+
+	// walk back from the goal, noting every set we pass through
+	path.clear();
+	for (uint32 p = parents_[ GOAL ]; p != NO_PORTAL; p = parents_[p])
+	{
+		ChunkWaypointSet * pSet = layout.nodes[ layout.portals[p].node ].pSet;
+		if (path.empty() || path.back() != pSet)
+		{
+			path.push_back( pSet );
+		}
+	}
+	if (path.empty() || path.back() != pSrc)
+	{
+		path.push_back( pSrc );
+	}
+	std::reverse( path.begin(), path.end() );
+
+	return FOUND;
+}
+
+
+/**
+ *	This method returns the approximate amount of memory used by the graph.
+ */
+uint32 ChunkWPSetGraph::memoryUsed() const
+{
+	uint32 infosSize = infos_.size() * (sizeof( SetInfos::value_type ) + 16);
+	for (SetInfos::const_iterator it = infos_.begin(); it != infos_.end(); ++it)
+	{
+		infosSize +=
+			it->second.connections.capacity() * sizeof( Connection ) +
+			it->second.tableKeys.capacity() * sizeof( PortalKey ) +
+			it->second.table.capacity() * sizeof( float );
+	}
+
+	return sizeof( *this ) + infosSize +
+		sizeof( Layout ) +
+		pLayout_->nodes.capacity() * sizeof( Node ) +
+		pLayout_->portals.capacity() * sizeof( Portal ) +
+		pLayout_->tables.capacity() * sizeof( float ) +
+		nodeMap_.size() * (sizeof( NodeMap::value_type ) + 16) +
+		landmarkDists_.capacity() * sizeof( float ) +
+		minLandmarkDists_.capacity() * sizeof( float ) +
+		gScores_.capacity() * sizeof( float ) +
+		fScores_.capacity() * sizeof( float ) +
+		parents_.capacity() * sizeof( uint32 ) +
+		visited_.capacity() * sizeof( uint32 );
+}
+
+// chunk_wpset_graph.cpp
@@ -0,0 +1,262 @@
+/******************************************************************************
+BigWorld Technology
+Copyright BigWorld Pty, Ltd.
+All Rights Reserved. Commercial in confidence.
+
+WARNING: This computer program is protected by copyright law and international
+treaties. Unauthorized use, reproduction or distribution of this program, or
+any portion of this program, may result in the imposition of civil and
+criminal penalties as provided by law.
+******************************************************************************/
+
+#ifndef CHUNK_WPSET_GRAPH_HPP
+#define CHUNK_WPSET_GRAPH_HPP
+
+#include "chunk_waypoint_set.hpp"
+
+#include "cstdmf/smartpointer.hpp"
+#include "cstdmf/stdmf.hpp"
+#include "math/vector3.hpp"
+
+#include <map>
+#include <vector>
+
+class ChunkSpace;
+
+
+/**
+ *	This class is a precomputed routing abstraction of all the waypoint sets
+ *	in a space. It is used by the Navigator to find a path amongst waypoint
+ *	sets without performing a full A-Star search of the set graph.
+ *
+ *	The graph nodes are the portals of each waypoint set, i.e. the points on
+ *	its boundary where it connects to a neighbouring set. Each set stores a
+ *	table of portal-to-portal distances through its waypoints. On top of this
+ *	a small number of landmarks have their shortest distances to every portal
+ *	stored, and these give a tight lower bound (the ALT heuristic) for the
+ *	search through the portal graph.
+ *
+ *	The graph is updated from tick() once the topology of the space has
+ *	settled, i.e. after no waypoint set has been added, removed or rebound for
+ *	a while. Until then it is unavailable and the caller should fall back to
+ *	the normal search. Queries never update the graph themselves.
+ *
+ *	An update only recomputes the tables of the sets that changed, and of
+ *	their neighbours whose portals changed with them. The other sets keep
+ *	the tables they had. The tables are computed in a thread from copies of
+ *	the waypoints, and a later tick swaps the result in. The landmarks are
+ *	then found one per tick, also in a thread, and the heuristic uses those
+ *	that have been found so far.
+ *
+ *	A graph that has been updated may still be missing sets whose chunks are
+ *	yet to load. Its paths are good, but the caller should not take its word
+ *	that there is no path until it has stayed unchanged for another settle
+ *	period, see isSettled().
+ *
+ *	Every topology change also gives the graph a new version number, which
+ *	is never reused across spaces. Anything derived from the sets of a space
+ *	may remember the version and treat itself as stale when it changes.
+ */
+class ChunkWPSetGraph
+{
+public:
+	/**
+	 *	This enumeration is the result of a route query.
+	 */
+	enum Result
+	{
+		UNAVAILABLE,	///< The graph is not up to date, search normally
+		NO_PATH,		///< There is no path between the sets
+		FOUND			///< A path was found
+	};
+
+	typedef std::vector<ChunkWaypointSet *> SetPath;
+
+	static ChunkWPSetGraph * instance( ChunkSpace * pSpace,
+		bool canCreate = true );
+
+	static void onSetAdded( ChunkWaypointSet * pSet );
+	static void onSetRemoved( ChunkWaypointSet * pSet );
+	static void onSetChanged( ChunkWaypointSet * pSet );
+
+	static uint32 version( ChunkSpace * pSpace );
+
+	static void tick();
+
+	Result findSetPath( ChunkWaypointSet * pSrc, const Vector3 & srcPoint,
+		ChunkWaypointSet * pDst, const Vector3 & dstPoint,
+		float maxDistance, bool blockNonPermissive, SetPath & path );
+
+	bool isUpToDate() const
+		{ return publishedVersion_ == version_ && !pLayout_->nodes.empty(); }
+	bool isSettled() const
+		{ return this->isUpToDate() && settledVersion_ == version_; }
+	uint32 memoryUsed() const;
+
+	static bool s_enabled_;
+	static bool s_verify_;
+	static float s_settleTime_;
+	static int s_landmarkCount_;
+
+	static uint32 s_queries_;
+	static uint32 s_fallbacks_;
+	static uint32 s_rebuilds_;
+	static uint32 s_tables_;
+	static uint32 s_mismatches_;
+
+private:
+	ChunkWPSetGraph( ChunkSpace * pSpace );
+	~ChunkWPSetGraph();
+
+	ChunkWPSetGraph( const ChunkWPSetGraph & );
+	ChunkWPSetGraph & operator=( const ChunkWPSetGraph & );
+
+	class Job;
+	class UpdateJob;
+	class LandmarkJob;
+
+	void addSet( ChunkWaypointSet * pSet );
+	void delSet( ChunkWaypointSet * pSet );
+	void changeSet( ChunkWaypointSet * pSet );
+	void touch();
+
+	bool prepare() const;
+	void tickGraph( uint64 settleStamps, bool & hasStarted );
+	void startUpdate();
+	void finishUpdate( UpdateJob & job );
+	void startLandmark();
+	void finishLandmark( LandmarkJob & job );
+
+	float heuristic( uint32 portal, const Vector3 & dstPoint,
+		const float * goalBounds ) const;
+
+	static const uint32 NO_PORTAL = 0xFFFFFFFF;
+	static const uint32 MAX_LANDMARKS = 32;
+
+	/**
+	 *	This structure is a point on the boundary of a waypoint set.
+	 *	Entry-only portals have no chunk portal and no target, they are
+	 *	created where a neighbour connects to us but we do not connect back.
+	 */
+	struct Portal
+	{
+		ChunkBoundary::Portal *	pChunkPortal;
+		Vector3					point;		///< In world coords
+		uint32					node;		///< Owning node
+		uint32					target;		///< Portal on the other side
+	};
+
+	/**
+	 *	This structure is a waypoint set in the graph. Its portals are
+	 *	contiguous in the portals of the layout, and its n*n distance table
+	 *	is contiguous in the tables.
+	 */
+	struct Node
+	{
+		ChunkWaypointSet *	pSet;		///< Dumb pointer, see delSet
+		uint32				firstPortal;
+		uint32				numPortals;
+		uint32				firstEntry;
+	};
+
+	/**
+	 *	This class is the nodes, portals and tables of one update of the
+	 *	graph. It is not changed once it has been built, so that it can be
+	 *	searched for landmarks in a thread while queries use it.
+	 */
+	class Layout : public ReferenceCount
+	{
+	public:
+		void dijkstra( uint32 source, float * dist ) const;
+
+		std::vector<Node>		nodes;
+		std::vector<Portal>		portals;
+		std::vector<float>		tables;
+	};
+
+	typedef SmartPointer<Layout> LayoutPtr;
+	typedef ConstSmartPointer<Layout> ConstLayoutPtr;
+
+	/**
+	 *	This structure is a connection of a waypoint set to a neighbour,
+	 *	found by looking at the set itself.
+	 */
+	struct Connection
+	{
+		ChunkWaypointSet *		pTarget;
+		ChunkBoundary::Portal *	pChunkPortal;
+		Vector3					point;		///< In world coords
+	};
+
+	/**
+	 *	This structure is what a portal's distances depend on, other than
+	 *	the waypoints of its set.
+	 */
+	struct PortalKey
+	{
+		ChunkWaypointSet *		pTarget;
+		Vector3					point;
+		bool					isEntry;
+
+		bool operator==( const PortalKey & other ) const
+		{
+			return pTarget == other.pTarget && point == other.point &&
+				isEntry == other.isEntry;
+		}
+	};
+
+	typedef std::vector<PortalKey> PortalKeys;
+
+	/**
+	 *	This structure is what is kept about each set between updates.
+	 */
+	struct SetInfo
+	{
+		SetInfo() : isDirty( true ) {}
+
+		std::vector<Connection>	connections;
+		bool					isDirty;	///< Changed since last update
+		PortalKeys				tableKeys;	///< The portals of the table
+		std::vector<float>		table;
+	};
+
+	typedef std::map<ChunkWaypointSet *, SetInfo> SetInfos;
+	typedef std::map<ChunkWaypointSet *, uint32> NodeMap;
+
+	void findConnections( ChunkWaypointSet * pSet, SetInfo & info ) const;
+
+	ChunkSpace *			pSpace_;
+
+	SetInfos				infos_;
+	uint64					lastChange_;
+	uint32					version_;
+	uint32					publishedVersion_;
+	uint32					settledVersion_;
+	uint64					rebuildTime_;
+	Job *					pJob_;
+
+	LayoutPtr				pLayout_;
+	NodeMap					nodeMap_;
+
+	uint32					numLandmarks_;
+	uint32					landmarkTarget_;
+	std::vector<float>		landmarkDists_;	///< Each landmark's, in turn
+	std::vector<float>		minLandmarkDists_;
+
+	// search scratch space, valid where visited_ matches generation_
+	std::vector<float>		gScores_;
+	std::vector<float>		fScores_;
+	std::vector<uint32>		parents_;
+	std::vector<uint32>		visited_;
+	uint32					generation_;
+
+	typedef std::map<ChunkSpace *, ChunkWPSetGraph *> Graphs;
+	static Graphs s_graphs_;
+	static uint32 s_lastVersion_;
+
+	typedef std::vector<Job *> Jobs;
+	static Jobs s_orphanJobs_;
+};
+
+
+#endif // CHUNK_WPSET_GRAPH_HPP
@@ -14,11 +14,13 @@ criminal penalties as provided by law.
 #include "pch.hpp"
 
 #include "cstdmf/debug.hpp"
+#include "cstdmf/watcher.hpp"
 
 DECLARE_DEBUG_COMPONENT2( "Waypoint", 0 )
 
 #include "navigator.hpp"
 #include "chunk_waypoint_set.hpp"
+#include "chunk_wpset_graph.hpp"
 #include "common/chunk_portal.hpp"
 #include "astar.hpp"
 #include "chunk/chunk_space.hpp"
@@ -492,63 +494,390 @@ bool ChunkWaypointState::getAdjacency( int index, ChunkWaypointState & neigh,
 }
 
 
+// -----------------------------------------------------------------------------
+// Section: NavigatorFlow
+// -----------------------------------------------------------------------------
+
+/**
+ *	This is a node that a path can pass through, i.e. a waypoint set and
+ *	waypoint index. Nodes of waypoint set paths have a waypoint index of -1.
+ */
+typedef std::pair<const ChunkWaypointSet *, int> NavigatorFlowNode;
+
+inline NavigatorFlowNode flowNode( const ChunkWaypointState & state )
+{
+	return NavigatorFlowNode( &*state.navLoc().set(), state.navLoc().waypoint() );
+}
+
+inline NavigatorFlowNode flowNode( const ChunkWPSetState & state )
+{
+	return NavigatorFlowNode( &*state.set(), -1 );
+}
+
+
+/**
+ *	This is the key of a shared flow. Waypoint set flows lead to a waypoint
+ *	in the destination set and have no search set. Waypoint flows lead
+ *	through the search set to the goal set, which is either the destination
+ *	set or the next set on the way to it.
+ */
+struct NavigatorFlowKey
+{
+	const ChunkWaypointSet *	pSet;
+	const ChunkWaypointSet *	pGoalSet;
+	const ChunkWaypointSet *	pDstSet;
+	int							dstWaypoint;
+	float						girth;
+	bool						blockNonPermissive;
+
+	bool operator<( const NavigatorFlowKey & other ) const
+	{
+		if (pDstSet != other.pDstSet) return pDstSet < other.pDstSet;
+		if (dstWaypoint != other.dstWaypoint)
+			return dstWaypoint < other.dstWaypoint;
+		if (pSet != other.pSet) return pSet < other.pSet;
+		if (pGoalSet != other.pGoalSet) return pGoalSet < other.pGoalSet;
+		if (girth != other.girth) return girth < other.girth;
+		return blockNonPermissive < other.blockNonPermissive;
+	}
+};
+
+
+/**
+ *	This class is the next step towards one destination from every node that
+ *	a path to that destination has been found from. Every Navigator heading
+ *	to the same place shares it, so that a crowd converging on one target
+ *	needs only the searches that reach nodes not yet in the flow.
+ *
+ *	A node that is already in the flow keeps its step when another path is
+ *	added. Since every path inserted ends at the goal, this keeps the flow
+ *	free of cycles.
+ */
+template <class State>
+class NavigatorFlow : public ReferenceCount
+{
+public:
+	/**
+	 *	This structure is the step from one node.
+	 */
+	struct Hop
+	{
+		State	next;
+		int		pathSize;	///< Number of states from the node to the goal
+	};
+
+	typedef std::map<NavigatorFlowNode, Hop> Hops;
+
+	NavigatorFlow( uint32 version ) : version_( version ) {}
+	~NavigatorFlow()		{ s_totalHops_ -= hops_.size(); }
+
+	uint32 version() const	{ return version_; }
+
+	const Hop * find( const NavigatorFlowNode & node ) const
+	{
+		typename Hops::const_iterator found = hops_.find( node );
+		return (found != hops_.end()) ? &found->second : NULL;
+	}
+
+	void add( const std::vector<State> & fwdPath );
+
+	uint32 memoryUsed() const
+	{
+		// the map node overhead is a guess at three pointers and a colour
+		return sizeof( *this ) +
+			hops_.size() * (sizeof( typename Hops::value_type ) + 16);
+	}
+
+	static uint32 s_totalHops_;
+
+private:
+	uint32	version_;
+	Hops	hops_;
+};
+
+template <class State>
+uint32 NavigatorFlow<State>::s_totalHops_ = 0;
+
+
+/**
+ *	This method adds the steps of the given path, which is in forward order
+ *	from the source to the goal.
+ */
+template <class State>
+void NavigatorFlow<State>::add( const std::vector<State> & fwdPath )
+{
+	const int pathSize = fwdPath.size();
+	for (int i = 0; i < pathSize - 1; ++i)
+	{
+		NavigatorFlowNode node = flowNode( fwdPath[i] );
+		if (hops_.find( node ) != hops_.end()) continue;
+
+		Hop & hop = hops_[ node ];
+		hop.next = fwdPath[i+1];
+		hop.pathSize = pathSize - i;
+		++s_totalHops_;
+	}
+}
+
+
+// -----------------------------------------------------------------------------
+// Section: NavigatorFlowCache
+// -----------------------------------------------------------------------------
+
+/**
+ *	This class is a least recently used cache of flows, shared by all the
+ *	Navigators in the process. A flow is stale once the topology version of
+ *	its space has changed, i.e. after any chunk has loaded or unloaded.
+ */
+template <class State>
+class NavigatorFlowCache
+{
+public:
+	typedef NavigatorFlow<State> Flow;
+	typedef SmartPointer<Flow> FlowPtr;
+
+	FlowPtr find( const NavigatorFlowKey & key, uint32 version );
+	FlowPtr obtain( const NavigatorFlowKey & key, uint32 version );
+
+	uint32 size() const		{ return entries_.size(); }
+	uint32 memoryUsed() const;
+
+private:
+	void erase( const NavigatorFlowKey & key );
+
+	typedef std::list<NavigatorFlowKey> Order;	// most recent first
+
+	/**
+	 *	This structure is a cached flow and its place in the order.
+	 */
+	struct Entry
+	{
+		FlowPtr				pFlow;
+		Order::iterator		orderIter;
+	};
+	typedef std::map<NavigatorFlowKey, Entry> Entries;
+
+	Order		order_;
+	Entries		entries_;
+};
+
+
+/**
+ *	This method finds the flow for the given key, if it is cached and not
+ *	stale.
+ */
+template <class State>
+typename NavigatorFlowCache<State>::FlowPtr NavigatorFlowCache<State>::find(
+	const NavigatorFlowKey & key, uint32 version )
+{
+	typename Entries::iterator found = entries_.find( key );
+	if (found == entries_.end()) return NULL;
+
+	if (found->second.pFlow->version() != version)
+	{
+		this->erase( key );
+		return NULL;
+	}
+
+	order_.splice( order_.begin(), order_, found->second.orderIter );
+	return found->second.pFlow;
+}
+
+
+/**
+ *	This method finds the flow for the given key, creating it if necessary.
+ *	The least recently used flows are dropped to keep the cache within
+ *	Navigator::s_maxSharedFlows.
+ */
+template <class State>
+typename NavigatorFlowCache<State>::FlowPtr NavigatorFlowCache<State>::obtain(
+	const NavigatorFlowKey & key, uint32 version )
+{
+	FlowPtr pFlow = this->find( key, version );
+	if (pFlow) return pFlow;
+
+	while (!order_.empty() &&
+		entries_.size() >= uint32( std::max( Navigator::s_maxSharedFlows, 1 ) ))
+	{
+		this->erase( order_.back() );
+	}
+
+	pFlow = new Flow( version );
+	order_.push_front( key );
+
+	Entry & entry = entries_[ key ];
+	entry.pFlow = pFlow;
+	entry.orderIter = order_.begin();
+
+	return pFlow;
+}
+
+
+/**
+ *	This method drops the flow for the given key. Navigators that are using
+ *	it keep their reference to it.
+ */
+template <class State>
+void NavigatorFlowCache<State>::erase( const NavigatorFlowKey & key )
+{
+	typename Entries::iterator found = entries_.find( key );
+	MF_ASSERT( found != entries_.end() );
+
+	order_.erase( found->second.orderIter );
+	entries_.erase( found );
+}
+
+
+/**
+ *	This method returns the approximate memory used by the cached flows.
+ */
+template <class State>
+uint32 NavigatorFlowCache<State>::memoryUsed() const
+{
+	uint32 total = 0;
+	for (typename Entries::const_iterator it = entries_.begin();
+		it != entries_.end(); ++it)
+	{
+		total += it->second.pFlow->memoryUsed() +
+			sizeof( typename Entries::value_type ) +
+			sizeof( NavigatorFlowKey ) + 32;
+	}
+	return total;
+}
+
+
+namespace
+{
+	NavigatorFlowCache<ChunkWaypointState>	s_wayFlows;
+	NavigatorFlowCache<ChunkWPSetState>		s_setFlows;
+
+	uint32 s_flowHits = 0;
+	uint32 s_flowMisses = 0;
+
+	uint32 sharedFlowCount()
+	{
+		return s_wayFlows.size() + s_setFlows.size();
+	}
+
+	uint32 sharedFlowHops()
+	{
+		return NavigatorFlow<ChunkWaypointState>::s_totalHops_ +
+			NavigatorFlow<ChunkWPSetState>::s_totalHops_;
+	}
+
+	uint32 sharedFlowMemory()
+	{
+		return s_wayFlows.memoryUsed() + s_setFlows.memoryUsed();
+	}
+
+	float sharedFlowHitRate()
+	{
+		uint32 total = s_flowHits + s_flowMisses;
+		return total ? float( s_flowHits ) / float( total ) : 0.f;
+	}
+}
+
+int Navigator::s_maxSharedFlows = 2048;
+
+
 // -----------------------------------------------------------------------------
 // Section: NavigatorCache
 // -----------------------------------------------------------------------------
 
+typedef NavigatorFlowCache<ChunkWaypointState>::FlowPtr NavigatorWayFlowPtr;
+typedef NavigatorFlowCache<ChunkWPSetState>::FlowPtr NavigatorSetFlowPtr;
+
 /**
- *  This class caches data from recent searches. It is purposefully not
- *  defined in the header file so that our users need not know its contents.
+ *  This class remembers the shared flows that a Navigator last used. It is
+ *  purposefully not defined in the header file so that our users need not
+ *  know its contents.
  */
 class NavigatorCache : public ReferenceCount
 {
 public:
-	const ChunkWaypointState * saveWayPath( AStar<ChunkWaypointState> & astar );
+	NavigatorCache() : setPathSize_( 0 ) {}
 
-	const ChunkWaypointState * findWayPath(
-		const ChunkWaypointState & src, const ChunkWaypointState & dst );
+	const ChunkWaypointState * findWayPath( const NavigatorFlowKey & key,
+		uint32 version, const ChunkWaypointState & src );
 
-	const ChunkWPSetState * saveWaySetPath( AStar<ChunkWPSetState> & astar );
+	const ChunkWaypointState * saveWayPath( const NavigatorFlowKey & key,
+		uint32 version, AStar<ChunkWaypointState> & astar );
 
-	const ChunkWPSetState * findWaySetPath(
-		const ChunkWPSetState & src, const ChunkWPSetState & dst );
+	const ChunkWPSetState * findWaySetPath( const NavigatorFlowKey & key,
+		uint32 version, const ChunkWPSetState & src );
 
-	int getWaySetPathSize() const;
+	const ChunkWPSetState * saveWaySetPath( const NavigatorFlowKey & key,
+		uint32 version, AStar<ChunkWPSetState> & astar );
+
+	const ChunkWPSetState * saveWaySetPath( const NavigatorFlowKey & key,
+		uint32 version, const ChunkWPSetState & src,
+		const ChunkWPSetState & dst, const ChunkWPSetGraph::SetPath & setPath );
+
+	int getWaySetPathSize() const
+		{ return setPathSize_; }
 
 	// this may be necessary because different results will be obtained depending
 	// on whether ChunkWPSetState::blockNonPermissive is true or false.
 	void clearWPSetCache()
-		{ waySetPath_.clear(); }
+		{ pSetFlow_ = NULL; setPathSize_ = 0; }
 
 	void clearWPCache()
-		{ wayPath_.clear(); }
+		{ pWayFlow_ = NULL; }
 
-	const std::vector<ChunkWaypointState>& wayPath() const
-		{ return wayPath_; }
-
-	void passedShellBoundary( bool a )
-		{ passedShellBoundary_ = a; }
+	void getWaypointPath( const NavLoc & srcLoc,
+		std::vector<Vector3> & wppath ) const;
 
-	bool passedShellBoundary() const
-		{ return passedShellBoundary_; }
 private:
-	std::vector<ChunkWaypointState>		wayPath_;
-	std::vector<ChunkWPSetState>		waySetPath_;
-	bool								passedShellBoundary_;
+	const ChunkWPSetState * storeWaySetPath( const NavigatorFlowKey & key,
+		uint32 version, const std::vector<ChunkWPSetState> & fwdPath );
+
+	NavigatorWayFlowPtr		pWayFlow_;
+	NavigatorFlowNode		wayNode_;
+
+	NavigatorSetFlowPtr		pSetFlow_;
+	int						setPathSize_;
 };
 
 /**
- *  This method saves a waypoint path.
+ *  This method finds the next waypoint state from the given source in the
+ *  shared flow for the given key.
+ */
+const ChunkWaypointState * NavigatorCache::findWayPath(
+	const NavigatorFlowKey & key, uint32 version,
+	const ChunkWaypointState & src )
+{
+	// (we intentionally ignore lpoint here ... we would not be
+	// called if src and dst were the same waypoint, since our
+	// user can take care of itself once that is achieved)
+	NavigatorWayFlowPtr pFlow = s_wayFlows.find( key, version );
+	const NavigatorFlow<ChunkWaypointState>::Hop * pHop =
+		pFlow ? pFlow->find( flowNode( src ) ) : NULL;
+
+	if (pHop == NULL)
+	{
+		++s_flowMisses;
+		return NULL;
+	}
+
+	++s_flowHits;
+	pWayFlow_ = pFlow;
+	wayNode_ = flowNode( src );
+	return &pHop->next;
+}
+
+/**
+ *  This method adds a waypoint path to the shared flow for the given key.
  *
  *  Both the source and destination (goal) are extracted from the
  *  search result in the given AStar object. (i.e. must be unspoilt)
  */
 const ChunkWaypointState * NavigatorCache::saveWayPath(
+	const NavigatorFlowKey & key, uint32 version,
 	AStar<ChunkWaypointState> & astar )
 {
-	std::vector<const ChunkWaypointState *>		fwdPath;
+	std::vector<ChunkWaypointState>		fwdPath;
 
-	// get out all the pointers
+	// get out all the states
 	const ChunkWaypointState * as = astar.first();
 	bool first = true;
 	const ChunkWaypointState* last = as;
@@ -557,7 +886,7 @@ const ChunkWaypointState * NavigatorCache::saveWayPath(
 	{
 		if (!almostZero( as->distanceFromParent() ) || first)
 		{
-			fwdPath.push_back( as );
+			fwdPath.push_back( *as );
 			first = false;
 		}
 
@@ -572,63 +901,17 @@ const ChunkWaypointState * NavigatorCache::saveWayPath(
 	if (fwdPath.size() < 2)
 	{
 		// make sure that fwdPath has at least 2 nodes
-		fwdPath.push_back( last );
+		fwdPath.push_back( *last );
 	}
 
-	// and store the path in reverse order (for pop_back)
-	wayPath_.clear();
-	for (int i = fwdPath.size()-1; i >= 0; i--)
-	{
-		wayPath_.push_back( *fwdPath[i] );
-	}
+	pWayFlow_ = s_wayFlows.obtain( key, version );
+	pWayFlow_->add( fwdPath );
+	wayNode_ = flowNode( fwdPath.front() );
 
-	MF_ASSERT_DEBUG( wayPath_.size() >= 2 );
-	return &wayPath_[wayPath_.size()-2];
-}
-
-/**
- *  This method finds a waypoint path
- */
-const ChunkWaypointState * NavigatorCache::findWayPath(
-	const ChunkWaypointState & src, const ChunkWaypointState & dst )
-{
-	// see if we have a path
-	if (wayPath_.size() < 2) return NULL;
-
-	// see if the path goes to the same waypoint
-	// (we intentionally ignore lpoint here ... we would not be
-	// called if src and dst were the same waypoint, since our
-	// user can take care of itself once that is achieved)
-	if (dst.navLoc().set() != wayPath_.front().navLoc().set() ||
-		dst.navLoc().waypoint() != wayPath_.front().navLoc().waypoint())
-			return NULL;
-
-	// ok, this path leads to the right place.
-	// now make sure it starts from the right place too.
-	if (src.navLoc().set() == wayPath_.back().navLoc().set() &&
-		src.navLoc().waypoint() == wayPath_.back().navLoc().waypoint())
-	{
-		// looks good.
-		return &wayPath_[wayPath_.size()-2];
-	}
-
-	// we might have progressed to the next node, so move on to it
-	wayPath_.pop_back();
-
-	// but make sure we didn't run out of nodes
-	// (no point checking if src is dst, that is known false)
-	if (wayPath_.size() < 2) return NULL;
-
-	// and see if it suits our purpose
-	if (src.navLoc().set() == wayPath_.back().navLoc().set() &&
-		src.navLoc().waypoint() == wayPath_.back().navLoc().waypoint())
-	{
-		return &wayPath_[wayPath_.size()-2];
-	}
-
-	// nope, no good. clear it now just for sanity
-	wayPath_.clear();
-	return NULL;
+	const NavigatorFlow<ChunkWaypointState>::Hop * pHop =
+		pWayFlow_->find( wayNode_ );
+	MF_ASSERT_DEBUG( pHop != NULL );
+	return &pHop->next;
 }
 
 
@@ -639,83 +922,156 @@ const ChunkWaypointState * NavigatorCache::findWayPath(
  *  search result in the given AStar object. (i.e. must be unspoilt)
  */
 const ChunkWPSetState * NavigatorCache::saveWaySetPath(
+	const NavigatorFlowKey & key, uint32 version,
 	AStar<ChunkWPSetState> & astar )
 {
-	std::vector<const ChunkWPSetState *>		fwdPath;
+	std::vector<ChunkWPSetState>		fwdPath;
 
-	// get out all the pointers
-	passedShellBoundary_ = false;
+	// get out all the states
 	const ChunkWPSetState * as = astar.first();
 	while (as != NULL)
 	{
-		passedShellBoundary_ = passedShellBoundary_ || as->passedShellBoundary();
-		fwdPath.push_back( as );
+		fwdPath.push_back( *as );
 		as = astar.next();
 	}
 
-	// and store the path in reverse order (for pop_back)
-	waySetPath_.clear();
-	for (int i = fwdPath.size()-1; i >= 0; i--)
-	{
-		waySetPath_.push_back( *fwdPath[i] );
-	}
-
-	MF_ASSERT_DEBUG( waySetPath_.size() >= 2 );
-	return &waySetPath_[waySetPath_.size()-2];
+	return this->storeWaySetPath( key, version, fwdPath );
 }
 
 /**
- *  This method finds a waypoint path
+ *  This method saves a waypoint set path found in the route graph.
+ *
+ *	The states along the path are recreated from the connections between
+ *	consecutive sets, exactly as the A-Star search would have created them.
+ *
+ *	@return The next state, or NULL if the path can no longer be followed.
  */
-const ChunkWPSetState * NavigatorCache::findWaySetPath(
-	const ChunkWPSetState & src, const ChunkWPSetState & dst )
+const ChunkWPSetState * NavigatorCache::saveWaySetPath(
+	const NavigatorFlowKey & key, uint32 version,
+	const ChunkWPSetState & src, const ChunkWPSetState & dst,
+	const ChunkWPSetGraph::SetPath & setPath )
 {
-	if( passedShellBoundary() )
+	MF_ASSERT_DEBUG( setPath.size() >= 2 && setPath.front() == &*src.set() );
+
+	std::vector<ChunkWPSetState>		fwdPath;
+	fwdPath.push_back( src );
+
+	for (uint i = 1; i < setPath.size(); ++i)
 	{
-		waySetPath_.clear();
-		return NULL;
+		ChunkWPSetState cur = fwdPath.back();
+		ChunkWPSetState neigh;
+
+		ChunkWaypointConns::const_iterator iter = cur.adjacenciesBegin();
+		while (iter != cur.adjacenciesEnd() &&
+				iter->first.getObject() != setPath[i])
+			++iter;
+
+		if (iter == cur.adjacenciesEnd() ||
+			!cur.getAdjacency( iter, neigh, dst ))
+		{
+			return NULL;
+		}
+
+		fwdPath.push_back( neigh );
 	}
 
-	// see if we have a path
-	if (waySetPath_.size() < 2) return NULL;
+	return this->storeWaySetPath( key, version, fwdPath );
+}
 
-	// see if the path goes to the same waypoint set
-	// (we assume that src is no the same as dest, or why call us)
-	if (dst.set() != waySetPath_.front().set())
-		return NULL;
+/**
+ *  This method stores the given waypoint set path, which is in forward
+ *	order from the source to the destination.
+ *
+ *	Paths that pass through a shell boundary are not shared, since whether
+ *	they can be followed depends on the state of the portals on the way.
+ */
+const ChunkWPSetState * NavigatorCache::storeWaySetPath(
+	const NavigatorFlowKey & key, uint32 version,
+	const std::vector<ChunkWPSetState> & fwdPath )
+{
+	MF_ASSERT_DEBUG( fwdPath.size() >= 2 );
 
-	// ok, this path leads to the right place.
-	// now make sure it starts from the right place too.
-	if (src.set() == waySetPath_.back().set())
+	bool passedShellBoundary = false;
+	for (uint i = 0; i < fwdPath.size(); ++i)
 	{
-		// looks good.
-		return &waySetPath_[waySetPath_.size()-2];
+		passedShellBoundary = passedShellBoundary ||
+			fwdPath[i].passedShellBoundary();
 	}
 
-	// we might have progressed to the next node, so move on to it
-	waySetPath_.pop_back();
+	pSetFlow_ = passedShellBoundary ?
+		new NavigatorFlow<ChunkWPSetState>( version ) :
+		s_setFlows.obtain( key, version );
+	pSetFlow_->add( fwdPath );
 
-	// but make sure we didn't run out of nodes
-	// (no point checking if src is dst, that is known false)
-	if (waySetPath_.size() < 2) return NULL;
+	const NavigatorFlow<ChunkWPSetState>::Hop * pHop =
+		pSetFlow_->find( flowNode( fwdPath.front() ) );
+	MF_ASSERT_DEBUG( pHop != NULL );
+	setPathSize_ = pHop->pathSize;
+	return &pHop->next;
+}
 
-	// and see if it suits our purpose
-	if (src.set() == waySetPath_.back().set())
+/**
+ *  This method finds the next waypoint set state from the given source in
+ *  the shared flow for the given key.
+ */
+const ChunkWPSetState * NavigatorCache::findWaySetPath(
+	const NavigatorFlowKey & key, uint32 version,
+	const ChunkWPSetState & src )
+{
+	NavigatorSetFlowPtr pFlow = s_setFlows.find( key, version );
+	const NavigatorFlow<ChunkWPSetState>::Hop * pHop =
+		pFlow ? pFlow->find( flowNode( src ) ) : NULL;
+
+	if (pHop == NULL)
 	{
-		return &waySetPath_[waySetPath_.size()-2];
+		++s_flowMisses;
+		return NULL;
 	}
 
-	// nope, no good. clear it now just for sanity
-	waySetPath_.clear();
-	return NULL;
+	++s_flowHits;
+	pSetFlow_ = pFlow;
+	setPathSize_ = pHop->pathSize;
+	return &pHop->next;
 }
 
 /**
- *  This method finds a waypoint path
+ *  This method gets the points of the last waypoint path that was found,
+ *  starting from the given source. The path is left empty if the source is
+ *  not on that path, or if the path is broken.
  */
-int NavigatorCache::getWaySetPathSize() const
+void NavigatorCache::getWaypointPath( const NavLoc & srcLoc,
+	std::vector<Vector3> & wppath ) const
 {
-	return waySetPath_.size();
+	if (!pWayFlow_ || !srcLoc.valid()) return;
+
+	// The path must start from the waypoint that the source is in. Any other
+	// waypoint of the flow may not be adjacent to it.
+	NavigatorFlowNode node( &*srcLoc.set(), srcLoc.waypoint() );
+	const NavigatorFlow<ChunkWaypointState>::Hop * pHop =
+		pWayFlow_->find( node );
+	if (pHop == NULL) return;
+
+	wppath.push_back( srcLoc.point() );
+
+	// the path size always decreases along the flow
+	int pathSize = INT_MAX;
+	while (pHop != NULL)
+	{
+		if (pHop->pathSize >= pathSize)
+		{
+			ERROR_MSG( "NavigatorCache::getWaypointPath: "
+					"Path size %d does not decrease from %d at waypoint %d "
+					"of %s. The flow is broken.\n",
+				pHop->pathSize, pathSize, pHop->next.navLoc().waypoint(),
+				srcLoc.desc().c_str() );
+			wppath.clear();
+			return;
+		}
+
+		pathSize = pHop->pathSize;
+		wppath.push_back( pHop->next.navLoc().point() );
+		pHop = pWayFlow_->find( flowNode( pHop->next ) );
+	}
 }
 
 // -----------------------------------------------------------------------------
@@ -906,6 +1262,25 @@ std::string NavLoc::desc() const
 Navigator::Navigator()
 	: pCache_(NULL)
 {
+	static bool firstTime = true;
+	if (firstTime)
+	{
+		firstTime = false;
+		MF_WATCH( "Navigation/PathCache/maxFlows", s_maxSharedFlows,
+			Watcher::WT_READ_WRITE,
+			"Maximum number of shared paths kept, each being the way to "
+			"one destination from every place it has been searched from" );
+		MF_WATCH( "Navigation/PathCache/flows", sharedFlowCount );
+		MF_WATCH( "Navigation/PathCache/hops", sharedFlowHops );
+		MF_WATCH( "Navigation/PathCache/memory", sharedFlowMemory );
+		MF_WATCH( "Navigation/PathCache/hits", s_flowHits,
+			Watcher::WT_READ_WRITE,
+			"Number of path queries answered from the shared paths" );
+		MF_WATCH( "Navigation/PathCache/misses", s_flowMisses,
+			Watcher::WT_READ_WRITE,
+			"Number of path queries that needed a search" );
+		MF_WATCH( "Navigation/PathCache/hitRate", sharedFlowHitRate );
+	}
 }
 
 /**
@@ -956,6 +1331,16 @@ bool Navigator::findPath( const NavLoc & src, const NavLoc & dst, float maxDista
 
 	if (!pCache_) pCache_ = new NavigatorCache();
 
+	// paths are shared until the topology of the space changes
+	const uint32 version =
+		ChunkWPSetGraph::version( src.set()->chunk()->space() );
+
+	NavigatorFlowKey key;
+	key.pDstSet = &*dst.set();
+	key.dstWaypoint = dst.waypoint();
+	key.girth = src.set()->girth();
+	key.blockNonPermissive = blockNonPermissive;
+
 	// see if they are in the same waypoint set
 	if (src.set() == dst.set())
 	{
@@ -963,9 +1348,12 @@ bool Navigator::findPath( const NavLoc & src, const NavLoc & dst, float maxDista
 		ChunkWaypointState srcState( src );
 		ChunkWaypointState dstState( dst );
 
+		key.pSet = &*src.set();
+		key.pGoalSet = &*dst.set();
+
 		// check if it's in our cache
 		const ChunkWaypointState * pWayState =
-			pCache_->findWayPath( srcState, dstState );
+			pCache_->findWayPath( key, version, srcState );
 		if (pWayState == NULL)
 		{
 			// do an A-Star search amongst the waypoints then
@@ -973,7 +1361,7 @@ bool Navigator::findPath( const NavLoc & src, const NavLoc & dst, float maxDista
 
 			if (astar.search( srcState, dstState, maxDistanceInSet ))
 			{
-				pWayState = pCache_->saveWayPath( astar );
+				pWayState = pCache_->saveWayPath( key, version, astar );
 				//DEBUG_MSG( "Navigator::findPath: "
 				//		"Next waypoint %d found through a new search\n",
 				//	pWayState->navLoc().waypoint() );
@@ -1008,26 +1396,82 @@ bool Navigator::findPath( const NavLoc & src, const NavLoc & dst, float maxDista
 		ChunkWPSetState srcSetState( src );
 		ChunkWPSetState dstSetState( dst );
 
+		key.pSet = NULL;
+		key.pGoalSet = NULL;
+
 		// check if it's in the cache
 		const ChunkWPSetState * pWaySetState =
-			pCache_->findWaySetPath( srcSetState, dstSetState );
+			pCache_->findWaySetPath( key, version, srcSetState );
 
 		if (pWaySetState == NULL)
 		{
-			// do an A-Star search amongst the waypoint sets then
 			ChunkWPSetState::blockNonPermissive = blockNonPermissive;
-			AStar<ChunkWPSetState> astarSet;
-			if (astarSet.search( srcSetState, dstSetState, maxDistance ))
+
+			// try the precomputed route graph of the space first
+			ChunkWPSetGraph::Result graphResult = ChunkWPSetGraph::UNAVAILABLE;
+			ChunkWPSetGraph * pGraph = ChunkWPSetGraph::instance(
+				src.set()->chunk()->space(), false );
+			if (pGraph != NULL)
 			{
-				pWaySetState = pCache_->saveWaySetPath( astarSet );
-				//DEBUG_MSG( "Next waypoint set 0x%08X found through "
-				//	"a new search\n", &*pWaySetState->set() );
+				ChunkWPSetGraph::SetPath setPath;
+				graphResult = pGraph->findSetPath( &*src.set(), src.point(),
+					&*dst.set(), dst.point(), maxDistance, blockNonPermissive,
+					setPath );
+
+				if (graphResult == ChunkWPSetGraph::FOUND)
+				{
+					pWaySetState = pCache_->saveWaySetPath( key, version,
+						srcSetState, dstSetState, setPath );
+					if (pWaySetState == NULL)
+					{
+						graphResult = ChunkWPSetGraph::UNAVAILABLE;
+					}
+				}
+				else if (graphResult == ChunkWPSetGraph::NO_PATH &&
+					!pGraph->isSettled())
+				{
+					// The graph may have been built before all of the chunks
+					// of the space had loaded, so only trust it to say that
+					// there is no path once it has stayed unchanged.
+					++ChunkWPSetGraph::s_fallbacks_;
+					graphResult = ChunkWPSetGraph::UNAVAILABLE;
+				}
 			}
-			if ( astarSet.infiniteLoopProblem )
+
+			if (graphResult == ChunkWPSetGraph::UNAVAILABLE ||
+				ChunkWPSetGraph::s_verify_)
 			{
-				ERROR_MSG( "Navigator::findPath: Infinite Loop problem "
-					"from waypoint %d to %d\n", src.waypoint(), dst.waypoint() );
-				this->infiniteLoopProblem = true;
+				// do an A-Star search amongst the waypoint sets then
+				AStar<ChunkWPSetState> astarSet;
+				bool found = astarSet.search( srcSetState, dstSetState,
+					maxDistance );
+
+				if (graphResult == ChunkWPSetGraph::UNAVAILABLE)
+				{
+					if (found)
+					{
+						pWaySetState = pCache_->saveWaySetPath( key, version,
+							astarSet );
+						//DEBUG_MSG( "Next waypoint set 0x%08X found through "
+						//	"a new search\n", &*pWaySetState->set() );
+					}
+				}
+				else if (found != (graphResult == ChunkWPSetGraph::FOUND))
+				{
+					++ChunkWPSetGraph::s_mismatches_;
+					WARNING_MSG( "Navigator::findPath: Route graph %s a path "
+							"from %s to %s but A-Star did%s\n",
+						found ? "did not find" : "found",
+						src.desc().c_str(), dst.desc().c_str(),
+						found ? "" : " not" );
+				}
+
+				if ( astarSet.infiniteLoopProblem )
+				{
+					ERROR_MSG( "Navigator::findPath: Infinite Loop problem "
+						"from waypoint %d to %d\n", src.waypoint(), dst.waypoint() );
+					this->infiniteLoopProblem = true;
+				}
 			}
 		}
 		//else
@@ -1042,16 +1486,19 @@ bool Navigator::findPath( const NavLoc & src, const NavLoc & dst, float maxDista
 			ChunkWaypointState dstState( pWaySetState->set(), dst.point(),
 				src.set() );
 
+			key.pSet = &*src.set();
+			key.pGoalSet = &*pWaySetState->set();
+
 			// check if it's in our cache
 			const ChunkWaypointState * pWayState =
-				pCache_->findWayPath( srcState, dstState );
+				pCache_->findWayPath( key, version, srcState );
 			if (pWayState == NULL)
 			{
 				// do the A-Star waypoint search then
 				AStar<ChunkWaypointState> astar;
 				if (astar.search( srcState, dstState, maxDistanceInSet ))
 				{
-					pWayState = pCache_->saveWayPath( astar );
+					pWayState = pCache_->saveWayPath( key, version, astar );
 					//DEBUG_MSG( "Next ulterior waypoint %d found through "
 					//	"a new search\n", pWayState->navLoc().waypoint() );
 				}
@@ -1306,15 +1753,7 @@ void Navigator::getWaypointPath( const NavLoc& srcLoc,std::vector<Vector3>& wppa
 
 	if (pCache_)
 	{
-		const std::vector<ChunkWaypointState>& path = pCache_->wayPath();
-		std::vector<ChunkWaypointState>::const_reverse_iterator iter =
-			path.rbegin();
-
-		while (iter != path.rend())
-		{
-			wppath.push_back( iter->navLoc().point() );
-			++iter;
-		}
+		pCache_->getWaypointPath( srcLoc, wppath );
 	}
 }
 
@@ -63,8 +63,8 @@ typedef SmartPointer<NavigatorCache> NavigatorCachePtr;
 
 /**
  *	This class guides vessels through the treacherous domain of chunk
- *	space navigation. Each instance caches recent data so similar searches
- *	can reuse previous effort.
+ *	space navigation. Paths found are shared by all instances, so similar
+ *	searches, including those of other vessels, can reuse previous effort.
  */
 class Navigator
 {
@@ -90,6 +90,8 @@ public:
 	static void astarSearchTimeLimit( float seconds );
 	static float astarSearchTimeLimit();
 
+	static int s_maxSharedFlows;
+
 private:
 	Navigator( const Navigator & other );
 	Navigator & operator = ( const Navigator & other );